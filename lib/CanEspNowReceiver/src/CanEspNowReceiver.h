@@ -0,0 +1,530 @@
+/**
+ * @file CanEspNowReceiver.h
+ * @brief Receiver side of the gateway's ESP-NOW link: decode and publish
+ *
+ * A display or logger creates one Receiver and calls onPacket() from its
+ * ESP-NOW receive callback. Every packet type the gateway sends is decoded in
+ * place (no allocation, no copy of the packet) and the values are published
+ * to fixed-size stores:
+ *
+ *   frames     latest frame per CAN ID (PACKET_FRAMES, PACKET_RELIABLE,
+ *              PACKET_STORED, PACKET_SNAPSHOT), tagged with its capture time on the
+ *              receiver's clock
+ *   signals    latest raw value per index of the generated signal table
+ *              (PACKET_SIGNALS); apply scale and offset with CanSignals.h
+ *   stats      the gateway's last PACKET_STATS report
+ *
+ * Each entry is guarded by its own sequence lock: the receive callback is
+ * the only writer, and any number of UI tasks read consistent copies without
+ * locks or blocking the radio. A reader retries only if it overlaps an update
+ * of that same entry.
+ *
+ * A value older than the one already stored (stored frames replayed after an
+ * outage, a relayed copy arriving late) does not overwrite it, so duplicates
+ * from relays are harmless.
+ *
+ * PACKET_TIME keeps a ClockMapper in step; send the reply from
+ * buildTimeReply() outside the callback so the gateway can measure latency.
+ * Reliable-class packets must be acknowledged: call buildAck() every few
+ * milliseconds and send what it returns to the gateway. One ACK covers
+ * every packet received so far, and retransmitted copies are dropped.
+ *
+ * Header-only with no Arduino dependencies, like CanEspNowWire.h.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include "CanEspNowWire.h"
+
+namespace canEspNowReceiver
+{
+    constexpr uint32_t EMPTY_KEY = 0xFFFFFFFF;
+
+    /**
+     * Single-writer sequence lock around a trivially copyable value. The value
+     * lives in relaxed atomic words, so a torn read is detected by the sequence
+     * check rather than being undefined behaviour.
+     */
+    template <typename T>
+    class Seqlock
+    {
+    public:
+        // Writer only; readers never block it
+        void write(const T &value)
+        {
+            uint32_t words[WORDS] = {};
+            memcpy(words, &value, sizeof(T));
+            uint32_t seq = seq_.load(std::memory_order_relaxed);
+            seq_.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                words_[i].store(words[i], std::memory_order_relaxed);
+            }
+            seq_.store(seq + 2, std::memory_order_release);
+        }
+
+        // One attempt; false if a write was in progress or completed meanwhile
+        bool tryRead(T &value) const
+        {
+            uint32_t before = seq_.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                return false;
+            }
+            uint32_t words[WORDS];
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                words[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) != before)
+            {
+                return false;
+            }
+            memcpy(&value, words, sizeof(T));
+            return true;
+        }
+
+        // Retry until a consistent copy is read; false if never written
+        bool read(T &value) const
+        {
+            while (!tryRead(value))
+            {
+            }
+            return seq_.load(std::memory_order_relaxed) != 0;
+        }
+
+        // Completed writes so far; lets readers skip unchanged values cheaply
+        uint32_t version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+    private:
+        static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+        std::atomic<uint32_t> seq_{0};
+        std::atomic<uint32_t> words_[WORDS] = {};
+    };
+
+    struct FrameValue
+    {
+        uint32_t identifier;
+        uint32_t capturedUs;  // Receiver clock: gateway capture time if known, else arrival
+        uint8_t dlc;
+        bool extended;
+        bool rtr;
+        uint8_t data[8];
+    };
+
+    struct SignalValue
+    {
+        uint64_t raw;          // Field bits as extracted, not sign-extended
+        uint32_t capturedUs;   // Receiver clock, as for frames
+    };
+
+    inline uint32_t keyFor(uint32_t identifier, bool extended)
+    {
+        return identifier | (extended ? canEspNowWire::KEY_EXTENDED : 0);
+    }
+
+    // a is later than b on a wrapping microsecond clock
+    inline bool newer(uint32_t a, uint32_t b)
+    {
+        return (int32_t)(a - b) > 0;
+    }
+
+    /**
+     * Latest frame per CAN ID. Open addressing with linear probing; a slot's
+     * key is published after its first value, so readers never see a claimed
+     * slot without data. CAPACITY must be a power of two; the table fills to
+     * 3/4 of it, later IDs are counted in untracked().
+     */
+    template <size_t CAPACITY>
+    class FrameStore
+    {
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0, "FrameStore CAPACITY must be a power of two");
+
+    public:
+        FrameStore()
+        {
+            for (size_t i = 0; i < CAPACITY; i++)
+            {
+                keys_[i].store(EMPTY_KEY, std::memory_order_relaxed);
+            }
+        }
+
+        // Writer only. False if the table is full or the stored value is newer.
+        bool publish(const FrameValue &value)
+        {
+            uint32_t key = keyFor(value.identifier, value.extended);
+            size_t index = hash(key);
+            for (size_t probe = 0; probe < CAPACITY; probe++)
+            {
+                uint32_t slotKey = keys_[index].load(std::memory_order_relaxed);
+                if (slotKey == key)
+                {
+                    if (newer(lastUs_[index], value.capturedUs))
+                    {
+                        stale_++;
+                        return false;
+                    }
+                    lastUs_[index] = value.capturedUs;
+                    values_[index].write(value);
+                    return true;
+                }
+                if (slotKey == EMPTY_KEY)
+                {
+                    if (used_ >= (CAPACITY * 3) / 4)
+                    {
+                        untracked_++;
+                        return false;
+                    }
+                    lastUs_[index] = value.capturedUs;
+                    values_[index].write(value);
+                    keys_[index].store(key, std::memory_order_release);
+                    used_++;
+                    return true;
+                }
+                index = (index + 1) & (CAPACITY - 1);
+            }
+            untracked_++;
+            return false;
+        }
+
+        // Any task: latest frame for an ID; false if none has been received
+        bool read(uint32_t identifier, bool extended, FrameValue &value) const
+        {
+            const Seqlock<FrameValue> *slot = find(keyFor(identifier, extended));
+            return slot != nullptr && slot->read(value);
+        }
+
+        // Any task: update count for an ID (0 if never received), to poll for changes without copying
+        uint32_t version(uint32_t identifier, bool extended) const
+        {
+            const Seqlock<FrameValue> *slot = find(keyFor(identifier, extended));
+            return slot != nullptr ? slot->version() : 0;
+        }
+
+        // Any task: call fn(const FrameValue &) for every stored ID, in table order
+        template <typename Fn>
+        void forEach(Fn fn) const
+        {
+            FrameValue value;
+            for (size_t i = 0; i < CAPACITY; i++)
+            {
+                if (keys_[i].load(std::memory_order_acquire) != EMPTY_KEY && values_[i].read(value))
+                {
+                    fn(value);
+                }
+            }
+        }
+
+        // Writer-side counters; approximate when read from other tasks
+        size_t size() const { return used_; }
+        uint32_t untracked() const { return untracked_; }
+        uint32_t stale() const { return stale_; }
+
+    private:
+        static size_t hash(uint32_t key)
+        {
+            return (key * 2654435761u) & (CAPACITY - 1);
+        }
+
+        const Seqlock<FrameValue> *find(uint32_t key) const
+        {
+            size_t index = hash(key);
+            for (size_t probe = 0; probe < CAPACITY; probe++)
+            {
+                uint32_t slotKey = keys_[index].load(std::memory_order_acquire);
+                if (slotKey == key)
+                {
+                    return &values_[index];
+                }
+                if (slotKey == EMPTY_KEY)
+                {
+                    return nullptr;
+                }
+                index = (index + 1) & (CAPACITY - 1);
+            }
+            return nullptr;
+        }
+
+        std::atomic<uint32_t> keys_[CAPACITY];
+        Seqlock<FrameValue> values_[CAPACITY];
+        uint32_t lastUs_[CAPACITY] = {};  // Writer only
+        size_t used_ = 0;
+        uint32_t untracked_ = 0;
+        uint32_t stale_ = 0;
+    };
+
+    /**
+     * Receive-callback decoder feeding the stores.
+     * FRAME_CAPACITY: power of two, about 4/3 of the IDs on the bus or more.
+     * SIGNAL_CAPACITY: at least SIGNAL_COUNT of the gateway's signal table;
+     * higher indices are ignored.
+     */
+    template <size_t FRAME_CAPACITY = 256, size_t SIGNAL_CAPACITY = 64>
+    class Receiver
+    {
+    public:
+        FrameStore<FRAME_CAPACITY> frames;
+
+        /**
+         * Decode one packet as delivered to the ESP-NOW receive callback.
+         * nowUs is the receiver's micros() at arrival. Returns false for
+         * packets that are not from the gateway or are malformed; records
+         * decoded before a malformed one are kept.
+         */
+        bool onPacket(const uint8_t *data, size_t length, uint32_t nowUs)
+        {
+            canEspNowWire::PacketReader reader;
+            if (!reader.begin(data, length))
+            {
+                malformed_++;
+                return false;
+            }
+            packets_++;
+            switch (reader.type())
+            {
+            case canEspNowWire::PACKET_RELIABLE:
+            {
+                bool fresh = ackTracker_.receive(reader.sequence());
+                // Publish on duplicates too: a retransmission means our last ACK was lost
+                ackState_.write(ackTracker_.ack());
+                if (!fresh)
+                {
+                    retransmitted_++;
+                    return true;
+                }
+                return decodeFrames(reader, nowUs);
+            }
+            case canEspNowWire::PACKET_FRAMES:
+            case canEspNowWire::PACKET_STORED:
+            case canEspNowWire::PACKET_SNAPSHOT:
+                return decodeFrames(reader, nowUs);
+            case canEspNowWire::PACKET_SIGNALS:
+                return decodeSignals(reader, nowUs);
+            case canEspNowWire::PACKET_STATS:
+                if (reader.payloadLength() < canEspNowWire::STATS_LEN)
+                {
+                    malformed_++;
+                    return false;
+                }
+                {
+                    canEspNowWire::GatewayStats stats;
+                    canEspNowWire::decodeStats(reader.payload(), stats);
+                    stats_.write(stats);
+                }
+                return true;
+            case canEspNowWire::PACKET_TIME:
+                return handleTime(reader, nowUs);
+            default:
+                return false;  // Requests and replies from other receivers
+            }
+        }
+
+        // Any task: latest raw value of a signal; false if none has been received
+        bool readSignal(uint8_t index, SignalValue &value) const
+        {
+            return index < SIGNAL_CAPACITY && signals_[index].read(value);
+        }
+
+        uint32_t signalVersion(uint8_t index) const
+        {
+            return index < SIGNAL_CAPACITY ? signals_[index].version() : 0;
+        }
+
+        // Any task: last gateway statistics report; false if none has been received
+        bool readStats(canEspNowWire::GatewayStats &stats) const
+        {
+            return stats_.read(stats);
+        }
+
+        /**
+         * Fill a PACKET_TIME_REPLY for the last PACKET_TIME; 0 if there is none
+         * to answer. Call outside the receive callback with the current
+         * micros() and unicast the result to the MAC the PACKET_TIME came from.
+         */
+        size_t buildTimeReply(uint8_t *buffer, size_t capacity, uint32_t nowUs)
+        {
+            if (capacity < canEspNowWire::HEADER_LEN + canEspNowWire::TIME_REPLY_LEN)
+            {
+                return 0;
+            }
+            canEspNowWire::TimeReply reply;
+            uint32_t version = timeRequest_.version();
+            if (version == answeredVersion_ || !timeRequest_.read(reply))
+            {
+                return 0;
+            }
+            answeredVersion_ = version;
+            reply.t3 = nowUs;
+            canEspNowWire::writeHeader(buffer, canEspNowWire::PACKET_TIME_REPLY, 0, 1);
+            canEspNowWire::encodeTimeReply(reply, buffer + canEspNowWire::HEADER_LEN);
+            return canEspNowWire::HEADER_LEN + canEspNowWire::TIME_REPLY_LEN;
+        }
+
+        /**
+         * Fill a PACKET_ACK covering every reliable packet received; 0 if none
+         * arrived since the last ACK. Call outside the receive callback and
+         * unicast the result to the gateway.
+         */
+        size_t buildAck(uint8_t *buffer, size_t capacity)
+        {
+            if (capacity < canEspNowWire::HEADER_LEN + canEspNowWire::ACK_LEN)
+            {
+                return 0;
+            }
+            canEspNowWire::AckInfo ack;
+            uint32_t version = ackState_.version();
+            if (version == ackedVersion_ || !ackState_.read(ack))
+            {
+                return 0;
+            }
+            ackedVersion_ = version;
+            canEspNowWire::writeHeader(buffer, canEspNowWire::PACKET_ACK, 0, 1);
+            canEspNowWire::encodeAck(ack, buffer + canEspNowWire::HEADER_LEN);
+            return canEspNowWire::HEADER_LEN + canEspNowWire::ACK_LEN;
+        }
+
+        /**
+         * Fill a PACKET_SNAPSHOT_REQUEST for the given key ranges (see keyFor);
+         * no ranges asks for every ID. 0 if the ranges do not fit.
+         */
+        static size_t buildSnapshotRequest(uint8_t *buffer, size_t capacity,
+                                           const uint32_t *firstKeys = nullptr, const uint32_t *lastKeys = nullptr,
+                                           uint8_t rangeCount = 0)
+        {
+            size_t length = canEspNowWire::HEADER_LEN + rangeCount * canEspNowWire::SNAPSHOT_RANGE_LEN;
+            if (length > capacity || length > canEspNowWire::MAX_PACKET_LEN)
+            {
+                return 0;
+            }
+            canEspNowWire::writeHeader(buffer, canEspNowWire::PACKET_SNAPSHOT_REQUEST, 0, rangeCount);
+            uint8_t *p = buffer + canEspNowWire::HEADER_LEN;
+            for (uint8_t i = 0; i < rangeCount; i++, p += canEspNowWire::SNAPSHOT_RANGE_LEN)
+            {
+                canEspNowWire::putU32(p, firstKeys[i]);
+                canEspNowWire::putU32(p + 4, lastKeys[i]);
+            }
+            return length;
+        }
+
+        // Gateway time -> receiver time, valid once a PACKET_TIME has arrived; receive callback only
+        const canEspNowWire::ClockMapper &clock() const { return clock_; }
+
+        // Writer-side counters; approximate when read from other tasks
+        uint32_t packets() const { return packets_; }
+        uint32_t malformed() const { return malformed_; }
+        uint32_t framesDecoded() const { return framesDecoded_; }
+        uint32_t signalsDecoded() const { return signalsDecoded_; }
+        uint32_t retransmitted() const { return retransmitted_; }  // Reliable packets received more than once
+
+    private:
+        // Capture time of a record on the receiver clock
+        uint32_t captured(const canEspNowWire::PacketReader &reader, int32_t offset, uint32_t nowUs) const
+        {
+            if (reader.type() == canEspNowWire::PACKET_STORED)
+            {
+                // Base is the age of the first frame in ms, offsets are ms after it
+                return nowUs - reader.base() * 1000 + (uint32_t)offset * 1000;
+            }
+            if ((reader.flags() & canEspNowWire::FLAG_TIMESTAMPS) && clock_.valid())
+            {
+                return clock_.toLocal(reader.base() + (uint32_t)offset);
+            }
+            return nowUs;
+        }
+
+        bool decodeFrames(canEspNowWire::PacketReader &reader, uint32_t nowUs)
+        {
+            canEspNowWire::Frame frame;
+            FrameValue value;
+            uint8_t decoded = 0;
+            while (reader.next(frame))
+            {
+                value.identifier = frame.identifier;
+                value.capturedUs = captured(reader, frame.offset, nowUs);
+                value.dlc = frame.dlc;
+                value.extended = frame.extended;
+                value.rtr = frame.rtr;
+                memcpy(value.data, frame.data, sizeof(value.data));
+                frames.publish(value);
+                decoded++;
+            }
+            framesDecoded_ += decoded;
+            return complete(reader, decoded);
+        }
+
+        bool decodeSignals(canEspNowWire::PacketReader &reader, uint32_t nowUs)
+        {
+            canEspNowWire::SignalUpdate update;
+            SignalValue value;
+            uint8_t decoded = 0;
+            while (reader.next(update))
+            {
+                decoded++;
+                if (update.index >= SIGNAL_CAPACITY)
+                {
+                    continue;
+                }
+                value.raw = update.raw;
+                value.capturedUs = captured(reader, update.offset, nowUs);
+                if (signalSeen_[update.index] && newer(signalLastUs_[update.index], value.capturedUs))
+                {
+                    continue;
+                }
+                signalSeen_[update.index] = true;
+                signalLastUs_[update.index] = value.capturedUs;
+                signals_[update.index].write(value);
+            }
+            signalsDecoded_ += decoded;
+            return complete(reader, decoded);
+        }
+
+        bool handleTime(const canEspNowWire::PacketReader &reader, uint32_t nowUs)
+        {
+            if (reader.payloadLength() < canEspNowWire::TIME_SYNC_LEN)
+            {
+                malformed_++;
+                return false;
+            }
+            const uint8_t *p = reader.payload();
+            canEspNowWire::TimeReply reply;
+            reply.seq = p[0];
+            reply.t1 = canEspNowWire::getU32(p + 1);
+            reply.t2 = nowUs;
+            reply.t3 = 0;
+            clock_.update(reply.t1, nowUs);
+            timeRequest_.write(reply);
+            return true;
+        }
+
+        bool complete(const canEspNowWire::PacketReader &reader, uint8_t decoded)
+        {
+            if (decoded != reader.count())
+            {
+                malformed_++;
+                return false;
+            }
+            return true;
+        }
+
+        Seqlock<SignalValue> signals_[SIGNAL_CAPACITY];
+        uint32_t signalLastUs_[SIGNAL_CAPACITY] = {};  // Writer only
+        bool signalSeen_[SIGNAL_CAPACITY] = {};
+        Seqlock<canEspNowWire::GatewayStats> stats_;
+        Seqlock<canEspNowWire::TimeReply> timeRequest_;  // t3 filled in by buildTimeReply
+        uint32_t answeredVersion_ = 0;  // Replying task only
+        canEspNowWire::AckTracker ackTracker_;      // Receive callback only
+        Seqlock<canEspNowWire::AckInfo> ackState_;  // Published to the task sending ACKs
+        uint32_t ackedVersion_ = 0;
+        canEspNowWire::ClockMapper clock_;
+        uint32_t packets_ = 0;
+        uint32_t malformed_ = 0;
+        uint32_t framesDecoded_ = 0;
+        uint32_t signalsDecoded_ = 0;
+        uint32_t retransmitted_ = 0;
+    };
+}
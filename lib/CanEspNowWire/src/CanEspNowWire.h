@@ -0,0 +1,802 @@
+/**
+ * @file CanEspNowWire.h
+ * @brief Compact ESP-NOW wire format shared by the gateway and its receivers
+ *
+ * Packet layout (all multi-byte fields little-endian):
+ *
+ *   byte 0     version (high nibble) | packet type (low nibble)
+ *   byte 1     packet flags (FLAG_TIMESTAMPS, FLAG_RELAY, FLAG_FINAL)
+ *   byte 2     record count
+ *   byte 3..   records
+ *
+ * Relay block (FLAG_RELAY): directly after the header, before any other
+ * field. Origin (uint32, the low four bytes of the sending unit's MAC),
+ * per-origin sequence number (uint16) and the hops a relay may still take
+ * (uint8). Relays re-broadcast packets they have not seen with one hop
+ * less, so duplicates and loops are dropped by (origin, sequence).
+ *
+ * Frame record (PACKET_FRAMES):
+ *
+ *   byte 0     EXT(7) | RTR(6) | DELTA_ID(5) | reserved(4) | DLC(3..0)
+ *   ID         DELTA_ID: 1 byte signed delta from the previous frame's ID
+ *              standard: 2 bytes (11-bit ID)
+ *              extended: 4 bytes (29-bit ID)
+ *   data       DLC bytes (none for remote frames)
+ *
+ * Timestamped frames (PACKET_FRAMES with FLAG_TIMESTAMPS): the header is
+ * followed by a uint32 base time (gateway micros()); each frame record is
+ * preceded by an int16 capture offset in microseconds from the base.
+ * Receivers map gateway time onto their own clock with ClockMapper, fed by
+ * PACKET_TIME.
+ *
+ * Reliable frames (PACKET_RELIABLE): frames of the IDs configured as
+ * reliable, encoded as PACKET_FRAMES (FLAG_TIMESTAMPS included) with a
+ * uint16 sequence number after the relay block and before the time base.
+ * Receivers answer with PACKET_ACK: the cumulative sequence (every packet up
+ * to it received, uint16) and a uint32 bitmap where bit i means packet
+ * cumulative + 2 + i was received too (AckTracker builds both). One ACK
+ * covers every packet received so far, so receivers send them batched; the
+ * gateway retransmits unacknowledged packets from a bounded window.
+ *
+ * Stored frames (PACKET_STORED): frames buffered by the gateway while
+ * the link was down. The header is followed by a uint32 age in ms of the
+ * first frame when the packet was sent; each frame record is preceded by a
+ * uint16 capture offset in ms after the first frame. Receivers recover the
+ * capture time as (arrival - age + offset) on their own clock.
+ *
+ * Signal updates (PACKET_SIGNALS): values extracted from subscribed DBC
+ * signals instead of whole frames. Each record is the signal's index in the
+ * generated signal table (uint8) followed by its raw field bits as an
+ * unsigned LEB128 varint; receivers apply sign, scale and offset from the
+ * same table (see CanSignals.h). FLAG_TIMESTAMPS works as for frames.
+ *
+ * Snapshots: a receiver sends PACKET_SNAPSHOT_REQUEST to the gateway, with
+ * the record count giving the number of ID ranges that follow (0 = every
+ * ID). Each range is two uint32 keys, first and last, with bit 31 set for
+ * extended IDs. The gateway answers with PACKET_SNAPSHOT packets holding the
+ * latest frame of each matching ID as plain frame records, sorted by ID. The
+ * last packet has FLAG_FINAL set.
+ *
+ * Traffic profile: a receiver sends PACKET_PROFILE_REQUEST (no records) and
+ * the gateway answers with PACKET_PROFILE packets, one ProfileRecord per CAN
+ * ID it has seen (PROFILE_RECORD_LEN bytes each, see encodeProfile). The last
+ * packet has FLAG_FINAL set. Bus load is reported in GatewayStats.
+ *
+ * Gateway statistics (PACKET_STATS): record count 1, followed by the
+ * GatewayStats fields as little-endian uint32 values in declaration order.
+ *
+ * Time sync (PACKET_TIME, broadcast by the gateway): sequence number and the
+ * gateway micros() at send. Receivers answer with a unicast PACKET_TIME_REPLY
+ * carrying the sequence, the echoed gateway time (t1), their receive time (t2)
+ * and their reply send time (t3), both on the receiver clock. The gateway
+ * derives one-way latency and clock offset per peer from it.
+ *
+ * An 8-byte standard frame costs 11 bytes (10 with a delta ID) against
+ * 16 for the old padded esp_now_message_t; a 2-byte frame costs 5.
+ *
+ * Header-only with no Arduino dependencies so receivers and host tools
+ * can use it unchanged.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace canEspNowWire
+{
+    constexpr uint8_t VERSION = 1;
+    constexpr size_t MAX_PACKET_LEN = 250;  // ESP_NOW_MAX_DATA_LEN
+    constexpr size_t HEADER_LEN = 3;
+    constexpr size_t MAX_FRAME_LEN = 1 + 4 + 8;
+
+    enum PacketType : uint8_t
+    {
+        PACKET_FRAMES = 0x1,
+        PACKET_STATS = 0x2,
+        PACKET_STORED = 0x3,
+        PACKET_TIME = 0x4,
+        PACKET_TIME_REPLY = 0x5,
+        PACKET_SIGNALS = 0x6,
+        PACKET_SNAPSHOT_REQUEST = 0x7,
+        PACKET_SNAPSHOT = 0x8,
+        PACKET_PROFILE_REQUEST = 0x9,
+        PACKET_PROFILE = 0xA,
+        PACKET_RELIABLE = 0xB,
+        PACKET_ACK = 0xC,
+    };
+
+    // Packet flag bits (header byte 1)
+    constexpr uint8_t FLAG_TIMESTAMPS = 0x01;
+    constexpr uint8_t FLAG_RELAY = 0x02;
+    constexpr uint8_t FLAG_FINAL = 0x04;  // Last packet of a snapshot or profile
+
+    constexpr size_t RELAY_LEN = 7;  // origin u32, seq u16, hops u8
+
+    // Timed packets (PACKET_STORED, FLAG_TIMESTAMPS on frames and signals): base field after the header, offset before each record
+    constexpr size_t TIME_BASE_LEN = 4;
+    constexpr size_t TIME_OFFSET_LEN = 2;
+
+    constexpr size_t SEQUENCE_LEN = 2;  // PACKET_RELIABLE
+    constexpr size_t ACK_LEN = 6;       // cumulative u16, bitmap u32
+
+    constexpr size_t SNAPSHOT_RANGE_LEN = 8;  // first key u32, last key u32
+    constexpr uint32_t KEY_EXTENDED = 0x80000000;
+
+    constexpr size_t TIME_SYNC_LEN = 5;    // seq u8, gateway time u32
+    constexpr size_t TIME_REPLY_LEN = 13;  // seq u8, t1 u32, t2 u32, t3 u32
+
+    // Frame record flag bits
+    constexpr uint8_t FRAME_EXT = 0x80;
+    constexpr uint8_t FRAME_RTR = 0x40;
+    constexpr uint8_t FRAME_DELTA_ID = 0x20;
+    constexpr uint8_t FRAME_DLC_MASK = 0x0F;
+
+    constexpr uint32_t STD_ID_MASK = 0x7FF;
+    constexpr uint32_t EXT_ID_MASK = 0x1FFFFFFF;
+
+    struct Frame
+    {
+        uint32_t identifier;
+        uint8_t dlc;  // 0..8
+        bool extended;
+        bool rtr;
+        uint8_t data[8];
+        int32_t offset;  // PACKET_STORED: ms after the first frame; FLAG_TIMESTAMPS: us from the base (int16 range)
+    };
+
+    struct RelayInfo
+    {
+        uint32_t origin;
+        uint16_t seq;
+        uint8_t hops;  // Relays left; 0 = do not relay
+    };
+
+    struct SignalUpdate
+    {
+        uint8_t index;   // Position in the generated signal table
+        uint64_t raw;    // Field bits as extracted, not sign-extended
+        int32_t offset;  // FLAG_TIMESTAMPS: us from the base (int16 range)
+    };
+
+    // Gateway health counters and latency percentiles (microseconds)
+    struct GatewayStats
+    {
+        uint32_t uptimeMs;
+        uint32_t framesIn;
+        uint32_t framesOut;
+        uint32_t framesDropped;
+        uint32_t sendFailures;
+        uint32_t queueWaitP50Us;
+        uint32_t queueWaitP99Us;
+        uint32_t queueWaitMaxUs;
+        uint32_t sendCallP50Us;
+        uint32_t sendCallP99Us;
+        uint32_t sendCallMaxUs;
+        uint32_t sendCompleteP50Us;
+        uint32_t sendCompleteP99Us;
+        uint32_t sendCompleteMaxUs;
+        uint32_t busOffEvents;
+        uint32_t recoveryLastMs;  // CAN bus-off until the driver ran again
+        uint32_t recoveryMaxMs;
+        uint32_t busLoadPermille;      // Last load window, from received frame lengths
+        uint32_t busLoadPeakPermille;
+        uint32_t statusFlags;  // STATUS_* bits
+    };
+
+    // GatewayStats::statusFlags
+    constexpr uint32_t STATUS_NO_STOREFWD_PARTITION = 0x01;  // Store-and-forward limited to RAM
+    constexpr uint32_t STATUS_NO_BLACKBOX_PARTITION = 0x02;  // Black box disabled
+    constexpr uint32_t STATUS_LEGACY_PARTITIONS = 0x04;      // Old table (spiffs); flash partitions.csv over serial
+
+    constexpr size_t STATS_FIELDS = sizeof(GatewayStats) / sizeof(uint32_t);
+    constexpr size_t STATS_LEN = STATS_FIELDS * 4;
+
+    // Per-ID traffic profile; periods in microseconds, 0 until two frames were seen
+    struct ProfileRecord
+    {
+        uint32_t key;  // CAN ID, KEY_EXTENDED for extended IDs
+        uint32_t count;
+        uint32_t meanPeriodUs;
+        uint32_t minPeriodUs;
+        uint32_t maxPeriodUs;
+        uint32_t jitterUs;  // EWMA of the deviation from the EWMA period
+        uint8_t lastDlc;
+    };
+
+    constexpr size_t PROFILE_RECORD_LEN = 6 * 4 + 1;
+
+    inline void putU16(uint8_t *p, uint16_t v)
+    {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+    }
+
+    inline void putU32(uint8_t *p, uint32_t v)
+    {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        p[2] = (uint8_t)(v >> 16);
+        p[3] = (uint8_t)(v >> 24);
+    }
+
+    inline uint16_t getU16(const uint8_t *p)
+    {
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    inline uint32_t getU32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    inline size_t varintSize(uint64_t v)
+    {
+        size_t size = 1;
+        while (v >= 0x80)
+        {
+            v >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    inline bool isTimed(uint8_t type, uint8_t flags)
+    {
+        return type == PACKET_STORED ||
+               ((type == PACKET_FRAMES || type == PACKET_SIGNALS || type == PACKET_RELIABLE) && (flags & FLAG_TIMESTAMPS));
+    }
+
+    inline void writeHeader(uint8_t *buffer, PacketType type, uint8_t flags, uint8_t count)
+    {
+        buffer[0] = (uint8_t)((VERSION << 4) | (type & 0x0F));
+        buffer[1] = flags;
+        buffer[2] = count;
+    }
+
+    // Bytes between the header and the packet's own fields
+    inline size_t relayLength(uint8_t flags)
+    {
+        return (flags & FLAG_RELAY) ? RELAY_LEN : 0;
+    }
+
+    // Fill the relay block of a packet whose header has FLAG_RELAY set
+    inline void writeRelay(uint8_t *buffer, const RelayInfo &relay)
+    {
+        putU32(buffer + HEADER_LEN, relay.origin);
+        putU16(buffer + HEADER_LEN + 4, relay.seq);
+        buffer[HEADER_LEN + 6] = relay.hops;
+    }
+
+    inline void readRelay(const uint8_t *buffer, RelayInfo &relay)
+    {
+        relay.origin = getU32(buffer + HEADER_LEN);
+        relay.seq = getU16(buffer + HEADER_LEN + 4);
+        relay.hops = buffer[HEADER_LEN + 6];
+    }
+
+    // PACKET_RELIABLE only: sequence number of an encoded packet
+    inline void writeSequence(uint8_t *buffer, uint16_t seq)
+    {
+        putU16(buffer + HEADER_LEN + relayLength(buffer[1]), seq);
+    }
+
+    inline uint16_t readSequence(const uint8_t *buffer)
+    {
+        return getU16(buffer + HEADER_LEN + relayLength(buffer[1]));
+    }
+
+    struct AckInfo
+    {
+        uint16_t cumulative;  // Every sequence up to this one received
+        uint32_t bitmap;      // Bit i: cumulative + 2 + i received
+    };
+
+    inline void encodeAck(const AckInfo &ack, uint8_t *out)
+    {
+        putU16(out, ack.cumulative);
+        putU32(out + 2, ack.bitmap);
+    }
+
+    inline void decodeAck(const uint8_t *in, AckInfo &ack)
+    {
+        ack.cumulative = getU16(in);
+        ack.bitmap = getU32(in + 2);
+    }
+
+    // True if an ACK covers a sequence number
+    inline bool acknowledges(const AckInfo &ack, uint16_t seq)
+    {
+        int16_t distance = (int16_t)(seq - ack.cumulative);
+        if (distance <= 0)
+        {
+            return true;
+        }
+        return distance >= 2 && distance < 34 && (ack.bitmap & (1u << (distance - 2)));
+    }
+
+    /**
+     * Receiver side: tracks the PACKET_RELIABLE sequence numbers seen and
+     * produces the ACK covering them. The first packet heard sets the start;
+     * a packet more than 33 ahead abandons the gap (the gateway has given up
+     * on it long before).
+     */
+    class AckTracker
+    {
+    public:
+        // Record a sequence number; false for a duplicate (a retransmission already received)
+        bool receive(uint16_t seq)
+        {
+            if (!started_)
+            {
+                started_ = true;
+                ack_.cumulative = seq;
+                ack_.bitmap = 0;
+                return true;
+            }
+            int16_t distance = (int16_t)(seq - ack_.cumulative);
+            if (distance <= 0)
+            {
+                return false;
+            }
+            if (distance == 1 || distance >= 34)
+            {
+                ack_.cumulative = seq;
+                if (distance >= 34)
+                {
+                    ack_.bitmap = 0;
+                    return true;
+                }
+                // Advance over packets that had already arrived out of order
+                for (;;)
+                {
+                    bool next = ack_.bitmap & 1;
+                    ack_.bitmap >>= 1;
+                    if (!next) break;
+                    ack_.cumulative++;
+                }
+                return true;
+            }
+            uint32_t bit = 1u << (distance - 2);
+            if (ack_.bitmap & bit)
+            {
+                return false;
+            }
+            ack_.bitmap |= bit;
+            return true;
+        }
+
+        bool started() const { return started_; }
+        const AckInfo &ack() const { return ack_; }
+
+    private:
+        AckInfo ack_ = {0, 0};
+        bool started_ = false;
+    };
+
+    struct TimeReply
+    {
+        uint8_t seq;
+        uint32_t t1;  // Gateway time from PACKET_TIME
+        uint32_t t2;  // Receiver time when PACKET_TIME arrived
+        uint32_t t3;  // Receiver time when the reply was sent
+    };
+
+    inline void encodeTimeReply(const TimeReply &reply, uint8_t *out)
+    {
+        out[0] = reply.seq;
+        putU32(out + 1, reply.t1);
+        putU32(out + 5, reply.t2);
+        putU32(out + 9, reply.t3);
+    }
+
+    inline void decodeTimeReply(const uint8_t *in, TimeReply &reply)
+    {
+        reply.seq = in[0];
+        reply.t1 = getU32(in + 1);
+        reply.t2 = getU32(in + 5);
+        reply.t3 = getU32(in + 9);
+    }
+
+    /**
+     * Receiver side: maps gateway time onto the local clock. Feed it every
+     * PACKET_TIME (gateway time, local arrival time); radio delay only ever
+     * adds to the observed offset, so the smallest offset of recent samples
+     * is the best estimate.
+     */
+    class ClockMapper
+    {
+    public:
+        static constexpr uint8_t WINDOW = 8;
+
+        void update(uint32_t gatewayUs, uint32_t localUs)
+        {
+            samples_[next_] = (int32_t)(localUs - gatewayUs);
+            next_ = (next_ + 1) % WINDOW;
+            if (count_ < WINDOW) count_++;
+            offset_ = samples_[0];
+            for (uint8_t i = 1; i < count_; i++)
+            {
+                if (samples_[i] < offset_) offset_ = samples_[i];
+            }
+        }
+
+        bool valid() const { return count_ > 0; }
+        uint32_t toLocal(uint32_t gatewayUs) const { return gatewayUs + (uint32_t)offset_; }
+
+    private:
+        int32_t samples_[WINDOW] = {};
+        uint8_t count_ = 0;
+        uint8_t next_ = 0;
+        int32_t offset_ = 0;
+    };
+
+    inline void encodeStats(const GatewayStats &stats, uint8_t *out)
+    {
+        const uint32_t *fields = reinterpret_cast<const uint32_t *>(&stats);
+        for (size_t i = 0; i < STATS_FIELDS; i++)
+        {
+            putU32(out + i * 4, fields[i]);
+        }
+    }
+
+    inline void decodeStats(const uint8_t *in, GatewayStats &stats)
+    {
+        uint32_t *fields = reinterpret_cast<uint32_t *>(&stats);
+        for (size_t i = 0; i < STATS_FIELDS; i++)
+        {
+            fields[i] = getU32(in + i * 4);
+        }
+    }
+
+    inline void encodeProfile(const ProfileRecord &record, uint8_t *out)
+    {
+        putU32(out, record.key);
+        putU32(out + 4, record.count);
+        putU32(out + 8, record.meanPeriodUs);
+        putU32(out + 12, record.minPeriodUs);
+        putU32(out + 16, record.maxPeriodUs);
+        putU32(out + 20, record.jitterUs);
+        out[24] = record.lastDlc;
+    }
+
+    inline void decodeProfile(const uint8_t *in, ProfileRecord &record)
+    {
+        record.key = getU32(in);
+        record.count = getU32(in + 4);
+        record.meanPeriodUs = getU32(in + 8);
+        record.minPeriodUs = getU32(in + 12);
+        record.maxPeriodUs = getU32(in + 16);
+        record.jitterUs = getU32(in + 20);
+        record.lastDlc = in[24];
+    }
+
+    /**
+     * Builds one packet in a caller-supplied buffer.
+     * Usage: begin(), append() until it returns false, finish() -> length to send.
+     */
+    class PacketWriter
+    {
+    public:
+        void begin(uint8_t *buffer, size_t capacity, PacketType type, bool deltaIds = true, uint8_t flags = 0)
+        {
+            buffer_ = buffer;
+            capacity_ = capacity < MAX_PACKET_LEN ? capacity : MAX_PACKET_LEN;
+            length_ = HEADER_LEN;
+            count_ = 0;
+            deltaIds_ = deltaIds;
+            timed_ = isTimed(type, flags);
+            writeHeader(buffer_, type, flags, 0);
+            length_ += relayLength(flags);
+            if (type == PACKET_RELIABLE)
+            {
+                putU16(buffer_ + length_, 0);  // Sequence, assigned when the packet is sent
+                length_ += SEQUENCE_LEN;
+            }
+            baseAt_ = length_;
+            if (timed_)
+            {
+                putU32(buffer_ + length_, 0);
+                length_ += TIME_BASE_LEN;
+            }
+        }
+
+        // PACKET_STORED: age of the first frame at send time (ms); FLAG_TIMESTAMPS: base time (us)
+        void setBase(uint32_t base)
+        {
+            if (timed_)
+            {
+                putU32(buffer_ + baseAt_, base);
+            }
+        }
+
+        // Encoded size of a frame if it were appended next
+        size_t frameSize(const Frame &frame) const
+        {
+            uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+            size_t size = 1 + (frame.rtr ? 0 : dlc) + (timed_ ? TIME_OFFSET_LEN : 0);
+            if (canDelta(frame))
+            {
+                return size + 1;
+            }
+            return size + (frame.extended ? 4 : 2);
+        }
+
+        // Append a frame; returns false if it does not fit (packet left unchanged)
+        bool append(const Frame &frame)
+        {
+            if (count_ == 0xFF || length_ + frameSize(frame) > capacity_)
+            {
+                return false;
+            }
+            uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+            uint32_t id = frame.identifier & (frame.extended ? EXT_ID_MASK : STD_ID_MASK);
+            uint8_t *p = buffer_ + length_;
+            uint8_t head = dlc;
+            if (frame.extended) head |= FRAME_EXT;
+            if (frame.rtr) head |= FRAME_RTR;
+
+            if (timed_)
+            {
+                putU16(p, (uint16_t)frame.offset);
+                p += TIME_OFFSET_LEN;
+            }
+            if (canDelta(frame))
+            {
+                *p++ = head | FRAME_DELTA_ID;
+                *p++ = (uint8_t)(int8_t)((int32_t)id - (int32_t)lastId_);
+            }
+            else if (frame.extended)
+            {
+                *p++ = head;
+                putU32(p, id);
+                p += 4;
+            }
+            else
+            {
+                *p++ = head;
+                putU16(p, (uint16_t)id);
+                p += 2;
+            }
+            if (!frame.rtr)
+            {
+                memcpy(p, frame.data, dlc);
+                p += dlc;
+            }
+
+            length_ = p - buffer_;
+            lastId_ = id;
+            lastExtended_ = frame.extended;
+            count_++;
+            return true;
+        }
+
+        // Append a signal update (PACKET_SIGNALS); returns false if it does not fit
+        bool append(const SignalUpdate &update)
+        {
+            size_t size = (timed_ ? TIME_OFFSET_LEN : 0) + 1 + varintSize(update.raw);
+            if (count_ == 0xFF || length_ + size > capacity_)
+            {
+                return false;
+            }
+            uint8_t *p = buffer_ + length_;
+            if (timed_)
+            {
+                putU16(p, (uint16_t)update.offset);
+                p += TIME_OFFSET_LEN;
+            }
+            *p++ = update.index;
+            uint64_t raw = update.raw;
+            while (raw >= 0x80)
+            {
+                *p++ = (uint8_t)(raw | 0x80);
+                raw >>= 7;
+            }
+            *p++ = (uint8_t)raw;
+
+            length_ = p - buffer_;
+            count_++;
+            return true;
+        }
+
+        // Finalise the header and return the number of bytes to send
+        size_t finish()
+        {
+            buffer_[2] = count_;
+            return length_;
+        }
+
+        uint8_t count() const { return count_; }
+        size_t length() const { return length_; }
+        bool empty() const { return count_ == 0; }
+
+    private:
+        bool canDelta(const Frame &frame) const
+        {
+            if (!deltaIds_ || count_ == 0 || frame.extended != lastExtended_)
+            {
+                return false;
+            }
+            uint32_t id = frame.identifier & (frame.extended ? EXT_ID_MASK : STD_ID_MASK);
+            int32_t delta = (int32_t)id - (int32_t)lastId_;
+            return delta >= -128 && delta <= 127;
+        }
+
+        uint8_t *buffer_ = nullptr;
+        size_t capacity_ = 0;
+        size_t length_ = 0;
+        uint8_t count_ = 0;
+        bool deltaIds_ = true;
+        bool timed_ = false;
+        size_t baseAt_ = HEADER_LEN;
+        uint32_t lastId_ = 0;
+        bool lastExtended_ = false;
+    };
+
+    /**
+     * Walks the records of a received packet without copying it.
+     * begin() validates the header; next() bounds-checks every record.
+     */
+    class PacketReader
+    {
+    public:
+        bool begin(const uint8_t *data, size_t length)
+        {
+            data_ = data;
+            length_ = length;
+            offset_ = HEADER_LEN;
+            remaining_ = 0;
+            lastId_ = 0;
+            base_ = 0;
+            sequence_ = 0;
+            timed_ = false;
+            if (data == nullptr || length < HEADER_LEN || (data[0] >> 4) != VERSION)
+            {
+                return false;
+            }
+            offset_ += relayLength(flags());
+            if (type() == PACKET_RELIABLE)
+            {
+                if (length < offset_ + SEQUENCE_LEN)
+                {
+                    return false;
+                }
+                sequence_ = getU16(data + offset_);
+                offset_ += SEQUENCE_LEN;
+            }
+            if (length < offset_)
+            {
+                return false;
+            }
+            timed_ = isTimed(type(), flags());
+            if (timed_)
+            {
+                if (length < offset_ + TIME_BASE_LEN)
+                {
+                    return false;
+                }
+                base_ = getU32(data + offset_);
+                offset_ += TIME_BASE_LEN;
+            }
+            remaining_ = data[2];
+            return true;
+        }
+
+        PacketType type() const { return (PacketType)(data_[0] & 0x0F); }
+        uint8_t flags() const { return data_[1]; }
+        uint8_t count() const { return data_[2]; }
+        // PACKET_STORED: age of the first frame (ms); FLAG_TIMESTAMPS: gateway base time (us)
+        uint32_t base() const { return base_; }
+
+        // PACKET_RELIABLE only
+        uint16_t sequence() const { return sequence_; }
+
+        // FLAG_RELAY packets only
+        bool relayed() const { return (flags() & FLAG_RELAY) != 0; }
+        void relay(RelayInfo &info) const { readRelay(data_, info); }
+
+        // Raw records for non-frame packet types
+        const uint8_t *payload() const { return data_ + HEADER_LEN + relayLength(flags()); }
+        size_t payloadLength() const { return length_ - HEADER_LEN - relayLength(flags()); }
+
+        // Decode the next frame record (PACKET_FRAMES, PACKET_RELIABLE, PACKET_STORED or PACKET_SNAPSHOT); false at the end of the packet or on a malformed record
+        bool next(Frame &frame)
+        {
+            if (remaining_ == 0 || offset_ >= length_)
+            {
+                return false;
+            }
+            frame.offset = 0;
+            if (timed_)
+            {
+                if (offset_ + TIME_OFFSET_LEN + 1 > length_) return fail();
+                uint16_t offset = getU16(data_ + offset_);
+                frame.offset = type() == PACKET_STORED ? (int32_t)offset : (int32_t)(int16_t)offset;
+                offset_ += TIME_OFFSET_LEN;
+            }
+            uint8_t head = data_[offset_++];
+            frame.extended = (head & FRAME_EXT) != 0;
+            frame.rtr = (head & FRAME_RTR) != 0;
+            frame.dlc = head & FRAME_DLC_MASK;
+            if (frame.dlc > 8)
+            {
+                return fail();
+            }
+
+            if (head & FRAME_DELTA_ID)
+            {
+                if (offset_ + 1 > length_) return fail();
+                frame.identifier = (uint32_t)((int32_t)lastId_ + (int8_t)data_[offset_]);
+                offset_ += 1;
+            }
+            else if (frame.extended)
+            {
+                if (offset_ + 4 > length_) return fail();
+                frame.identifier = getU32(data_ + offset_) & EXT_ID_MASK;
+                offset_ += 4;
+            }
+            else
+            {
+                if (offset_ + 2 > length_) return fail();
+                frame.identifier = getU16(data_ + offset_) & STD_ID_MASK;
+                offset_ += 2;
+            }
+
+            memset(frame.data, 0, sizeof(frame.data));
+            if (!frame.rtr)
+            {
+                if (offset_ + frame.dlc > length_) return fail();
+                memcpy(frame.data, data_ + offset_, frame.dlc);
+                offset_ += frame.dlc;
+            }
+
+            lastId_ = frame.identifier;
+            remaining_--;
+            return true;
+        }
+
+        // Decode the next signal update (PACKET_SIGNALS); false at the end of the packet or on a malformed record
+        bool next(SignalUpdate &update)
+        {
+            if (remaining_ == 0 || offset_ >= length_)
+            {
+                return false;
+            }
+            update.offset = 0;
+            if (timed_)
+            {
+                if (offset_ + TIME_OFFSET_LEN + 2 > length_) return fail();
+                update.offset = (int16_t)getU16(data_ + offset_);
+                offset_ += TIME_OFFSET_LEN;
+            }
+            if (offset_ + 2 > length_) return fail();
+            update.index = data_[offset_++];
+            update.raw = 0;
+            for (uint8_t shift = 0;; shift += 7)
+            {
+                if (offset_ >= length_ || shift > 63) return fail();
+                uint8_t byte = data_[offset_++];
+                update.raw |= (uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            remaining_--;
+            return true;
+        }
+
+    private:
+        bool fail()
+        {
+            remaining_ = 0;
+            return false;
+        }
+
+        const uint8_t *data_ = nullptr;
+        size_t length_ = 0;
+        size_t offset_ = 0;
+        uint8_t remaining_ = 0;
+        uint32_t lastId_ = 0;
+        bool timed_ = false;
+        uint32_t base_ = 0;
+        uint16_t sequence_ = 0;
+    };
+}
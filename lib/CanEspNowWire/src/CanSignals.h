@@ -0,0 +1,95 @@
+/**
+ * @file CanSignals.h
+ * @brief DBC signal descriptors and raw value extraction
+ *
+ * Tables of these descriptors are generated from a DBC file by
+ * tools/dbc_codegen.py (see src/signalTable.h). The gateway extracts raw
+ * values and sends them in PACKET_SIGNALS records; receivers include the
+ * same generated table to turn a record's index and raw value back into a
+ * physical value.
+ *
+ * Bit numbering follows the DBC convention: bit n is bit (n % 8) of data
+ * byte (n / 8). Intel (little-endian, @1) signals give the position of
+ * their least significant bit, Motorola (big-endian, @0) signals the
+ * position of their most significant bit.
+ *
+ * Header-only with no Arduino dependencies, like CanEspNowWire.h.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace canSignals
+{
+    struct Signal
+    {
+        const char *name;  // Message.Signal
+        uint16_t startBit;
+        uint8_t length;    // 1..64 bits
+        bool bigEndian;    // Motorola byte order
+        bool isSigned;
+        uint8_t minDlc;    // Bytes the frame must carry for the signal to be present
+        float scale;
+        float offset;
+    };
+
+    // Subscribed signals of one CAN ID: signalTable[firstSignal .. firstSignal + signalCount)
+    struct Message
+    {
+        uint32_t identifier;
+        bool extended;
+        uint8_t firstSignal;
+        uint8_t signalCount;
+    };
+
+    // Bit position of the signal's least significant bit in the frame loaded as a 64-bit word
+    // (little-endian load for Intel signals, big-endian load for Motorola signals)
+    constexpr uint8_t lsbPosition(const Signal &signal)
+    {
+        return signal.bigEndian
+                   ? (uint8_t)((7 - signal.startBit / 8) * 8 + signal.startBit % 8 - (signal.length - 1))
+                   : (uint8_t)signal.startBit;
+    }
+
+    constexpr uint64_t mask(uint8_t length)
+    {
+        return length >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << length) - 1);
+    }
+
+    // Raw field bits of a signal (no sign extension); data must hold 8 bytes
+    inline uint64_t extractRaw(const Signal &signal, const uint8_t *data)
+    {
+        uint64_t word = 0;
+        if (signal.bigEndian)
+        {
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                word = (word << 8) | data[i];
+            }
+        }
+        else
+        {
+            for (uint8_t i = 8; i > 0; i--)
+            {
+                word = (word << 8) | data[i - 1];
+            }
+        }
+        return (word >> lsbPosition(signal)) & mask(signal.length);
+    }
+
+    // Two's complement interpretation of the raw bits for signed signals
+    inline int64_t toInteger(const Signal &signal, uint64_t raw)
+    {
+        if (signal.isSigned && signal.length < 64 && (raw >> (signal.length - 1)) & 1)
+        {
+            return (int64_t)(raw | ~mask(signal.length));
+        }
+        return (int64_t)raw;
+    }
+
+    inline float physical(const Signal &signal, uint64_t raw)
+    {
+        return (float)toInteger(signal, raw) * signal.scale + signal.offset;
+    }
+}
@@ -0,0 +1,549 @@
+/**
+ * @file blackBox.h
+ * @brief Flash-backed CAN black-box recorder
+ *
+ * Every frame received from CAN is timestamped and handed (one ring push) to a
+ * low-priority task that packs frames into 256-byte pages. Sealed pages are
+ * kept in a RAM ring of the last BLACKBOX_RAM_PAGES; flash is only written
+ * when the recorder is triggered (bus-off, error passive, or a CONFIG_BLACKBOX
+ * request): the pages from before the trigger plus BLACKBOX_POST_TRIGGER_PAGES
+ * after it are appended to a circular log in the "blackbox" partition.
+ *
+ * Flash wear and stalls: an erase stops the flash cache on both cores for tens
+ * of milliseconds, which stalls the (non-IRAM) TWAI interrupt until the 64-byte
+ * hardware FIFO overruns. Sectors are therefore erased ahead of the write
+ * position only while the bus is quiet, and a dump only writes into sectors
+ * erased beforehand; pages with no erased space left are skipped. Erases are
+ * also held to BLACKBOX_ERASES_PER_HOUR. With the default 0x49000 partition
+ * (73 sectors, ~100,000 erase cycles each) the budget gives an expected flash
+ * life of 73 * 100000 / 12 = ~608,000 hours (~69 years) even if it is used up
+ * every hour; each dump of the default window erases 4 sectors.
+ *
+ * Page layout (little-endian):
+ *
+ *   0   magic 0x4B42 ("BK")       2  version          3  record count
+ *   4   page sequence number      8  boot ID         10  payload length
+ *   12  time of the first record (us since boot, low 32 bits)
+ *   16  CRC-32 (zlib) over bytes 0..15 and the payload
+ *   20  records
+ *
+ * Record:
+ *
+ *   varint     microseconds since the previous record in the page (0 for the first)
+ *   byte       EXT(7) | RTR(6) | DELTA_ID(5) | REPEAT(4) | DLC(3..0)
+ *   ID         as in the ESP-NOW wire format (1-byte delta, 2 or 4 bytes)
+ *   data       DLC bytes, omitted for REPEAT (same data as this ID's previous
+ *              record in the page) and remote frames
+ *
+ * Pages decode independently and are only valid with a matching CRC, so a
+ * page torn by power loss is skipped. On boot the log resumes in the sector
+ * after the newest valid page. tools/blackbox_decode.py converts a partition
+ * dump to candump -L format.
+ */
+
+#pragma once
+#include "globals.h"
+#include "metrics.h"
+#include <esp_partition.h>
+#include <Preferences.h>
+
+#ifndef BLACKBOX_ENABLED
+#define BLACKBOX_ENABLED 1
+#endif
+// Frames buffered between the CAN receive task and the recorder task (power of two)
+#ifndef BLACKBOX_RING_DEPTH
+#define BLACKBOX_RING_DEPTH 256
+#endif
+// A partially filled page is sealed (into the RAM ring) after this long
+#ifndef BLACKBOX_FLUSH_MS
+#define BLACKBOX_FLUSH_MS 1000
+#endif
+// Sealed pages kept in RAM: the history written out when the recorder is triggered
+#ifndef BLACKBOX_RAM_PAGES
+#define BLACKBOX_RAM_PAGES 32
+#endif
+// Pages written after a trigger
+#ifndef BLACKBOX_POST_TRIGGER_PAGES
+#define BLACKBOX_POST_TRIGGER_PAGES 32
+#endif
+// Write every sealed page instead of waiting for a trigger; still bound by the erase budget
+#ifndef BLACKBOX_CONTINUOUS
+#define BLACKBOX_CONTINUOUS 0
+#endif
+// Flash page writes per recorder pass (each one briefly stops the flash cache)
+#ifndef BLACKBOX_WRITES_PER_PASS
+#define BLACKBOX_WRITES_PER_PASS 4
+#endif
+// Wear budget: sector erases per hour, allowed in bursts of BLACKBOX_ERASE_BURST
+#ifndef BLACKBOX_ERASES_PER_HOUR
+#define BLACKBOX_ERASES_PER_HOUR 12
+#endif
+#ifndef BLACKBOX_ERASE_BURST
+#define BLACKBOX_ERASE_BURST 4
+#endif
+// Sectors are only erased after the bus has been quiet this long
+#ifndef BLACKBOX_ERASE_IDLE_MS
+#define BLACKBOX_ERASE_IDLE_MS 500
+#endif
+#ifndef BLACKBOX_TASK_PRIORITY
+#define BLACKBOX_TASK_PRIORITY 1
+#endif
+#ifndef BLACKBOX_TASK_CORE
+#define BLACKBOX_TASK_CORE 0
+#endif
+#define BLACKBOX_PARTITION_LABEL "blackbox"
+#define BLACKBOX_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x41)
+#define BLACKBOX_SECTOR_SIZE 4096
+#define BLACKBOX_PAGE_SIZE 256
+#define BLACKBOX_HEADER_LEN 20
+#define BLACKBOX_MAGIC 0x4B42
+#define BLACKBOX_VERSION 1
+#define BLACKBOX_PAGES_PER_SECTOR (BLACKBOX_SECTOR_SIZE / BLACKBOX_PAGE_SIZE)
+// Erased pages kept ready ahead of the write position: one full dump
+#define BLACKBOX_PREERASE_PAGES                                                                            \
+    (((BLACKBOX_RAM_PAGES + BLACKBOX_POST_TRIGGER_PAGES + BLACKBOX_PAGES_PER_SECTOR - 1) / BLACKBOX_PAGES_PER_SECTOR) * \
+     BLACKBOX_PAGES_PER_SECTOR)
+
+// Trigger reasons
+#define BLACKBOX_TRIGGER_BUS_OFF 1
+#define BLACKBOX_TRIGGER_ERROR_PASSIVE 2
+#define BLACKBOX_TRIGGER_REQUEST 3
+
+#define BLACKBOX_REPEAT 0x10
+// Page-local cache of the last data per ID for REPEAT records (power of two)
+#define BLACKBOX_REPEAT_SLOTS 64
+
+typedef struct
+{
+    twai_message_t message;
+    uint32_t rxMicros;
+} blackbox_frame_t;
+
+typedef struct
+{
+    uint32_t key;  // ID | bit 31 for extended; 0xFFFFFFFF if unused
+    uint8_t dlc;
+    uint8_t data[8];
+} blackbox_repeat_t;
+
+static FrameRing<blackbox_frame_t, BLACKBOX_RING_DEPTH> blackBoxRing;
+
+// Set by the CAN receive and config tasks, taken by the recorder task
+static std::atomic<uint8_t> blackBoxTriggerReason{0};
+
+static const esp_partition_t *blackBoxPartition = NULL;
+static uint32_t blackBoxPageCount = 0;
+static uint32_t blackBoxNextPage = 0;    // Page index to write next
+static uint32_t blackBoxErasedPages = 0; // Erased pages from blackBoxNextPage on
+static uint32_t blackBoxSequence = 0;
+static uint16_t blackBoxBootId = 0;
+
+// Sealed pages (recorder task only). Counters run over all pages sealed since boot.
+static uint8_t blackBoxRamPages[BLACKBOX_RAM_PAGES][BLACKBOX_PAGE_SIZE];
+static uint16_t blackBoxRamLength[BLACKBOX_RAM_PAGES];
+static uint32_t blackBoxSealed = 0;     // Pages sealed
+static uint32_t blackBoxFlushed = 0;    // Pages before this one are written or given up
+static uint32_t blackBoxDumpUntil = 0;  // Write pages up to here (trigger + post-trigger window)
+static unsigned long blackBoxLastFrameMs = 0;
+static uint32_t blackBoxEraseTokens = BLACKBOX_ERASE_BURST;
+static unsigned long blackBoxTokenMs = 0;
+
+// Page being filled (recorder task only)
+static uint8_t blackBoxPage[BLACKBOX_PAGE_SIZE];
+static size_t blackBoxPageLength = BLACKBOX_HEADER_LEN;
+static uint8_t blackBoxPageCountRecords = 0;
+static uint32_t blackBoxLastUs = 0;
+static uint32_t blackBoxLastId = 0;
+static bool blackBoxLastExtended = false;
+static unsigned long blackBoxPageStartedMs = 0;
+static blackbox_repeat_t blackBoxRepeat[BLACKBOX_REPEAT_SLOTS];
+
+static uint32_t blackBoxFramesRecorded = 0;
+static uint32_t blackBoxPagesWritten = 0;
+static uint32_t blackBoxPagesSkipped = 0;  // Due for flash, but no erased space or overwritten in RAM
+static uint32_t blackBoxDumps = 0;
+static uint32_t blackBoxErases = 0;
+static uint32_t blackBoxFlashErrors = 0;
+
+namespace blackBox
+{
+    // CRC-32 as computed by zlib.crc32(), so the host tool can check pages with the standard library
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        crc = ~crc;
+        while (length--)
+        {
+            crc ^= *data++;
+            for (uint8_t bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+
+    // Called from the CAN receive task for every frame; never blocks
+    inline void record(const twai_message_t &message, uint32_t rxMicros)
+    {
+#if BLACKBOX_ENABLED
+        if (blackBoxPartition != NULL)
+        {
+            blackbox_frame_t frame;
+            frame.message = message;
+            frame.rxMicros = rxMicros;
+            blackBoxRing.push(frame);
+        }
+#endif
+    }
+
+    static void startPage()
+    {
+        memset(blackBoxPage, 0xFF, sizeof(blackBoxPage));
+        blackBoxPageLength = BLACKBOX_HEADER_LEN;
+        blackBoxPageCountRecords = 0;
+        for (uint8_t i = 0; i < BLACKBOX_REPEAT_SLOTS; i++)
+        {
+            blackBoxRepeat[i].key = 0xFFFFFFFF;
+        }
+    }
+
+    static bool pageValid(const uint8_t *page)
+    {
+        uint16_t length = canEspNowWire::getU16(page + 10);
+        if (canEspNowWire::getU16(page) != BLACKBOX_MAGIC || page[2] != BLACKBOX_VERSION ||
+            length > BLACKBOX_PAGE_SIZE - BLACKBOX_HEADER_LEN)
+        {
+            return false;
+        }
+        uint32_t crc = crc32(0, page, 16);
+        crc = crc32(crc, page + BLACKBOX_HEADER_LEN, length);
+        return crc == canEspNowWire::getU32(page + 16);
+    }
+
+    // Any task: write the RAM history and the next BLACKBOX_POST_TRIGGER_PAGES to flash
+    inline void trigger(uint8_t reason)
+    {
+#if BLACKBOX_ENABLED
+        blackBoxTriggerReason = reason;
+#endif
+    }
+
+    // Seal the current page into the RAM ring
+    static void sealPage()
+    {
+        if (blackBoxPageCountRecords == 0)
+        {
+            return;
+        }
+        uint16_t payload = blackBoxPageLength - BLACKBOX_HEADER_LEN;
+        canEspNowWire::putU16(blackBoxPage, BLACKBOX_MAGIC);
+        blackBoxPage[2] = BLACKBOX_VERSION;
+        blackBoxPage[3] = blackBoxPageCountRecords;
+        canEspNowWire::putU32(blackBoxPage + 4, blackBoxSequence);
+        canEspNowWire::putU16(blackBoxPage + 8, blackBoxBootId);
+        canEspNowWire::putU16(blackBoxPage + 10, payload);
+        uint32_t crc = crc32(0, blackBoxPage, 16);
+        crc = crc32(crc, blackBoxPage + BLACKBOX_HEADER_LEN, payload);
+        canEspNowWire::putU32(blackBoxPage + 16, crc);
+
+        uint32_t slot = blackBoxSealed % BLACKBOX_RAM_PAGES;
+        memcpy(blackBoxRamPages[slot], blackBoxPage, blackBoxPageLength);
+        blackBoxRamLength[slot] = blackBoxPageLength;
+        blackBoxSealed++;
+        blackBoxSequence++;
+        startPage();
+    }
+
+    static void startDump(uint8_t reason)
+    {
+        // Pages older than the RAM ring are gone; pages already written stay written
+        uint32_t oldest = blackBoxSealed > BLACKBOX_RAM_PAGES ? blackBoxSealed - BLACKBOX_RAM_PAGES : 0;
+        if (blackBoxFlushed < oldest)
+        {
+            blackBoxFlushed = oldest;
+        }
+        blackBoxDumpUntil = blackBoxSealed + BLACKBOX_POST_TRIGGER_PAGES;
+        blackBoxDumps++;
+        log_event(LOG_CAN, LOG_INFO, "[BLACKBOX] Triggered (reason %lu), writing %lu pages, %lu erased pages ready",
+                  reason, blackBoxDumpUntil - blackBoxFlushed, blackBoxErasedPages);
+    }
+
+    // Write due pages into already erased flash; never erases
+    static void flushPages()
+    {
+        uint32_t limit = BLACKBOX_CONTINUOUS || blackBoxDumpUntil > blackBoxSealed ? blackBoxSealed : blackBoxDumpUntil;
+        if (blackBoxFlushed >= limit)
+        {
+            return;
+        }
+        if (blackBoxSealed - blackBoxFlushed > BLACKBOX_RAM_PAGES)
+        {
+            blackBoxPagesSkipped += blackBoxSealed - BLACKBOX_RAM_PAGES - blackBoxFlushed;
+            blackBoxFlushed = blackBoxSealed - BLACKBOX_RAM_PAGES;
+        }
+        for (uint8_t written = 0; written < BLACKBOX_WRITES_PER_PASS && blackBoxFlushed < limit; written++)
+        {
+            if (blackBoxErasedPages == 0)
+            {
+                blackBoxPagesSkipped += limit - blackBoxFlushed;
+                blackBoxFlushed = limit;
+                return;
+            }
+            uint32_t slot = blackBoxFlushed % BLACKBOX_RAM_PAGES;
+            if (esp_partition_write(blackBoxPartition, (size_t)blackBoxNextPage * BLACKBOX_PAGE_SIZE,
+                                    blackBoxRamPages[slot], blackBoxRamLength[slot]) == ESP_OK)
+            {
+                blackBoxPagesWritten++;
+            }
+            else
+            {
+                blackBoxFlashErrors++;
+            }
+            blackBoxNextPage = (blackBoxNextPage + 1) % blackBoxPageCount;
+            blackBoxErasedPages--;
+            blackBoxFlushed++;
+        }
+    }
+
+    // Erase one more sector ahead of the write position while the bus is quiet and the budget allows
+    static void preErase(unsigned long now)
+    {
+        uint32_t target = BLACKBOX_PREERASE_PAGES;
+        if (target > blackBoxPageCount - BLACKBOX_PAGES_PER_SECTOR)
+        {
+            target = blackBoxPageCount - BLACKBOX_PAGES_PER_SECTOR;
+        }
+        uint32_t interval = 3600000UL / BLACKBOX_ERASES_PER_HOUR;
+        while (blackBoxEraseTokens < BLACKBOX_ERASE_BURST && now - blackBoxTokenMs >= interval)
+        {
+            blackBoxEraseTokens++;
+            blackBoxTokenMs += interval;
+        }
+        if (blackBoxEraseTokens >= BLACKBOX_ERASE_BURST)
+        {
+            blackBoxTokenMs = now;
+        }
+        if (blackBoxErasedPages + BLACKBOX_PAGES_PER_SECTOR > target || blackBoxEraseTokens == 0 ||
+            blackBoxFlushed < blackBoxDumpUntil || now - blackBoxLastFrameMs < BLACKBOX_ERASE_IDLE_MS)
+        {
+            return;
+        }
+        uint32_t page = (blackBoxNextPage + blackBoxErasedPages) % blackBoxPageCount;
+        if (esp_partition_erase_range(blackBoxPartition, (size_t)page * BLACKBOX_PAGE_SIZE, BLACKBOX_SECTOR_SIZE) != ESP_OK)
+        {
+            blackBoxFlashErrors++;
+            return;
+        }
+        blackBoxErasedPages += BLACKBOX_PAGES_PER_SECTOR;
+        blackBoxEraseTokens--;
+        blackBoxErases++;
+    }
+
+    static void putVarint(uint8_t *&p, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            *p++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *p++ = (uint8_t)value;
+    }
+
+    // Encode one frame into the current page, writing the page out first if it is full
+    static void append(const blackbox_frame_t &frame)
+    {
+        const twai_message_t &message = frame.message;
+        uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+        uint32_t id = message.identifier & (message.extd ? canEspNowWire::EXT_ID_MASK : canEspNowWire::STD_ID_MASK);
+
+        // Worst case: 5-byte varint, head, 4-byte ID, 8 data bytes
+        if (blackBoxPageLength + 18 > BLACKBOX_PAGE_SIZE)
+        {
+            sealPage();
+        }
+        if (blackBoxPageCountRecords == 0)
+        {
+            canEspNowWire::putU32(blackBoxPage + 12, frame.rxMicros);
+            blackBoxLastUs = frame.rxMicros;
+            blackBoxPageStartedMs = millis();
+        }
+
+        uint8_t *p = blackBoxPage + blackBoxPageLength;
+        putVarint(p, frame.rxMicros - blackBoxLastUs);
+
+        uint8_t head = dlc;
+        if (message.extd) head |= canEspNowWire::FRAME_EXT;
+        if (message.rtr) head |= canEspNowWire::FRAME_RTR;
+
+        uint32_t key = id | (message.extd ? 0x80000000 : 0);
+        blackbox_repeat_t &slot = blackBoxRepeat[(key * 2654435761u) & (BLACKBOX_REPEAT_SLOTS - 1)];
+        bool repeat = !message.rtr && slot.key == key && slot.dlc == dlc && memcmp(slot.data, message.data, dlc) == 0;
+        if (repeat) head |= BLACKBOX_REPEAT;
+
+        int32_t delta = (int32_t)id - (int32_t)blackBoxLastId;
+        if (blackBoxPageCountRecords > 0 && message.extd == blackBoxLastExtended && delta >= -128 && delta <= 127)
+        {
+            *p++ = head | canEspNowWire::FRAME_DELTA_ID;
+            *p++ = (uint8_t)(int8_t)delta;
+        }
+        else if (message.extd)
+        {
+            *p++ = head;
+            canEspNowWire::putU32(p, id);
+            p += 4;
+        }
+        else
+        {
+            *p++ = head;
+            canEspNowWire::putU16(p, (uint16_t)id);
+            p += 2;
+        }
+        if (!message.rtr && !repeat)
+        {
+            memcpy(p, message.data, dlc);
+            p += dlc;
+            slot.key = key;
+            slot.dlc = dlc;
+            memcpy(slot.data, message.data, dlc);
+        }
+
+        blackBoxPageLength = p - blackBoxPage;
+        blackBoxPageCountRecords++;
+        blackBoxLastUs = frame.rxMicros;
+        blackBoxLastId = id;
+        blackBoxLastExtended = message.extd;
+        blackBoxFramesRecorded++;
+    }
+
+    static void recorderTask(void *parameter)
+    {
+        blackbox_frame_t frame;
+        for (;;)
+        {
+            unsigned long now = millis();
+            while (blackBoxRing.pop(frame))
+            {
+                append(frame);
+                blackBoxLastFrameMs = now;
+            }
+            if (blackBoxPageCountRecords > 0 && now - blackBoxPageStartedMs >= BLACKBOX_FLUSH_MS)
+            {
+                sealPage();
+            }
+            uint8_t reason = blackBoxTriggerReason.exchange(0);
+            if (reason != 0)
+            {
+                startDump(reason);
+            }
+            // Keep off the flash while an update is being written
+            if (!otaInProgress)
+            {
+                flushPages();
+                preErase(now);
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+    }
+
+    // Count the blank sectors ahead of the write position, so a reboot does not erase them again
+    static void countErased()
+    {
+        uint8_t chunk[BLACKBOX_PAGE_SIZE];
+        blackBoxErasedPages = 0;
+        while (blackBoxErasedPages + BLACKBOX_PAGES_PER_SECTOR <= BLACKBOX_PREERASE_PAGES &&
+               blackBoxErasedPages + BLACKBOX_PAGES_PER_SECTOR <= blackBoxPageCount - BLACKBOX_PAGES_PER_SECTOR)
+        {
+            uint32_t first = (blackBoxNextPage + blackBoxErasedPages) % blackBoxPageCount;
+            for (uint32_t i = 0; i < BLACKBOX_PAGES_PER_SECTOR; i++)
+            {
+                if (esp_partition_read(blackBoxPartition, (size_t)(first + i) * BLACKBOX_PAGE_SIZE, chunk, sizeof(chunk)) != ESP_OK)
+                {
+                    return;
+                }
+                for (size_t j = 0; j < sizeof(chunk); j++)
+                {
+                    if (chunk[j] != 0xFF)
+                    {
+                        return;
+                    }
+                }
+            }
+            blackBoxErasedPages += BLACKBOX_PAGES_PER_SECTOR;
+        }
+    }
+
+    // Find the newest valid page and continue the log in the following sector
+    static void resumeLog()
+    {
+        uint8_t page[BLACKBOX_PAGE_SIZE];
+        bool found = false;
+        uint32_t newestSequence = 0;
+        uint32_t newestPage = 0;
+        for (uint32_t i = 0; i < blackBoxPageCount; i++)
+        {
+            if (esp_partition_read(blackBoxPartition, (size_t)i * BLACKBOX_PAGE_SIZE, page, sizeof(page)) != ESP_OK ||
+                !pageValid(page))
+            {
+                continue;
+            }
+            uint32_t sequence = canEspNowWire::getU32(page + 4);
+            if (!found || (int32_t)(sequence - newestSequence) > 0)
+            {
+                found = true;
+                newestSequence = sequence;
+                newestPage = i;
+            }
+        }
+        if (found)
+        {
+            // Skip the rest of the newest sector: its unwritten pages may hold a torn write
+            blackBoxSequence = newestSequence + 1;
+            blackBoxNextPage = ((newestPage / BLACKBOX_PAGES_PER_SECTOR + 1) * BLACKBOX_PAGES_PER_SECTOR) % blackBoxPageCount;
+        }
+        countErased();
+        debugf("[BLACKBOX] %lu pages, resuming at page %lu (sequence %lu, boot %u), %lu pages erased ahead\n",
+               (unsigned long)blackBoxPageCount, (unsigned long)blackBoxNextPage, (unsigned long)blackBoxSequence,
+               blackBoxBootId, (unsigned long)blackBoxErasedPages);
+    }
+
+    void startTask()
+    {
+#if BLACKBOX_ENABLED
+        const esp_partition_t *partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, BLACKBOX_PARTITION_SUBTYPE, BLACKBOX_PARTITION_LABEL);
+        if (partition == NULL || partition->size < BLACKBOX_SECTOR_SIZE)
+        {
+            debugf("[BLACKBOX] No '%s' partition - recorder disabled\n", BLACKBOX_PARTITION_LABEL);
+            metrics::notePartitionMissing(canEspNowWire::STATUS_NO_BLACKBOX_PARTITION);
+            return;
+        }
+        blackBoxPageCount = (partition->size / BLACKBOX_SECTOR_SIZE) * BLACKBOX_PAGES_PER_SECTOR;
+
+        Preferences prefs;
+        prefs.begin("blackbox", false);  // read-write
+        blackBoxBootId = prefs.getUShort("boot", 0) + 1;
+        prefs.putUShort("boot", blackBoxBootId);
+        prefs.end();
+
+        blackBoxPartition = partition;
+        resumeLog();
+        startPage();
+        blackBoxTokenMs = millis();
+        xTaskCreatePinnedToCore(recorderTask, "blackBox", 3072, NULL, BLACKBOX_TASK_PRIORITY, NULL, BLACKBOX_TASK_CORE);
+#endif
+    }
+
+    void printStatus()
+    {
+        if (blackBoxPartition == NULL)
+        {
+            return;
+        }
+        debugf("[BLACKBOX] Recorded=%lu sealed=%lu written=%lu skipped=%lu dumps=%lu ring dropped=%lu flash errors=%lu\n",
+               (unsigned long)blackBoxFramesRecorded, (unsigned long)blackBoxSealed, (unsigned long)blackBoxPagesWritten,
+               (unsigned long)blackBoxPagesSkipped, (unsigned long)blackBoxDumps, (unsigned long)blackBoxRing.dropped(),
+               (unsigned long)blackBoxFlashErrors);
+        debugf("[BLACKBOX] Erases=%lu (budget %u/h, %lu left), %lu pages erased ahead\n", (unsigned long)blackBoxErases,
+               BLACKBOX_ERASES_PER_HOUR, (unsigned long)blackBoxEraseTokens, (unsigned long)blackBoxErasedPages);
+    }
+}
@@ -0,0 +1,579 @@
+#pragma once
+#include "globals.h"
+#include "gatewayConfig.h"
+#include <esp_timer.h>
+
+/**
+ * Thin CAN bus interface over the TWAI driver calls the gateway uses, so the
+ * forwarding path can be driven by something other than the ESP32 controller.
+ * Return values follow the TWAI driver (ESP_OK on success).
+ */
+class CanBus
+{
+public:
+    virtual ~CanBus() {}
+    virtual esp_err_t install(const twai_general_config_t &g_config, const twai_timing_config_t &t_config,
+                              const twai_filter_config_t &f_config) = 0;
+    virtual esp_err_t uninstall() = 0;
+    virtual esp_err_t start() = 0;
+    virtual esp_err_t stop() = 0;
+    virtual esp_err_t reconfigureAlerts(uint32_t alerts) = 0;
+    virtual esp_err_t readAlerts(uint32_t *alerts, TickType_t wait) = 0;
+    virtual esp_err_t receive(twai_message_t *message, TickType_t wait) = 0;
+    virtual esp_err_t transmit(const twai_message_t *message, TickType_t wait) = 0;
+    virtual esp_err_t getStatus(twai_status_info_t *status) = 0;
+    virtual esp_err_t initiateRecovery() = 0;
+};
+
+#if !HOST_BUILD
+// ESP32 TWAI controller
+class Esp32CanBus : public CanBus
+{
+public:
+    esp_err_t install(const twai_general_config_t &g_config, const twai_timing_config_t &t_config,
+                      const twai_filter_config_t &f_config) override
+    {
+        return twai_driver_install(&g_config, &t_config, &f_config);
+    }
+    esp_err_t uninstall() override { return twai_driver_uninstall(); }
+    esp_err_t start() override { return twai_start(); }
+    esp_err_t stop() override { return twai_stop(); }
+    esp_err_t reconfigureAlerts(uint32_t alerts) override { return twai_reconfigure_alerts(alerts, NULL); }
+    esp_err_t readAlerts(uint32_t *alerts, TickType_t wait) override { return twai_read_alerts(alerts, wait); }
+    esp_err_t receive(twai_message_t *message, TickType_t wait) override { return twai_receive(message, wait); }
+    esp_err_t transmit(const twai_message_t *message, TickType_t wait) override { return twai_transmit(message, wait); }
+    esp_err_t getStatus(twai_status_info_t *status) override { return twai_get_status_info(status); }
+    esp_err_t initiateRecovery() override { return twai_initiate_recovery(); }
+};
+#endif
+
+#if CAN_REPLAY && !CAN_BENCH
+/**
+ * Feeds frames from `candump -L` lines read on Serial, e.g.
+ *   (1436509052.249713) can0 123#DEADBEEF
+ *   (1436509052.250001) can0 18FEF100#0102  (8 hex digits = extended ID)
+ *   (1436509052.250100) can0 321#R          (remote frame)
+ * Lines are parsed as fast as they arrive; tools/candump_replay.py streams a
+ * log file in a loop. Transmitted frames are counted and discarded.
+ */
+class ReplayCanBus : public CanBus
+{
+public:
+    esp_err_t install(const twai_general_config_t &, const twai_timing_config_t &,
+                      const twai_filter_config_t &) override { return ESP_OK; }
+    esp_err_t uninstall() override { return ESP_OK; }
+    esp_err_t start() override { return ESP_OK; }
+    esp_err_t stop() override { return ESP_OK; }
+    esp_err_t reconfigureAlerts(uint32_t) override { return ESP_OK; }
+
+    esp_err_t readAlerts(uint32_t *alerts, TickType_t wait) override
+    {
+        *alerts = 0;
+        pollSerial();
+        if (pending_.empty())
+        {
+            vTaskDelay(1);
+            pollSerial();
+        }
+        if (!pending_.empty())
+        {
+            *alerts = TWAI_ALERT_RX_DATA;
+            return ESP_OK;
+        }
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t receive(twai_message_t *message, TickType_t) override
+    {
+        return pending_.pop(*message) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t transmit(const twai_message_t *, TickType_t) override
+    {
+        transmitted++;
+        return ESP_OK;
+    }
+
+    esp_err_t getStatus(twai_status_info_t *status) override
+    {
+        memset(status, 0, sizeof(*status));
+        status->state = TWAI_STATE_RUNNING;
+        status->msgs_to_rx = pending_.size();
+        return ESP_OK;
+    }
+
+    esp_err_t initiateRecovery() override { return ESP_OK; }
+
+    uint32_t parsed = 0;
+    uint32_t malformed = 0;
+    uint32_t transmitted = 0;
+
+private:
+    void pollSerial()
+    {
+        while (Serial.available() > 0 && pending_.size() < pending_.capacity())
+        {
+            char c = (char)Serial.read();
+            if (c == '\n' || c == '\r')
+            {
+                if (lineLength_ > 0)
+                {
+                    line_[lineLength_] = '\0';
+                    parseLine();
+                    lineLength_ = 0;
+                }
+            }
+            else if (lineLength_ < sizeof(line_) - 1)
+            {
+                line_[lineLength_++] = c;
+            }
+        }
+    }
+
+    static int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    // "(timestamp) interface ID#DATA"; only the ID#DATA token is used
+    void parseLine()
+    {
+        char *frame = strrchr(line_, ' ');
+        frame = frame ? frame + 1 : line_;
+        char *hash = strchr(frame, '#');
+        if (hash == NULL || hash == frame)
+        {
+            malformed++;
+            return;
+        }
+
+        twai_message_t message;
+        memset(&message, 0, sizeof(message));
+        size_t idDigits = hash - frame;
+        for (size_t i = 0; i < idDigits; i++)
+        {
+            int v = hexValue(frame[i]);
+            if (v < 0)
+            {
+                malformed++;
+                return;
+            }
+            message.identifier = (message.identifier << 4) | v;
+        }
+        message.extd = idDigits > 3;
+
+        const char *data = hash + 1;
+        if (*data == 'R')
+        {
+            message.rtr = 1;
+            message.data_length_code = (data[1] >= '0' && data[1] <= '8') ? data[1] - '0' : 0;
+        }
+        else
+        {
+            uint8_t length = 0;
+            while (data[0] && data[1] && length < 8)
+            {
+                int hi = hexValue(data[0]);
+                int lo = hexValue(data[1]);
+                if (hi < 0 || lo < 0)
+                {
+                    break;
+                }
+                message.data[length++] = (uint8_t)((hi << 4) | lo);
+                data += 2;
+            }
+            message.data_length_code = length;
+        }
+        pending_.push(message);
+        parsed++;
+    }
+
+    char line_[96];
+    size_t lineLength_ = 0;
+    FrameRing<twai_message_t, 16> pending_;
+};
+
+static ReplayCanBus replayCanBus;
+CanBus *canBus = &replayCanBus;
+#endif
+
+#if CAN_BENCH
+// Largest receive queue the synthetic bus can model (CAN_RX_QUEUE_MAX)
+#ifndef BENCH_QUEUE_CAPACITY
+#define BENCH_QUEUE_CAPACITY 256
+#endif
+#ifndef BENCH_SEED
+#define BENCH_SEED 0x2545F491
+#endif
+// Time for the transmit task to flush the last batches before the run is reported
+#ifndef BENCH_SETTLE_MS
+#define BENCH_SETTLE_MS 500
+#endif
+
+/**
+ * Generates synthetic traffic for saturation benchmarks. A run starts with a
+ * command line on Serial (tools/can_benchmark.py sends it), e.g.
+ *   BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=5 seconds=30
+ *
+ *   rate     frames/s
+ *   ids      distinct IDs spread over the standard range, ext percent of them extended
+ *   dlc8     percent of frames with 8 data bytes, the rest 0..7 bytes
+ *   burst    frames sent back to back, same average rate (1 = periodic)
+ *   control  permille of frames on the OTA trigger and config IDs
+ *   seconds  run length
+ *
+ * Frames come due by the clock; when the receive task falls behind by more
+ * than the installed rx_queue_len they are counted as overruns, as the TWAI
+ * controller would lose them. Every run uses the same seed.
+ */
+class SyntheticCanBus : public CanBus
+{
+public:
+    esp_err_t install(const twai_general_config_t &g_config, const twai_timing_config_t &,
+                      const twai_filter_config_t &) override
+    {
+        queueLimit_ = g_config.rx_queue_len < pending_.capacity() ? g_config.rx_queue_len : pending_.capacity();
+        return ESP_OK;
+    }
+    esp_err_t uninstall() override { return ESP_OK; }
+    esp_err_t start() override { return ESP_OK; }
+    esp_err_t stop() override { return ESP_OK; }
+    esp_err_t reconfigureAlerts(uint32_t) override { return ESP_OK; }
+
+    esp_err_t readAlerts(uint32_t *alerts, TickType_t wait) override
+    {
+        *alerts = 0;
+        pollSerial();
+        if (started_)
+        {
+            // Let the receive task baseline its counters before the run's first frame
+            return ESP_ERR_TIMEOUT;
+        }
+        generate();
+        if (pending_.empty())
+        {
+            vTaskDelay(1);
+            generate();
+        }
+        if (queueFull_)
+        {
+            *alerts |= TWAI_ALERT_RX_QUEUE_FULL;
+            queueFull_ = false;
+        }
+        if (!pending_.empty())
+        {
+            *alerts |= TWAI_ALERT_RX_DATA;
+        }
+        return *alerts ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t receive(twai_message_t *message, TickType_t) override
+    {
+        return pending_.pop(*message) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t transmit(const twai_message_t *, TickType_t) override
+    {
+        transmitted++;
+        return ESP_OK;
+    }
+
+    esp_err_t getStatus(twai_status_info_t *status) override
+    {
+        memset(status, 0, sizeof(*status));
+        status->state = TWAI_STATE_RUNNING;
+        status->msgs_to_rx = pending_.size();
+        status->rx_overrun_count = overruns;
+        return ESP_OK;
+    }
+
+    esp_err_t initiateRecovery() override { return ESP_OK; }
+
+    // CAN receive task: true once when a run starts / when its last frame has been generated
+    bool takeStarted()
+    {
+        bool started = started_;
+        started_ = false;
+        return started;
+    }
+    bool takeFinished()
+    {
+        bool finished = finished_;
+        finished_ = false;
+        return finished;
+    }
+
+    // CAN receive task: frames generated but not yet received, and when the current run started
+    uint32_t backlog() const { return pending_.size(); }
+    int64_t startedUs() const { return startUs_; }
+
+    uint32_t rate = 0;
+    uint32_t seconds = 0;
+    uint32_t generated = 0;
+    uint32_t overruns = 0;
+    uint32_t rejected = 0;  // Malformed command lines
+    uint32_t transmitted = 0;
+
+private:
+    void pollSerial()
+    {
+        while (Serial.available() > 0)
+        {
+            char c = (char)Serial.read();
+            if (c == '\n' || c == '\r')
+            {
+                if (lineLength_ > 0)
+                {
+                    line_[lineLength_] = '\0';
+                    parseCommand();
+                    lineLength_ = 0;
+                }
+            }
+            else if (lineLength_ < sizeof(line_) - 1)
+            {
+                line_[lineLength_++] = c;
+            }
+        }
+    }
+
+    void parseCommand()
+    {
+        uint32_t values[] = {4000, 64, 0, 100, 1, 0, 10};
+        static const char *const keys[] = {"rate", "ids", "ext", "dlc8", "burst", "control", "seconds"};
+        char *save = NULL;
+        char *token = strtok_r(line_, " ", &save);
+        if (token == NULL || strcmp(token, "BENCH") != 0)
+        {
+            rejected++;
+            return;
+        }
+        while ((token = strtok_r(NULL, " ", &save)) != NULL)
+        {
+            char *equals = strchr(token, '=');
+            size_t key = sizeof(keys) / sizeof(keys[0]);
+            if (equals != NULL)
+            {
+                *equals = '\0';
+                for (key = 0; key < sizeof(keys) / sizeof(keys[0]) && strcmp(token, keys[key]) != 0; key++)
+                {
+                }
+            }
+            if (key == sizeof(keys) / sizeof(keys[0]))
+            {
+                rejected++;
+                return;
+            }
+            values[key] = strtoul(equals + 1, NULL, 10);
+        }
+        if (values[0] == 0 || values[1] == 0 || values[1] > 0x7F0 || values[2] > 100 || values[3] > 100 ||
+            values[4] == 0 || values[5] > 1000 || values[6] == 0)
+        {
+            rejected++;
+            return;
+        }
+        rate = values[0];
+        ids_ = values[1];
+        extPercent_ = values[2];
+        dlc8Percent_ = values[3];
+        burst_ = values[4];
+        controlPermille_ = values[5];
+        seconds = values[6];
+        total_ = (uint64_t)rate * seconds;
+        random_ = BENCH_SEED;
+        twai_message_t stale;
+        while (pending_.pop(stale))
+        {
+        }
+        generated = 0;
+        overruns = 0;
+        started_ = true;
+        running_ = true;
+        startUs_ = esp_timer_get_time();
+    }
+
+    uint32_t nextRandom()
+    {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 17;
+        random_ ^= random_ << 5;
+        return random_;
+    }
+
+    void nextFrame(twai_message_t &message)
+    {
+        memset(&message, 0, sizeof(message));
+        if (nextRandom() % 1000 < controlPermille_)
+        {
+            // OTA trigger for another gateway, or an unknown config request (answered on CAN)
+            if (generated & 1)
+            {
+                message.identifier = 0x0;
+                message.data_length_code = 3;
+                memset(message.data, 0xFF, 3);
+            }
+            else
+            {
+                message.identifier = configCanIds[0];
+                message.data_length_code = 2;
+                message.data[0] = 0x01;  // ISO-TP single frame, 1 byte
+                message.data[1] = 0x7F;
+            }
+            return;
+        }
+        uint32_t index = nextRandom() % ids_;
+        if (index * 100 < extPercent_ * ids_)
+        {
+            message.extd = 1;
+            message.identifier = 0x18FF0000 | index;
+        }
+        else
+        {
+            message.identifier = 0x010 + index * (0x7F0 / ids_);
+        }
+        message.data_length_code = nextRandom() % 100 < dlc8Percent_ ? 8 : nextRandom() % 8;
+        uint32_t low = nextRandom();
+        uint32_t high = nextRandom();
+        memcpy(message.data, &low, 4);
+        memcpy(message.data + 4, &high, 4);
+    }
+
+    // Queue the frames due by now, in whole bursts
+    void generate()
+    {
+        if (!running_)
+        {
+            return;
+        }
+        uint64_t due = (uint64_t)(esp_timer_get_time() - startUs_) * rate / 1000000;
+        due -= due % burst_;
+        if (due > total_)
+        {
+            due = total_;
+        }
+        while (generated < due)
+        {
+            if (pending_.size() >= queueLimit_)
+            {
+                overruns += (uint32_t)(due - generated);
+                generated = (uint32_t)due;
+                queueFull_ = true;
+                break;
+            }
+            twai_message_t message;
+            nextFrame(message);
+            pending_.push(message);
+            generated++;
+        }
+        if (generated >= total_)
+        {
+            running_ = false;
+            finished_ = true;
+        }
+    }
+
+    char line_[96];
+    size_t lineLength_ = 0;
+    FrameRing<twai_message_t, BENCH_QUEUE_CAPACITY> pending_;
+    uint32_t queueLimit_ = BENCH_QUEUE_CAPACITY;
+    uint32_t ids_ = 1;
+    uint32_t extPercent_ = 0;
+    uint32_t dlc8Percent_ = 100;
+    uint32_t burst_ = 1;
+    uint32_t controlPermille_ = 0;
+    uint64_t total_ = 0;
+    uint32_t random_ = BENCH_SEED;
+    int64_t startUs_ = 0;
+    bool running_ = false;
+    bool started_ = false;
+    bool finished_ = false;
+    bool queueFull_ = false;
+};
+
+static SyntheticCanBus syntheticCanBus;
+CanBus *canBus = &syntheticCanBus;
+#endif
+
+#if HOST_BUILD && !CAN_REPLAY
+/**
+ * In-memory bus for host builds: tests inject received frames with inject() and
+ * find what the gateway transmitted in sent. Bus states and error alerts are
+ * simulated by setting state and raising alerts. Never blocks.
+ */
+class HostCanBus : public CanBus
+{
+public:
+    esp_err_t install(const twai_general_config_t &, const twai_timing_config_t &,
+                      const twai_filter_config_t &f_config) override
+    {
+        filter = f_config;
+        installs++;
+        return ESP_OK;
+    }
+    esp_err_t uninstall() override { return ESP_OK; }
+    esp_err_t start() override
+    {
+        state = TWAI_STATE_RUNNING;
+        return ESP_OK;
+    }
+    esp_err_t stop() override
+    {
+        state = TWAI_STATE_STOPPED;
+        return ESP_OK;
+    }
+    esp_err_t reconfigureAlerts(uint32_t) override { return ESP_OK; }
+
+    esp_err_t readAlerts(uint32_t *alerts, TickType_t) override
+    {
+        *alerts = alerts_ | (pending_.empty() ? 0 : TWAI_ALERT_RX_DATA);
+        alerts_ = 0;
+        return *alerts ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t receive(twai_message_t *message, TickType_t) override
+    {
+        return pending_.pop(*message) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t transmit(const twai_message_t *message, TickType_t) override
+    {
+        return state == TWAI_STATE_RUNNING && sent.push(*message) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t getStatus(twai_status_info_t *status) override
+    {
+        memset(status, 0, sizeof(*status));
+        status->state = state;
+        status->msgs_to_rx = pending_.size();
+        return ESP_OK;
+    }
+
+    esp_err_t initiateRecovery() override
+    {
+        state = TWAI_STATE_RECOVERING;
+        return ESP_OK;
+    }
+
+    // Queue a frame as if received from the bus; false when the receive queue is full
+    bool inject(const twai_message_t &message) { return pending_.push(message); }
+    // Report alerts (e.g. TWAI_ALERT_BUS_OFF) on the next readAlerts()
+    void raiseAlerts(uint32_t alerts) { alerts_ |= alerts; }
+
+    twai_state_t state = TWAI_STATE_STOPPED;
+    twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    uint32_t installs = 0;
+    FrameRing<twai_message_t, 64> sent;
+
+private:
+    FrameRing<twai_message_t, 256> pending_;
+    uint32_t alerts_ = 0;
+};
+
+static HostCanBus hostCanBus;
+CanBus *canBus = &hostCanBus;
+#elif !CAN_REPLAY
+static Esp32CanBus esp32CanBus;
+CanBus *canBus = &esp32CanBus;
+#endif
@@ -0,0 +1,185 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * TWAI acceptance filter derivation for a set of standard (11-bit) IDs.
+ *
+ * The ESP32 TWAI controller matches received frames against an acceptance
+ * code/mask pair (mask bit 1 = don't care). For standard frames the ID sits
+ * in bits 31..21 in single-filter mode; dual-filter mode has two independent
+ * ID filters in bits 31..21 and 15..5. compute() picks the single or dual
+ * configuration that lets the fewest unwanted IDs through; IdSet::contains()
+ * then drops what the mask still admits.
+ *
+ * No driver dependencies so the computation can be checked on the host.
+ */
+namespace canFilter
+{
+    constexpr uint16_t STD_ID_COUNT = 0x800;
+
+    // Bitset over all 2048 standard IDs (256 bytes); O(1) membership test
+    struct IdSet
+    {
+        uint32_t bits[STD_ID_COUNT / 32];
+
+        void clear() { memset(bits, 0, sizeof(bits)); }
+
+        void add(uint32_t id)
+        {
+            if (id < STD_ID_COUNT)
+            {
+                bits[id >> 5] |= 1u << (id & 31);
+            }
+        }
+
+        void addRange(uint32_t firstId, uint32_t lastId)
+        {
+            for (uint32_t id = firstId; id <= lastId && id < STD_ID_COUNT; id++)
+            {
+                add(id);
+            }
+        }
+
+        bool contains(uint32_t id) const
+        {
+            return id < STD_ID_COUNT && (bits[id >> 5] & (1u << (id & 31))) != 0;
+        }
+
+        uint16_t count() const
+        {
+            uint16_t total = 0;
+            for (uint16_t i = 0; i < STD_ID_COUNT / 32; i++)
+            {
+                total += __builtin_popcount(bits[i]);
+            }
+            return total;
+        }
+    };
+
+    struct AcceptanceFilter
+    {
+        uint32_t code;
+        uint32_t mask;
+        bool single;
+        uint16_t acceptedIds;  // Standard IDs the hardware lets through (upper bound for dual)
+    };
+
+    // Tightest code/mask over a group of IDs given their bitwise AND and OR
+    struct Cover
+    {
+        uint16_t code;
+        uint16_t dontCare;
+        uint16_t size() const { return (uint16_t)(1u << __builtin_popcount(dontCare)); }
+    };
+
+    inline Cover coverOf(uint16_t andBits, uint16_t orBits)
+    {
+        Cover cover;
+        cover.dontCare = (andBits ^ orBits) & 0x7FF;
+        cover.code = andBits & ~cover.dontCare & 0x7FF;
+        return cover;
+    }
+
+    inline AcceptanceFilter singleFilter(const Cover &cover)
+    {
+        AcceptanceFilter filter;
+        filter.code = (uint32_t)cover.code << 21;
+        filter.mask = ((uint32_t)cover.dontCare << 21) | 0x1FFFFF;  // RTR and data bytes don't care
+        filter.single = true;
+        filter.acceptedIds = cover.size();
+        return filter;
+    }
+
+    inline AcceptanceFilter dualFilter(const Cover &first, const Cover &second)
+    {
+        AcceptanceFilter filter;
+        filter.code = ((uint32_t)first.code << 21) | ((uint32_t)second.code << 5);
+        filter.mask = ((uint32_t)first.dontCare << 21) | 0x1F0000 | ((uint32_t)second.dontCare << 5) | 0x1F;
+        filter.single = false;
+        uint32_t accepted = first.size() + second.size();
+        filter.acceptedIds = accepted > STD_ID_COUNT ? STD_ID_COUNT : accepted;
+        return filter;
+    }
+
+    inline AcceptanceFilter acceptAll()
+    {
+        AcceptanceFilter filter = {0, 0xFFFFFFFF, true, STD_ID_COUNT};
+        return filter;
+    }
+
+    /**
+     * Derive the acceptance filter for a set of IDs.
+     * Dual-filter candidates split the sorted IDs at every position and by
+     * every ID bit; the candidate admitting the fewest IDs wins.
+     */
+    inline AcceptanceFilter compute(const IdSet &ids)
+    {
+        static uint16_t sorted[STD_ID_COUNT];
+        static uint16_t prefixAnd[STD_ID_COUNT], prefixOr[STD_ID_COUNT];
+        uint16_t n = 0;
+        for (uint16_t id = 0; id < STD_ID_COUNT; id++)
+        {
+            if (ids.contains(id))
+            {
+                sorted[n++] = id;
+            }
+        }
+        if (n == 0 || n == STD_ID_COUNT)
+        {
+            return acceptAll();
+        }
+
+        for (uint16_t i = 0; i < n; i++)
+        {
+            prefixAnd[i] = i ? (prefixAnd[i - 1] & sorted[i]) : sorted[i];
+            prefixOr[i] = i ? (prefixOr[i - 1] | sorted[i]) : sorted[i];
+        }
+        AcceptanceFilter best = singleFilter(coverOf(prefixAnd[n - 1], prefixOr[n - 1]));
+
+        // Split sorted IDs into [0, k) and [k, n)
+        uint16_t suffixAnd = 0x7FF, suffixOr = 0;
+        for (uint16_t k = n - 1; k >= 1; k--)
+        {
+            suffixAnd &= sorted[k];
+            suffixOr |= sorted[k];
+            AcceptanceFilter candidate = dualFilter(coverOf(prefixAnd[k - 1], prefixOr[k - 1]), coverOf(suffixAnd, suffixOr));
+            if (candidate.acceptedIds < best.acceptedIds)
+            {
+                best = candidate;
+            }
+        }
+
+        // Split by the value of one ID bit
+        for (uint8_t bit = 0; bit < 11; bit++)
+        {
+            uint16_t and0 = 0x7FF, or0 = 0, and1 = 0x7FF, or1 = 0;
+            bool any0 = false, any1 = false;
+            for (uint16_t i = 0; i < n; i++)
+            {
+                if (sorted[i] & (1u << bit))
+                {
+                    and1 &= sorted[i];
+                    or1 |= sorted[i];
+                    any1 = true;
+                }
+                else
+                {
+                    and0 &= sorted[i];
+                    or0 |= sorted[i];
+                    any0 = true;
+                }
+            }
+            if (!any0 || !any1)
+            {
+                continue;
+            }
+            AcceptanceFilter candidate = dualFilter(coverOf(and0, or0), coverOf(and1, or1));
+            if (candidate.acceptedIds < best.acceptedIds)
+            {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+}
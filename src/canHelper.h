@@ -1,319 +1,447 @@
 #pragma once
 #include "globals.h"
 #include "espNowHelper.h"
-#include <OtaUpdate.h>
-#include <Preferences.h>
+#include "otaHelper.h"
+#include "canFilter.h"
+#include "canBus.h"
+#include "canSupervisor.h"
+#include "powerManager.h"
+#include "gatewayConfig.h"
+#include "configHelper.h"
+#include "blackBox.h"
 #define CAN_RX 13
 #define CAN_TX 15
 // Interval:
 #define POLLING_RATE_MS 33
-static bool driver_installed = false;
+// TWAI driver RX queue length (driver default is 5)
+#ifndef CAN_RX_QUEUE_LEN
+#define CAN_RX_QUEUE_LEN 32
+#endif
+// TWAI driver TX queue length
+#ifndef CAN_TX_QUEUE_LEN
+#define CAN_TX_QUEUE_LEN 8
+#endif
+// Frames received over ESP-NOW waiting for the CAN transmit task
+#ifndef ESPNOW_TO_CAN_QUEUE_DEPTH
+#define ESPNOW_TO_CAN_QUEUE_DEPTH 32
+#endif
+// How long the CAN transmit task waits for room in the TWAI TX queue
+#ifndef CAN_TX_TIMEOUT_MS
+#define CAN_TX_TIMEOUT_MS 20
+#endif
+// CAN receive task
+#ifndef CAN_RX_TASK_PRIORITY
+#define CAN_RX_TASK_PRIORITY 5
+#endif
+#ifndef CAN_RX_TASK_CORE
+#define CAN_RX_TASK_CORE 1
+#endif
+// CAN transmit task (ESP-NOW -> CAN)
+#ifndef CAN_TX_TASK_PRIORITY
+#define CAN_TX_TASK_PRIORITY 4
+#endif
 
-// Forward declaration for OTA handler
-extern OtaUpdate otaUpdate;
+// IDs accepted in software after the hardware acceptance filter
+static canFilter::IdSet acceptedIds;
+static uint32_t softwareFilteredCount = 0;
 
-// WiFi credential reception state (CAN ID 0x01 protocol)
-static bool wifiConfigInProgress = false;
-static uint8_t wifiSsidBuffer[33];       // Max 32 chars + null
-static uint8_t wifiPasswordBuffer[64];   // Max 63 chars + null
-static uint8_t wifiSsidLen = 0;
-static uint8_t wifiPasswordLen = 0;
-static uint8_t wifiSsidReceived = 0;
-static uint8_t wifiPasswordReceived = 0;
+// ESP-NOW -> CAN transmit metrics
+static uint32_t canTxSent = 0;
+static uint32_t canTxFailed = 0;
+static uint64_t canTxLatencyTotalUs = 0;
+static uint32_t canTxLatencyMaxUs = 0;
+
+// CPU time spent in handle_rx_message
+static uint32_t rxFramesHandled = 0;
+static uint64_t rxHandleTotalUs = 0;
 
 namespace canHelper
 {
-    void initialize()
+    // Derive the tightest hardware filter covering the forwarded IDs plus the gateway's control IDs
+    static twai_filter_config_t buildAcceptanceFilter()
     {
-        // Show CAN configuration
-        debugf("[CAN] Initializing with TX=GPIO%d, RX=GPIO%d, Speed=500kbps\n", CAN_TX, CAN_RX);
-
-        // Initialize configuration structures using macro initializers
-        twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)CAN_TX, (gpio_num_t)CAN_RX, TWAI_MODE_NO_ACK);
-        // g_config.rx_queue_len = 20; // Increase RX queue length to hold more messages
-        twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS(); // Look in the api-reference for other speed sets.
-        // Filter to only listen for messages from a single extended can identifier. Will need to be changed once we have
-        // two different senders. One for on/off and another for 0 >> 255 values.
-        twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-
-        // Install TWAI driver
-        debugln("[CAN] Installing driver...");
-        if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK)
-        {
-            debugln("[CAN] ✓ Driver installed successfully");
-        }
-        else
-        {
-            debugln("[CAN] ✗ ERROR: Failed to install driver - check GPIO pins!");
-            return;
-        }
-
-        // Start TWAI driver
-        debugln("[CAN] Starting driver...");
-        if (twai_start() == ESP_OK)
+        acceptedIds.clear();
+        for (size_t i = 0; i < sizeof(forwardRanges) / sizeof(forwardRanges[0]); i++)
         {
-            debugln("[CAN] ✓ Driver started successfully");
+            acceptedIds.addRange(forwardRanges[i].firstId, forwardRanges[i].lastId);
         }
-        else
+        acceptedIds.add(0x0);   // OTA trigger
+        for (size_t i = 0; i < sizeof(configCanIds) / sizeof(configCanIds[0]); i++)
         {
-            debugln("[CAN] ✗ ERROR: Failed to start driver");
-            return;
+            acceptedIds.add(configCanIds[i]);  // ISO-TP configuration
         }
 
-        // Reconfigure alerts to detect frame receive, Bus-Off error and RX queue full states
-        debugln("[CAN] Configuring alerts...");
-        uint32_t alerts_to_enable = TWAI_ALERT_RX_DATA | TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_ERROR | TWAI_ALERT_RX_QUEUE_FULL;
-        if (twai_reconfigure_alerts(alerts_to_enable, NULL) == ESP_OK)
+        twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        if (!FORWARD_EXTENDED_IDS && !PROFILER_ACCEPT_ALL)
         {
-            debugln("[CAN] ✓ Alerts configured successfully");
+            canFilter::AcceptanceFilter filter = canFilter::compute(acceptedIds);
+            f_config.acceptance_code = filter.code;
+            f_config.acceptance_mask = filter.mask;
+            f_config.single_filter = filter.single;
+            debugf("[CAN] Acceptance filter: %s, code=0x%08lX, mask=0x%08lX, %u of %u wanted IDs admitted\n",
+                   filter.single ? "single" : "dual", (unsigned long)filter.code, (unsigned long)filter.mask,
+                   filter.acceptedIds, acceptedIds.count());
         }
         else
         {
-            debugln("[CAN] ✗ ERROR: Failed to reconfigure alerts");
-            return;
+            debugln(FORWARD_EXTENDED_IDS ? "[CAN] Acceptance filter: accept all (extended IDs forwarded)"
+                                         : "[CAN] Acceptance filter: accept all (bus profiling)");
         }
-
-        // TWAI driver is now successfully installed and started
-        debugln("[CAN] ✓ CAN Bus fully initialized and ready to receive messages");
-        driver_installed = true;
+        return f_config;
     }
 
-    static void saveWifiCredentials(const char* ssid, const char* password) {
-        Preferences prefs;
-        prefs.begin("wifi", false);  // read-write
-        prefs.putString("ssid", ssid);
-        prefs.putString("password", password);
-        prefs.end();
-        debugf("[WiFi] Credentials saved to NVS (SSID: %s)\n", ssid);
-    }
-
-    static void handleWifiConfigMessage(twai_message_t &message) {
-        uint8_t msgType = message.data[0];
-
-        switch (msgType) {
-            case 0x01: {  // Start message
-                wifiSsidLen = message.data[1];
-                wifiPasswordLen = message.data[2];
-                wifiSsidReceived = 0;
-                wifiPasswordReceived = 0;
-                memset(wifiSsidBuffer, 0, sizeof(wifiSsidBuffer));
-                memset(wifiPasswordBuffer, 0, sizeof(wifiPasswordBuffer));
-                wifiConfigInProgress = true;
-                debugf("[WiFi] Config start: SSID len=%d, Password len=%d\n", wifiSsidLen, wifiPasswordLen);
-                break;
-            }
-
-            case 0x02: {  // SSID chunk
-                if (!wifiConfigInProgress) break;
-                uint8_t dataBytes = message.data_length_code - 2;
-                uint8_t remaining = wifiSsidLen - wifiSsidReceived;
-                if (dataBytes > remaining) dataBytes = remaining;
-                if (wifiSsidReceived + dataBytes <= 32) {
-                    memcpy(wifiSsidBuffer + wifiSsidReceived, &message.data[2], dataBytes);
-                    wifiSsidReceived += dataBytes;
-                }
-                break;
-            }
-
-            case 0x03: {  // Password chunk
-                if (!wifiConfigInProgress) break;
-                uint8_t dataBytes = message.data_length_code - 2;
-                uint8_t remaining = wifiPasswordLen - wifiPasswordReceived;
-                if (dataBytes > remaining) dataBytes = remaining;
-                if (wifiPasswordReceived + dataBytes <= 63) {
-                    memcpy(wifiPasswordBuffer + wifiPasswordReceived, &message.data[2], dataBytes);
-                    wifiPasswordReceived += dataBytes;
-                }
-                break;
-            }
+    void initialize()
+    {
+        // Show CAN configuration
+        debugf("[CAN] Initializing with TX=GPIO%d, RX=GPIO%d, Speed=500kbps\n", CAN_TX, CAN_RX);
 
-            case 0x04: {  // End message with checksum
-                if (!wifiConfigInProgress) break;
-                wifiConfigInProgress = false;
+        // Initialize configuration structures using macro initializers
+        twai_mode_t mode = CAN_MODE_NORMAL ? TWAI_MODE_NORMAL : TWAI_MODE_NO_ACK;
+        twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)CAN_TX, (gpio_num_t)CAN_RX, mode);
+        g_config.rx_queue_len = CAN_RX_QUEUE_LEN; // Hold bursts while the receive task is preempted
+        g_config.tx_queue_len = CAN_TX_QUEUE_LEN;
+        twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS(); // Look in the api-reference for other speed sets.
+        twai_filter_config_t f_config = buildAcceptanceFilter();
 
-                uint8_t checksum = 0;
-                for (uint8_t i = 0; i < wifiSsidReceived; i++) checksum ^= wifiSsidBuffer[i];
-                for (uint8_t i = 0; i < wifiPasswordReceived; i++) checksum ^= wifiPasswordBuffer[i];
+        trafficProfiler::initialize();
+        powerManager::initialize();
 
-                if (checksum == message.data[1] && wifiSsidReceived == wifiSsidLen && wifiPasswordReceived == wifiPasswordLen) {
-                    wifiSsidBuffer[wifiSsidReceived] = '\0';
-                    wifiPasswordBuffer[wifiPasswordReceived] = '\0';
-                    saveWifiCredentials((const char*)wifiSsidBuffer, (const char*)wifiPasswordBuffer);
-                } else {
-                    debugf("[WiFi] Config failed: checksum %s, SSID %d/%d bytes, Password %d/%d bytes\n",
-                           (checksum == message.data[1]) ? "OK" : "MISMATCH",
-                           wifiSsidReceived, wifiSsidLen, wifiPasswordReceived, wifiPasswordLen);
-                }
-                break;
-            }
+        // Install and start the TWAI driver with every health alert enabled; the supervisor
+        // retries with backoff if this fails and recovers from bus-off later on
+        debugln("[CAN] Installing driver...");
+        canSupervisor::begin(g_config, t_config, f_config);
+        if (driver_installed)
+        {
+            debugln("[CAN] ✓ CAN Bus fully initialized and ready to receive messages");
         }
     }
 
-    static void handle_rx_message(twai_message_t &message)
+    static void handle_rx_message(twai_message_t &message, uint32_t rxMicros)
     {
-        // Print message details
-        debugf("[CAN] >>> Message Received: ID=0x%03X, DLC=%d, Data=",
-               message.identifier, message.data_length_code);
-        for (int i = 0; i < message.data_length_code; i++) {
-            debugf("%02X ", message.data[i]);
-        }
-        debugln();
+        // Record message details (deferred; formatted by the log task)
+        log_event(LOG_CAN, LOG_DEBUG, "[CAN] >>> Message Received: ID=0x%03lX, DLC=%lu, Data=%08lX%08lX",
+                  message.identifier, message.data_length_code,
+                  ((uint32_t)message.data[0] << 24) | ((uint32_t)message.data[1] << 16) | ((uint32_t)message.data[2] << 8) | message.data[3],
+                  ((uint32_t)message.data[4] << 24) | ((uint32_t)message.data[5] << 16) | ((uint32_t)message.data[6] << 8) | message.data[7]);
 
-        // OTA trigger message (ID 0x0)
+        // OTA trigger message (ID 0x0); the update itself runs in the OTA task
         if (message.identifier == 0x0) {
-            debugln("[OTA] CAN trigger received");
-
-            // Get current device hostname
-            String currentHostName = otaUpdate.getHostName();
-
-            // Extract target hostname from CAN data
-            char targetHostName[14];
-            debugf("[OTA] Raw CAN data: %02X %02X %02X\n",
-                    message.data[0], message.data[1], message.data[2]);
-
-            sprintf(targetHostName, "esp32-%02X%02X%02X",
-                    message.data[0], message.data[1], message.data[2]);
-
-            debugf("[OTA] Target hostname:  '%s'\n", targetHostName);
-            debugf("[OTA] Current hostname: '%s'\n", currentHostName.c_str());
-
-            // Check if this OTA trigger is for this device
-            if (currentHostName.equals(targetHostName)) {
-                debugln("[OTA] ✓ Hostname matched - reading WiFi credentials from NVS");
-                Preferences prefs;
-                prefs.begin("wifi", true);  // read-only
-                String ssid = prefs.getString("ssid", "");
-                String password = prefs.getString("password", "");
-                prefs.end();
-
-                if (ssid.length() > 0 && password.length() > 0) {
-                    debugf("[OTA] Using stored WiFi credentials (SSID: %s)\n", ssid.c_str());
-                    OtaUpdate ota(180000, ssid.c_str(), password.c_str());
-                    ota.waitForOta();
-                    debugln("[OTA] OTA mode exited - resuming normal operation");
-                } else {
-                    debugln("[OTA] ERROR: No WiFi credentials in NVS - cannot start OTA");
-                }
-            } else {
-                debugln("[OTA] ✗ Hostname mismatch - ignoring OTA trigger");
-            }
+            otaHelper::handleTrigger(message);
             return;  // Don't forward OTA trigger messages via ESP-NOW
         }
 
-        // WiFi credential configuration message (ID 0x01)
-        if (message.identifier == 0x01) {
-            handleWifiConfigMessage(message);
-            return;  // Don't forward WiFi config messages via ESP-NOW
+        // Configuration transfer (Wi-Fi credentials, routing table) over ISO-TP, handled by the config task
+        if (!message.extd && configHelper::isConfigId(message.identifier)) {
+            configHelper::queueFrame(message);
+            return;  // Don't forward configuration frames via ESP-NOW
         }
 
-        // Forward regular CAN messages via ESP-NOW
-        outgoingMessage.identifier = message.identifier;
-        outgoingMessage.data_length_code = message.data_length_code;
-        if (message.data_length_code = 8)
-        {
-            outgoingMessage.dataByte7 = message.data[7];
-        }
-        else
-        {
-            outgoingMessage.dataByte7 = 0x0;
-        }
-        if (message.data_length_code = 7)
-        {
-            outgoingMessage.dataByte6 = message.data[6];
-        }
-        else
-        {
-            outgoingMessage.dataByte6 = 0x0;
-        }
-        if (message.data_length_code = 6)
-        {
-            outgoingMessage.dataByte5 = message.data[5];
-        }
-        else
+        // Drop what the hardware mask could not exclude
+        if (message.extd ? !FORWARD_EXTENDED_IDS : !acceptedIds.contains(message.identifier))
         {
-            outgoingMessage.dataByte5 = 0x0;
+            softwareFilteredCount++;
+            return;
         }
-        if (message.data_length_code = 5)
+
+        // Subscribed signals go out as compact updates instead of the raw frame
+        if (signalExtractor::handle(message, rxMicros) && !SIGNAL_FORWARD_RAW)
         {
-            outgoingMessage.dataByte4 = message.data[4];
+            return;
         }
-        else
+
+        // Hand regular CAN messages to the ESP-NOW transmit task, tagged with their ingest time
+        gateway_frame_t frame;
+        frame.message = message;
+        frame.rxMicros = rxMicros;
+        if (!canToEspNowRing.push(frame))
         {
-            outgoingMessage.dataByte4 = 0;
+            metricFramesDropped++;
         }
-        if (message.data_length_code = 4)
+    }
+
+    void checkCanBusForMessages()
+    {
+        // Check if alert happened
+        uint32_t alerts_triggered = 0;
+        canBus->readAlerts(&alerts_triggered, pdMS_TO_TICKS(POLLING_RATE_MS));
+
+        // Check if message is received
+        if (alerts_triggered & TWAI_ALERT_RX_DATA)
         {
-            outgoingMessage.dataByte3 = message.data[3];
+            twai_status_info_t status;
+            if (canBus->getStatus(&status) == ESP_OK)
+            {
+                canSupervisor::noteRxBacklog(status.msgs_to_rx);
+            }
+            log_event(LOG_CAN, LOG_DEBUG, "[CAN] *** RX DATA ALERT - Message(s) detected ***");
+            powerManager::noteActivity();
+            // One or more messages received. Handle all.
+            twai_message_t message;
+            while (canBus->receive(&message, 0) == ESP_OK)
+            {
+                uint32_t started = micros();
+                metricFramesIn++;
+                trafficProfiler::record(message, started);
+                blackBox::record(message, started);
+                handle_rx_message(message, started);
+                rxHandleTotalUs += micros() - started;
+                rxFramesHandled++;
+            }
+            if (espNowTxTaskHandle != NULL && (!canToEspNowRing.empty() || !signalRing.empty()))
+            {
+                xTaskNotifyGive(espNowTxTaskHandle);
+            }
         }
-        else
+
+        // Error states, bus-off recovery and queue overflows
+        canSupervisor::handleAlerts(alerts_triggered);
+    }
+
+#if CAN_BENCH
+    // Counters at the start of the current benchmark run; CAN receive task only
+    static latency_histogram_t benchStartHist;
+    static uint32_t benchStartHandled = 0;
+    static uint64_t benchStartHandleUs = 0;
+    static uint32_t benchStartOut = 0;
+    static uint32_t benchStartDropped = 0;
+    static uint32_t benchStartFiltered = 0;
+    static bool benchFinished = false;
+    static int64_t benchDrainedUs = 0;
+    static uint32_t benchDrainedMs = 0;
+
+    /**
+     * One [BENCH] line per run for tools/can_benchmark.py. Latencies are CAN
+     * ingest to radio handoff, as bucket upper bounds; max_us is the highest
+     * bucket this run reached. fps is handled frames over the time from the
+     * run start until the last frame left the ring (drain_ms), so a gateway
+     * that falls behind reports less than the offered rate. The heap figures
+     * and stack high-water marks cover everything since boot.
+     */
+    static void printBenchReport()
+    {
+        latency_histogram_t hist = queueWaitHist;
+        for (uint8_t i = 0; i < HIST_BUCKETS; i++)
         {
-            outgoingMessage.dataByte3 = 0x0;
+            hist.buckets[i] -= benchStartHist.buckets[i];
         }
-        if (message.data_length_code = 3)
+        hist.count -= benchStartHist.count;
+        hist.maxUs = metrics::percentile(hist, 1000);
+        uint32_t handled = rxFramesHandled - benchStartHandled;
+        uint64_t drainUs = (uint64_t)(benchDrainedUs - syntheticCanBus.startedUs());
+        uint32_t heapSize = ESP.getHeapSize();
+        uint32_t heapMinFree = ESP.getMinFreeHeap();
+        Serial.printf("[BENCH] rate=%lu seconds=%lu generated=%lu handled=%lu forwarded=%lu filtered=%lu fps=%lu "
+                      "drain_ms=%lu cpu_us_per_frame=%lu p50_us=%lu p99_us=%lu p999_us=%lu max_us=%lu overruns=%lu "
+                      "dropped=%lu ring_high_water=%lu ring_depth=%u heap_peak_used_boot=%lu heap_min_free_boot=%lu "
+                      "rx_stack_free=%lu tx_stack_free=%lu\n",
+                      (unsigned long)syntheticCanBus.rate, (unsigned long)syntheticCanBus.seconds,
+                      (unsigned long)syntheticCanBus.generated, (unsigned long)handled,
+                      (unsigned long)(metricFramesOut - benchStartOut),
+                      (unsigned long)(softwareFilteredCount - benchStartFiltered),
+                      (unsigned long)(drainUs ? (uint64_t)handled * 1000000 / drainUs : 0),
+                      (unsigned long)(drainUs / 1000),
+                      (unsigned long)(handled ? (rxHandleTotalUs - benchStartHandleUs) / handled : 0),
+                      (unsigned long)metrics::percentile(hist, 500), (unsigned long)metrics::percentile(hist, 990),
+                      (unsigned long)metrics::percentile(hist, 999), (unsigned long)hist.maxUs,
+                      (unsigned long)syntheticCanBus.overruns, (unsigned long)(metricFramesDropped - benchStartDropped),
+                      (unsigned long)canToEspNowRing.highWater(), (unsigned)canToEspNowRing.capacity(),
+                      (unsigned long)(heapSize - heapMinFree), (unsigned long)heapMinFree,
+                      (unsigned long)uxTaskGetStackHighWaterMark(NULL),
+                      (unsigned long)(espNowTxTaskHandle ? uxTaskGetStackHighWaterMark(espNowTxTaskHandle) : 0));
+    }
+
+    // CAN receive task: baseline the counters when a run starts, report once it has drained
+    static void serviceBenchmark()
+    {
+        if (syntheticCanBus.takeStarted())
         {
-            outgoingMessage.dataByte2 = message.data[2];
+            benchStartHist = queueWaitHist;
+            benchStartHandled = rxFramesHandled;
+            benchStartHandleUs = rxHandleTotalUs;
+            benchStartOut = metricFramesOut;
+            benchStartDropped = metricFramesDropped;
+            benchStartFiltered = softwareFilteredCount;
+            canToEspNowRing.resetHighWater();
+            benchFinished = false;
+            benchDrainedMs = 0;
         }
-        else
+        if (syntheticCanBus.takeFinished())
         {
-            outgoingMessage.dataByte2 = 0x0;
+            benchFinished = true;
         }
-        if (message.data_length_code = 2)
+        if (benchFinished && syntheticCanBus.backlog() == 0 && canToEspNowRing.empty())
         {
-            outgoingMessage.dataByte1 = message.data[1];
+            benchFinished = false;
+            benchDrainedUs = esp_timer_get_time();
+            benchDrainedMs = millis() | 1;
         }
-        else
+        if (benchDrainedMs != 0 && millis() - benchDrainedMs >= BENCH_SETTLE_MS)
         {
-            outgoingMessage.dataByte1 = 0x0;
+            benchDrainedMs = 0;
+            printBenchReport();
         }
-        if (message.data_length_code = 1)
+    }
+#endif
+
+    // Dedicated CAN receive task; keeps the TWAI RX queue drained independently of the radio
+    static void rxTask(void *parameter)
+    {
+        for (;;)
         {
-            outgoingMessage.dataByte0 = message.data[0];
+            if (driver_installed)
+            {
+                checkCanBusForMessages();
+            }
+            else
+            {
+                vTaskDelay(pdMS_TO_TICKS(POLLING_RATE_MS));
+            }
+            canSupervisor::service();
+#if CAN_BENCH
+            serviceBenchmark();
+#endif
+            trafficProfiler::service(millis());
+            powerManager::service((gpio_num_t)CAN_RX);
         }
-        else
+    }
+
+    void startRxTask()
+    {
+        xTaskCreatePinnedToCore(rxTask, "canRx", 4096, NULL, CAN_RX_TASK_PRIORITY, NULL, CAN_RX_TASK_CORE);
+    }
+
+    // Transmit frames received over ESP-NOW onto the CAN bus
+    static void txTask(void *parameter)
+    {
+        can_tx_request_t request;
+        for (;;)
         {
-            outgoingMessage.dataByte0 = 0;
+            if (xQueueReceive(espNowToCanQueue, &request, portMAX_DELAY) != pdTRUE)
+            {
+                continue;
+            }
+            if (!driver_installed ||
+                canBus->transmit(&request.message, pdMS_TO_TICKS(CAN_TX_TIMEOUT_MS)) != ESP_OK)
+            {
+                canTxFailed++;
+                continue;
+            }
+            uint32_t latency = micros() - request.receivedMicros;
+            canTxSent++;
+            canTxLatencyTotalUs += latency;
+            if (latency > canTxLatencyMaxUs)
+            {
+                canTxLatencyMaxUs = latency;
+            }
         }
-        newDataToSend = true;
-        espNowHelper::sendData();
     }
 
-    void checkCanBusForMessages()
+    void startTxTask()
     {
-        // Check if alert happened
-        uint32_t alerts_triggered;
-        twai_read_alerts(&alerts_triggered, pdMS_TO_TICKS(POLLING_RATE_MS));
-        twai_status_info_t twaistatus;
-        twai_get_status_info(&twaistatus);
+        espNowToCanQueue = xQueueCreate(ESPNOW_TO_CAN_QUEUE_DEPTH, sizeof(can_tx_request_t));
+        xTaskCreatePinnedToCore(txTask, "canTx", 4096, NULL, CAN_TX_TASK_PRIORITY, NULL, CAN_RX_TASK_CORE);
+    }
 
-        // Debug: Show CAN status periodically (every 100 loops)
-        static unsigned long loop_count = 0;
-        loop_count++;
-        if (loop_count % 100 == 0) {
-            debugf("[CAN] Status: RX errors=%lu, TX errors=%lu, RX queued=%lu\n",
-                   twaistatus.rx_error_counter, twaistatus.tx_error_counter, twaistatus.msgs_to_rx);
+    // Publish a stats snapshot over ESP-NOW and, if configured, on DIAG_CAN_ID; paused while the bus is idle
+    void publishStats()
+    {
+        if (powerManager::busIdle())
+        {
+            return;
         }
+        canEspNowWire::GatewayStats stats;
+        metrics::snapshot(stats);
+        espNowHelper::publishStats(stats);
 
-        // Check if message is received
-        if (alerts_triggered & TWAI_ALERT_RX_DATA)
+        if (DIAG_CAN_ID == 0 || !driver_installed)
         {
-            debugln("[CAN] *** RX DATA ALERT - Message(s) detected ***");
-            // One or more messages received. Handle all.
-            twai_message_t message;
-            while (twai_receive(&message, 0) == ESP_OK)
+            return;
+        }
+        uint8_t payload[canEspNowWire::STATS_LEN];
+        canEspNowWire::encodeStats(stats, payload);
+        twai_message_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.identifier = DIAG_CAN_ID;
+        for (uint8_t index = 0; index * 7 < sizeof(payload); index++)
+        {
+            size_t offset = index * 7;
+            size_t chunk = sizeof(payload) - offset < 7 ? sizeof(payload) - offset : 7;
+            frame.data[0] = index;
+            memcpy(&frame.data[1], payload + offset, chunk);
+            frame.data_length_code = 1 + chunk;
+            if (canBus->transmit(&frame, pdMS_TO_TICKS(CAN_TX_TIMEOUT_MS)) != ESP_OK)
             {
-                handle_rx_message(message);
+                log_event(LOG_CAN, LOG_WARN, "[CAN] Failed to publish stats frame %lu", index);
+                return;
             }
         }
+    }
 
-        // Debug: Check for other alerts
-        if (alerts_triggered & TWAI_ALERT_ERR_PASS) {
-            debugln("[CAN] WARNING: Error Passive state");
-        }
-        if (alerts_triggered & TWAI_ALERT_BUS_ERROR) {
-            debugln("[CAN] WARNING: Bus error detected");
-        }
-        if (alerts_triggered & TWAI_ALERT_RX_QUEUE_FULL) {
-            debugln("[CAN] WARNING: RX queue full - messages may be lost!");
-        }
+#if CAN_REPLAY
+    // Replay summary; printed regardless of DEBUG so tools/candump_replay.py can parse it
+    void printReplayReport()
+    {
+        static unsigned long lastMs = 0;
+        static uint32_t lastFrames = 0;
+        unsigned long now = millis();
+        uint32_t frames = rxFramesHandled;
+        Serial.printf("[REPLAY] frames=%lu fps=%lu cpu_us_per_frame=%lu parsed=%lu malformed=%lu "
+                      "filtered=%lu dropped=%lu air_frames=%lu air_packets=%lu air_bytes=%lu "
+                      "relayed=%lu relay_us_avg=%lu relay_us_max=%lu duplicates=%lu "
+                      "reliable=%lu retransmits=%lu recovered=%lu recovery_ms_avg=%lu recovery_ms_max=%lu "
+                      "reliable_lost=%lu air_lost=%lu\n",
+                      (unsigned long)frames,
+                      (unsigned long)(lastMs && now > lastMs ? (frames - lastFrames) * 1000UL / (now - lastMs) : 0),
+                      (unsigned long)(frames ? rxHandleTotalUs / frames : 0),
+#if CAN_BENCH
+                      (unsigned long)syntheticCanBus.generated, (unsigned long)syntheticCanBus.rejected,
+#else
+                      (unsigned long)replayCanBus.parsed, (unsigned long)replayCanBus.malformed,
+#endif
+                      (unsigned long)softwareFilteredCount, (unsigned long)canToEspNowRing.dropped(),
+                      (unsigned long)framesQueued, (unsigned long)dryRunRadioLink.packets,
+                      (unsigned long)dryRunRadioLink.bytes, (unsigned long)relayForwarded,
+                      (unsigned long)(relayForwarded ? relayLatencyTotalUs / relayForwarded : 0),
+                      (unsigned long)relayLatencyMaxUs, (unsigned long)relayDuplicates,
+                      (unsigned long)reliablePackets, (unsigned long)reliableRetransmits, (unsigned long)reliableRecovered,
+                      (unsigned long)(reliableRecovered ? reliableRecoveryTotalMs / reliableRecovered : 0),
+                      (unsigned long)reliableRecoveryMaxMs, (unsigned long)(reliableLost + reliableAbandoned),
+                      (unsigned long)dryRunRadioLink.lost);
+        lastMs = now;
+        lastFrames = frames;
+    }
+#endif
+
+    void printStatus()
+    {
+        twai_status_info_t twaistatus;
+        canBus->getStatus(&twaistatus);
+        debugf("[CAN] Status: RX errors=%lu, TX errors=%lu, RX queued=%lu\n",
+               (unsigned long)twaistatus.rx_error_counter, (unsigned long)twaistatus.tx_error_counter,
+               (unsigned long)twaistatus.msgs_to_rx);
+        canSupervisor::printStatus();
+        debugf("[CAN] Software filtered: %lu\n", (unsigned long)softwareFilteredCount);
+        configHelper::printStatus();
+        storeForward::printStatus();
+        blackBox::printStatus();
+        timeSync::printStatus();
+        signalExtractor::printStatus();
+        relay::printStatus();
+        snapshot::printStatus();
+        reliableDelivery::printStatus();
+        trafficProfiler::printStatus();
+        powerManager::printStatus();
+        debugf("[CAN] Forward ring: %lu/%u used, high water %lu, dropped %lu\n",
+               (unsigned long)canToEspNowRing.size(), (unsigned)canToEspNowRing.capacity(),
+               (unsigned long)canToEspNowRing.highWater(), (unsigned long)canToEspNowRing.dropped());
+        debugf("[ESPNOW] Batching: %lu frames in %lu packets, %lu signal packets\n", framesQueued, packetsSent, signalPacketsSent);
+        debugf("[ESPNOW->CAN] RX packets=%lu malformed=%lu duplicates=%lu rejected=%lu queue drops=%lu waiting=%lu ring drops=%lu\n",
+               (unsigned long)rxPackets, (unsigned long)rxMalformed, (unsigned long)rxDuplicates, (unsigned long)rxRejected,
+               (unsigned long)rxQueueDrops, (unsigned long)(espNowToCanQueue ? uxQueueMessagesWaiting(espNowToCanQueue) : 0),
+               (unsigned long)espNowRxRing.dropped());
+        debugf("[ESPNOW->CAN] Sent=%lu failed=%lu latency avg=%lu us max=%lu us\n",
+               (unsigned long)canTxSent, (unsigned long)canTxFailed,
+               (unsigned long)(canTxSent ? canTxLatencyTotalUs / canTxSent : 0), (unsigned long)canTxLatencyMaxUs);
+        txScheduler::printStatus();
     }
 }
\ No newline at end of file
@@ -0,0 +1,372 @@
+#pragma once
+#include "globals.h"
+#include "canBus.h"
+#include "metrics.h"
+#include "blackBox.h"
+#include <Preferences.h>
+
+// TWAI driver health: every alert is counted, bus-off is recovered with
+// twai_initiate_recovery(), and a driver that fails to install, start or
+// recover is torn down and reinstalled with exponential backoff. Runs on the
+// CAN receive task.
+//
+//   STOPPED --install+start--> RUNNING --BUS_OFF--> RECOVERING --BUS_RECOVERED+start--> RUNNING
+//      |  failure                                       | timeout or error
+//      +--------------------> RESTART_WAIT <------------+
+//                                 | backoff elapsed: reinstall
+//                                 +--> RUNNING, or back to RESTART_WAIT with twice the delay
+
+// Bus-off recovery needs 128 x 11 recessive bits; anything beyond this means the bus is held dominant
+#ifndef CAN_RECOVERY_TIMEOUT_MS
+#define CAN_RECOVERY_TIMEOUT_MS 2000
+#endif
+#ifndef CAN_RESTART_BACKOFF_MIN_MS
+#define CAN_RESTART_BACKOFF_MIN_MS 100
+#endif
+#ifndef CAN_RESTART_BACKOFF_MAX_MS
+#define CAN_RESTART_BACKOFF_MAX_MS 30000
+#endif
+// Driver state is also polled, in case a bus-off alert was missed
+#ifndef CAN_STATUS_POLL_MS
+#define CAN_STATUS_POLL_MS 1000
+#endif
+// RX queue sizing: twice the busiest backlog seen on earlier boots, from the configured length up to this
+#ifndef CAN_RX_QUEUE_MAX
+#define CAN_RX_QUEUE_MAX 256
+#endif
+// New RX queue high-water marks are written to NVS at most this often
+#ifndef CAN_HIGH_WATER_SAVE_MS
+#define CAN_HIGH_WATER_SAVE_MS 60000
+#endif
+
+// Everything except TX_IDLE and TX_SUCCESS, which fire on every transmitted frame
+#define CAN_SUPERVISED_ALERTS (TWAI_ALERT_RX_DATA | TWAI_ALERT_BELOW_ERR_WARN | TWAI_ALERT_ERR_ACTIVE |            \
+                               TWAI_ALERT_RECOVERY_IN_PROGRESS | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ARB_LOST | \
+                               TWAI_ALERT_ABOVE_ERR_WARN | TWAI_ALERT_BUS_ERROR | TWAI_ALERT_TX_FAILED |         \
+                               TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF |             \
+                               TWAI_ALERT_RX_FIFO_OVERRUN)
+
+typedef enum
+{
+    CAN_STATE_STOPPED,
+    CAN_STATE_RUNNING,
+    CAN_STATE_RECOVERING,
+    CAN_STATE_RESTART_WAIT,
+    CAN_STATE_SUSPENDED,  // Controller stopped for light sleep
+} can_state_t;
+
+static bool driver_installed = false;  // Driver installed and started; frames may be received and sent
+static can_state_t canState = CAN_STATE_STOPPED;
+static twai_general_config_t canGeneralConfig;
+static twai_timing_config_t canTimingConfig;
+static twai_filter_config_t canFilterConfig;
+
+static uint32_t canRestartBackoffMs = CAN_RESTART_BACKOFF_MIN_MS;
+static unsigned long canRestartAtMs = 0;
+static unsigned long canBusOffAtMs = 0;
+static bool canBusOffPending = false;  // Bus-off not yet recovered; time-to-recover runs until RUNNING
+static unsigned long canStatusPolledMs = 0;
+
+static uint32_t canRxHighWater = 0;       // This boot
+static uint32_t canRxHighWaterSaved = 0;  // Stored in NVS
+static unsigned long canRxHighWaterSavedMs = 0;
+
+static uint32_t canRestarts = 0;
+static uint32_t canErrorWarnings = 0;
+static uint32_t canErrorPassive = 0;
+static uint32_t canBusErrors = 0;
+static uint32_t canArbitrationLost = 0;
+static uint32_t canTxFailedAlerts = 0;
+static uint32_t canRxQueueFull = 0;
+static uint32_t canRxOverruns = 0;
+
+namespace canSupervisor
+{
+    static const char *stateName(can_state_t state)
+    {
+        switch (state)
+        {
+            case CAN_STATE_RUNNING: return "running";
+            case CAN_STATE_RECOVERING: return "recovering from bus-off";
+            case CAN_STATE_RESTART_WAIT: return "waiting to restart";
+            case CAN_STATE_SUSPENDED: return "suspended";
+            default: return "stopped";
+        }
+    }
+
+    // Configured queue length, doubled until it covers twice the saved high-water mark
+    static uint32_t sizeRxQueue(uint32_t configured, uint32_t highWater)
+    {
+        uint32_t length = configured;
+        while (length < highWater * 2 && length < CAN_RX_QUEUE_MAX)
+        {
+            length *= 2;
+        }
+        return length < CAN_RX_QUEUE_MAX ? length : CAN_RX_QUEUE_MAX;
+    }
+
+    static bool startDriver()
+    {
+        if (canBus->install(canGeneralConfig, canTimingConfig, canFilterConfig) != ESP_OK)
+        {
+            debugln("[CAN] ✗ ERROR: Failed to install driver - check GPIO pins!");
+            return false;
+        }
+        if (canBus->start() != ESP_OK)
+        {
+            debugln("[CAN] ✗ ERROR: Failed to start driver");
+            canBus->uninstall();
+            return false;
+        }
+        driver_installed = true;
+        canState = CAN_STATE_RUNNING;
+        canRestartBackoffMs = CAN_RESTART_BACKOFF_MIN_MS;
+        canStatusPolledMs = millis();
+        return true;
+    }
+
+    // Tear the driver down and try again after the current backoff; message gets the delay in ms
+    static void scheduleRestart(const char *message)
+    {
+        driver_installed = false;
+        canBus->stop();
+        canBus->uninstall();
+        canState = CAN_STATE_RESTART_WAIT;
+        canRestartAtMs = millis() + canRestartBackoffMs;
+        log_event(LOG_CAN, LOG_ERROR, message, canRestartBackoffMs);
+        canRestartBackoffMs = canRestartBackoffMs * 2 < CAN_RESTART_BACKOFF_MAX_MS ? canRestartBackoffMs * 2 : CAN_RESTART_BACKOFF_MAX_MS;
+    }
+
+    static void noteRecovered()
+    {
+        if (!canBusOffPending)
+        {
+            return;
+        }
+        canBusOffPending = false;
+        uint32_t elapsed = millis() - canBusOffAtMs;
+        metricRecoveryLastMs = elapsed;
+        if (elapsed > metricRecoveryMaxMs)
+        {
+            metricRecoveryMaxMs = elapsed;
+        }
+        log_event(LOG_CAN, LOG_INFO, "[CAN] Bus-off recovered in %lu ms", elapsed);
+    }
+
+    static void enterBusOff()
+    {
+        metricBusOffEvents++;
+        canBusOffPending = true;
+        canBusOffAtMs = millis();
+        log_event(LOG_CAN, LOG_ERROR, "[CAN] Bus-off, starting recovery");
+        blackBox::trigger(BLACKBOX_TRIGGER_BUS_OFF);
+        if (canBus->initiateRecovery() != ESP_OK)
+        {
+            scheduleRestart("[CAN] Bus-off recovery refused, driver restart in %lu ms");
+            return;
+        }
+        canState = CAN_STATE_RECOVERING;
+    }
+
+    // Install and start the driver; on failure the receive task keeps retrying through service()
+    void begin(const twai_general_config_t &g_config, const twai_timing_config_t &t_config,
+               const twai_filter_config_t &f_config)
+    {
+        Preferences prefs;
+        prefs.begin("can", true);  // read-only
+        canRxHighWaterSaved = prefs.getUInt("rxHighWater", 0);
+        prefs.end();
+
+        canGeneralConfig = g_config;
+        canGeneralConfig.rx_queue_len = sizeRxQueue(g_config.rx_queue_len, canRxHighWaterSaved);
+        canGeneralConfig.alerts_enabled = CAN_SUPERVISED_ALERTS;
+        canTimingConfig = t_config;
+        canFilterConfig = f_config;
+        debugf("[CAN] RX queue length %lu (saved high water %lu)\n",
+               (unsigned long)canGeneralConfig.rx_queue_len, (unsigned long)canRxHighWaterSaved);
+
+        if (!startDriver())
+        {
+            scheduleRestart("[CAN] Initialization failed, driver restart in %lu ms");
+        }
+    }
+
+    // React to the alerts returned by readAlerts()
+    void handleAlerts(uint32_t alerts)
+    {
+        if (alerts & TWAI_ALERT_ABOVE_ERR_WARN)
+        {
+            canErrorWarnings++;
+            log_event(LOG_CAN, LOG_WARN, "[CAN] WARNING: Error counter above warning limit");
+        }
+        if (alerts & TWAI_ALERT_ERR_PASS)
+        {
+            canErrorPassive++;
+            log_event(LOG_CAN, LOG_WARN, "[CAN] WARNING: Error Passive state");
+            blackBox::trigger(BLACKBOX_TRIGGER_ERROR_PASSIVE);
+        }
+        if (alerts & (TWAI_ALERT_BELOW_ERR_WARN | TWAI_ALERT_ERR_ACTIVE))
+        {
+            log_event(LOG_CAN, LOG_INFO, "[CAN] Error counters back to normal");
+        }
+        if (alerts & TWAI_ALERT_BUS_ERROR)
+        {
+            canBusErrors++;
+            log_event(LOG_CAN, LOG_WARN, "[CAN] WARNING: Bus error detected");
+        }
+        if (alerts & TWAI_ALERT_ARB_LOST)
+        {
+            canArbitrationLost++;
+        }
+        if (alerts & TWAI_ALERT_TX_FAILED)
+        {
+            canTxFailedAlerts++;
+        }
+        if (alerts & TWAI_ALERT_RX_QUEUE_FULL)
+        {
+            canRxQueueFull++;
+            log_event(LOG_CAN, LOG_WARN, "[CAN] WARNING: RX queue full - messages may be lost!");
+        }
+        if (alerts & TWAI_ALERT_RX_FIFO_OVERRUN)
+        {
+            canRxOverruns++;
+            log_event(LOG_CAN, LOG_WARN, "[CAN] WARNING: RX FIFO overrun");
+        }
+        if ((alerts & TWAI_ALERT_BUS_OFF) && canState == CAN_STATE_RUNNING)
+        {
+            enterBusOff();
+        }
+        if ((alerts & TWAI_ALERT_BUS_RECOVERED) && canState == CAN_STATE_RECOVERING)
+        {
+            // Recovery leaves the controller stopped
+            if (canBus->start() == ESP_OK)
+            {
+                canState = CAN_STATE_RUNNING;
+                noteRecovered();
+            }
+            else
+            {
+                scheduleRestart("[CAN] Start after bus-off recovery failed, driver restart in %lu ms");
+            }
+        }
+    }
+
+    // Frames waiting in the driver when the receive task woke up
+    void noteRxBacklog(uint32_t waiting)
+    {
+        if (waiting > canRxHighWater)
+        {
+            canRxHighWater = waiting;
+        }
+    }
+
+    // Persist a new high-water mark so the next boot sizes the queue from it
+    static void saveHighWater(unsigned long now)
+    {
+        if (canRxHighWater > canRxHighWaterSaved && now - canRxHighWaterSavedMs >= CAN_HIGH_WATER_SAVE_MS)
+        {
+            Preferences prefs;
+            prefs.begin("can", false);  // read-write
+            prefs.putUInt("rxHighWater", canRxHighWater);
+            prefs.end();
+            canRxHighWaterSaved = canRxHighWater;
+            canRxHighWaterSavedMs = now;
+            log_event(LOG_CAN, LOG_INFO, "[CAN] RX queue high water %lu saved", canRxHighWater);
+        }
+    }
+
+    // Receive task, every iteration: restarts, recovery timeouts and missed bus-off
+    void service()
+    {
+        unsigned long now = millis();
+        saveHighWater(now);
+        switch (canState)
+        {
+            case CAN_STATE_RESTART_WAIT:
+                if ((long)(now - canRestartAtMs) >= 0)
+                {
+                    canRestarts++;
+                    if (startDriver())
+                    {
+                        log_event(LOG_CAN, LOG_INFO, "[CAN] Driver restarted");
+                        noteRecovered();
+                    }
+                    else
+                    {
+                        scheduleRestart("[CAN] Driver restart failed, next attempt in %lu ms");
+                    }
+                }
+                break;
+            case CAN_STATE_RECOVERING:
+                if (now - canBusOffAtMs >= CAN_RECOVERY_TIMEOUT_MS)
+                {
+                    scheduleRestart("[CAN] Bus-off recovery timed out, driver restart in %lu ms");
+                }
+                break;
+            case CAN_STATE_RUNNING:
+                if (now - canStatusPolledMs >= CAN_STATUS_POLL_MS)
+                {
+                    canStatusPolledMs = now;
+                    twai_status_info_t status;
+                    if (canBus->getStatus(&status) != ESP_OK)
+                    {
+                        scheduleRestart("[CAN] Driver not responding, restart in %lu ms");
+                    }
+                    else if (status.state == TWAI_STATE_BUS_OFF)
+                    {
+                        enterBusOff();
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    bool running()
+    {
+        return canState == CAN_STATE_RUNNING;
+    }
+
+    // Receive task: stop the controller before light sleep; false unless it was running
+    bool suspend()
+    {
+        if (canState != CAN_STATE_RUNNING || canBus->stop() != ESP_OK)
+        {
+            return false;
+        }
+        canState = CAN_STATE_SUSPENDED;
+        return true;
+    }
+
+    // Receive task: restart the controller after light sleep
+    void resume()
+    {
+        if (canState != CAN_STATE_SUSPENDED)
+        {
+            return;
+        }
+        if (canBus->start() == ESP_OK)
+        {
+            canState = CAN_STATE_RUNNING;
+            canStatusPolledMs = millis();
+        }
+        else
+        {
+            scheduleRestart("[CAN] Start after sleep failed, driver restart in %lu ms");
+        }
+    }
+
+    void printStatus()
+    {
+        debugf("[CAN] Driver %s: bus-off=%lu recovery last=%lu ms max=%lu ms restarts=%lu\n",
+               stateName(canState), (unsigned long)metricBusOffEvents, (unsigned long)metricRecoveryLastMs,
+               (unsigned long)metricRecoveryMaxMs, (unsigned long)canRestarts);
+        debugf("[CAN] Alerts: warning=%lu passive=%lu bus errors=%lu arb lost=%lu tx failed=%lu rx queue full=%lu overruns=%lu\n",
+               (unsigned long)canErrorWarnings, (unsigned long)canErrorPassive, (unsigned long)canBusErrors,
+               (unsigned long)canArbitrationLost, (unsigned long)canTxFailedAlerts, (unsigned long)canRxQueueFull,
+               (unsigned long)canRxOverruns);
+        debugf("[CAN] RX queue: length %lu, high water %lu (saved %lu)\n", (unsigned long)canGeneralConfig.rx_queue_len,
+               (unsigned long)canRxHighWater, (unsigned long)canRxHighWaterSaved);
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include "globals.h"
+#include "isoTp.h"
+#include "routingTable.h"
+#include "gatewayConfig.h"
+#include "trafficProfiler.h"
+#include "blackBox.h"
+#include <Preferences.h>
+
+/**
+ * Configuration messages carried over ISO-TP on the CONFIG_CAN_IDS.
+ * Byte 0 selects the blob, the rest is its payload:
+ *
+ *   CONFIG_WIFI     ssidLen (1..32), SSID, password (0..63 bytes, rest of message)
+ *   CONFIG_ROUTES   routing table blob (see routingTable::loadBlob)
+ *   CONFIG_PROFILE  no payload; broadcasts the traffic profile over ESP-NOW
+ *   CONFIG_BLACKBOX no payload; writes the black-box history to flash (status
+ *                   CONFIG_STATUS_INVALID without a blackbox partition)
+ *
+ * Every message is answered with a single frame {type | 0x40, status}
+ * on the request ID + ISOTP_RESPONSE_ID_OFFSET. CONFIG_PROFILE appends the
+ * bus load in permille and the number of profiled IDs (uint16 each, LE).
+ */
+#define CONFIG_WIFI 0x01
+#define CONFIG_ROUTES 0x02
+#define CONFIG_PROFILE 0x03
+#define CONFIG_BLACKBOX 0x04
+
+#define CONFIG_RESPONSE_FLAG 0x40
+
+#define CONFIG_STATUS_OK 0x00
+#define CONFIG_STATUS_INVALID 0x01
+#define CONFIG_STATUS_UNKNOWN_TYPE 0x02
+
+// Reassembly, flow control, NVS writes and responses run in their own task so
+// the CAN receive task only hands frames over
+#ifndef CONFIG_FRAME_RING_DEPTH
+#define CONFIG_FRAME_RING_DEPTH 32
+#endif
+#ifndef CONFIG_TASK_PRIORITY
+#define CONFIG_TASK_PRIORITY 2
+#endif
+#ifndef CONFIG_TASK_CORE
+#define CONFIG_TASK_CORE 0
+#endif
+
+// Frames on the config IDs: CAN receive task -> config task
+static FrameRing<twai_message_t, CONFIG_FRAME_RING_DEPTH> configFrames;
+static TaskHandle_t configTaskHandle = NULL;
+
+namespace configHelper
+{
+    bool isConfigId(uint32_t identifier)
+    {
+        for (size_t i = 0; i < sizeof(configCanIds) / sizeof(configCanIds[0]); i++)
+        {
+            if (identifier == configCanIds[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint8_t saveWifiCredentials(const uint8_t *data, size_t length)
+    {
+        if (length < 1)
+        {
+            return CONFIG_STATUS_INVALID;
+        }
+        uint8_t ssidLen = data[0];
+        if (ssidLen == 0 || ssidLen > 32 || 1 + (size_t)ssidLen > length || length - 1 - ssidLen > 63)
+        {
+            return CONFIG_STATUS_INVALID;
+        }
+        char ssid[33];
+        char password[64];
+        memcpy(ssid, data + 1, ssidLen);
+        ssid[ssidLen] = '\0';
+        size_t passwordLen = length - 1 - ssidLen;
+        memcpy(password, data + 1 + ssidLen, passwordLen);
+        password[passwordLen] = '\0';
+
+        Preferences prefs;
+        prefs.begin("wifi", false);  // read-write
+        prefs.putString("ssid", ssid);
+        prefs.putString("password", password);
+        prefs.end();
+        debugf("[WiFi] Credentials saved to NVS (SSID: %s)\n", ssid);
+        return CONFIG_STATUS_OK;
+    }
+
+    // ISO-TP handler: apply one configuration blob and acknowledge it
+    void handleMessage(uint32_t canId, const uint8_t *data, size_t length)
+    {
+        if (length < 1)
+        {
+            return;
+        }
+        uint8_t status;
+        switch (data[0])
+        {
+            case CONFIG_WIFI:
+                status = saveWifiCredentials(data + 1, length - 1);
+                break;
+            case CONFIG_ROUTES:
+                status = routingTable::update(data + 1, length - 1) ? CONFIG_STATUS_OK : CONFIG_STATUS_INVALID;
+                break;
+            case CONFIG_PROFILE:
+                trafficProfiler::requestBroadcast();
+                status = CONFIG_STATUS_OK;
+                break;
+            case CONFIG_BLACKBOX:
+                blackBox::trigger(BLACKBOX_TRIGGER_REQUEST);
+                status = blackBoxPartition != NULL ? CONFIG_STATUS_OK : CONFIG_STATUS_INVALID;
+                break;
+            default:
+                status = CONFIG_STATUS_UNKNOWN_TYPE;
+                break;
+        }
+        log_event(LOG_CAN, LOG_INFO, "[CONFIG] Type 0x%02lX (%lu bytes) from 0x%03lX: status %lu",
+                  data[0], length, canId, status);
+        uint8_t response[6] = {(uint8_t)(data[0] | CONFIG_RESPONSE_FLAG), status};
+        uint8_t responseLength = 2;
+        if (data[0] == CONFIG_PROFILE)
+        {
+            canEspNowWire::putU16(response + 2, (uint16_t)profileLoadPermille);
+            canEspNowWire::putU16(response + 4, profileUsed);
+            responseLength = 6;
+        }
+        isoTp::sendSingleFrame(canId, response, responseLength);
+    }
+
+    // CAN receive task: hand a frame on a config ID to the config task; never blocks
+    void queueFrame(const twai_message_t &message)
+    {
+        if (configFrames.push(message) && configTaskHandle != NULL)
+        {
+            xTaskNotifyGive(configTaskHandle);
+        }
+    }
+
+    static void configTask(void *parameter)
+    {
+        twai_message_t message;
+        for (;;)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            while (configFrames.pop(message))
+            {
+                isoTp::handleFrame(message);
+            }
+        }
+    }
+
+    void initialize()
+    {
+        isoTp::setHandler(handleMessage);
+    }
+
+    void startTask()
+    {
+        xTaskCreatePinnedToCore(configTask, "config", 4096, NULL, CONFIG_TASK_PRIORITY, &configTaskHandle, CONFIG_TASK_CORE);
+        if (!configFrames.empty())
+        {
+            xTaskNotifyGive(configTaskHandle);
+        }
+    }
+
+    void printStatus()
+    {
+        isoTp::printStatus();
+        if (configFrames.dropped() > 0)
+        {
+            debugf("[CONFIG] Frames dropped with the config task behind: %lu\n", (unsigned long)configFrames.dropped());
+        }
+    }
+}
@@ -1,30 +1,294 @@
 #pragma once
 #include "globals.h"
+#include "lastValueCache.h"
+#include "txScheduler.h"
+#include "radioLink.h"
+#include "metrics.h"
+#include "routingTable.h"
+#include "storeForward.h"
+#include "timeSync.h"
+#include "signalExtractor.h"
+#include "relay.h"
+#include "snapshot.h"
+#include "trafficProfiler.h"
+#include "powerManager.h"
+#include "reliableDelivery.h"
 
-esp_now_peer_info_t peerInfo;
+// Maximum time a partially filled batch may wait before it is sent
+#ifndef BATCH_FLUSH_DEADLINE_MS
+#define BATCH_FLUSH_DEADLINE_MS 10
+#endif
 
-esp_now_message_t incomingMessage;
+// ESP-NOW receive task (drains espNowRxRing)
+#ifndef ESPNOW_RX_TASK_PRIORITY
+#define ESPNOW_RX_TASK_PRIORITY 4
+#endif
+// Packets from the receive callback waiting for the receive task (power of two)
+#ifndef ESPNOW_RX_QUEUE_DEPTH
+#define ESPNOW_RX_QUEUE_DEPTH 8
+#endif
+// ESP-NOW transmit task (drains canToEspNowRing)
+#ifndef ESPNOW_TX_TASK_PRIORITY
+#define ESPNOW_TX_TASK_PRIORITY 4
+#endif
+#ifndef ESPNOW_TX_TASK_CORE
+#define ESPNOW_TX_TASK_CORE 0
+#endif
+// Packets handed to esp_now_send whose send callback has not fired yet.
+// Frames beyond this wait in the priority scheduler rather than in the WiFi driver.
+#ifndef ESPNOW_MAX_INFLIGHT
+#define ESPNOW_MAX_INFLIGHT 2
+#endif
+// Radio share while an OTA update is downloading: fewer ESP-NOW packets in flight
+// leaves airtime for the update; frames queue in the scheduler by priority meanwhile.
+#ifndef ESPNOW_MAX_INFLIGHT_DURING_OTA
+#define ESPNOW_MAX_INFLIGHT_DURING_OTA 1
+#endif
+// Assume a send callback was lost after this long
+#define ESPNOW_SEND_TIMEOUT_MS 100
+// Per-frame capture timestamps (FLAG_TIMESTAMPS) on forwarded packets
+#ifndef ESPNOW_FRAME_TIMESTAMPS
+#define ESPNOW_FRAME_TIMESTAMPS 1
+#endif
+#define BATCH_FLAGS ((ESPNOW_FRAME_TIMESTAMPS ? canEspNowWire::FLAG_TIMESTAMPS : 0) | RELAY_FLAGS)
+// Batches filled concurrently, one per distinct routing peer mask
+#ifndef ROUTE_MAX_BATCHES
+#define ROUTE_MAX_BATCHES 4
+#endif
 
-String success;
+// ESP-NOW -> CAN receive counters
+static uint32_t rxPackets = 0;
+static uint32_t rxMalformed = 0;
+static uint32_t rxRejected = 0;    // ID not in writableRanges
+static uint32_t rxQueueDrops = 0;  // espNowToCanQueue full
+static uint32_t rxDuplicates = 0;  // Dropped by relay::admit
+
+// Filled by the receive callback (WiFi task), drained by the ESP-NOW receive task
+static FrameRing<espnow_packet_t, ESPNOW_RX_QUEUE_DEPTH> espNowRxRing;
+static TaskHandle_t espNowRxTaskHandle = NULL;
+
+// Packet being filled for one set of receivers
+typedef struct
+{
+    uint8_t buffer[ESP_NOW_MAX_DATA_LEN];
+    canEspNowWire::PacketWriter writer;
+    unsigned long startedMs;
+    uint32_t baseUs;    // Ingest time of the first frame; timestamps are offsets from it
+    uint8_t peerMask;   // routingTable peers, or ROUTE_BROADCAST
+    bool urgent;        // Holds a PRIORITY_HIGH frame; send without waiting for the deadline
+    bool reliable;      // PACKET_RELIABLE batch: sequenced and retransmitted until acknowledged
+    uint32_t rxMicros[128];  // Ingest time of each frame in the batch (2-byte minimum record)
+} espnow_batch_t;
+
+// One batch per peer set, plus the reliable-class batch at RELIABLE_BATCH
+#define RELIABLE_BATCH ROUTE_MAX_BATCHES
+#define BATCH_COUNT (ROUTE_MAX_BATCHES + 1)
+static espnow_batch_t batches[BATCH_COUNT];
+
+// Send-call timestamps of packets awaiting their send callback (TX task -> WiFi task)
+static FrameRing<uint32_t, 16> sendStartedMicros;
+
+// Stats packet requested by publishStats(), sent by the transmit task
+static uint8_t statsPacket[canEspNowWire::HEADER_LEN + canEspNowWire::RELAY_LEN + canEspNowWire::STATS_LEN];
+static size_t statsPacketLength = 0;
+static std::atomic<bool> statsPacketPending{false};
+
+// Signal updates being batched (always broadcast)
+static uint8_t signalPacket[ESP_NOW_MAX_DATA_LEN];
+static canEspNowWire::PacketWriter signalWriter;
+static unsigned long signalStartedMs = 0;
+static uint32_t signalBaseUs = 0;
+static unsigned long signalPacketsSent = 0;
+
+// Snapshot reply packet being sent
+static uint8_t snapshotPacket[ESP_NOW_MAX_DATA_LEN];
+static uint8_t profilePacket[ESP_NOW_MAX_DATA_LEN];
+
+// Time sync packet, built and sent by the transmit task
+static uint8_t timeSyncPacket[canEspNowWire::HEADER_LEN + canEspNowWire::TIME_SYNC_LEN];
+
+// Stored-frame packet being replayed after an outage
+static uint8_t storedPacket[ESP_NOW_MAX_DATA_LEN];
+static unsigned long lastReplayMs = 0;
+static unsigned long lastProbeMs = 0;
+static unsigned long lastCanFrameMs = 0;  // Last frame handed over by the CAN receive task; flash erases wait for a quiet bus
+
+// Routing table generation the unicast batches were filled under
+static uint32_t batchRouteGeneration = 0;
+
+static std::atomic<uint8_t> packetsInFlight{0};
+static unsigned long lastSendMs = 0;
+
+// Throughput counters
+static unsigned long framesQueued = 0;
+static unsigned long packetsSent = 0;
 
 namespace espNowHelper
 {
-    // Callback when data is received
+    // Send callback and transmit task: one packet left the radio. Saturates at zero,
+    // since radioReady() may have cleared the count after a send timeout meanwhile.
+    static void releaseInFlight()
+    {
+        uint8_t inFlight = packetsInFlight.load();
+        while (inFlight > 0 && !packetsInFlight.compare_exchange_weak(inFlight, inFlight - 1))
+        {
+        }
+    }
+
+    static bool isWritable(const canEspNowWire::Frame &frame)
+    {
+        if (frame.extended)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(writableRanges) / sizeof(writableRanges[0]); i++)
+        {
+            if (frame.identifier >= writableRanges[i].firstId && frame.identifier <= writableRanges[i].lastId)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Callback when data is received (WiFi task context): copy the packet for the receive task
     void OnDataRecv(const uint8_t *mac, const uint8_t *incomingData, int len)
     {
-        memcpy(&incomingMessage, incomingData, sizeof(incomingMessage));
+        espnow_packet_t packet;
+        if (len <= 0 || len > ESP_NOW_MAX_DATA_LEN)
+        {
+            rxMalformed++;
+            return;
+        }
+        packet.rxMicros = micros();
+        memcpy(packet.mac, mac, 6);
+        packet.length = (uint8_t)len;
+        memcpy(packet.data, incomingData, len);
+        if (espNowRxRing.push(packet) && espNowRxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowRxTaskHandle);
+        }
+    }
+
+    // Receive task: drop duplicates, relay, then validate and queue frames for the CAN bus
+    static void handlePacket(const espnow_packet_t &packet)
+    {
+        uint32_t now = packet.rxMicros;
+        canEspNowWire::PacketReader reader;
+        if (!reader.begin(packet.data, packet.length))
+        {
+            rxMalformed++;
+            return;
+        }
+        if (!relay::admit(packet, reader))
+        {
+            rxDuplicates++;
+            return;
+        }
+        if (reader.type() == canEspNowWire::PACKET_TIME_REPLY)
+        {
+            timeSync::handleReply(packet.mac, reader.payload(), reader.payloadLength(), now);
+            return;
+        }
+        if (reader.type() == canEspNowWire::PACKET_SNAPSHOT_REQUEST)
+        {
+            if (!snapshot::queueRequest(packet.mac, reader))
+            {
+                rxMalformed++;
+            }
+            return;
+        }
+        if (reader.type() == canEspNowWire::PACKET_ACK)
+        {
+            if (!reliableDelivery::queueAck(packet.mac, reader))
+            {
+                rxMalformed++;
+            }
+            return;
+        }
+        if (reader.type() == canEspNowWire::PACKET_PROFILE_REQUEST)
+        {
+            trafficProfiler::queueRequest(packet.mac);
+            return;
+        }
+        if (reader.type() != canEspNowWire::PACKET_FRAMES)
+        {
+            // Other gateways' stats and signal updates are only relayed
+            if (reader.type() != canEspNowWire::PACKET_STATS && reader.type() != canEspNowWire::PACKET_SIGNALS &&
+                reader.type() != canEspNowWire::PACKET_STORED && reader.type() != canEspNowWire::PACKET_PROFILE &&
+                reader.type() != canEspNowWire::PACKET_RELIABLE)
+            {
+                rxMalformed++;
+            }
+            return;
+        }
+        rxPackets++;
+
+        canEspNowWire::Frame frame;
+        uint8_t decoded = 0;
+        while (reader.next(frame))
+        {
+            decoded++;
+            if (!isWritable(frame))
+            {
+                rxRejected++;
+                continue;
+            }
+            can_tx_request_t request;
+            fromWireFrame(frame, request.message);
+            request.receivedMicros = now;
+            if (espNowToCanQueue == NULL || xQueueSend(espNowToCanQueue, &request, 0) != pdTRUE)
+            {
+                rxQueueDrops++;
+                continue;
+            }
+            // Only traffic bound for the bus keeps the gateway awake
+            powerManager::noteActivity();
+        }
+        if (decoded != reader.count())
+        {
+            rxMalformed++;
+        }
+    }
+
+    static void rxTask(void *parameter)
+    {
+        espnow_packet_t packet;
+        for (;;)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            while (espNowRxRing.pop(packet))
+            {
+                handlePacket(packet);
+            }
+        }
     }
 
-    // Callback when data is sent
+    // Callback when data is sent (WiFi task context)
     void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
     {
-        if (status == 0)
+        uint32_t now = micros();
+        if (status != ESP_NOW_SEND_SUCCESS)
         {
-            success = "Delivery Success :)";
+            metricSendFailures++;
         }
-        else
+        storeForward::noteSendResult(mac_addr, status == ESP_NOW_SEND_SUCCESS);
+
+        // Discard timestamps orphaned by a send timeout, then time this packet
+        uint32_t started;
+        while (sendStartedMicros.size() > packetsInFlight.load() && sendStartedMicros.pop(started))
+        {
+        }
+        if (sendStartedMicros.pop(started))
+        {
+            metrics::record(sendCompleteHist, now - started);
+        }
+
+        releaseInFlight();
+        // Radio has room again; let the transmit task send waiting frames
+        if (espNowTxTaskHandle != NULL)
         {
-            success = "Delivery Fail :(";
+            xTaskNotifyGive(espNowTxTaskHandle);
         }
     }
 
@@ -33,49 +297,582 @@ namespace espNowHelper
         return esp_wifi_get_mac(WIFI_IF_STA, mac);
     }
 
-    void sendData()
+    bool batchPending()
+    {
+        for (uint8_t i = 0; i < BATCH_COUNT; i++)
+        {
+            if (!batches[i].writer.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool radioReady()
     {
-        for (int i = 0; i < outgoingMessage.data_length_code; i++)
-        {           
-            uint8_t address = *(&outgoingMessage.dataByte0 + i);
+        if (radioAsleep.load())
+        {
+            return false;
         }
-        esp_err_t result = esp_now_send(broadcastAddress, (uint8_t *)&outgoingMessage, sizeof(outgoingMessage));
+        if (packetsInFlight.load() > 0 && millis() - lastSendMs > ESPNOW_SEND_TIMEOUT_MS)
+        {
+            packetsInFlight = 0;
+        }
+        uint8_t limit = otaInProgress ? ESPNOW_MAX_INFLIGHT_DURING_OTA : ESPNOW_MAX_INFLIGHT;
+        return packetsInFlight.load() < limit;
+    }
+
+    // Hand one packet to the radio, tracking it until its send callback
+    static esp_err_t sendPacket(const uint8_t *mac, const uint8_t *data, size_t length)
+    {
+        // Count the packet in flight before sending; the send callback may run before send() returns
+        uint32_t started = micros();
+        packetsInFlight++;
+        sendStartedMicros.push(started);
+        lastSendMs = millis();
+        esp_err_t result = radioLink->send(mac, data, length);
+        metrics::record(sendCallHist, micros() - started);
         if (result == ESP_OK)
         {
-            debugln("Sent with success");
+            packetsSent++;
+        }
+        else
+        {
+            releaseInFlight();
+            metricSendFailures++;
+            storeForward::noteSendResult(mac, false);
+        }
+        return result;
+    }
+
+    // Send one encoded packet to every peer in a routing mask; ESP_OK if any peer took it
+    static esp_err_t sendToPeers(uint8_t peerMask, const uint8_t *data, size_t length)
+    {
+        if (peerMask == ROUTE_BROADCAST)
+        {
+            return sendPacket(broadcastAddress, data, length);
+        }
+        esp_err_t result = ESP_FAIL;
+        uint8_t mac[6];
+        for (uint8_t peer = 0; peer < ROUTE_MAX_PEERS; peer++)
+        {
+            if ((peerMask & (1 << peer)) && routingTable::peerAddress(peer, mac) &&
+                sendPacket(mac, data, length) == ESP_OK)
+            {
+                result = ESP_OK;
+            }
+        }
+        return result;
+    }
+
+    // Start an empty packet in a batch
+    static void resetBatch(espnow_batch_t &batch)
+    {
+        batch.writer.begin(batch.buffer, sizeof(batch.buffer),
+                           batch.reliable ? canEspNowWire::PACKET_RELIABLE : canEspNowWire::PACKET_FRAMES, true, BATCH_FLAGS);
+        batch.urgent = false;
+    }
+
+    // Send a batch (if not empty) as one ESP-NOW packet, encoded once and unicast to each of its peers
+    void flushBatch(espnow_batch_t &batch)
+    {
+        if (batch.writer.empty())
+        {
+            return;
+        }
+        uint8_t frames = batch.writer.count();
+        batch.writer.setBase(batch.baseUs);
+        size_t length = batch.writer.finish();
+        if (batch.reliable)
+        {
+            reliableDelivery::track(batch.buffer, length);
+        }
+        relay::stamp(batch.buffer);
+        uint32_t handedOff = micros();
+        // Frames count as out once any receiver was handed the packet
+        esp_err_t result = sendToPeers(batch.peerMask, batch.buffer, length);
+        if (result == ESP_OK)
+        {
+            metricFramesOut += frames;
+            powerManager::noteForwarded();
+            for (uint8_t i = 0; i < frames; i++)
+            {
+                metrics::record(queueWaitHist, handedOff - batch.rxMicros[i]);
+            }
+        }
+        else
+        {
+            metricFramesDropped += frames;
+            log_event(LOG_ESPNOW, LOG_WARN, "[ESPNOW] Error sending the data (%lu frames, peers=0x%02lX, err=0x%lX)",
+                      frames, batch.peerMask, result);
+        }
+        resetBatch(batch);
+    }
+
+    // Batch collecting frames for a peer mask; takes a free batch or flushes the oldest one
+    static espnow_batch_t &batchFor(uint8_t peerMask)
+    {
+        espnow_batch_t *oldest = &batches[0];
+        espnow_batch_t *unused = NULL;
+        for (uint8_t i = 0; i < ROUTE_MAX_BATCHES; i++)
+        {
+            espnow_batch_t &batch = batches[i];
+            if (batch.writer.empty())
+            {
+                if (unused == NULL)
+                {
+                    unused = &batch;
+                }
+                continue;
+            }
+            if (batch.peerMask == peerMask)
+            {
+                return batch;
+            }
+            if (oldest->writer.empty() || (long)(batch.startedMs - oldest->startedMs) < 0)
+            {
+                oldest = &batch;
+            }
+        }
+        if (unused == NULL)
+        {
+            flushBatch(*oldest);
+            unused = oldest;
+        }
+        unused->peerMask = peerMask;
+        return *unused;
+    }
+
+    // Queue a stats packet for the transmit task; ignored while the previous one is unsent
+    void publishStats(const canEspNowWire::GatewayStats &stats)
+    {
+        if (statsPacketPending.load())
+        {
+            return;
+        }
+        size_t offset = canEspNowWire::HEADER_LEN + canEspNowWire::relayLength(RELAY_FLAGS);
+        canEspNowWire::writeHeader(statsPacket, canEspNowWire::PACKET_STATS, RELAY_FLAGS, 1);
+        canEspNowWire::encodeStats(stats, statsPacket + offset);
+        statsPacketLength = offset + canEspNowWire::STATS_LEN;
+        statsPacketPending = true;
+        if (espNowTxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowTxTaskHandle);
+        }
+    }
+
+    // millis() at which a frame ingested at rxMicros was received
+    static uint32_t captureMillis(uint32_t rxMicros)
+    {
+        return millis() - (micros() - rxMicros) / 1000;
+    }
+
+    // Append a frame to the batch for its receivers, sending that batch once the packet is full.
+    // Receivers that are down get the frame through the store instead.
+    void queueFrame(const gateway_frame_t &queued, uint8_t priority)
+    {
+        canEspNowWire::Frame frame;
+        toWireFrame(queued.message, frame);
+        bool reliable = reliableDelivery::isReliable(queued.message);
+        uint8_t peerMask = reliable ? ROUTE_BROADCAST : routingTable::lookup(queued.message.identifier, queued.message.extd);
+        uint8_t down = peerMask & storeForward::downPeers();
+        if (down != 0)
+        {
+            storeForward::store(frame, captureMillis(queued.rxMicros), down);
+            peerMask &= ~down;
+            if (peerMask == 0)
+            {
+                return;  // Every receiver is down; an empty mask would mean broadcast
+            }
+        }
+        espnow_batch_t &batch = reliable ? batches[RELIABLE_BATCH] : batchFor(peerMask);
+
+        // Scheduler order is by priority, not time: start a new packet if the offset would not fit
+        int32_t offset = (int32_t)(queued.rxMicros - batch.baseUs);
+        if (!batch.writer.empty() && (offset < INT16_MIN || offset > INT16_MAX))
+        {
+            flushBatch(batch);
+        }
+        if (batch.writer.empty())
+        {
+            batch.startedMs = millis();
+            batch.baseUs = queued.rxMicros;
+        }
+        frame.offset = (int32_t)(queued.rxMicros - batch.baseUs);
+        if (!batch.writer.append(frame))
+        {
+            // Packet full: send it and start the next one with this frame
+            flushBatch(batch);
+            batch.startedMs = millis();
+            batch.baseUs = queued.rxMicros;
+            frame.offset = 0;
+            batch.writer.append(frame);
+        }
+        batch.rxMicros[batch.writer.count() - 1] = queued.rxMicros;
+        batch.urgent |= (priority == PRIORITY_HIGH);
+        framesQueued++;
+    }
+
+    // Broadcast the pending signal updates as one PACKET_SIGNALS packet
+    void flushSignals()
+    {
+        if (signalWriter.empty())
+        {
+            return;
+        }
+        signalWriter.setBase(signalBaseUs);
+        size_t length = signalWriter.finish();
+        relay::stamp(signalPacket);
+        if (sendPacket(broadcastAddress, signalPacket, length) == ESP_OK)
+        {
+            signalPacketsSent++;
+            powerManager::noteForwarded();
         }
         else
         {
-            debugln("Error sending the data");
+            log_event(LOG_ESPNOW, LOG_WARN, "[ESPNOW] Error sending %lu signal updates", signalWriter.count());
+        }
+        signalWriter.begin(signalPacket, sizeof(signalPacket), canEspNowWire::PACKET_SIGNALS, true, BATCH_FLAGS);
+    }
+
+    void queueSignal(const signal_update_t &queued)
+    {
+        canEspNowWire::SignalUpdate update;
+        update.index = queued.index;
+        update.raw = queued.raw;
+        int32_t offset = (int32_t)(queued.rxMicros - signalBaseUs);
+        if (!signalWriter.empty() && (offset < INT16_MIN || offset > INT16_MAX))
+        {
+            flushSignals();
+        }
+        if (signalWriter.empty())
+        {
+            signalStartedMs = millis();
+            signalBaseUs = queued.rxMicros;
+        }
+        update.offset = (int32_t)(queued.rxMicros - signalBaseUs);
+        if (!signalWriter.append(update))
+        {
+            flushSignals();
+            signalStartedMs = millis();
+            signalBaseUs = queued.rxMicros;
+            update.offset = 0;
+            signalWriter.append(update);
+        }
+    }
+
+    // Send partially filled batches once they have waited BATCH_FLUSH_DEADLINE_MS or hold a high-priority frame
+    void flushIfDue()
+    {
+        unsigned long now = millis();
+        for (uint8_t i = 0; i < BATCH_COUNT && radioReady(); i++)
+        {
+            espnow_batch_t &batch = batches[i];
+            if (!batch.writer.empty() && (batch.urgent || now - batch.startedMs >= BATCH_FLUSH_DEADLINE_MS))
+            {
+                flushBatch(batch);
+            }
+        }
+    }
+
+    // The routing table changed: peer mask bits may now name other receivers, so frames
+    // waiting in unicast batches go back through the router instead of out to the old peers
+    static void rerouteBatches()
+    {
+        uint32_t generation = routingTable::generation();
+        if (generation == batchRouteGeneration)
+        {
+            return;
+        }
+        batchRouteGeneration = generation;
+        storeForward::routesChanged();
+        // Empty every stale batch first, so re-queuing cannot flush one to its old peers
+        static uint8_t pending[ROUTE_MAX_BATCHES][ESP_NOW_MAX_DATA_LEN];
+        static uint32_t pendingMicros[ROUTE_MAX_BATCHES][128];
+        size_t lengths[ROUTE_MAX_BATCHES] = {};
+        unsigned long oldestMs = millis();
+        for (uint8_t i = 0; i < ROUTE_MAX_BATCHES; i++)
+        {
+            espnow_batch_t &batch = batches[i];
+            if (!batch.writer.empty())
+            {
+                if ((long)(batch.startedMs - oldestMs) < 0)
+                {
+                    oldestMs = batch.startedMs;
+                }
+                lengths[i] = batch.writer.finish();
+                memcpy(pending[i], batch.buffer, lengths[i]);
+                memcpy(pendingMicros[i], batch.rxMicros, sizeof(pendingMicros[i]));
+                resetBatch(batch);
+            }
+        }
+        for (uint8_t i = 0; i < ROUTE_MAX_BATCHES; i++)
+        {
+            canEspNowWire::PacketReader reader;
+            canEspNowWire::Frame frame;
+            if (lengths[i] == 0 || !reader.begin(pending[i], lengths[i]))
+            {
+                continue;
+            }
+            for (uint8_t n = 0; reader.next(frame); n++)
+            {
+                gateway_frame_t queued;
+                fromWireFrame(frame, queued.message);
+                queued.rxMicros = pendingMicros[i][n];
+                queueFrame(queued, txScheduler::classify(queued.message));
+                framesQueued--;  // Already counted when first queued
+            }
+        }
+        // Re-queued frames keep their flush deadline
+        for (uint8_t i = 0; i < ROUTE_MAX_BATCHES; i++)
+        {
+            if (!batches[i].writer.empty() && (long)(oldestMs - batches[i].startedMs) < 0)
+            {
+                batches[i].startedMs = oldestMs;
+            }
+        }
+    }
+
+    // Peers went down: move the frames waiting for them in unicast batches into the store, and send
+    // the rest on to the batch's other peers. Broadcast and reliable batches are never stored.
+    static void stashBatches(uint8_t down)
+    {
+        for (uint8_t i = 0; i < ROUTE_MAX_BATCHES; i++)
+        {
+            espnow_batch_t &batch = batches[i];
+            uint8_t missed = batch.peerMask & down;
+            if (missed == 0 || batch.writer.empty())
+            {
+                continue;
+            }
+            size_t length = batch.writer.finish();
+            canEspNowWire::PacketReader reader;
+            canEspNowWire::Frame frame;
+            reader.begin(batch.buffer, length);
+            for (uint8_t n = 0; reader.next(frame); n++)
+            {
+                storeForward::store(frame, captureMillis(batch.rxMicros[n]), missed);
+            }
+            // finish() only fills in the header count, so the batch keeps filling for its other peers
+            batch.peerMask &= ~missed;
+            if (batch.peerMask == 0)
+            {
+                resetBatch(batch);
+            }
+        }
+    }
+
+    // Empty packet to each down peer; an acknowledged one ends that peer's outage
+    static void sendProbe(uint8_t down)
+    {
+        uint8_t probe[canEspNowWire::HEADER_LEN];
+        canEspNowWire::writeHeader(probe, canEspNowWire::PACKET_FRAMES, 0, 0);
+        uint8_t mac[6];
+        for (uint8_t peer = 0; peer < ROUTE_MAX_PEERS; peer++)
+        {
+            if ((down & (1 << peer)) && routingTable::peerAddress(peer, mac))
+            {
+                sendPacket(mac, probe, sizeof(probe));
+            }
         }
+        lastProbeMs = millis();
+    }
+
+    // Replay one packet of stored frames
+    static void replayStored()
+    {
+        uint8_t peerMask = ROUTE_BROADCAST;
+        size_t length = storeForward::buildPacket(storedPacket, sizeof(storedPacket), peerMask);
+        if (length == 0)
+        {
+            lastReplayMs = millis();
+            return;
+        }
+        relay::stamp(storedPacket);
+        if (sendToPeers(peerMask, storedPacket, length) == ESP_OK)
+        {
+            metricFramesOut += storedPacket[2];
+        }
+        lastReplayMs = millis();
+    }
+
+    // A snapshot or profile reply went out: once nothing else sends to its receiver, drop
+    // the receiver from ESP-NOW so one-off requesters do not fill the peer table
+    static void releaseReplyPeer(const uint8_t *mac)
+    {
+        if (memcmp(mac, broadcastAddress, 6) == 0 || routingTable::isPeer(mac) || snapshot::replyingTo(mac) ||
+            trafficProfiler::replyingTo(mac))
+        {
+            return;
+        }
+        radioLink->removePeer(mac);
+    }
+
+    // Move frames from the scheduler into batches while the radio has room, highest priority first
+    void serviceRadio()
+    {
+        // Relayed packets first; they have already spent one hop
+        espnow_packet_t relayed;
+        while (radioReady() && relayRing.pop(relayed))
+        {
+            if (sendPacket(broadcastAddress, relayed.data, relayed.length) == ESP_OK)
+            {
+                relay::noteForwarded(relayed);
+            }
+        }
+        // Reliable-class retransmissions before new traffic
+        uint8_t *retransmit;
+        size_t retransmitLength;
+        while (radioReady() && (retransmitLength = reliableDelivery::nextRetransmission(retransmit)) > 0)
+        {
+            relay::stamp(retransmit);
+            sendPacket(broadcastAddress, retransmit, retransmitLength);
+        }
+        if (statsPacketPending.load() && radioReady())
+        {
+            relay::stamp(statsPacket);
+            sendPacket(broadcastAddress, statsPacket, statsPacketLength);
+            statsPacketPending = false;
+        }
+        // No time sync while the bus is idle: nothing is being timestamped
+        if (timeSync::due() && radioReady() && !powerManager::busIdle())
+        {
+            sendPacket(broadcastAddress, timeSyncPacket, timeSync::buildSync(timeSyncPacket));
+        }
+        // Signal updates are broadcast, so unicast outages do not hold them back
+        if (!signalWriter.empty() && radioReady() && millis() - signalStartedMs >= BATCH_FLUSH_DEADLINE_MS)
+        {
+            flushSignals();
+        }
+
+        rerouteBatches();
+        // Outages are per peer: frames for down peers go to the store, everyone else stays live
+        uint8_t down = storeForward::downPeers();
+        if (down != 0)
+        {
+            stashBatches(down);
+            if (millis() - lastProbeMs >= SF_PROBE_INTERVAL_MS && radioReady())
+            {
+                sendProbe(down);
+            }
+        }
+
+        gateway_frame_t frame;
+        uint8_t priority;
+        while (radioReady() && txScheduler::dequeue(frame, priority))
+        {
+            queueFrame(frame, priority);
+        }
+        flushIfDue();
+
+        // Snapshot replies take one packet per interval, after live traffic
+        if (snapshot::due() && radioReady())
+        {
+            const uint8_t *destination;
+            size_t length = snapshot::buildPacket(snapshotPacket, sizeof(snapshotPacket), destination);
+            if (length > 0)
+            {
+                sendPacket(destination, snapshotPacket, length);
+                releaseReplyPeer(destination);
+            }
+        }
+        if (trafficProfiler::due() && radioReady())
+        {
+            const uint8_t *destination;
+            size_t length = trafficProfiler::buildPacket(profilePacket, sizeof(profilePacket), destination);
+            if (length > 0)
+            {
+                sendPacket(destination, profilePacket, length);
+                releaseReplyPeer(destination);
+            }
+        }
+
+        // Replay stored frames in the gaps of live traffic
+        if (storeForward::pending() && txScheduler::empty() && !batchPending() && radioReady() &&
+            millis() - lastReplayMs >= SF_REPLAY_INTERVAL_MS)
+        {
+            replayStored();
+        }
+    }
+
+    // One pass of the transmit task: take what the CAN receive task handed over, then send what is due
+    void service()
+    {
+        uint32_t now = millis();
+        signal_update_t update;
+        while (signalRing.pop(update))
+        {
+            queueSignal(update);
+        }
+        gateway_frame_t frame;
+        while (canToEspNowRing.pop(frame))
+        {
+            lastCanFrameMs = now;
+            if (lastValueCache::shouldForward(frame.message, now) && txScheduler::enqueue(frame, now))
+            {
+                lastValueCache::commit(frame.message, now);
+            }
+        }
+        serviceRadio();
+        storeForward::preErase(now, lastCanFrameMs);
+    }
+
+    // Drain frames handed over by the CAN receive task into ESP-NOW batches
+    static void txTask(void *parameter)
+    {
+        for (;;)
+        {
+            bool idle = !batchPending() && txScheduler::empty() && !statsPacketPending.load() && !storeForward::pending() &&
+                        storeForward::downPeers() == 0 && signalWriter.empty() && relayRing.empty() && !snapshot::pending() &&
+                        !trafficProfiler::pending() && !reliableDelivery::pending();
+            // Idle: wake anyway for the next time sync, and to erase store-and-forward sectors once the bus is quiet
+            TickType_t idleWait = storeForward::eraseWanted()                      ? pdMS_TO_TICKS(SF_ERASE_IDLE_MS)
+                                  : TIMESYNC_ENABLED && !powerManager::busIdle() ? pdMS_TO_TICKS(TIMESYNC_INTERVAL_MS)
+                                                                                 : portMAX_DELAY;
+            ulTaskNotifyTake(pdTRUE, idle ? idleWait : pdMS_TO_TICKS(BATCH_FLUSH_DEADLINE_MS));
+            service();
+        }
+    }
+
+    void startTxTask()
+    {
+        lastValueCache::initialize();
+        txScheduler::initialize();
+        storeForward::initialize();
+        signalWriter.begin(signalPacket, sizeof(signalPacket), canEspNowWire::PACKET_SIGNALS, true, BATCH_FLAGS);
+        reliableDelivery::initialize();
+        batches[RELIABLE_BATCH].reliable = true;
+        batches[RELIABLE_BATCH].peerMask = ROUTE_BROADCAST;
+        for (uint8_t i = 0; i < BATCH_COUNT; i++)
+        {
+            resetBatch(batches[i]);
+        }
+        xTaskCreatePinnedToCore(txTask, "espNowTx", 4096, NULL, ESPNOW_TX_TASK_PRIORITY,
+                                &espNowTxTaskHandle, ESPNOW_TX_TASK_CORE);
+        xTaskCreatePinnedToCore(rxTask, "espNowRx", 4096, NULL, ESPNOW_RX_TASK_PRIORITY,
+                                &espNowRxTaskHandle, ESPNOW_TX_TASK_CORE);
     }
 
     void initialize()
     {
-        WiFi.mode(WIFI_STA);
-        // Init ESP-NOW
-        if (esp_now_init() != ESP_OK)
+        // Init ESP-NOW and register for send (delivery status) and receive callbacks
+        if (radioLink->begin(OnDataRecv, OnDataSent) != ESP_OK)
         {
             Serial.println("Error initializing ESP-NOW");
             return;
         }
 
-        // Once ESPNow is successfully Init, we will register for Send CB to
-        // get the status of Trasnmitted packet
-        esp_now_register_send_cb(esp_now_send_cb_t(OnDataSent));
-
         // Register peer
-        memcpy(peerInfo.peer_addr, broadcastAddress, 6);
-        peerInfo.channel = 0;
-        peerInfo.encrypt = false;
-
-        // Add peer
-        if (esp_now_add_peer(&peerInfo) != ESP_OK)
+        if (radioLink->addPeer(broadcastAddress) != ESP_OK)
         {
             Serial.println("Failed to add peer");
             return;
         }
-        // Register for a callback function that will be called when data is received
-        esp_now_register_recv_cb(esp_now_recv_cb_t(OnDataRecv));
+        routingTable::initialize();
+
+        uint8_t mac[6];
+        getMacAddress(mac);
+        relay::initialize(mac);
     }
 }
\ No newline at end of file
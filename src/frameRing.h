@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * Lock-free single-producer / single-consumer ring buffer.
+ *
+ * One task may call push() and exactly one other task may call pop().
+ * Depth must be a power of two; head and tail run freely and are masked
+ * on access, so all Depth slots are usable.
+ */
+template <typename T, size_t Depth>
+class FrameRing
+{
+    static_assert(Depth >= 2 && (Depth & (Depth - 1)) == 0, "FrameRing depth must be a power of two");
+
+public:
+    // Producer side. Returns false (and counts a drop) when the ring is full.
+    bool push(const T &item)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (head - tail >= Depth)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots_[head & (Depth - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+
+        uint32_t used = head + 1 - tail;
+        if (used > highWater_.load(std::memory_order_relaxed))
+        {
+            highWater_.store(used, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side. Returns false when the ring is empty.
+    bool pop(T &item)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if (head == tail)
+        {
+            return false;
+        }
+        item = slots_[tail & (Depth - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    uint32_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint32_t highWater() const { return highWater_.load(std::memory_order_relaxed); }
+    // Producer side: restart the high-water mark from the current fill level
+    void resetHighWater() { highWater_.store(size(), std::memory_order_relaxed); }
+    static constexpr size_t capacity() { return Depth; }
+
+private:
+    T slots_[Depth];
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<uint32_t> highWater_{0};
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <stdint.h>
+
+// Site-specific forwarding configuration. Edit the tables below to match the
+// CAN IDs used on your trailer bus.
+
+// ============================================================================
+// TRANSMIT PRIORITY
+// ============================================================================
+
+#define PRIORITY_HIGH 0    // Safety-relevant (brake, breakaway); sent immediately
+#define PRIORITY_NORMAL 1  // Control and status
+#define PRIORITY_LOW 2     // Telemetry
+#define PRIORITY_CLASSES 3
+
+typedef struct
+{
+    uint32_t firstId;
+    uint32_t lastId;
+    uint8_t priority;
+} id_priority_range_t;
+
+// Standard IDs only; extended IDs and IDs outside every range are PRIORITY_LOW.
+// Mirrors CAN arbitration: lower IDs are more important.
+static const id_priority_range_t priorityRanges[] = {
+    {0x000, 0x0FF, PRIORITY_HIGH},
+    {0x100, 0x3FF, PRIORITY_NORMAL},
+    {0x400, 0x7FF, PRIORITY_LOW},
+};
+
+// ============================================================================
+// PER-ID RATE LIMITS (token bucket)
+// ============================================================================
+
+typedef struct
+{
+    uint32_t id;
+    uint16_t framesPerSecond;  /**< Refill rate; 0 disables limiting for the entry */
+    uint16_t burst;            /**< Bucket size in frames */
+} id_rate_limit_t;
+
+// Build with -D'RATE_LIMIT_TABLE={0x500, 10, 5}, ...' to replace this table
+#ifdef RATE_LIMIT_TABLE
+static const id_rate_limit_t rateLimits[] = {RATE_LIMIT_TABLE};
+#else
+static const id_rate_limit_t rateLimits[] = {
+    // {0x500, 10, 5},  // Example: cap ID 0x500 at 10 frames/s with bursts of 5
+    {0x000, 0, 0},
+};
+#endif
+
+// ============================================================================
+// FORWARDED IDS (TWAI acceptance filter + software ID set)
+// ============================================================================
+
+typedef struct
+{
+    uint32_t firstId;
+    uint32_t lastId;
+} id_range_t;
+
+// Standard IDs forwarded over ESP-NOW. The gateway's own control IDs (OTA
+// trigger 0x0, CONFIG_CAN_IDS) are always accepted in addition to these.
+static const id_range_t forwardRanges[] = {
+    {0x000, 0x7FF},
+};
+
+// Extended (29-bit) frames cannot be covered by the standard-ID hardware
+// filter; forwarding them keeps the TWAI filter at accept-all.
+#ifndef FORWARD_EXTENDED_IDS
+#define FORWARD_EXTENDED_IDS 1
+#endif
+
+// ============================================================================
+// RELIABLE DELIVERY
+// ============================================================================
+
+// Standard IDs sent as PACKET_RELIABLE: sequenced, acknowledged by receivers
+// and retransmitted when lost (see reliableDelivery.h). Always broadcast.
+// Every other ID stays best effort. Receivers must understand PACKET_RELIABLE
+// (lib/CanEspNowReceiver) to see these IDs, so the class is opt-in.
+// Build with -D'RELIABLE_RANGE_TABLE={0x000, 0x0FF}, ...' to replace this table
+#ifdef RELIABLE_RANGE_TABLE
+static const id_range_t reliableRanges[] = {RELIABLE_RANGE_TABLE};
+#else
+static const id_range_t reliableRanges[] = {
+    // {0x000, 0x0FF},  // Example: brake controller, breakaway and other PRIORITY_HIGH traffic
+    {1, 0},  // Placeholder matching no ID; remove once real ranges are listed
+};
+#endif
+
+// ============================================================================
+// CONFIGURATION (ISO-TP)
+// ============================================================================
+
+// Request IDs for configuration transfers (Wi-Fi credentials, routing table).
+// Each ID gets its own ISO-TP session; the gateway answers on ID + 0x08.
+// These IDs are consumed by the gateway and never forwarded.
+static const uint32_t configCanIds[] = {
+    0x01,
+};
+
+// ============================================================================
+// WRITABLE IDS (ESP-NOW -> CAN)
+// ============================================================================
+
+// Standard IDs that receivers may transmit onto the CAN bus through the
+// gateway. Frames for any other ID (and all extended frames) are rejected.
+// Build with -D'WRITABLE_RANGE_TABLE={0x200, 0x20F}, ...' to replace this table
+#ifdef WRITABLE_RANGE_TABLE
+static const id_range_t writableRanges[] = {WRITABLE_RANGE_TABLE};
+#else
+static const id_range_t writableRanges[] = {
+    // {0x200, 0x20F},  // Example: lighting commands from the in-vehicle display
+    {1, 0},  // Placeholder matching no ID; remove once real ranges are listed
+};
+#endif
+
+// TWAI_MODE_NORMAL acknowledges and retransmits like any other node; required
+// when other nodes must reliably receive frames bridged from ESP-NOW.
+#ifndef CAN_MODE_NORMAL
+#define CAN_MODE_NORMAL 0
+#endif
+
+// ============================================================================
+// DIAGNOSTICS
+// ============================================================================
+
+// Gateway health stats are published every STATS_PUBLISH_INTERVAL_MS as an
+// ESP-NOW PACKET_STATS packet (0 disables publishing). Set DIAG_CAN_ID to a
+// free ID on your bus to also send them on CAN as a sequence of frames
+// (byte 0 = frame index, bytes 1-7 = stats payload); 0 keeps the gateway off the bus.
+#ifndef DIAG_CAN_ID
+#define DIAG_CAN_ID 0
+#endif
+#ifndef STATS_PUBLISH_INTERVAL_MS
+#define STATS_PUBLISH_INTERVAL_MS 10000
+#endif
@@ -6,21 +6,78 @@
 #include <esp_now.h>
 #include "driver/twai.h"
 #include "debug.h"
+#include "logHelper.h"
+#include "frameRing.h"
+#include <CanEspNowWire.h>
 
-bool newDataToSend = false;
+// Replay candump logs streamed over Serial through the forwarding path instead of
+// using the TWAI controller; radio sends are counted instead of transmitted
+#ifndef CAN_REPLAY
+#define CAN_REPLAY 0
+#endif
+// Replay build variant that generates synthetic traffic for saturation benchmarks (see SyntheticCanBus)
+#ifndef CAN_BENCH
+#define CAN_BENCH 0
+#endif
+#if CAN_BENCH && !CAN_REPLAY
+#error "CAN_BENCH requires CAN_REPLAY=1"
+#endif
+// Desktop build (env:native, test/host): the ESP32 CAN and radio drivers are left out
+// and canBus/radioLink point at the in-memory HostCanBus and DryRunRadioLink
+#ifndef HOST_BUILD
+#define HOST_BUILD 0
+#endif
 
+// Depth of the CAN receive -> ESP-NOW transmit ring (power of two)
+#ifndef FRAME_RING_DEPTH
+#define FRAME_RING_DEPTH 128
+#endif
+
+// CAN frame tagged with its ingest time as it moves through the forwarding pipeline
+typedef struct
+{
+    twai_message_t message;
+    uint32_t rxMicros;
+} gateway_frame_t;
+
+// Frames received from CAN waiting to be forwarded over ESP-NOW.
+// Produced by the CAN receive task, consumed by the ESP-NOW transmit task.
+FrameRing<gateway_frame_t, FRAME_RING_DEPTH> canToEspNowRing;
+
+// ESP-NOW transmit task, notified by the CAN receive task when frames are queued
+TaskHandle_t espNowTxTaskHandle = NULL;
+
+// Set while a firmware update runs in the background OTA task
+std::atomic<bool> otaInProgress{false};
+
+// Frame received over ESP-NOW waiting to be transmitted on the CAN bus
 typedef struct
 {
-    uint32_t identifier;
-    uint8_t data_length_code; /**< Data length code max value of 8 */
-    byte dataByte0;
-    byte dataByte1;
-    byte dataByte2;
-    byte dataByte3;
-    byte dataByte4;
-    byte dataByte5;
-    byte dataByte6;
-    byte dataByte7;
-} esp_now_message_t;
-
-esp_now_message_t outgoingMessage;
\ No newline at end of file
+    twai_message_t message;
+    uint32_t receivedMicros;
+} can_tx_request_t;
+
+// Filled by the ESP-NOW receive callback, drained by the CAN transmit task
+QueueHandle_t espNowToCanQueue = NULL;
+
+// Convert a received TWAI frame to the shared wire representation
+inline void toWireFrame(const twai_message_t &message, canEspNowWire::Frame &frame)
+{
+    frame.identifier = message.identifier;
+    frame.extended = message.extd;
+    frame.rtr = message.rtr;
+    frame.dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+    memcpy(frame.data, message.data, frame.dlc);
+    frame.offset = 0;
+}
+
+// Convert a decoded wire frame to a TWAI frame for transmission
+inline void fromWireFrame(const canEspNowWire::Frame &frame, twai_message_t &message)
+{
+    memset(&message, 0, sizeof(message));
+    message.identifier = frame.identifier;
+    message.extd = frame.extended;
+    message.rtr = frame.rtr;
+    message.data_length_code = frame.dlc;
+    memcpy(message.data, frame.data, frame.dlc);
+}
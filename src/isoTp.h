@@ -0,0 +1,276 @@
+/**
+ * @file isoTp.h
+ * @brief ISO 15765-2 (ISO-TP) reassembly for configuration transfers over CAN
+ *
+ * Classic CAN, normal addressing. Each request CAN ID gets its own session
+ * from a fixed pool, so several tools (or several IDs) can transfer at once.
+ *
+ *   Single frame       0x0L   L = 1..7 payload bytes follow
+ *   First frame        0x1H LL  12-bit length (8..ISOTP_MAX_PAYLOAD), 6 bytes follow
+ *   Consecutive frame  0x2N   N = sequence number (1, 2, ... 15, 0, ...), 7 bytes follow
+ *   Flow control       0x3S BS STmin  S: 0 = continue, 1 = wait, 2 = overflow
+ *
+ * Flow control and responses are sent on the request ID + ISOTP_RESPONSE_ID_OFFSET.
+ * With the default block size 0 and STmin 0 the sender streams the whole
+ * transfer after a single flow control frame.
+ */
+
+#pragma once
+#include "globals.h"
+#include "canBus.h"
+
+#ifndef ISOTP_MAX_SESSIONS
+#define ISOTP_MAX_SESSIONS 4
+#endif
+// Largest reassembled message (ISO-TP allows up to 4095 on classic CAN)
+#ifndef ISOTP_MAX_PAYLOAD
+#define ISOTP_MAX_PAYLOAD 512
+#endif
+// Consecutive frames between flow control frames; 0 = no further flow control
+#ifndef ISOTP_BLOCK_SIZE
+#define ISOTP_BLOCK_SIZE 0
+#endif
+// Minimum gap the sender must leave between consecutive frames (ms, 0..127)
+#ifndef ISOTP_STMIN_MS
+#define ISOTP_STMIN_MS 0
+#endif
+// N_Cr: a session waiting longer than this for its next consecutive frame is abandoned
+#ifndef ISOTP_TIMEOUT_MS
+#define ISOTP_TIMEOUT_MS 1000
+#endif
+// How long to wait for room in the TWAI TX queue for flow control and responses
+#ifndef ISOTP_TX_TIMEOUT_MS
+#define ISOTP_TX_TIMEOUT_MS 20
+#endif
+#ifndef ISOTP_RESPONSE_ID_OFFSET
+#define ISOTP_RESPONSE_ID_OFFSET 0x08
+#endif
+
+#define ISOTP_PCI_SINGLE 0x0
+#define ISOTP_PCI_FIRST 0x1
+#define ISOTP_PCI_CONSECUTIVE 0x2
+#define ISOTP_PCI_FLOW_CONTROL 0x3
+
+#define ISOTP_FC_CONTINUE 0x0
+#define ISOTP_FC_OVERFLOW 0x2
+
+typedef struct
+{
+    bool active;
+    uint32_t canId;
+    uint16_t length;        // Announced payload length
+    uint16_t received;      // Bytes reassembled so far
+    uint8_t nextSequence;   // Expected consecutive frame sequence number
+    uint8_t blockRemaining; // Consecutive frames before the next flow control (block size > 0)
+    unsigned long lastFrameMs;
+    uint8_t buffer[ISOTP_MAX_PAYLOAD];
+} isotp_session_t;
+
+// Called with each complete message; runs in the config task (see configHelper.h)
+typedef void (*isotp_handler_t)(uint32_t canId, const uint8_t *data, size_t length);
+
+static isotp_session_t isoTpSessions[ISOTP_MAX_SESSIONS];
+static isotp_handler_t isoTpHandler = NULL;
+
+// Transfer counters
+static uint32_t isoTpMessages = 0;
+static uint32_t isoTpAborted = 0;   // Sequence errors, timeouts, overflows and pool exhaustion
+
+namespace isoTp
+{
+    void setHandler(isotp_handler_t handler)
+    {
+        isoTpHandler = handler;
+    }
+
+    static void sendFlowControl(uint32_t canId, uint8_t status)
+    {
+        twai_message_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.identifier = canId + ISOTP_RESPONSE_ID_OFFSET;
+        frame.data_length_code = 3;
+        frame.data[0] = (ISOTP_PCI_FLOW_CONTROL << 4) | status;
+        frame.data[1] = ISOTP_BLOCK_SIZE;
+        frame.data[2] = ISOTP_STMIN_MS;
+        if (canBus->transmit(&frame, pdMS_TO_TICKS(ISOTP_TX_TIMEOUT_MS)) != ESP_OK)
+        {
+            log_event(LOG_CAN, LOG_WARN, "[ISOTP] Failed to send flow control on 0x%03lX", frame.identifier);
+        }
+    }
+
+    // Reply to a request with a single frame (payload up to 7 bytes)
+    void sendSingleFrame(uint32_t requestId, const uint8_t *data, uint8_t length)
+    {
+        if (length > 7)
+        {
+            return;
+        }
+        twai_message_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.identifier = requestId + ISOTP_RESPONSE_ID_OFFSET;
+        frame.data_length_code = 1 + length;
+        frame.data[0] = (ISOTP_PCI_SINGLE << 4) | length;
+        memcpy(&frame.data[1], data, length);
+        if (canBus->transmit(&frame, pdMS_TO_TICKS(ISOTP_TX_TIMEOUT_MS)) != ESP_OK)
+        {
+            log_event(LOG_CAN, LOG_WARN, "[ISOTP] Failed to send response on 0x%03lX", frame.identifier);
+        }
+    }
+
+    static void deliver(uint32_t canId, const uint8_t *data, size_t length)
+    {
+        isoTpMessages++;
+        if (isoTpHandler != NULL)
+        {
+            isoTpHandler(canId, data, length);
+        }
+    }
+
+    // Session for a CAN ID; optionally claims a free (or timed-out) slot
+    static isotp_session_t *findSession(uint32_t canId, bool create, unsigned long now)
+    {
+        isotp_session_t *free = NULL;
+        for (uint8_t i = 0; i < ISOTP_MAX_SESSIONS; i++)
+        {
+            isotp_session_t &session = isoTpSessions[i];
+            if (session.active && now - session.lastFrameMs > ISOTP_TIMEOUT_MS)
+            {
+                session.active = false;
+                isoTpAborted++;
+                log_event(LOG_CAN, LOG_WARN, "[ISOTP] Session on 0x%03lX timed out at %lu/%lu bytes",
+                          session.canId, session.received, session.length);
+            }
+            if (session.active && session.canId == canId)
+            {
+                return &session;
+            }
+            if (!session.active && free == NULL)
+            {
+                free = &session;
+            }
+        }
+        return create ? free : NULL;
+    }
+
+    // Feed one frame received on an ISO-TP request ID
+    void handleFrame(const twai_message_t &message)
+    {
+        if (message.rtr || message.data_length_code == 0)
+        {
+            return;
+        }
+        unsigned long now = millis();
+        const uint8_t *data = message.data;
+        uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+
+        switch (data[0] >> 4)
+        {
+            case ISOTP_PCI_SINGLE:
+            {
+                uint8_t length = data[0] & 0x0F;
+                if (length == 0 || length > dlc - 1)
+                {
+                    return;
+                }
+                // A single frame supersedes any transfer in progress on this ID
+                isotp_session_t *session = findSession(message.identifier, false, now);
+                if (session != NULL)
+                {
+                    session->active = false;
+                    isoTpAborted++;
+                }
+                deliver(message.identifier, data + 1, length);
+                break;
+            }
+            case ISOTP_PCI_FIRST:
+            {
+                if (dlc < 8)
+                {
+                    return;
+                }
+                uint16_t length = ((data[0] & 0x0F) << 8) | data[1];
+                if (length < 8)
+                {
+                    return;
+                }
+                isotp_session_t *session = findSession(message.identifier, true, now);
+                if (session == NULL || length > ISOTP_MAX_PAYLOAD)
+                {
+                    isoTpAborted++;
+                    log_event(LOG_CAN, LOG_WARN, "[ISOTP] Rejected %lu byte transfer on 0x%03lX (free sessions: %lu)",
+                              length, message.identifier, session != NULL);
+                    sendFlowControl(message.identifier, ISOTP_FC_OVERFLOW);
+                    return;
+                }
+                // A repeated first frame restarts the session
+                session->active = true;
+                session->canId = message.identifier;
+                session->length = length;
+                memcpy(session->buffer, data + 2, 6);
+                session->received = 6;
+                session->nextSequence = 1;
+                session->blockRemaining = ISOTP_BLOCK_SIZE;
+                session->lastFrameMs = now;
+                sendFlowControl(message.identifier, ISOTP_FC_CONTINUE);
+                break;
+            }
+            case ISOTP_PCI_CONSECUTIVE:
+            {
+                isotp_session_t *session = findSession(message.identifier, false, now);
+                if (session == NULL)
+                {
+                    return;
+                }
+                if ((data[0] & 0x0F) != session->nextSequence)
+                {
+                    session->active = false;
+                    isoTpAborted++;
+                    log_event(LOG_CAN, LOG_WARN, "[ISOTP] Sequence error on 0x%03lX: got %lu, expected %lu",
+                              message.identifier, data[0] & 0x0F, session->nextSequence);
+                    return;
+                }
+                uint16_t chunk = session->length - session->received;
+                if (chunk > 7)
+                {
+                    chunk = 7;
+                }
+                if (chunk > dlc - 1)
+                {
+                    session->active = false;
+                    isoTpAborted++;
+                    return;
+                }
+                memcpy(session->buffer + session->received, data + 1, chunk);
+                session->received += chunk;
+                session->nextSequence = (session->nextSequence + 1) & 0x0F;
+                session->lastFrameMs = now;
+
+                if (session->received >= session->length)
+                {
+                    session->active = false;
+                    deliver(session->canId, session->buffer, session->length);
+                }
+                else if (ISOTP_BLOCK_SIZE > 0 && --session->blockRemaining == 0)
+                {
+                    session->blockRemaining = ISOTP_BLOCK_SIZE;
+                    sendFlowControl(message.identifier, ISOTP_FC_CONTINUE);
+                }
+                break;
+            }
+            default:
+                // Flow control frames are only expected by senders
+                break;
+        }
+    }
+
+    void printStatus()
+    {
+        uint8_t active = 0;
+        for (uint8_t i = 0; i < ISOTP_MAX_SESSIONS; i++)
+        {
+            active += isoTpSessions[i].active ? 1 : 0;
+        }
+        debugf("[ISOTP] Messages=%lu aborted=%lu active sessions=%u/%u\n",
+               (unsigned long)isoTpMessages, (unsigned long)isoTpAborted, active, ISOTP_MAX_SESSIONS);
+    }
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include "globals.h"
+
+// Change-only forwarding: a frame whose payload matches the last forwarded
+// value for its ID is suppressed until LVC_HEARTBEAT_MS has passed. The table
+// also holds the latest frame per ID for the snapshot service.
+#ifndef LVC_ENABLED
+#define LVC_ENABLED 1
+#endif
+// Table slots (power of two); keep the ID count well below this for short probe chains
+#ifndef LVC_CAPACITY
+#define LVC_CAPACITY 512
+#endif
+// Unchanged IDs are re-sent at this interval so receivers stay in sync
+#ifndef LVC_HEARTBEAT_MS
+#define LVC_HEARTBEAT_MS 1000
+#endif
+
+static_assert((LVC_CAPACITY & (LVC_CAPACITY - 1)) == 0, "LVC_CAPACITY must be a power of two");
+
+#define LVC_EMPTY_KEY 0xFFFFFFFF
+
+typedef struct
+{
+    uint32_t key;            /**< CAN ID, bit 31 set for extended IDs; LVC_EMPTY_KEY if unused */
+    uint32_t lastForwardMs;  /**< millis() of the last forwarded frame */
+    uint32_t forwarded;
+    uint32_t suppressed;
+    uint8_t dlc;
+    uint8_t rtr;
+    uint8_t data[8];
+} lvc_entry_t;
+
+static lvc_entry_t lvcTable[LVC_CAPACITY];
+static uint16_t lvcUsed = 0;
+static uint32_t lvcUntracked = 0;  // Frames forwarded because the table was full
+
+namespace lastValueCache
+{
+    static inline uint32_t keyFor(const twai_message_t &message)
+    {
+        return message.identifier | (message.extd ? 0x80000000 : 0);
+    }
+
+    void initialize()
+    {
+        for (uint16_t i = 0; i < LVC_CAPACITY; i++)
+        {
+            lvcTable[i].key = LVC_EMPTY_KEY;
+        }
+        lvcUsed = 0;
+    }
+
+    // Find the slot for a key, claiming an empty one if needed. NULL when the table is full.
+    static lvc_entry_t *findOrInsert(uint32_t key, bool &inserted)
+    {
+        uint32_t index = (key * 2654435761u) & (LVC_CAPACITY - 1);
+        inserted = false;
+        for (uint16_t probe = 0; probe < LVC_CAPACITY; probe++)
+        {
+            lvc_entry_t &entry = lvcTable[index];
+            if (entry.key == key)
+            {
+                return &entry;
+            }
+            if (entry.key == LVC_EMPTY_KEY)
+            {
+                // Keep the table at most 3/4 full so misses stay cheap
+                if (lvcUsed >= (LVC_CAPACITY * 3) / 4)
+                {
+                    return NULL;
+                }
+                memset(&entry, 0, sizeof(entry));
+                entry.key = key;
+                lvcUsed++;
+                inserted = true;
+                return &entry;
+            }
+            index = (index + 1) & (LVC_CAPACITY - 1);
+        }
+        return NULL;
+    }
+
+    static lvc_entry_t *lookup(uint32_t key)
+    {
+        uint32_t index = (key * 2654435761u) & (LVC_CAPACITY - 1);
+        for (uint16_t probe = 0; probe < LVC_CAPACITY; probe++)
+        {
+            lvc_entry_t &entry = lvcTable[index];
+            if (entry.key == key)
+            {
+                return &entry;
+            }
+            if (entry.key == LVC_EMPTY_KEY)
+            {
+                return NULL;
+            }
+            index = (index + 1) & (LVC_CAPACITY - 1);
+        }
+        return NULL;
+    }
+
+    // Look up a frame by ID without modifying the table
+    const lvc_entry_t *find(uint32_t identifier, bool extended)
+    {
+        return lookup(identifier | (extended ? 0x80000000 : 0));
+    }
+
+    // Decide whether a frame needs to go over the air. Nothing is recorded until
+    // commit(), so a frame the scheduler then drops does not suppress its successors.
+    bool shouldForward(const twai_message_t &message, uint32_t nowMs)
+    {
+        bool inserted;
+        lvc_entry_t *entry = findOrInsert(keyFor(message), inserted);
+        if (entry == NULL)
+        {
+            lvcUntracked++;
+            return true;
+        }
+
+        uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+        bool changed = entry->forwarded == 0 || entry->dlc != dlc || entry->rtr != message.rtr ||
+                       memcmp(entry->data, message.data, dlc) != 0;
+        if (LVC_ENABLED && !changed && nowMs - entry->lastForwardMs < LVC_HEARTBEAT_MS)
+        {
+            entry->suppressed++;
+            return false;
+        }
+        return true;
+    }
+
+    // The frame was accepted for transmission: it is now the value receivers have.
+    // Entries are only readable by the snapshot service once committed (forwarded > 0).
+    void commit(const twai_message_t &message, uint32_t nowMs)
+    {
+        lvc_entry_t *entry = lookup(keyFor(message));
+        if (entry == NULL)
+        {
+            return;
+        }
+        uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+        entry->dlc = dlc;
+        entry->rtr = message.rtr;
+        memcpy(entry->data, message.data, dlc);
+        entry->lastForwardMs = nowMs;
+        entry->forwarded++;
+    }
+
+    void printReport()
+    {
+        uint32_t forwarded = 0;
+        uint32_t suppressed = 0;
+        debugf("[LVC] %u IDs tracked, %lu untracked frames\n", lvcUsed, (unsigned long)lvcUntracked);
+        for (uint16_t i = 0; i < LVC_CAPACITY; i++)
+        {
+            const lvc_entry_t &entry = lvcTable[i];
+            if (entry.key == LVC_EMPTY_KEY)
+            {
+                continue;
+            }
+            forwarded += entry.forwarded;
+            suppressed += entry.suppressed;
+            debugf("[LVC]   ID=0x%03lX%s forwarded=%lu suppressed=%lu\n",
+                   (unsigned long)(entry.key & 0x1FFFFFFF), (entry.key & 0x80000000) ? "x" : "",
+                   (unsigned long)entry.forwarded, (unsigned long)entry.suppressed);
+        }
+        uint32_t total = forwarded + suppressed;
+        debugf("[LVC] Total forwarded=%lu suppressed=%lu (%lu%% airtime saved)\n",
+               (unsigned long)forwarded, (unsigned long)suppressed,
+               (unsigned long)(total ? (uint64_t)suppressed * 100 / total : 0));
+    }
+}
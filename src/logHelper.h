@@ -0,0 +1,164 @@
+/**
+ * @file logHelper.h
+ * @brief Deferred binary logging for the forwarding hot path
+ *
+ * log_event() stores a timestamp, the format string pointer and up to four
+ * 32-bit arguments in a RAM ring; a low-priority task formats and prints them
+ * later. Recording costs a level check, a short critical section and a
+ * 28-byte copy instead of blocking on the UART.
+ *
+ * Usage:
+ *   log_event(LOG_CAN, LOG_DEBUG, "[CAN] RX ID=0x%03lX DLC=%lu", id, dlc);
+ *   logHelper::setLevel(LOG_CAN, LOG_DEBUG);   // runtime, per category
+ *
+ * Arguments are stored as uint32_t: use 32-bit format specifiers and only
+ * pass string pointers to literals (the string is read when printed).
+ */
+
+#pragma once
+#include <Arduino.h>
+
+#ifndef LOG_ENABLED
+#define LOG_ENABLED 1
+#endif
+// Events buffered between the recording tasks and the drain task (power of two)
+#ifndef LOG_RING_DEPTH
+#define LOG_RING_DEPTH 256
+#endif
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_INFO
+#endif
+#ifndef LOG_TASK_PRIORITY
+#define LOG_TASK_PRIORITY 1
+#endif
+#ifndef LOG_TASK_CORE
+#define LOG_TASK_CORE 0
+#endif
+
+static_assert((LOG_RING_DEPTH & (LOG_RING_DEPTH - 1)) == 0, "LOG_RING_DEPTH must be a power of two");
+
+typedef enum
+{
+    LOG_CAN,
+    LOG_ESPNOW,
+    LOG_SCHED,
+    LOG_OTA,
+    LOG_WIFI,
+    LOG_CATEGORY_COUNT
+} log_category_t;
+
+typedef enum
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG
+} log_level_t;
+
+typedef struct
+{
+    uint32_t timestampUs;
+    const char *format;
+    uint32_t args[4];
+    uint8_t category;
+    uint8_t level;
+} log_event_t;
+
+static log_event_t logRing[LOG_RING_DEPTH];
+static uint32_t logHead = 0;  // Next slot to write (guarded by logMux)
+static uint32_t logTail = 0;  // Next slot to print (drain task only)
+static uint32_t logDropped = 0;
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint8_t logLevels[LOG_CATEGORY_COUNT] = {
+    LOG_LEVEL_DEFAULT, LOG_LEVEL_DEFAULT, LOG_LEVEL_DEFAULT, LOG_LEVEL_DEFAULT, LOG_LEVEL_DEFAULT};
+
+namespace logHelper
+{
+    void setLevel(log_category_t category, log_level_t level)
+    {
+        if (category < LOG_CATEGORY_COUNT)
+        {
+            logLevels[category] = level;
+        }
+    }
+
+    inline bool enabled(log_category_t category, log_level_t level)
+    {
+        return LOG_ENABLED && level <= logLevels[category];
+    }
+
+    // Safe from any task; drops (and counts) the event when the ring is full
+    void record(log_category_t category, log_level_t level, const char *format,
+                uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0)
+    {
+        uint32_t now = micros();
+        portENTER_CRITICAL(&logMux);
+        if (logHead - logTail >= LOG_RING_DEPTH)
+        {
+            logDropped++;
+            portEXIT_CRITICAL(&logMux);
+            return;
+        }
+        log_event_t &event = logRing[logHead & (LOG_RING_DEPTH - 1)];
+        event.timestampUs = now;
+        event.format = format;
+        event.args[0] = a0;
+        event.args[1] = a1;
+        event.args[2] = a2;
+        event.args[3] = a3;
+        event.category = category;
+        event.level = level;
+        logHead++;
+        portEXIT_CRITICAL(&logMux);
+    }
+
+    // Format and print everything recorded so far
+    void drain()
+    {
+        static uint32_t reportedDropped = 0;
+        for (;;)
+        {
+            portENTER_CRITICAL(&logMux);
+            bool empty = logTail == logHead;
+            log_event_t event;
+            if (!empty)
+            {
+                event = logRing[logTail & (LOG_RING_DEPTH - 1)];
+                logTail++;
+            }
+            portEXIT_CRITICAL(&logMux);
+            if (empty)
+            {
+                break;
+            }
+            Serial.printf("%lu.%06lu ", (unsigned long)(event.timestampUs / 1000000), (unsigned long)(event.timestampUs % 1000000));
+            Serial.printf(event.format, (unsigned long)event.args[0], (unsigned long)event.args[1],
+                          (unsigned long)event.args[2], (unsigned long)event.args[3]);
+            Serial.println();
+        }
+        if (logDropped != reportedDropped)
+        {
+            Serial.printf("[LOG] %lu events dropped\n", (unsigned long)(logDropped - reportedDropped));
+            reportedDropped = logDropped;
+        }
+    }
+
+    static void drainTask(void *parameter)
+    {
+        for (;;)
+        {
+            drain();
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+    }
+
+    void startTask()
+    {
+        xTaskCreatePinnedToCore(drainTask, "log", 3072, NULL, LOG_TASK_PRIORITY, NULL, LOG_TASK_CORE);
+    }
+}
+
+// Record an event if its category is enabled at this level; arguments are evaluated only then
+#define log_event(category, level, ...) do { \
+  if (logHelper::enabled(category, level)) { logHelper::record(category, level, __VA_ARGS__); } \
+} while(0)
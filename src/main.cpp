@@ -1,18 +1,27 @@
 #include "globals.h"
 #include "canHelper.h"
 #include "espNowHelper.h"
+#include "otaHelper.h"
+#include "blackBox.h"
 #include <OtaUpdate.h>
 #include <Preferences.h>
 
-// Create OTA update handler (3-minute timeout, 180000 ms)
-// Credentials are loaded from NVS when OTA is triggered; empty here for getHostName() only
-OtaUpdate otaUpdate(180000, "", "");
+// OTA handler used for getHostName() only; updates run in the background OTA task
+// with credentials loaded from NVS when triggered (see otaHelper.h)
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 115200
+#endif
 
 void setup()
 {
-  Serial.begin(115200);
+  Serial.begin(SERIAL_BAUD);
   delay(1000);  // Give serial time to initialize
 
+  // Drain deferred log events at low priority so hot paths never block on the UART
+  logHelper::startTask();
+
   debugln("\n=== TrailCurrent CAN-to-ESPNow Gateway ===");
   debugln("CAN to ESP-NOW Bridge with OTA Updates");
 
@@ -31,17 +40,58 @@ void setup()
   debugln("[ESPNOW] Initializing ESP-NOW...");
   espNowHelper::initialize();
 
+  // Configuration blobs (Wi-Fi credentials, routing table) arrive over ISO-TP
+  configHelper::initialize();
+
   delay(500);
   debugf("[WIFI] Connected: %s\n", WiFi.isConnected() ? "YES" : "NO");
   if (WiFi.isConnected()) {
     debugf("[WIFI] IP: %s\n", WiFi.localIP().toString().c_str());
   }
 
+  // Flight recorder fed by the CAN receive task; writes flash from its own low-priority task
+  blackBox::startTask();
+  // ISO-TP configuration transfers, fed by the CAN receive task
+  configHelper::startTask();
+  // Start the forwarding pipeline: CAN receive task -> ring -> ESP-NOW transmit task
+  espNowHelper::startTxTask();
+  canHelper::startRxTask();
+  // Reverse path: ESP-NOW receive callback -> queue -> CAN transmit task
+  canHelper::startTxTask();
+  // OTA waits in its own low-priority task so updates don't stall forwarding
+  otaHelper::startTask();
+
   debugln("=== Setup Complete ===\n");
 }
 
 void loop()
 {
-  canHelper::checkCanBusForMessages();
-  delay(10);
+  // Forwarding runs in its own tasks; loop() only handles periodic reporting
+  static unsigned long lastStatusMs = 0;
+  static unsigned long lastReportMs = 0;
+  static unsigned long lastStatsMs = 0;
+  unsigned long now = millis();
+
+  if (now - lastStatusMs >= 5000)
+  {
+    lastStatusMs = now;
+#if CAN_REPLAY
+    canHelper::printReplayReport();
+#endif
+    canHelper::printStatus();
+    otaHelper::sampleThroughput();
+  }
+  if (now - lastReportMs >= 60000)
+  {
+    lastReportMs = now;
+    lastValueCache::printReport();
+    metrics::printReport();
+    trafficProfiler::printReport();
+  }
+  if (STATS_PUBLISH_INTERVAL_MS > 0 && now - lastStatsMs >= STATS_PUBLISH_INTERVAL_MS)
+  {
+    lastStatsMs = now;
+    canHelper::publishStats();
+  }
+  delay(100);
 }
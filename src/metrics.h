@@ -0,0 +1,140 @@
+#pragma once
+#include "globals.h"
+#include "trafficProfiler.h"
+#include <esp_partition.h>
+
+// Pipeline latency histograms and health counters.
+// Each histogram has a single writer task; readers tolerate torn snapshots.
+
+// Bucket i holds samples below 2^(i+4) us (bucket 0: < 16 us); the last bucket is open-ended (~8 s+)
+#define HIST_BUCKETS 20
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t maxUs;
+} latency_histogram_t;
+
+static latency_histogram_t queueWaitHist;     // CAN ingest -> packet handed to the radio (per frame)
+static latency_histogram_t sendCallHist;      // Duration of the ESP-NOW send call (per packet)
+static latency_histogram_t sendCompleteHist;  // Send call -> send callback (per packet)
+
+// Counted from the CAN receive task, the ESP-NOW transmit task and the send callback on different cores
+static std::atomic<uint32_t> metricFramesIn{0};      // Frames received from CAN
+static std::atomic<uint32_t> metricFramesOut{0};     // Frames in packets accepted by the radio
+static std::atomic<uint32_t> metricFramesDropped{0}; // Frames lost to full rings, queues or rate limits
+static std::atomic<uint32_t> metricSendFailures{0};  // Send call errors plus failed send callbacks
+// Written by the CAN receive task only
+static uint32_t metricBusOffEvents = 0;
+static uint32_t metricRecoveryLastMs = 0;  // Bus-off until the driver runs again
+static uint32_t metricRecoveryMaxMs = 0;
+static uint32_t metricStatusFlags = 0;  // canEspNowWire::STATUS_*, set during setup
+
+namespace metrics
+{
+    inline void record(latency_histogram_t &hist, uint32_t us)
+    {
+        uint8_t bucket = 0;
+        if (us >= 16)
+        {
+            bucket = (uint8_t)(32 - __builtin_clz(us) - 4);
+            if (bucket >= HIST_BUCKETS)
+            {
+                bucket = HIST_BUCKETS - 1;
+            }
+        }
+        hist.buckets[bucket]++;
+        hist.count++;
+        if (us > hist.maxUs)
+        {
+            hist.maxUs = us;
+        }
+    }
+
+    // Upper bound of the bucket holding the given quantile in permille, e.g. 990 for p99
+    // (capped at the observed maximum)
+    uint32_t percentile(const latency_histogram_t &hist, uint16_t permille)
+    {
+        if (hist.count == 0)
+        {
+            return 0;
+        }
+        uint32_t target = (uint32_t)(((uint64_t)hist.count * permille + 999) / 1000);
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            seen += hist.buckets[i];
+            if (seen >= target)
+            {
+                uint32_t upper = (i == HIST_BUCKETS - 1) ? hist.maxUs : (1u << (i + 4));
+                return upper < hist.maxUs ? upper : hist.maxUs;
+            }
+        }
+        return hist.maxUs;
+    }
+
+    /**
+     * A feature's flash partition is missing. OTA only rewrites an app slot, so
+     * units updated over the air keep the table they were first flashed with;
+     * tables from before store-and-forward and the black box have a spiffs
+     * partition where storefwd and blackbox now live.
+     */
+    void notePartitionMissing(uint32_t flag)
+    {
+        metricStatusFlags |= flag;
+        if (!(metricStatusFlags & canEspNowWire::STATUS_LEGACY_PARTITIONS) &&
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL) != NULL)
+        {
+            metricStatusFlags |= canEspNowWire::STATUS_LEGACY_PARTITIONS;
+            debugln("[METRICS] WARNING: legacy partition table (spiffs) - flash partitions.csv over serial "
+                    "to enable store-and-forward and the black box");
+        }
+    }
+
+    void snapshot(canEspNowWire::GatewayStats &stats)
+    {
+        stats.uptimeMs = millis();
+        stats.framesIn = metricFramesIn;
+        stats.framesOut = metricFramesOut;
+        stats.framesDropped = metricFramesDropped;
+        stats.sendFailures = metricSendFailures;
+        stats.queueWaitP50Us = percentile(queueWaitHist, 500);
+        stats.queueWaitP99Us = percentile(queueWaitHist, 990);
+        stats.queueWaitMaxUs = queueWaitHist.maxUs;
+        stats.sendCallP50Us = percentile(sendCallHist, 500);
+        stats.sendCallP99Us = percentile(sendCallHist, 990);
+        stats.sendCallMaxUs = sendCallHist.maxUs;
+        stats.sendCompleteP50Us = percentile(sendCompleteHist, 500);
+        stats.sendCompleteP99Us = percentile(sendCompleteHist, 990);
+        stats.sendCompleteMaxUs = sendCompleteHist.maxUs;
+        stats.busOffEvents = metricBusOffEvents;
+        stats.recoveryLastMs = metricRecoveryLastMs;
+        stats.recoveryMaxMs = metricRecoveryMaxMs;
+        stats.busLoadPermille = profileLoadPermille;
+        stats.busLoadPeakPermille = profileLoadPeakPermille;
+        stats.statusFlags = metricStatusFlags;
+    }
+
+    void printHistogram(const char *name, const latency_histogram_t &hist)
+    {
+        debugf("[METRICS] %s: n=%lu p50=%lu us p99=%lu us max=%lu us\n", name, (unsigned long)hist.count,
+               (unsigned long)percentile(hist, 500), (unsigned long)percentile(hist, 990), (unsigned long)hist.maxUs);
+    }
+
+    void printReport()
+    {
+        debugf("[METRICS] frames in=%lu out=%lu dropped=%lu send failures=%lu\n",
+               (unsigned long)metricFramesIn, (unsigned long)metricFramesOut,
+               (unsigned long)metricFramesDropped, (unsigned long)metricSendFailures);
+        printHistogram("Queue wait", queueWaitHist);
+        printHistogram("Send call", sendCallHist);
+        printHistogram("Send complete", sendCompleteHist);
+        if (metricStatusFlags & canEspNowWire::STATUS_LEGACY_PARTITIONS)
+        {
+            debugln("[METRICS] Legacy partition table: store-and-forward and black box run without flash");
+        }
+        debugf("[METRICS] CAN bus-off=%lu time to recover last=%lu ms max=%lu ms\n", (unsigned long)metricBusOffEvents,
+               (unsigned long)metricRecoveryLastMs, (unsigned long)metricRecoveryMaxMs);
+    }
+}
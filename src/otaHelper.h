@@ -0,0 +1,140 @@
+#pragma once
+#include "globals.h"
+#include "espNowHelper.h"
+#include <OtaUpdate.h>
+#include <Preferences.h>
+
+// OTA runs in its own low-priority task on the WiFi core so the CAN receive
+// task (CAN_RX_TASK_CORE) keeps forwarding while an update is in progress.
+#ifndef OTA_TASK_PRIORITY
+#define OTA_TASK_PRIORITY 1
+#endif
+#ifndef OTA_TASK_CORE
+#define OTA_TASK_CORE 0
+#endif
+#ifndef OTA_TIMEOUT_MS
+#define OTA_TIMEOUT_MS 180000
+#endif
+// Warn when forwarding throughput during an update falls more than this below the pre-update rate
+#ifndef OTA_MAX_THROUGHPUT_DROP_PCT
+#define OTA_MAX_THROUGHPUT_DROP_PCT 50
+#endif
+
+// Forward declaration for OTA handler
+extern OtaUpdate otaUpdate;
+
+static TaskHandle_t otaTaskHandle = NULL;
+
+// Forwarding rate measured over the last status interval before the update
+static uint32_t otaBaselineFramesPerSec = 0;
+static unsigned long otaSampleFrames = 0;
+static unsigned long otaSampleMs = 0;
+
+namespace otaHelper
+{
+    // Called periodically while idle to keep the pre-update baseline current
+    void sampleThroughput()
+    {
+        if (otaInProgress)
+        {
+            return;
+        }
+        unsigned long now = millis();
+        unsigned long frames = framesQueued;
+        if (otaSampleMs != 0 && now > otaSampleMs)
+        {
+            otaBaselineFramesPerSec = (uint32_t)((frames - otaSampleFrames) * 1000UL / (now - otaSampleMs));
+        }
+        otaSampleFrames = frames;
+        otaSampleMs = now;
+    }
+
+    static void reportThroughput(unsigned long startMs, unsigned long startFrames)
+    {
+        unsigned long durationMs = millis() - startMs;
+        uint32_t duringFramesPerSec = durationMs ? (uint32_t)((framesQueued - startFrames) * 1000UL / durationMs) : 0;
+        uint32_t dropPct = 0;
+        if (otaBaselineFramesPerSec > duringFramesPerSec)
+        {
+            dropPct = (otaBaselineFramesPerSec - duringFramesPerSec) * 100 / otaBaselineFramesPerSec;
+        }
+        debugf("[OTA] Forwarding during update: %lu frames/s (baseline %lu frames/s, %lu%% drop) over %lu ms\n",
+               (unsigned long)duringFramesPerSec, (unsigned long)otaBaselineFramesPerSec,
+               (unsigned long)dropPct, durationMs);
+        if (dropPct > OTA_MAX_THROUGHPUT_DROP_PCT)
+        {
+            debugf("[OTA] WARNING: throughput drop exceeded %d%% limit\n", OTA_MAX_THROUGHPUT_DROP_PCT);
+        }
+    }
+
+    static void otaTask(void *parameter)
+    {
+        for (;;)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+            debugln("[OTA] Reading WiFi credentials from NVS");
+            Preferences prefs;
+            prefs.begin("wifi", true);  // read-only
+            String ssid = prefs.getString("ssid", "");
+            String password = prefs.getString("password", "");
+            prefs.end();
+
+            if (ssid.length() > 0 && password.length() > 0) {
+                debugf("[OTA] Using stored WiFi credentials (SSID: %s)\n", ssid.c_str());
+                unsigned long startMs = millis();
+                unsigned long startFrames = framesQueued;
+                OtaUpdate ota(OTA_TIMEOUT_MS, ssid.c_str(), password.c_str());
+                ota.waitForOta();
+                debugln("[OTA] OTA mode exited");
+                reportThroughput(startMs, startFrames);
+            } else {
+                debugln("[OTA] ERROR: No WiFi credentials in NVS - cannot start OTA");
+            }
+            otaInProgress = false;
+        }
+    }
+
+    void startTask()
+    {
+        xTaskCreatePinnedToCore(otaTask, "ota", 8192, NULL, OTA_TASK_PRIORITY, &otaTaskHandle, OTA_TASK_CORE);
+    }
+
+    // Handle an OTA trigger frame (CAN ID 0x0); returns immediately
+    void handleTrigger(const twai_message_t &message)
+    {
+        debugln("[OTA] CAN trigger received");
+
+        // Get current device hostname
+        String currentHostName = otaUpdate.getHostName();
+
+        // Extract target hostname from CAN data
+        char targetHostName[14];
+        debugf("[OTA] Raw CAN data: %02X %02X %02X\n",
+                message.data[0], message.data[1], message.data[2]);
+
+        sprintf(targetHostName, "esp32-%02X%02X%02X",
+                message.data[0], message.data[1], message.data[2]);
+
+        debugf("[OTA] Target hostname:  '%s'\n", targetHostName);
+        debugf("[OTA] Current hostname: '%s'\n", currentHostName.c_str());
+
+        // Check if this OTA trigger is for this device
+        if (!currentHostName.equals(targetHostName)) {
+            debugln("[OTA] ✗ Hostname mismatch - ignoring OTA trigger");
+            return;
+        }
+        if (otaTaskHandle == NULL) {
+            debugln("[OTA] OTA task not running - ignoring trigger");
+            return;
+        }
+        // Claim the update here, not in the OTA task, so forwarding, light sleep and
+        // flash writers see it from the moment the trigger is accepted
+        if (otaInProgress.exchange(true)) {
+            debugln("[OTA] Update already in progress - ignoring trigger");
+            return;
+        }
+        debugln("[OTA] ✓ Hostname matched - starting OTA in background");
+        xTaskNotifyGive(otaTaskHandle);
+    }
+}
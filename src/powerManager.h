@@ -0,0 +1,183 @@
+#pragma once
+#include "globals.h"
+#include "radioLink.h"
+#include "canSupervisor.h"
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+// Parked-trailer power saving: once the bus has carried no traffic for
+// POWER_IDLE_TIMEOUT_MS, the CAN receive task stops the TWAI controller,
+// powers the radio down and enters light sleep. Bus traffic is CAN frames
+// received plus ESP-NOW frames queued for writing onto the bus; time sync
+// replies, stats, duplicates and other gateways' traffic do not count. A
+// dominant bit on CAN_RX (the first frame on the bus) wakes it; that frame is
+// lost while the controller restarts, the ones after it are forwarded.
+#ifndef POWER_SAVE_ENABLED
+#define POWER_SAVE_ENABLED (!CAN_REPLAY)
+#endif
+#ifndef POWER_IDLE_TIMEOUT_MS
+#define POWER_IDLE_TIMEOUT_MS 300000
+#endif
+// Wake to first forwarded frame; wakes over budget are counted
+#ifndef POWER_WAKE_BUDGET_MS
+#define POWER_WAKE_BUDGET_MS 250
+#endif
+// The gateway's own periodic broadcasts (time sync, stats) pause once the bus has
+// been idle this long, so they neither keep receivers awake nor answer themselves
+#ifndef POWER_BROADCAST_IDLE_MS
+#define POWER_BROADCAST_IDLE_MS 10000
+#endif
+
+typedef enum
+{
+    POWER_ACTIVE,
+    POWER_LIGHT_SLEEP,
+    POWER_STATE_COUNT,
+} power_state_t;
+
+// millis() of the last bus traffic; written by both receive tasks
+static std::atomic<uint32_t> powerLastActivityMs{0};
+// esp_timer time of the last wake, 0 once its first frame was forwarded
+static std::atomic<int64_t> powerWakeUs{0};
+
+// CAN receive task only, except the latency fields written by the ESP-NOW transmit task
+static power_state_t powerState = POWER_ACTIVE;
+static int64_t powerStateSinceUs = 0;
+static uint64_t powerStateTotalUs[POWER_STATE_COUNT];
+static uint32_t powerSleeps = 0;
+static uint32_t powerResumeLastUs = 0;  // Radio and controller restart after wake
+static uint32_t powerResumeMaxUs = 0;
+static uint32_t powerWakeLatencyLastMs = 0;
+static uint32_t powerWakeLatencyMaxMs = 0;
+static uint32_t powerWakeOverBudget = 0;
+static uint32_t powerWakesUnforwarded = 0;  // Slept again before any frame went out
+
+namespace powerManager
+{
+    static const char *stateName(power_state_t state)
+    {
+        return state == POWER_LIGHT_SLEEP ? "light sleep" : "active";
+    }
+
+    static void enterState(power_state_t state)
+    {
+        int64_t now = esp_timer_get_time();
+        powerStateTotalUs[powerState] += now - powerStateSinceUs;
+        powerState = state;
+        powerStateSinceUs = now;
+    }
+
+    void initialize()
+    {
+        powerStateSinceUs = esp_timer_get_time();
+        powerLastActivityMs = millis();
+    }
+
+    // Any receive task: bus traffic seen (a CAN frame, or one queued for the bus), postpone sleep
+    inline void noteActivity()
+    {
+        powerLastActivityMs = millis();
+    }
+
+    // True once the bus has been idle for POWER_BROADCAST_IDLE_MS; periodic broadcasts stop
+    inline bool busIdle()
+    {
+        return POWER_SAVE_ENABLED && millis() - powerLastActivityMs.load() >= POWER_BROADCAST_IDLE_MS;
+    }
+
+    // ESP-NOW transmit task: a packet of live frames was handed to the radio
+    void noteForwarded()
+    {
+        int64_t wokeUs = powerWakeUs.exchange(0);
+        if (wokeUs == 0)
+        {
+            return;
+        }
+        uint32_t latency = (uint32_t)((esp_timer_get_time() - wokeUs) / 1000);
+        powerWakeLatencyLastMs = latency;
+        if (latency > powerWakeLatencyMaxMs)
+        {
+            powerWakeLatencyMaxMs = latency;
+        }
+        if (latency > POWER_WAKE_BUDGET_MS)
+        {
+            powerWakeOverBudget++;
+            log_event(LOG_CAN, LOG_WARN, "[POWER] First frame forwarded %lu ms after wake (budget %lu ms)",
+                      latency, (uint32_t)POWER_WAKE_BUDGET_MS);
+        }
+    }
+
+    // Light sleep until CAN_RX goes dominant, then bring the controller and radio back
+    static void sleep(gpio_num_t wakePin)
+    {
+        if (!canSupervisor::suspend())
+        {
+            return;
+        }
+        radioAsleep = true;
+        radioLink->sleep();
+        if (powerWakeUs.exchange(0) != 0)
+        {
+            powerWakesUnforwarded++;
+        }
+        log_event(LOG_CAN, LOG_INFO, "[POWER] Bus idle for %lu ms, entering light sleep", (uint32_t)POWER_IDLE_TIMEOUT_MS);
+        vTaskDelay(pdMS_TO_TICKS(10));  // Let the log task drain to the UART
+
+        gpio_wakeup_enable(wakePin, GPIO_INTR_LOW_LEVEL);
+        esp_sleep_enable_gpio_wakeup();
+        enterState(POWER_LIGHT_SLEEP);
+        powerSleeps++;
+        esp_light_sleep_start();
+        enterState(POWER_ACTIVE);
+        gpio_wakeup_disable(wakePin);
+
+        int64_t wokeUs = powerStateSinceUs;
+        canSupervisor::resume();
+        radioLink->wake();
+        radioAsleep = false;
+        uint32_t resumeUs = (uint32_t)(esp_timer_get_time() - wokeUs);
+        powerResumeLastUs = resumeUs;
+        if (resumeUs > powerResumeMaxUs)
+        {
+            powerResumeMaxUs = resumeUs;
+        }
+        powerWakeUs = wokeUs;
+        noteActivity();
+        log_event(LOG_CAN, LOG_INFO, "[POWER] Woken by CAN, controller and radio back in %lu us", resumeUs);
+    }
+
+    // CAN receive task, every iteration
+    void service(gpio_num_t wakePin)
+    {
+        if (!POWER_SAVE_ENABLED || otaInProgress || !canSupervisor::running() ||
+            millis() - powerLastActivityMs.load() < POWER_IDLE_TIMEOUT_MS)
+        {
+            return;
+        }
+        sleep(wakePin);
+    }
+
+    void printStatus()
+    {
+        if (!POWER_SAVE_ENABLED)
+        {
+            return;
+        }
+        uint64_t totals[POWER_STATE_COUNT];
+        memcpy(totals, powerStateTotalUs, sizeof(totals));
+        totals[powerState] += esp_timer_get_time() - powerStateSinceUs;
+        debugf("[POWER] %s: active %lu s, light sleep %lu s, sleeps=%lu\n", stateName(powerState),
+               (unsigned long)(totals[POWER_ACTIVE] / 1000000), (unsigned long)(totals[POWER_LIGHT_SLEEP] / 1000000),
+               (unsigned long)powerSleeps);
+        if (powerSleeps > 0)
+        {
+            debugf("[POWER] Wake: resume last=%lu us max=%lu us, first frame out last=%lu ms max=%lu ms "
+                   "(budget %lu ms, over=%lu, none forwarded=%lu)\n",
+                   (unsigned long)powerResumeLastUs, (unsigned long)powerResumeMaxUs,
+                   (unsigned long)powerWakeLatencyLastMs, (unsigned long)powerWakeLatencyMaxMs,
+                   (unsigned long)POWER_WAKE_BUDGET_MS, (unsigned long)powerWakeOverBudget,
+                   (unsigned long)powerWakesUnforwarded);
+        }
+    }
+}
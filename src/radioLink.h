@@ -0,0 +1,206 @@
+#pragma once
+#include "globals.h"
+
+/**
+ * Thin radio interface over the ESP-NOW calls the gateway uses.
+ * Return values follow ESP-NOW (ESP_OK on success).
+ */
+class RadioLink
+{
+public:
+    virtual ~RadioLink() {}
+    virtual esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) = 0;
+    virtual esp_err_t addPeer(const uint8_t *mac) = 0;
+    virtual esp_err_t removePeer(const uint8_t *mac) = 0;
+    virtual esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) = 0;
+    // Power the radio down for light sleep and back up; ESP-NOW state and peers are kept
+    virtual esp_err_t sleep() = 0;
+    virtual esp_err_t wake() = 0;
+};
+
+#if !HOST_BUILD
+// ESP-NOW over the ESP32 WiFi radio
+class Esp32RadioLink : public RadioLink
+{
+public:
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        WiFi.mode(WIFI_STA);
+        esp_err_t result = esp_now_init();
+        if (result != ESP_OK)
+        {
+            return result;
+        }
+        esp_now_register_send_cb(onSent);
+        return esp_now_register_recv_cb(onReceive);
+    }
+
+    esp_err_t addPeer(const uint8_t *mac) override
+    {
+        esp_now_peer_info_t peerInfo = {};
+        memcpy(peerInfo.peer_addr, mac, 6);
+        peerInfo.channel = 0;
+        peerInfo.encrypt = false;
+        return esp_now_add_peer(&peerInfo);
+    }
+
+    esp_err_t removePeer(const uint8_t *mac) override
+    {
+        return esp_now_del_peer(mac);
+    }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        return esp_now_send(mac, data, length);
+    }
+
+    esp_err_t sleep() override
+    {
+        return esp_wifi_stop();
+    }
+
+    esp_err_t wake() override
+    {
+        return esp_wifi_start();
+    }
+};
+#endif
+
+// Counts what would have gone over the air and completes each send immediately.
+// With echoCopies set, every packet is also heard back that many times, as if
+// re-broadcast by neighbouring units. lossPercent drops that share of broadcasts
+// (unicasts have MAC-layer retries); with acknowledgeReliable, a simulated
+// receiver answers every PACKET_RELIABLE it gets with a PACKET_ACK, subject to
+// the same loss. Peers are kept in a table as small as ESP-NOW's, so a leak
+// shows up as ESP_ERR_ESPNOW_FULL here too.
+class DryRunRadioLink : public RadioLink
+{
+public:
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        onReceive_ = onReceive;
+        onSent_ = onSent;
+        return ESP_OK;
+    }
+
+    esp_err_t addPeer(const uint8_t *mac) override
+    {
+        if (findPeer(mac) >= 0)
+        {
+            return ESP_ERR_ESPNOW_EXIST;
+        }
+        if (peerCount_ == ESP_NOW_MAX_TOTAL_PEER_NUM)
+        {
+            return ESP_ERR_ESPNOW_FULL;
+        }
+        memcpy(peers_[peerCount_++], mac, 6);
+        return ESP_OK;
+    }
+
+    esp_err_t removePeer(const uint8_t *mac) override
+    {
+        int index = findPeer(mac);
+        if (index < 0)
+        {
+            return ESP_ERR_ESPNOW_NOT_FOUND;
+        }
+        memcpy(peers_[index], peers_[--peerCount_], 6);
+        return ESP_OK;
+    }
+
+    uint8_t peerCount() const { return peerCount_; }
+    bool hasPeer(const uint8_t *mac) const { return findPeer(mac) >= 0; }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        packets++;
+        bytes += length;
+        if (onSent_ != NULL)
+        {
+            onSent_(mac, ESP_NOW_SEND_SUCCESS);
+        }
+        if (memcmp(mac, broadcastAddress, 6) == 0 && lose())
+        {
+            return ESP_OK;
+        }
+        static const uint8_t neighbour[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+        for (uint8_t i = 0; i < echoCopies && onReceive_ != NULL; i++)
+        {
+            onReceive_(neighbour, data, (int)length);
+        }
+        if (acknowledgeReliable)
+        {
+            acknowledge(data, length);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t sleep() override { return ESP_OK; }
+    esp_err_t wake() override { return ESP_OK; }
+
+    uint32_t packets = 0;
+    uint64_t bytes = 0;
+    uint8_t echoCopies = 0;
+    uint8_t lossPercent = 0;
+    uint32_t lost = 0;
+    bool acknowledgeReliable = false;
+
+private:
+    int findPeer(const uint8_t *mac) const
+    {
+        for (uint8_t i = 0; i < peerCount_; i++)
+        {
+            if (memcmp(peers_[i], mac, 6) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    bool lose()
+    {
+        if (lossPercent == 0 || esp_random() % 100 >= lossPercent)
+        {
+            return false;
+        }
+        lost++;
+        return true;
+    }
+
+    void acknowledge(const uint8_t *data, size_t length)
+    {
+        canEspNowWire::PacketReader reader;
+        if (onReceive_ == NULL || !reader.begin(data, length) || reader.type() != canEspNowWire::PACKET_RELIABLE)
+        {
+            return;
+        }
+        tracker_.receive(reader.sequence());
+        if (lose())
+        {
+            return;
+        }
+        static const uint8_t receiver[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+        uint8_t ack[canEspNowWire::HEADER_LEN + canEspNowWire::ACK_LEN];
+        canEspNowWire::writeHeader(ack, canEspNowWire::PACKET_ACK, 0, 1);
+        canEspNowWire::encodeAck(tracker_.ack(), ack + canEspNowWire::HEADER_LEN);
+        onReceive_(receiver, ack, (int)sizeof(ack));
+    }
+
+    canEspNowWire::AckTracker tracker_;
+    uint8_t peers_[ESP_NOW_MAX_TOTAL_PEER_NUM][6];
+    uint8_t peerCount_ = 0;
+    esp_now_recv_cb_t onReceive_ = NULL;
+    esp_now_send_cb_t onSent_ = NULL;
+};
+
+#if CAN_REPLAY || HOST_BUILD
+static DryRunRadioLink dryRunRadioLink;
+RadioLink *radioLink = &dryRunRadioLink;
+#else
+static Esp32RadioLink esp32RadioLink;
+RadioLink *radioLink = &esp32RadioLink;
+#endif
+
+// Set while the radio is powered down for light sleep; the transmit task holds packets back
+std::atomic<bool> radioAsleep{false};
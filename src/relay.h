@@ -0,0 +1,199 @@
+#pragma once
+#include "globals.h"
+#include "radioLink.h"
+
+// Multi-gateway installs: packets this unit originates carry a relay block
+// (origin, sequence, hop limit). Every unit drops duplicates and its own
+// echoes by (origin, sequence); in RELAY_MODE a unit also re-broadcasts each
+// new packet it hears with one hop less, extending range to receivers the
+// originating gateway cannot reach.
+#ifndef RELAY_MODE
+#define RELAY_MODE 0
+#endif
+// Relays a packet from this unit may take; 0 sends packets without a relay block
+#ifndef RELAY_HOP_LIMIT
+#define RELAY_HOP_LIMIT 2
+#endif
+// Duplicates arrive within a few relay hops of the original, far below this
+#ifndef RELAY_SEEN_TTL_MS
+#define RELAY_SEEN_TTL_MS 250
+#endif
+// Highest rate of relayed packets heard from all origins together (ESP-NOW tops out around this)
+#ifndef RELAY_MAX_PACKETS_PER_SEC
+#define RELAY_MAX_PACKETS_PER_SEC 500
+#endif
+// Recently seen (origin, sequence) pairs: every packet heard within the TTL at the maximum rate.
+// Entries overwritten before they expire are counted as evictions.
+#ifndef RELAY_SEEN_CAPACITY
+#define RELAY_SEEN_CAPACITY ((RELAY_MAX_PACKETS_PER_SEC * RELAY_SEEN_TTL_MS + 999) / 1000)
+#endif
+// Packets waiting to be re-broadcast (power of two)
+#ifndef RELAY_QUEUE_DEPTH
+#define RELAY_QUEUE_DEPTH 8
+#endif
+// Origin stamped on replayed log frames when simulating a relay (CAN_REPLAY && RELAY_MODE)
+#ifndef RELAY_SIM_ORIGIN
+#define RELAY_SIM_ORIGIN 0x5AFE0001
+#endif
+
+static_assert(RELAY_SEEN_CAPACITY > 0 && RELAY_SEEN_CAPACITY <= 4096, "RELAY_SEEN_CAPACITY out of range");
+
+#define RELAY_FLAGS (RELAY_HOP_LIMIT > 0 ? canEspNowWire::FLAG_RELAY : 0)
+
+// Packet as heard by the ESP-NOW receive callback
+typedef struct
+{
+    uint8_t mac[6];
+    uint8_t length;
+    uint32_t rxMicros;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} espnow_packet_t;
+
+typedef struct
+{
+    uint32_t origin;
+    uint16_t seq;
+    uint32_t seenMs;
+} relay_seen_t;
+
+// Packets to re-broadcast; produced by the ESP-NOW receive task, consumed by the transmit task
+FrameRing<espnow_packet_t, RELAY_QUEUE_DEPTH> relayRing;
+
+// Receive task only
+static relay_seen_t relaySeen[RELAY_SEEN_CAPACITY];
+static uint16_t relaySeenUsed = 0;
+static uint16_t relaySeenNext = 0;
+
+static uint32_t relayOrigin = 0;       // This unit
+static uint32_t relayStampOrigin = 0;  // Written on originated packets; relayOrigin except in simulation
+static uint16_t relaySeq = 0;          // Transmit task only
+
+static uint32_t relayAccepted = 0;
+static uint32_t relayDuplicates = 0;
+static uint32_t relayOwnEchoes = 0;
+static uint32_t relaySeenEvictions = 0;  // Seen entries overwritten before their TTL
+static uint32_t relayForwarded = 0;
+static uint32_t relayLatencyMaxUs = 0;
+static uint64_t relayLatencyTotalUs = 0;
+
+namespace relay
+{
+    void initialize(const uint8_t *mac)
+    {
+        relayOrigin = canEspNowWire::getU32(mac + 2);
+        relayStampOrigin = relayOrigin;
+        // Start somewhere new so a quick reboot is not mistaken for duplicates
+        relaySeq = (uint16_t)esp_random();
+#if CAN_REPLAY && RELAY_MODE
+        // Replay simulation: log frames leave as if sent by an upstream gateway, and the dry-run
+        // link hears every packet twice (directly and through another relay)
+        relayStampOrigin = RELAY_SIM_ORIGIN;
+        dryRunRadioLink.echoCopies = 2;
+#endif
+    }
+
+    // Fill in the relay block of a packet about to be sent by this unit (transmit task)
+    void stamp(uint8_t *buffer)
+    {
+        if (!(buffer[1] & canEspNowWire::FLAG_RELAY))
+        {
+            return;
+        }
+        canEspNowWire::RelayInfo info;
+        info.origin = relayStampOrigin;
+        info.seq = relaySeq++;
+        info.hops = RELAY_HOP_LIMIT;
+        canEspNowWire::writeRelay(buffer, info);
+    }
+
+    // Record (origin, seq); true if it was already seen within RELAY_SEEN_TTL_MS
+    static bool seen(uint32_t origin, uint16_t seq, uint32_t nowMs)
+    {
+        for (uint16_t i = 0; i < relaySeenUsed; i++)
+        {
+            const relay_seen_t &entry = relaySeen[i];
+            if (entry.origin == origin && entry.seq == seq && nowMs - entry.seenMs < RELAY_SEEN_TTL_MS)
+            {
+                return true;
+            }
+        }
+        relay_seen_t &slot = relaySeen[relaySeenNext];
+        if (relaySeenUsed == RELAY_SEEN_CAPACITY && nowMs - slot.seenMs < RELAY_SEEN_TTL_MS)
+        {
+            relaySeenEvictions++;
+        }
+        slot.origin = origin;
+        slot.seq = seq;
+        slot.seenMs = nowMs;
+        relaySeenNext = (relaySeenNext + 1) % RELAY_SEEN_CAPACITY;
+        if (relaySeenUsed < RELAY_SEEN_CAPACITY)
+        {
+            relaySeenUsed++;
+        }
+        return false;
+    }
+
+    // Receive task: false for duplicates and this unit's own packets. In RELAY_MODE, new packets
+    // with hops left are queued for re-broadcast. Packets without a relay block always pass.
+    bool admit(const espnow_packet_t &packet, const canEspNowWire::PacketReader &reader)
+    {
+        if (!reader.relayed() || packet.length < canEspNowWire::HEADER_LEN + canEspNowWire::RELAY_LEN)
+        {
+            return true;
+        }
+        canEspNowWire::RelayInfo info;
+        reader.relay(info);
+        if (info.origin == relayOrigin)
+        {
+            relayOwnEchoes++;
+            return false;
+        }
+        if (seen(info.origin, info.seq, millis()))
+        {
+            relayDuplicates++;
+            return false;
+        }
+        relayAccepted++;
+
+        if (RELAY_MODE && info.hops > 0)
+        {
+            espnow_packet_t copy = packet;
+            info.hops--;
+            canEspNowWire::writeRelay(copy.data, info);
+            if (relayRing.push(copy) && espNowTxTaskHandle != NULL)
+            {
+                xTaskNotifyGive(espNowTxTaskHandle);
+            }
+        }
+        return true;
+    }
+
+    // Transmit task: a relayed packet was handed to the radio
+    void noteForwarded(const espnow_packet_t &packet)
+    {
+        uint32_t latency = micros() - packet.rxMicros;
+        relayForwarded++;
+        relayLatencyTotalUs += latency;
+        if (latency > relayLatencyMaxUs)
+        {
+            relayLatencyMaxUs = latency;
+        }
+    }
+
+    void printStatus()
+    {
+        uint32_t heard = relayAccepted + relayDuplicates;
+        debugf("[RELAY] %s, origin %08lX: accepted=%lu duplicates=%lu (%lu%%) own echoes=%lu seen evictions=%lu\n",
+               RELAY_MODE ? "relaying" : "not relaying", (unsigned long)relayOrigin,
+               (unsigned long)relayAccepted, (unsigned long)relayDuplicates,
+               (unsigned long)(heard ? (uint64_t)relayDuplicates * 100 / heard : 0), (unsigned long)relayOwnEchoes,
+               (unsigned long)relaySeenEvictions);
+        if (RELAY_MODE)
+        {
+            debugf("[RELAY] Forwarded=%lu queue drops=%lu latency avg=%lu us max=%lu us\n",
+                   (unsigned long)relayForwarded, (unsigned long)relayRing.dropped(),
+                   (unsigned long)(relayForwarded ? relayLatencyTotalUs / relayForwarded : 0),
+                   (unsigned long)relayLatencyMaxUs);
+        }
+    }
+}
@@ -0,0 +1,320 @@
+#pragma once
+#include "globals.h"
+#include "gatewayConfig.h"
+#include "radioLink.h"
+
+// Reliable class: frames of the reliableRanges IDs go out as sequenced
+// PACKET_RELIABLE broadcasts. Receivers acknowledge them with batched
+// PACKET_ACK bitmaps; a packet stays in a bounded window until every active
+// receiver has acknowledged it, and is rebroadcast after RELIABLE_RTO_MS.
+// Best-effort IDs are not affected.
+#ifndef RELIABLE_ENABLED
+#define RELIABLE_ENABLED 1
+#endif
+// Unacknowledged packets kept for retransmission (power of two, at most 32);
+// the oldest is given up when a new packet needs its slot
+#ifndef RELIABLE_WINDOW
+#define RELIABLE_WINDOW 8
+#endif
+#ifndef RELIABLE_RTO_MS
+#define RELIABLE_RTO_MS 30
+#endif
+#ifndef RELIABLE_MAX_RETRIES
+#define RELIABLE_MAX_RETRIES 4
+#endif
+// Receivers whose ACKs are awaited; one that has not acknowledged anything for the timeout is not waited for
+#ifndef RELIABLE_MAX_RECEIVERS
+#define RELIABLE_MAX_RECEIVERS 4
+#endif
+#ifndef RELIABLE_RECEIVER_TIMEOUT_MS
+#define RELIABLE_RECEIVER_TIMEOUT_MS 5000
+#endif
+// ACKs waiting for the transmit task (power of two)
+#ifndef RELIABLE_ACK_QUEUE_DEPTH
+#define RELIABLE_ACK_QUEUE_DEPTH 16
+#endif
+// Replay builds: packet loss on the dry-run link, both directions, with a simulated receiver acknowledging
+#ifndef RELIABLE_SIM_LOSS_PERCENT
+#define RELIABLE_SIM_LOSS_PERCENT 10
+#endif
+
+static_assert((RELIABLE_WINDOW & (RELIABLE_WINDOW - 1)) == 0 && RELIABLE_WINDOW <= 32,
+              "RELIABLE_WINDOW must be a power of two no larger than 32");
+static_assert(RELIABLE_MAX_RECEIVERS <= 8, "Receivers are tracked in an 8-bit mask");
+
+typedef struct
+{
+    uint8_t buffer[ESP_NOW_MAX_DATA_LEN];
+    uint8_t length;
+    bool used;
+    uint16_t seq;
+    uint8_t retries;
+    uint8_t ackMask;  // Receivers that acknowledged the packet
+    uint32_t firstSentMs;
+    uint32_t lastSentMs;
+} reliable_slot_t;
+
+typedef struct
+{
+    uint8_t mac[6];
+    uint32_t lastAckMs;
+    bool known;
+} reliable_receiver_t;
+
+typedef struct
+{
+    uint8_t mac[6];
+    canEspNowWire::AckInfo ack;
+} reliable_ack_t;
+
+// Produced by the ESP-NOW receive task, consumed by the transmit task
+FrameRing<reliable_ack_t, RELIABLE_ACK_QUEUE_DEPTH> reliableAcks;
+
+// Transmit task only
+static reliable_slot_t reliableSlots[RELIABLE_WINDOW];
+static reliable_receiver_t reliableReceivers[RELIABLE_MAX_RECEIVERS];
+static uint16_t reliableNextSeq = 0;
+
+static uint32_t reliablePackets = 0;
+static uint32_t reliableRetransmits = 0;
+static uint32_t reliableDelivered = 0;    // Acknowledged by every active receiver
+static uint32_t reliableRecovered = 0;    // ... after at least one retransmission
+static uint32_t reliableLost = 0;         // Retries exhausted
+static uint32_t reliableAbandoned = 0;    // Slot needed for a newer packet
+static uint32_t reliableUnconfirmed = 0;  // No active receiver to acknowledge it
+static uint64_t reliableRecoveryTotalMs = 0;
+static uint32_t reliableRecoveryMaxMs = 0;
+
+namespace reliableDelivery
+{
+    void initialize()
+    {
+        reliableNextSeq = (uint16_t)esp_random();
+#if CAN_REPLAY
+        dryRunRadioLink.lossPercent = RELIABLE_SIM_LOSS_PERCENT;
+        dryRunRadioLink.acknowledgeReliable = true;
+#endif
+    }
+
+    bool isReliable(const twai_message_t &message)
+    {
+        if (!RELIABLE_ENABLED || message.extd)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(reliableRanges) / sizeof(reliableRanges[0]); i++)
+        {
+            if (message.identifier >= reliableRanges[i].firstId && message.identifier <= reliableRanges[i].lastId)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Receive task: hand a PACKET_ACK to the transmit task
+    bool queueAck(const uint8_t *mac, const canEspNowWire::PacketReader &reader)
+    {
+        if (reader.payloadLength() < canEspNowWire::ACK_LEN)
+        {
+            return false;
+        }
+        reliable_ack_t ack;
+        memcpy(ack.mac, mac, 6);
+        canEspNowWire::decodeAck(reader.payload(), ack.ack);
+        if (!reliableAcks.push(ack))
+        {
+            return false;
+        }
+        if (espNowTxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowTxTaskHandle);
+        }
+        return true;
+    }
+
+    // Receivers heard from within RELIABLE_RECEIVER_TIMEOUT_MS
+    static uint8_t activeMask(uint32_t nowMs)
+    {
+        uint8_t mask = 0;
+        for (uint8_t i = 0; i < RELIABLE_MAX_RECEIVERS; i++)
+        {
+            if (reliableReceivers[i].known && nowMs - reliableReceivers[i].lastAckMs < RELIABLE_RECEIVER_TIMEOUT_MS)
+            {
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+    }
+
+    // Index of a receiver, taking the slot of the longest-silent one when all are in use
+    static uint8_t receiverIndex(const uint8_t *mac)
+    {
+        uint8_t stalest = 0;
+        for (uint8_t i = 0; i < RELIABLE_MAX_RECEIVERS; i++)
+        {
+            reliable_receiver_t &receiver = reliableReceivers[i];
+            if (receiver.known && memcmp(receiver.mac, mac, 6) == 0)
+            {
+                return i;
+            }
+            if (!receiver.known)
+            {
+                stalest = i;
+                break;
+            }
+            if ((int32_t)(receiver.lastAckMs - reliableReceivers[stalest].lastAckMs) < 0)
+            {
+                stalest = i;
+            }
+        }
+        reliable_receiver_t &receiver = reliableReceivers[stalest];
+        memcpy(receiver.mac, mac, 6);
+        receiver.known = true;
+        for (uint8_t i = 0; i < RELIABLE_WINDOW; i++)
+        {
+            reliableSlots[i].ackMask &= ~(1 << stalest);
+        }
+        return stalest;
+    }
+
+    static void release(reliable_slot_t &slot, uint32_t nowMs, bool confirmed)
+    {
+        slot.used = false;
+        if (!confirmed)
+        {
+            reliableUnconfirmed++;
+            return;
+        }
+        reliableDelivered++;
+        if (slot.retries > 0)
+        {
+            uint32_t elapsed = nowMs - slot.firstSentMs;
+            reliableRecovered++;
+            reliableRecoveryTotalMs += elapsed;
+            if (elapsed > reliableRecoveryMaxMs)
+            {
+                reliableRecoveryMaxMs = elapsed;
+            }
+        }
+    }
+
+    // Transmit task: apply queued ACKs and release packets every active receiver has
+    static void processAcks(uint32_t nowMs)
+    {
+        reliable_ack_t ack;
+        while (reliableAcks.pop(ack))
+        {
+            uint8_t index = receiverIndex(ack.mac);
+            reliableReceivers[index].lastAckMs = nowMs;
+            for (uint8_t i = 0; i < RELIABLE_WINDOW; i++)
+            {
+                reliable_slot_t &slot = reliableSlots[i];
+                if (slot.used && canEspNowWire::acknowledges(ack.ack, slot.seq))
+                {
+                    slot.ackMask |= 1 << index;
+                }
+            }
+        }
+    }
+
+    // Transmit task: number a finished PACKET_RELIABLE and keep a copy for retransmission
+    void track(uint8_t *buffer, size_t length)
+    {
+        uint32_t now = millis();
+        uint16_t seq = reliableNextSeq++;
+        canEspNowWire::writeSequence(buffer, seq);
+        reliable_slot_t &slot = reliableSlots[seq & (RELIABLE_WINDOW - 1)];
+        if (slot.used)
+        {
+            reliableAbandoned++;
+            log_event(LOG_ESPNOW, LOG_WARN, "[RELIABLE] Window full, giving up on packet %lu", slot.seq);
+        }
+        memcpy(slot.buffer, buffer, length);
+        slot.length = (uint8_t)length;
+        slot.used = true;
+        slot.seq = seq;
+        slot.retries = 0;
+        slot.ackMask = 0;
+        slot.firstSentMs = now;
+        slot.lastSentMs = now;
+        reliablePackets++;
+    }
+
+    bool pending()
+    {
+        if (!reliableAcks.empty())
+        {
+            return true;
+        }
+        for (uint8_t i = 0; i < RELIABLE_WINDOW; i++)
+        {
+            if (reliableSlots[i].used)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Transmit task: settle acknowledged and expired packets, then return the
+     * next packet due for retransmission (0 if none). The caller sends it as is.
+     */
+    size_t nextRetransmission(uint8_t *&data)
+    {
+        uint32_t now = millis();
+        processAcks(now);
+        uint8_t active = activeMask(now);
+        for (uint8_t i = 0; i < RELIABLE_WINDOW; i++)
+        {
+            // Oldest first
+            reliable_slot_t &slot = reliableSlots[(reliableNextSeq + i) & (RELIABLE_WINDOW - 1)];
+            if (!slot.used)
+            {
+                continue;
+            }
+            if (active == 0 || (slot.ackMask & active) == active)
+            {
+                release(slot, now, active != 0);
+                continue;
+            }
+            if (now - slot.lastSentMs < RELIABLE_RTO_MS)
+            {
+                continue;
+            }
+            if (slot.retries >= RELIABLE_MAX_RETRIES)
+            {
+                slot.used = false;
+                reliableLost++;
+                log_event(LOG_ESPNOW, LOG_WARN, "[RELIABLE] Packet %lu unacknowledged after %lu retries",
+                          slot.seq, (uint32_t)RELIABLE_MAX_RETRIES);
+                continue;
+            }
+            slot.retries++;
+            slot.lastSentMs = now;
+            reliableRetransmits++;
+            data = slot.buffer;
+            return slot.length;
+        }
+        return 0;
+    }
+
+    void printStatus()
+    {
+        if (!RELIABLE_ENABLED)
+        {
+            return;
+        }
+        uint8_t active = activeMask(millis());
+        debugf("[RELIABLE] Packets=%lu retransmits=%lu (%lu%%) delivered=%lu recovered=%lu lost=%lu abandoned=%lu "
+               "unconfirmed=%lu receivers=%u\n",
+               (unsigned long)reliablePackets, (unsigned long)reliableRetransmits,
+               (unsigned long)(reliablePackets ? (uint64_t)reliableRetransmits * 100 / reliablePackets : 0),
+               (unsigned long)reliableDelivered, (unsigned long)reliableRecovered, (unsigned long)reliableLost,
+               (unsigned long)reliableAbandoned, (unsigned long)reliableUnconfirmed, (unsigned)__builtin_popcount(active));
+        debugf("[RELIABLE] Recovery latency avg=%lu ms max=%lu ms, ACK queue drops=%lu\n",
+               (unsigned long)(reliableRecovered ? reliableRecoveryTotalMs / reliableRecovered : 0),
+               (unsigned long)reliableRecoveryMaxMs, (unsigned long)reliableAcks.dropped());
+    }
+}
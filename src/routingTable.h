@@ -0,0 +1,226 @@
+#pragma once
+#include "globals.h"
+#include "radioLink.h"
+#include <Preferences.h>
+#include <atomic>
+
+// Unicast routing: CAN ID ranges map to sets of receiver MACs. IDs outside every
+// range (or every ID while the table is empty) go to broadcastAddress as before.
+#ifndef ROUTE_MAX_PEERS
+#define ROUTE_MAX_PEERS 8  // Bits in route_range_t::peerMask
+#endif
+#ifndef ROUTE_MAX_RANGES
+#define ROUTE_MAX_RANGES 32
+#endif
+
+// Peer mask for frames that have no unicast route
+#define ROUTE_BROADCAST 0
+
+typedef struct
+{
+    uint32_t firstId;  /**< Inclusive; bit 31 set for extended IDs */
+    uint32_t lastId;   /**< Inclusive; bit 31 set for extended IDs */
+    uint8_t peerMask;  /**< Bit n = routePeers[n] */
+} route_range_t;
+
+static uint8_t routePeers[ROUTE_MAX_PEERS][6];
+static uint8_t routePeerCount = 0;
+static route_range_t routeRanges[ROUTE_MAX_RANGES];  // Sorted by firstId, non-overlapping
+static uint8_t routeRangeCount = 0;
+static portMUX_TYPE routeMux = portMUX_INITIALIZER_UNLOCKED;  // Table updates vs. transmit-task lookups
+static std::atomic<uint32_t> routeGeneration{0};              // Bumped on every load; peer mask bits change meaning
+
+namespace routingTable
+{
+    /**
+     * Replace the table from its serialized form (also the NVS and config format):
+     *   peerCount, peerCount x 6-byte MAC,
+     *   rangeCount, rangeCount x {firstId u32 LE, lastId u32 LE, peerMask u8}
+     * Ranges must be sorted and non-overlapping. Returns false (table unchanged) if invalid.
+     */
+    bool loadBlob(const uint8_t *blob, size_t length)
+    {
+        size_t offset = 0;
+        if (length < 1)
+        {
+            return false;
+        }
+        uint8_t peers = blob[offset++];
+        if (peers > ROUTE_MAX_PEERS || offset + peers * 6 + 1 > length)
+        {
+            return false;
+        }
+        const uint8_t *macs = blob + offset;
+        offset += peers * 6;
+        uint8_t ranges = blob[offset++];
+        if (ranges > ROUTE_MAX_RANGES || offset + ranges * 9 != length)
+        {
+            return false;
+        }
+
+        route_range_t parsed[ROUTE_MAX_RANGES];
+        for (uint8_t i = 0; i < ranges; i++)
+        {
+            const uint8_t *p = blob + offset + i * 9;
+            parsed[i].firstId = canEspNowWire::getU32(p);
+            parsed[i].lastId = canEspNowWire::getU32(p + 4);
+            parsed[i].peerMask = p[8];
+            if (parsed[i].lastId < parsed[i].firstId || (i > 0 && parsed[i].firstId <= parsed[i - 1].lastId) ||
+                (parsed[i].peerMask >> peers) != 0)
+            {
+                return false;
+            }
+        }
+
+        portENTER_CRITICAL(&routeMux);
+        memcpy(routePeers, macs, peers * 6);
+        routePeerCount = peers;
+        memcpy(routeRanges, parsed, ranges * sizeof(route_range_t));
+        routeRangeCount = ranges;
+        portEXIT_CRITICAL(&routeMux);
+        routeGeneration++;
+        return true;
+    }
+
+    // Copy the peer list under the lock; returns the number of peers
+    uint8_t copyPeers(uint8_t peers[ROUTE_MAX_PEERS][6])
+    {
+        portENTER_CRITICAL(&routeMux);
+        uint8_t count = routePeerCount;
+        memcpy(peers, routePeers, count * 6);
+        portEXIT_CRITICAL(&routeMux);
+        return count;
+    }
+
+    // Bit index of mac in the peer masks; -1 if it is not a routed unicast peer
+    int8_t peerIndex(const uint8_t *mac)
+    {
+        int8_t index = -1;
+        portENTER_CRITICAL(&routeMux);
+        for (uint8_t i = 0; i < routePeerCount && index < 0; i++)
+        {
+            if (memcmp(routePeers[i], mac, 6) == 0)
+            {
+                index = i;
+            }
+        }
+        portEXIT_CRITICAL(&routeMux);
+        return index;
+    }
+
+    // True if mac is one of the routed unicast peers
+    bool isPeer(const uint8_t *mac)
+    {
+        return peerIndex(mac) >= 0;
+    }
+
+    // Register every routed peer with ESP-NOW so unicast sends get MAC-layer retries
+    void registerPeers()
+    {
+        uint8_t peers[ROUTE_MAX_PEERS][6];
+        uint8_t count = copyPeers(peers);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            esp_err_t result = radioLink->addPeer(peers[i]);
+            if (result != ESP_OK && result != ESP_ERR_ESPNOW_EXIST)
+            {
+                debugf("[ROUTE] Failed to add peer %02X:%02X:%02X:%02X:%02X:%02X\n", peers[i][0], peers[i][1],
+                       peers[i][2], peers[i][3], peers[i][4], peers[i][5]);
+            }
+        }
+    }
+
+    // Validate, apply and persist a new table; peers it no longer lists are removed from ESP-NOW
+    bool update(const uint8_t *blob, size_t length)
+    {
+        uint8_t oldPeers[ROUTE_MAX_PEERS][6];
+        uint8_t oldCount = copyPeers(oldPeers);
+        if (!loadBlob(blob, length))
+        {
+            debugln("[ROUTE] Rejected invalid routing table");
+            return false;
+        }
+        for (uint8_t i = 0; i < oldCount; i++)
+        {
+            if (!isPeer(oldPeers[i]))
+            {
+                radioLink->removePeer(oldPeers[i]);
+            }
+        }
+        Preferences prefs;
+        prefs.begin("routes", false);  // read-write
+        prefs.putBytes("table", blob, length);
+        prefs.end();
+        registerPeers();
+        debugf("[ROUTE] Routing table updated: %u peers, %u ranges\n", routePeerCount, routeRangeCount);
+        return true;
+    }
+
+    // Load the persisted table (if any) and register its peers
+    void initialize()
+    {
+        Preferences prefs;
+        prefs.begin("routes", true);  // read-only
+        uint8_t blob[1 + ROUTE_MAX_PEERS * 6 + 1 + ROUTE_MAX_RANGES * 9];
+        size_t length = prefs.getBytesLength("table");
+        if (length > 0 && length <= sizeof(blob))
+        {
+            prefs.getBytes("table", blob, length);
+            if (!loadBlob(blob, length))
+            {
+                debugln("[ROUTE] Stored routing table is invalid - broadcasting all frames");
+            }
+        }
+        prefs.end();
+        registerPeers();
+        debugf("[ROUTE] %u peers, %u ranges\n", routePeerCount, routeRangeCount);
+    }
+
+    // Peer mask for an ID; binary search over the sorted ranges
+    uint8_t lookup(uint32_t identifier, bool extended)
+    {
+        uint32_t key = identifier | (extended ? 0x80000000 : 0);
+        uint8_t mask = ROUTE_BROADCAST;
+        portENTER_CRITICAL(&routeMux);
+        int16_t low = 0;
+        int16_t high = (int16_t)routeRangeCount - 1;
+        while (low <= high)
+        {
+            int16_t mid = (low + high) / 2;
+            if (key < routeRanges[mid].firstId)
+            {
+                high = mid - 1;
+            }
+            else if (key > routeRanges[mid].lastId)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                mask = routeRanges[mid].peerMask;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&routeMux);
+        return mask;
+    }
+
+    // Copy peer index's MAC into mac; false if the index is not (or no longer) in the table
+    bool peerAddress(uint8_t index, uint8_t *mac)
+    {
+        portENTER_CRITICAL(&routeMux);
+        bool found = index < routePeerCount;
+        if (found)
+        {
+            memcpy(mac, routePeers[index], 6);
+        }
+        portEXIT_CRITICAL(&routeMux);
+        return found;
+    }
+
+    // Changes whenever the table is reloaded; peer masks from an older generation are stale
+    uint32_t generation()
+    {
+        return routeGeneration;
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "globals.h"
+#include "metrics.h"
+#include "signalTable.h"
+
+// Subscribed DBC signals (src/signalTable.h, generated from dbc/) are extracted
+// from their frames on the CAN receive task and forwarded as PACKET_SIGNALS
+// updates. A signal is sent when its raw value changes, and re-sent after
+// SIGNAL_HEARTBEAT_MS so receivers stay in sync.
+#ifndef SIGNAL_EXTRACTION
+#define SIGNAL_EXTRACTION 1
+#endif
+// Also forward the raw frames of subscribed messages
+#ifndef SIGNAL_FORWARD_RAW
+#define SIGNAL_FORWARD_RAW 0
+#endif
+#ifndef SIGNAL_HEARTBEAT_MS
+#define SIGNAL_HEARTBEAT_MS 1000
+#endif
+// Depth of the CAN receive -> ESP-NOW transmit signal ring (power of two)
+#ifndef SIGNAL_RING_DEPTH
+#define SIGNAL_RING_DEPTH 64
+#endif
+
+#define SIGNAL_SLOTS (sizeof(signalTable) / sizeof(signalTable[0]))
+
+// Extracted signal value tagged with the ingest time of its frame
+typedef struct
+{
+    uint8_t index;
+    uint64_t raw;
+    uint32_t rxMicros;
+} signal_update_t;
+
+// Produced by the CAN receive task, consumed by the ESP-NOW transmit task
+FrameRing<signal_update_t, SIGNAL_RING_DEPTH> signalRing;
+
+// Last value sent per signal; CAN receive task only
+static uint64_t signalLastRaw[SIGNAL_SLOTS];
+static uint32_t signalLastSentMs[SIGNAL_SLOTS];
+static bool signalSent[SIGNAL_SLOTS];
+
+static uint32_t signalFramesDecoded = 0;
+static uint64_t signalDecodeTotalUs = 0;
+static uint32_t signalUpdates = 0;
+static uint32_t signalUnchanged = 0;   // Suppressed until the heartbeat
+static uint32_t signalShortFrames = 0; // DLC too short for a subscribed signal
+
+namespace signalExtractor
+{
+    // Subscribed signals carried by this frame's ID; NULL if none
+    static const canSignals::Message *find(const twai_message_t &message)
+    {
+        uint32_t key = message.identifier | (message.extd ? 0x80000000 : 0);
+        int low = 0;
+        int high = SIGNAL_MESSAGE_COUNT - 1;
+        while (low <= high)
+        {
+            int mid = (low + high) / 2;
+            const canSignals::Message &entry = signalMessages[mid];
+            uint32_t entryKey = entry.identifier | (entry.extended ? 0x80000000 : 0);
+            if (entryKey == key)
+            {
+                return &entry;
+            }
+            if (entryKey < key)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid - 1;
+            }
+        }
+        return NULL;
+    }
+
+    // Queue updates for the frame's subscribed signals; false if its ID has none (forward it raw)
+    bool handle(const twai_message_t &message, uint32_t rxMicros)
+    {
+        if (!SIGNAL_EXTRACTION || message.rtr)
+        {
+            return false;
+        }
+        const canSignals::Message *entry = find(message);
+        if (entry == NULL)
+        {
+            return false;
+        }
+
+        uint32_t started = micros();
+        uint32_t now = millis();
+        for (uint8_t i = entry->firstSignal; i < entry->firstSignal + entry->signalCount; i++)
+        {
+            const canSignals::Signal &signal = signalTable[i];
+            if (message.data_length_code < signal.minDlc)
+            {
+                signalShortFrames++;
+                continue;
+            }
+            uint64_t raw = canSignals::extractRaw(signal, message.data);
+            if (signalSent[i] && raw == signalLastRaw[i] && now - signalLastSentMs[i] < SIGNAL_HEARTBEAT_MS)
+            {
+                signalUnchanged++;
+                continue;
+            }
+            signal_update_t update;
+            update.index = i;
+            update.raw = raw;
+            update.rxMicros = rxMicros;
+            if (!signalRing.push(update))
+            {
+                metricFramesDropped++;
+                continue;  // Not recorded as sent; retried with the next frame
+            }
+            signalLastRaw[i] = raw;
+            signalLastSentMs[i] = now;
+            signalSent[i] = true;
+            signalUpdates++;
+        }
+        signalDecodeTotalUs += micros() - started;
+        signalFramesDecoded++;
+        return true;
+    }
+
+    void printStatus()
+    {
+        if (SIGNAL_COUNT == 0)
+        {
+            return;
+        }
+        debugf("[SIGNALS] %u signals in %u messages: frames=%lu updates=%lu unchanged=%lu short=%lu decode avg=%lu us\n",
+               (unsigned)SIGNAL_COUNT, (unsigned)SIGNAL_MESSAGE_COUNT, (unsigned long)signalFramesDecoded,
+               (unsigned long)signalUpdates, (unsigned long)signalUnchanged, (unsigned long)signalShortFrames,
+               (unsigned long)(signalFramesDecoded ? signalDecodeTotalUs / signalFramesDecoded : 0));
+        debugf("[SIGNALS] Ring: high water %lu, dropped %lu\n",
+               (unsigned long)signalRing.highWater(), (unsigned long)signalRing.dropped());
+    }
+}
@@ -0,0 +1,18 @@
+// Generated by tools/dbc_codegen.py from dbc/trailer.dbc; do not edit.
+// Signal indexes are part of the PACKET_SIGNALS wire format: receivers must use the same table.
+#pragma once
+#include <CanSignals.h>
+
+#define SIGNAL_COUNT 0
+#define SIGNAL_MESSAGE_COUNT 0
+
+// Index on the wire = position in this table
+static constexpr canSignals::Signal signalTable[] = {
+    // name, start bit, length, big endian, signed, min DLC, scale, offset
+    {"", 0, 1, false, false, 0, 1.0f, 0.0f},  // Placeholder; no signals subscribed
+};
+
+// Sorted by identifier (extended IDs after standard IDs)
+static constexpr canSignals::Message signalMessages[] = {
+    {0, false, 0, 0},  // Placeholder; no signals subscribed
+};
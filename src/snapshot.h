@@ -0,0 +1,191 @@
+#pragma once
+#include "globals.h"
+#include "lastValueCache.h"
+#include "radioLink.h"
+
+// Snapshot service: a receiver that boots or rejoins sends PACKET_SNAPSHOT_REQUEST
+// and gets the latest frame of every tracked ID (or of the ID ranges it asked for)
+// without waiting for slow periodic IDs. Frames are sent sorted by ID so delta IDs
+// keep the packets full; one packet goes out per SNAPSHOT_PACKET_INTERVAL_MS in the
+// gaps of live traffic. Requests are served one at a time, in arrival order.
+#ifndef SNAPSHOT_PACKET_INTERVAL_MS
+#define SNAPSHOT_PACKET_INTERVAL_MS 5
+#endif
+// ID ranges per request; larger requests are rejected
+#ifndef SNAPSHOT_MAX_RANGES
+#define SNAPSHOT_MAX_RANGES 8
+#endif
+// Requests waiting behind the one being served (power of two)
+#ifndef SNAPSHOT_QUEUE_DEPTH
+#define SNAPSHOT_QUEUE_DEPTH 4
+#endif
+
+typedef struct
+{
+    uint8_t mac[6];
+    uint8_t rangeCount;  /**< 0 = every ID */
+    uint32_t firstKey[SNAPSHOT_MAX_RANGES];
+    uint32_t lastKey[SNAPSHOT_MAX_RANGES];
+} snapshot_request_t;
+
+// Produced by the ESP-NOW receive task, consumed by the transmit task
+FrameRing<snapshot_request_t, SNAPSHOT_QUEUE_DEPTH> snapshotRequests;
+
+// Request being served and its lvcTable slots sorted by key; transmit task only
+static snapshot_request_t snapshotActive;
+static bool snapshotRunning = false;
+static const uint8_t *snapshotDestination = NULL;
+static uint16_t snapshotSlots[LVC_CAPACITY];
+static uint16_t snapshotSlotCount = 0;
+static uint16_t snapshotCursor = 0;
+static unsigned long snapshotLastMs = 0;
+
+static uint32_t snapshotServed = 0;
+static uint32_t snapshotInvalid = 0;
+static uint32_t snapshotPackets = 0;
+static uint32_t snapshotFrames = 0;
+
+namespace snapshot
+{
+    // Receive task: validate a request and queue it for the transmit task
+    bool queueRequest(const uint8_t *mac, const canEspNowWire::PacketReader &reader)
+    {
+        snapshot_request_t request;
+        size_t length = reader.payloadLength();
+        uint8_t ranges = reader.count();
+        if (ranges > SNAPSHOT_MAX_RANGES || length < ranges * canEspNowWire::SNAPSHOT_RANGE_LEN)
+        {
+            snapshotInvalid++;
+            return false;
+        }
+        memcpy(request.mac, mac, 6);
+        request.rangeCount = ranges;
+        const uint8_t *p = reader.payload();
+        for (uint8_t i = 0; i < ranges; i++, p += canEspNowWire::SNAPSHOT_RANGE_LEN)
+        {
+            request.firstKey[i] = canEspNowWire::getU32(p);
+            request.lastKey[i] = canEspNowWire::getU32(p + 4);
+        }
+        if (!snapshotRequests.push(request))
+        {
+            return false;
+        }
+        if (espNowTxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowTxTaskHandle);
+        }
+        return true;
+    }
+
+    static bool wanted(const snapshot_request_t &request, uint32_t key)
+    {
+        if (request.rangeCount == 0)
+        {
+            return true;
+        }
+        for (uint8_t i = 0; i < request.rangeCount; i++)
+        {
+            if (key >= request.firstKey[i] && key <= request.lastKey[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Take the next request: collect the matching IDs and sort them
+    static bool start()
+    {
+        if (!snapshotRequests.pop(snapshotActive))
+        {
+            return false;
+        }
+        snapshotSlotCount = 0;
+        for (uint16_t slot = 0; slot < LVC_CAPACITY; slot++)
+        {
+            uint32_t key = lvcTable[slot].key;
+            // Skip IDs whose first frame has not been forwarded yet
+            if (key == LVC_EMPTY_KEY || lvcTable[slot].forwarded == 0 || !wanted(snapshotActive, key))
+            {
+                continue;
+            }
+            // Insertion sort; the table holds at most 3/4 LVC_CAPACITY IDs and this runs once per request
+            uint16_t i = snapshotSlotCount++;
+            while (i > 0 && lvcTable[snapshotSlots[i - 1]].key > key)
+            {
+                snapshotSlots[i] = snapshotSlots[i - 1];
+                i--;
+            }
+            snapshotSlots[i] = slot;
+        }
+        snapshotCursor = 0;
+        snapshotRunning = true;
+
+        // Reply by unicast (MAC-layer retries); broadcast if the peer table is full
+        esp_err_t result = radioLink->addPeer(snapshotActive.mac);
+        snapshotDestination = (result == ESP_OK || result == ESP_ERR_ESPNOW_EXIST) ? snapshotActive.mac : broadcastAddress;
+        return true;
+    }
+
+    bool pending()
+    {
+        return snapshotRunning || !snapshotRequests.empty();
+    }
+
+    // True while a reply to mac is still being sent
+    bool replyingTo(const uint8_t *mac)
+    {
+        return snapshotRunning && memcmp(snapshotDestination, mac, 6) == 0;
+    }
+
+    bool due()
+    {
+        return pending() && millis() - snapshotLastMs >= SNAPSHOT_PACKET_INTERVAL_MS;
+    }
+
+    // Transmit task: fill the next PACKET_SNAPSHOT packet; 0 when nothing is pending
+    size_t buildPacket(uint8_t *buffer, size_t capacity, const uint8_t *&destination)
+    {
+        if (!snapshotRunning && !start())
+        {
+            return 0;
+        }
+        canEspNowWire::PacketWriter writer;
+        writer.begin(buffer, capacity, canEspNowWire::PACKET_SNAPSHOT);
+        canEspNowWire::Frame frame;
+        while (snapshotCursor < snapshotSlotCount)
+        {
+            const lvc_entry_t &entry = lvcTable[snapshotSlots[snapshotCursor]];
+            frame.identifier = entry.key & ~canEspNowWire::KEY_EXTENDED;
+            frame.extended = (entry.key & canEspNowWire::KEY_EXTENDED) != 0;
+            frame.rtr = entry.rtr;
+            frame.dlc = entry.dlc;
+            memcpy(frame.data, entry.data, sizeof(frame.data));
+            frame.offset = 0;
+            if (!writer.append(frame))
+            {
+                break;
+            }
+            snapshotCursor++;
+        }
+        size_t length = writer.finish();
+        if (snapshotCursor == snapshotSlotCount)
+        {
+            buffer[1] |= canEspNowWire::FLAG_FINAL;
+            snapshotRunning = false;
+            snapshotServed++;
+        }
+        destination = snapshotDestination;
+        snapshotLastMs = millis();
+        snapshotPackets++;
+        snapshotFrames += writer.count();
+        return length;
+    }
+
+    void printStatus()
+    {
+        debugf("[SNAPSHOT] Served=%lu invalid=%lu dropped=%lu packets=%lu frames=%lu%s\n",
+               (unsigned long)snapshotServed, (unsigned long)snapshotInvalid, (unsigned long)snapshotRequests.dropped(),
+               (unsigned long)snapshotPackets, (unsigned long)snapshotFrames, snapshotRunning ? " (in progress)" : "");
+    }
+}
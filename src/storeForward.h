@@ -0,0 +1,605 @@
+#pragma once
+#include "globals.h"
+#include "routingTable.h"
+#include "metrics.h"
+#include "relay.h"
+#include <esp_partition.h>
+
+/**
+ * Store-and-forward buffering for ESP-NOW link outages, tracked per routed peer.
+ *
+ * A peer is down after SF_OUTAGE_FAILURES consecutive failed unicast sends to
+ * it (broadcast sends are never acknowledged, so only routed peers can report
+ * an outage, and broadcast traffic is never stored). While a peer is down,
+ * frames routed to it are appended to a log, tagged with the down peers they
+ * missed; their other receivers keep getting them live. The log keeps the
+ * newest SF_RAM_RECORDS in RAM, older ones spilled a sector at a time into the
+ * "storefwd" flash partition. When the log is full the oldest records are
+ * dropped, but the latest record per ID survives in a side table and is
+ * replayed ahead of the remaining history.
+ *
+ * A peer is probed every SF_PROBE_INTERVAL_MS until a send to it succeeds.
+ * The log is then replayed in order as PACKET_STORED packets, at most one per
+ * SF_REPLAY_INTERVAL_MS and only while live traffic is idle; replay pauses at
+ * a record whose peers are not all back yet. The log is not kept across resets.
+ *
+ * Flash wear and stalls: as in the black box, an erase stalls the TWAI
+ * interrupt long enough to overrun its FIFO, so spilling never erases. The
+ * transmit task erases sectors ahead of the log only after the bus has been
+ * quiet for SF_ERASE_IDLE_MS, at most SF_ERASES_PER_HOUR. A spill with no
+ * erased sector left drops the oldest records instead (whatever is in flash,
+ * then the oldest RAM record); each dropped ID's newest value lives on in the
+ * latest-per-ID table. With the default 0x40000
+ * partition (64 sectors, ~100,000 erase cycles each) the budget gives an
+ * expected flash life of 64 * 100000 / 60 = ~107,000 hours (~12 years) even
+ * if it is used up every hour.
+ */
+#ifndef SF_ENABLED
+#define SF_ENABLED 1
+#endif
+#ifndef SF_OUTAGE_FAILURES
+#define SF_OUTAGE_FAILURES 3
+#endif
+// An empty packet is sent to each down peer at this interval
+#ifndef SF_PROBE_INTERVAL_MS
+#define SF_PROBE_INTERVAL_MS 500
+#endif
+#ifndef SF_REPLAY_INTERVAL_MS
+#define SF_REPLAY_INTERVAL_MS 10
+#endif
+#ifndef SF_RAM_RECORDS
+#define SF_RAM_RECORDS 256
+#endif
+// Latest-record-per-ID table slots (power of two)
+#ifndef SF_LATEST_CAPACITY
+#define SF_LATEST_CAPACITY 256
+#endif
+// Wear budget: sector erases per hour, allowed in bursts of SF_ERASE_BURST
+#ifndef SF_ERASES_PER_HOUR
+#define SF_ERASES_PER_HOUR 60
+#endif
+#ifndef SF_ERASE_BURST
+#define SF_ERASE_BURST 16
+#endif
+// Sectors are only erased after the bus has been quiet this long
+#ifndef SF_ERASE_IDLE_MS
+#define SF_ERASE_IDLE_MS 500
+#endif
+#define SF_PARTITION_LABEL "storefwd"
+#define SF_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x40)
+#define SF_SECTOR_SIZE 4096
+
+#define SF_KEY_EXTENDED 0x80000000
+#define SF_KEY_RTR 0x40000000
+#define SF_EMPTY_KEY 0xFFFFFFFF
+
+typedef struct
+{
+    uint32_t captureMs;  /**< millis() when the frame was received from CAN */
+    uint32_t key;        /**< CAN ID | SF_KEY_EXTENDED | SF_KEY_RTR */
+    uint8_t dlc;
+    uint8_t data[8];
+    uint8_t peerMask;    /**< Routed peers that were down when it was stored */
+    uint8_t reserved[2];
+} sf_record_t;
+
+typedef struct
+{
+    sf_record_t record;  /**< record.key is the table key; SF_EMPTY_KEY if unused */
+    uint32_t seq;        /**< Log position of the record */
+    bool evicted;        /**< Dropped from the log before being replayed */
+} sf_latest_t;
+
+#define SF_RECORDS_PER_SECTOR (SF_SECTOR_SIZE / sizeof(sf_record_t))
+
+static_assert(SF_RAM_RECORDS >= SF_RECORDS_PER_SECTOR, "SF_RAM_RECORDS must hold at least one flash sector");
+static_assert((SF_LATEST_CAPACITY & (SF_LATEST_CAPACITY - 1)) == 0, "SF_LATEST_CAPACITY must be a power of two");
+
+// Log positions: flash holds [sfFlashTailSeq, sfRamTailSeq), RAM holds [sfRamTailSeq, sfWriteSeq)
+static sf_record_t sfRam[SF_RAM_RECORDS];
+static uint32_t sfWriteSeq = 0;
+static uint32_t sfReadSeq = 0;  // Next record to replay
+static uint32_t sfRamTailSeq = 0;
+static uint32_t sfFlashTailSeq = 0;
+
+static const esp_partition_t *sfPartition = NULL;
+static uint16_t sfSectorCount = 0;
+static uint16_t sfFlashTail = 0;  // Sector holding sfFlashTailSeq
+static uint16_t sfFlashUsed = 0;
+static uint16_t sfErasedSectors = 0;  // Blank sectors from the write position (sfFlashTail + sfFlashUsed) on
+static uint8_t sfSectorBuffer[SF_SECTOR_SIZE];
+static uint32_t sfEraseTokens = SF_ERASE_BURST;
+static unsigned long sfTokenMs = 0;
+
+static sf_latest_t sfLatest[SF_LATEST_CAPACITY];
+static uint16_t sfLatestUsed = 0;
+static uint16_t sfEvictedPending = 0;
+static uint32_t sfRemapBeforeSeq = 0;  // Records before this were tagged under an older routing table
+
+// Per-peer link state, by routing table peer index; written from the WiFi task (send callback) and the transmit task
+static std::atomic<uint8_t> sfConsecutiveFailures[ROUTE_MAX_PEERS];
+static std::atomic<uint8_t> sfDownMask{0};
+
+static uint32_t sfOutages = 0;
+static uint32_t sfStored = 0;
+static uint32_t sfReplayed = 0;
+static uint32_t sfEvicted = 0;       // History records dropped for space
+static uint32_t sfLatestUntracked = 0;
+static uint32_t sfFlashWrites = 0;
+static uint32_t sfFlashErrors = 0;
+static uint32_t sfErases = 0;
+
+namespace storeForward
+{
+    // Count the blank sectors from the start of the partition, so a reboot does not erase them again
+    static void countErased()
+    {
+        sfErasedSectors = 0;
+        while (sfErasedSectors < sfSectorCount)
+        {
+            if (esp_partition_read(sfPartition, (size_t)sfErasedSectors * SF_SECTOR_SIZE, sfSectorBuffer, SF_SECTOR_SIZE) != ESP_OK)
+            {
+                return;
+            }
+            for (size_t i = 0; i < SF_SECTOR_SIZE; i++)
+            {
+                if (sfSectorBuffer[i] != 0xFF)
+                {
+                    return;
+                }
+            }
+            sfErasedSectors++;
+        }
+    }
+
+    void initialize()
+    {
+        for (uint16_t i = 0; i < SF_LATEST_CAPACITY; i++)
+        {
+            sfLatest[i].record.key = SF_EMPTY_KEY;
+        }
+        sfPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SF_PARTITION_SUBTYPE, SF_PARTITION_LABEL);
+        if (sfPartition != NULL)
+        {
+            sfSectorCount = sfPartition->size / SF_SECTOR_SIZE;
+            countErased();
+            sfTokenMs = millis();
+            debugf("[SF] Store-and-forward: %u RAM records + %u flash records, %u sectors erased\n", SF_RAM_RECORDS,
+                   (unsigned)(sfSectorCount * SF_RECORDS_PER_SECTOR), sfErasedSectors);
+        }
+        else
+        {
+            debugf("[SF] No '%s' partition - store-and-forward limited to %u RAM records\n", SF_PARTITION_LABEL, SF_RAM_RECORDS);
+            metrics::notePartitionMissing(canEspNowWire::STATUS_NO_STOREFWD_PARTITION);
+        }
+    }
+
+    // Send outcome for a destination. Only routed peers count: broadcasts are never acknowledged,
+    // and other unicasts (snapshot replies) go to receivers that may have left.
+    void noteSendResult(const uint8_t *mac, bool delivered)
+    {
+        int8_t peer = (SF_ENABLED && mac != NULL) ? routingTable::peerIndex(mac) : -1;
+        if (peer < 0)
+        {
+            return;
+        }
+        uint8_t bit = 1 << peer;
+        std::atomic<uint8_t> &failures = sfConsecutiveFailures[peer];
+        if (delivered)
+        {
+            failures = 0;
+            if (sfDownMask.fetch_and(~bit) & bit)
+            {
+                log_event(LOG_ESPNOW, LOG_INFO, "[SF] Peer %lu restored, replaying %lu stored frames", peer,
+                          sfWriteSeq - sfReadSeq);
+            }
+        }
+        else if (failures.load() < 0xFF && ++failures >= SF_OUTAGE_FAILURES && !(sfDownMask.fetch_or(bit) & bit))
+        {
+            sfOutages++;
+            log_event(LOG_ESPNOW, LOG_WARN, "[SF] Peer %lu down after %lu failed sends, storing its frames", peer,
+                      SF_OUTAGE_FAILURES);
+        }
+    }
+
+    // Routing peer mask of the peers that are down
+    uint8_t downPeers()
+    {
+        return sfDownMask.load();
+    }
+
+    // Transmit task: the routing table was reloaded, so peer indices changed. Outages are
+    // detected afresh, and stored records replay to their IDs' receivers under the new table.
+    void routesChanged()
+    {
+        for (uint8_t i = 0; i < ROUTE_MAX_PEERS; i++)
+        {
+            sfConsecutiveFailures[i] = 0;
+        }
+        sfDownMask = 0;
+        sfRemapBeforeSeq = sfWriteSeq;
+        for (uint16_t i = 0; i < SF_LATEST_CAPACITY; i++)
+        {
+            if (sfLatest[i].record.key != SF_EMPTY_KEY)
+            {
+                sfLatest[i].record.peerMask = routingTable::lookup(sfLatest[i].record.key & canEspNowWire::EXT_ID_MASK,
+                                                                    (sfLatest[i].record.key & SF_KEY_EXTENDED) != 0);
+            }
+        }
+    }
+
+    // Stored frames (or evicted latest values) waiting to be replayed
+    bool pending()
+    {
+        return sfReadSeq != sfWriteSeq || sfEvictedPending > 0;
+    }
+
+    static sf_latest_t *findOrInsertLatest(uint32_t key)
+    {
+        uint32_t index = (key * 2654435761u) & (SF_LATEST_CAPACITY - 1);
+        for (uint16_t probe = 0; probe < SF_LATEST_CAPACITY; probe++)
+        {
+            sf_latest_t &entry = sfLatest[index];
+            if (entry.record.key == key)
+            {
+                return &entry;
+            }
+            if (entry.record.key == SF_EMPTY_KEY)
+            {
+                // Keep the table at most 3/4 full so misses stay cheap
+                if (sfLatestUsed >= (SF_LATEST_CAPACITY * 3) / 4)
+                {
+                    return NULL;
+                }
+                entry.evicted = false;
+                sfLatestUsed++;
+                return &entry;
+            }
+            index = (index + 1) & (SF_LATEST_CAPACITY - 1);
+        }
+        return NULL;
+    }
+
+    // Flag the latest values whose log records in [first, end) are about to be dropped unreplayed
+    static void evict(uint32_t first, uint32_t end)
+    {
+        if (first < sfReadSeq)
+        {
+            first = sfReadSeq;
+        }
+        if (first >= end)
+        {
+            return;
+        }
+        for (uint16_t i = 0; i < SF_LATEST_CAPACITY; i++)
+        {
+            sf_latest_t &entry = sfLatest[i];
+            if (entry.record.key != SF_EMPTY_KEY && !entry.evicted && entry.seq >= first && entry.seq < end)
+            {
+                entry.evicted = true;
+                sfEvictedPending++;
+            }
+        }
+        sfEvicted += end - first;
+        metricFramesDropped += end - first;
+        sfReadSeq = end;
+    }
+
+    static void releaseReplayed();
+
+    // Make room in RAM: move the oldest sector's worth of records into an erased flash sector,
+    // or drop the oldest record when none is ready. Never erases: see preErase().
+    static void spill()
+    {
+        releaseReplayed();
+        // Records already replayed need no space
+        if (sfReadSeq > sfRamTailSeq)
+        {
+            sfRamTailSeq = sfReadSeq;
+            sfFlashTailSeq = sfRamTailSeq;
+            if (sfWriteSeq - sfRamTailSeq < SF_RAM_RECORDS)
+            {
+                return;
+            }
+        }
+
+        if (sfPartition == NULL || sfErasedSectors == 0)
+        {
+            // Drop the oldest record; the log must stay contiguous, so any older ones in flash go with it
+            evict(sfFlashTailSeq, sfRamTailSeq + 1);
+            if (sfFlashUsed > 0)
+            {
+                sfFlashTail = (sfFlashTail + sfFlashUsed) % sfSectorCount;
+                sfFlashUsed = 0;
+            }
+            sfRamTailSeq++;
+            sfFlashTailSeq = sfRamTailSeq;
+            return;
+        }
+
+        for (uint16_t i = 0; i < SF_RECORDS_PER_SECTOR; i++)
+        {
+            memcpy(sfSectorBuffer + i * sizeof(sf_record_t), &sfRam[(sfRamTailSeq + i) % SF_RAM_RECORDS], sizeof(sf_record_t));
+        }
+        uint16_t sector = (sfFlashTail + sfFlashUsed) % sfSectorCount;
+        sfErasedSectors--;
+        if (esp_partition_write(sfPartition, (size_t)sector * SF_SECTOR_SIZE, sfSectorBuffer,
+                                SF_RECORDS_PER_SECTOR * sizeof(sf_record_t)) != ESP_OK)
+        {
+            // Drop the records and whatever is older in flash rather than leave a hole in the
+            // log, and skip the sector: it is no longer blank
+            sfFlashErrors++;
+            evict(sfFlashTailSeq, sfRamTailSeq + SF_RECORDS_PER_SECTOR);
+            sfFlashTail = (sector + 1) % sfSectorCount;
+            sfFlashUsed = 0;
+            sfRamTailSeq += SF_RECORDS_PER_SECTOR;
+            sfFlashTailSeq = sfRamTailSeq;
+            return;
+        }
+        sfFlashWrites++;
+        sfFlashUsed++;
+        sfRamTailSeq += SF_RECORDS_PER_SECTOR;
+    }
+
+    /**
+     * Transmit task: erase one more sector ahead of the log while the bus has been quiet since
+     * lastFrameMs and the budget allows. Sectors freed by replay are erased here, never on the
+     * send path.
+     */
+    void preErase(unsigned long now, unsigned long lastFrameMs)
+    {
+        if (sfPartition == NULL || sfFlashUsed + sfErasedSectors >= sfSectorCount)
+        {
+            return;
+        }
+        uint32_t interval = 3600000UL / SF_ERASES_PER_HOUR;
+        while (sfEraseTokens < SF_ERASE_BURST && now - sfTokenMs >= interval)
+        {
+            sfEraseTokens++;
+            sfTokenMs += interval;
+        }
+        if (sfEraseTokens >= SF_ERASE_BURST)
+        {
+            sfTokenMs = now;
+        }
+        // Keep off the flash while an update is being written
+        if (sfEraseTokens == 0 || now - lastFrameMs < SF_ERASE_IDLE_MS || otaInProgress)
+        {
+            return;
+        }
+        uint16_t sector = (sfFlashTail + sfFlashUsed + sfErasedSectors) % sfSectorCount;
+        if (esp_partition_erase_range(sfPartition, (size_t)sector * SF_SECTOR_SIZE, SF_SECTOR_SIZE) != ESP_OK)
+        {
+            sfFlashErrors++;
+            return;
+        }
+        sfErasedSectors++;
+        sfEraseTokens--;
+        sfErases++;
+    }
+
+    // True while preErase() has sectors to erase; the transmit task wakes for it
+    bool eraseWanted()
+    {
+        return sfPartition != NULL && sfFlashUsed + sfErasedSectors < sfSectorCount;
+    }
+
+    // Append a frame received at captureMs, for the down peers in peerMask, to the log
+    void store(const canEspNowWire::Frame &frame, uint32_t captureMs, uint8_t peerMask)
+    {
+        sf_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.captureMs = captureMs;
+        record.peerMask = peerMask;
+        record.key = frame.identifier | (frame.extended ? SF_KEY_EXTENDED : 0) | (frame.rtr ? SF_KEY_RTR : 0);
+        record.dlc = frame.dlc;
+        memcpy(record.data, frame.data, sizeof(record.data));
+
+        if (sfWriteSeq - sfRamTailSeq >= SF_RAM_RECORDS)
+        {
+            spill();
+        }
+        sfRam[sfWriteSeq % SF_RAM_RECORDS] = record;
+
+        sf_latest_t *latest = findOrInsertLatest(record.key);
+        if (latest != NULL)
+        {
+            if (latest->evicted)
+            {
+                sfEvictedPending--;
+            }
+            latest->record = record;
+            latest->seq = sfWriteSeq;
+            latest->evicted = false;
+        }
+        else
+        {
+            sfLatestUntracked++;
+        }
+        sfWriteSeq++;
+        sfStored++;
+    }
+
+    static bool readRecord(uint32_t seq, sf_record_t &record)
+    {
+        if (seq >= sfRamTailSeq)
+        {
+            record = sfRam[seq % SF_RAM_RECORDS];
+            return true;
+        }
+        uint32_t index = seq - sfFlashTailSeq;
+        uint16_t sector = (sfFlashTail + index / SF_RECORDS_PER_SECTOR) % sfSectorCount;
+        size_t offset = (size_t)sector * SF_SECTOR_SIZE + (index % SF_RECORDS_PER_SECTOR) * sizeof(sf_record_t);
+        if (esp_partition_read(sfPartition, offset, &record, sizeof(record)) != ESP_OK)
+        {
+            sfFlashErrors++;
+            return false;
+        }
+        return true;
+    }
+
+    // Release flash sectors that have been fully replayed
+    static void releaseReplayed()
+    {
+        while (sfFlashUsed > 0 && sfReadSeq >= sfFlashTailSeq + SF_RECORDS_PER_SECTOR)
+        {
+            sfFlashTailSeq += SF_RECORDS_PER_SECTOR;
+            sfFlashTail = (sfFlashTail + 1) % sfSectorCount;
+            sfFlashUsed--;
+        }
+    }
+
+    static void toFrame(const sf_record_t &record, uint32_t baseMs, canEspNowWire::Frame &frame)
+    {
+        frame.identifier = record.key & canEspNowWire::EXT_ID_MASK;
+        frame.extended = (record.key & SF_KEY_EXTENDED) != 0;
+        frame.rtr = (record.key & SF_KEY_RTR) != 0;
+        frame.dlc = record.dlc;
+        memcpy(frame.data, record.data, sizeof(frame.data));
+        frame.offset = (int32_t)(record.captureMs - baseMs);
+    }
+
+    // Receivers of a log record; ones tagged under an older routing table go to the ID's current receivers
+    static uint8_t routeFor(const sf_record_t &record, uint32_t seq)
+    {
+        if (seq < sfRemapBeforeSeq)
+        {
+            return routingTable::lookup(record.key & canEspNowWire::EXT_ID_MASK, (record.key & SF_KEY_EXTENDED) != 0);
+        }
+        return record.peerMask;
+    }
+
+    // Start over once everything has been replayed
+    static void resetIfDrained()
+    {
+        if (pending())
+        {
+            return;
+        }
+        for (uint16_t i = 0; i < SF_LATEST_CAPACITY; i++)
+        {
+            sfLatest[i].record.key = SF_EMPTY_KEY;
+        }
+        sfLatestUsed = 0;
+        sfWriteSeq = sfReadSeq = sfRamTailSeq = sfFlashTailSeq = sfRemapBeforeSeq = 0;
+        // The erased sectors stay ahead of the (empty) log
+        if (sfSectorCount > 0)
+        {
+            sfFlashTail = (sfFlashTail + sfFlashUsed) % sfSectorCount;
+        }
+        sfFlashUsed = 0;
+    }
+
+    /**
+     * Build the next PACKET_STORED packet: evicted latest values first, then the
+     * log in order. All frames in a packet share one routing peer mask and fit a
+     * 16-bit capture offset, and none is for a peer that is still down. Returns
+     * the packet length, 0 when nothing can be replayed yet.
+     */
+    size_t buildPacket(uint8_t *buffer, size_t capacity, uint8_t &peerMask)
+    {
+        canEspNowWire::PacketWriter writer;
+        writer.begin(buffer, capacity, canEspNowWire::PACKET_STORED, true, RELAY_FLAGS);
+        canEspNowWire::Frame frame;
+        uint32_t baseMs = 0;
+        uint8_t down = downPeers();
+
+        // Oldest evicted value whose peers are all up sets the base time and the receivers
+        const sf_latest_t *oldest = NULL;
+        uint16_t evicted = 0;
+        for (uint16_t i = 0; i < SF_LATEST_CAPACITY && sfEvictedPending > 0; i++)
+        {
+            const sf_latest_t &entry = sfLatest[i];
+            if (entry.record.key == SF_EMPTY_KEY || !entry.evicted)
+            {
+                continue;
+            }
+            evicted++;
+            if ((entry.record.peerMask & down) == 0 &&
+                (oldest == NULL || (int32_t)(entry.record.captureMs - oldest->record.captureMs) < 0))
+            {
+                oldest = &entry;
+            }
+        }
+        sfEvictedPending = evicted;
+        if (oldest != NULL)
+        {
+            baseMs = oldest->record.captureMs;
+            peerMask = oldest->record.peerMask;
+            for (uint16_t i = 0; i < SF_LATEST_CAPACITY; i++)
+            {
+                sf_latest_t &entry = sfLatest[i];
+                if (entry.record.key == SF_EMPTY_KEY || !entry.evicted ||
+                    entry.record.captureMs - baseMs > 0xFFFF || entry.record.peerMask != peerMask)
+                {
+                    continue;
+                }
+                toFrame(entry.record, baseMs, frame);
+                if (!writer.append(frame))
+                {
+                    break;
+                }
+                entry.evicted = false;
+                sfEvictedPending--;
+                sfReplayed++;
+            }
+        }
+        else
+        {
+            sf_record_t record;
+            bool first = true;
+            bool blocked = false;
+            while (sfReadSeq != sfWriteSeq && readRecord(sfReadSeq, record))
+            {
+                uint8_t route = routeFor(record, sfReadSeq);
+                if (route & down)
+                {
+                    blocked = true;
+                    break;
+                }
+                if (first)
+                {
+                    baseMs = record.captureMs;
+                    peerMask = route;
+                    first = false;
+                }
+                else if (record.captureMs - baseMs > 0xFFFF || route != peerMask)
+                {
+                    break;
+                }
+                toFrame(record, baseMs, frame);
+                if (!writer.append(frame))
+                {
+                    break;
+                }
+                sfReadSeq++;
+                sfReplayed++;
+            }
+            if (first && !blocked && sfReadSeq != sfWriteSeq)
+            {
+                // Unreadable flash record: skip it rather than stall the replay
+                sfReadSeq++;
+            }
+            releaseReplayed();
+        }
+
+        if (writer.empty())
+        {
+            resetIfDrained();
+            return 0;
+        }
+        writer.setBase(millis() - baseMs);
+        size_t length = writer.finish();
+        resetIfDrained();
+        return length;
+    }
+
+    void printStatus()
+    {
+        debugf("[SF] Peers down=0x%02X, outages=%lu stored=%lu replayed=%lu evicted=%lu pending=%lu (+%u latest) flash sectors=%u/%u erased=%u writes=%lu erases=%lu errors=%lu\n",
+               downPeers(), (unsigned long)sfOutages, (unsigned long)sfStored, (unsigned long)sfReplayed,
+               (unsigned long)sfEvicted, (unsigned long)(sfWriteSeq - sfReadSeq), sfEvictedPending, sfFlashUsed,
+               sfSectorCount, sfErasedSectors, (unsigned long)sfFlashWrites, (unsigned long)sfErases,
+               (unsigned long)sfFlashErrors);
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "globals.h"
+
+// Periodic PACKET_TIME broadcast and per-peer latency / clock offset from the replies.
+// NTP-style exchange: t1 gateway send, t2 receiver receive, t3 receiver reply, t4 gateway receive.
+#ifndef TIMESYNC_ENABLED
+#define TIMESYNC_ENABLED 1
+#endif
+#ifndef TIMESYNC_INTERVAL_MS
+#define TIMESYNC_INTERVAL_MS 1000
+#endif
+// Peers tracked for latency / offset reporting
+#ifndef TIMESYNC_MAX_PEERS
+#define TIMESYNC_MAX_PEERS 8
+#endif
+
+typedef struct
+{
+    uint8_t mac[6];
+    uint32_t samples;
+    int32_t offsetUs;         /**< Receiver clock minus gateway clock */
+    uint32_t oneWayUs;        /**< Latest round trip / 2, excluding receiver turnaround */
+    uint32_t oneWayAvgUs;     /**< EWMA of oneWayUs (1/8) */
+    uint32_t oneWayMaxUs;
+    uint32_t offsetErrorUs;   /**< EWMA of |offset change| between samples: estimate noise plus drift */
+} timesync_peer_t;
+
+static timesync_peer_t timeSyncPeers[TIMESYNC_MAX_PEERS];
+static uint8_t timeSyncPeerCount = 0;
+static uint8_t timeSyncSeq = 0;
+static unsigned long timeSyncLastMs = 0;
+static uint32_t timeSyncRepliesIgnored = 0;  // Malformed, or from peers beyond TIMESYNC_MAX_PEERS
+
+namespace timeSync
+{
+    bool due()
+    {
+        return TIMESYNC_ENABLED && millis() - timeSyncLastMs >= TIMESYNC_INTERVAL_MS;
+    }
+
+    // Fill a PACKET_TIME packet stamped with the current time; send it right away
+    size_t buildSync(uint8_t *buffer)
+    {
+        canEspNowWire::writeHeader(buffer, canEspNowWire::PACKET_TIME, 0, 1);
+        buffer[canEspNowWire::HEADER_LEN] = ++timeSyncSeq;
+        canEspNowWire::putU32(buffer + canEspNowWire::HEADER_LEN + 1, micros());
+        timeSyncLastMs = millis();
+        return canEspNowWire::HEADER_LEN + canEspNowWire::TIME_SYNC_LEN;
+    }
+
+    static timesync_peer_t *findPeer(const uint8_t *mac)
+    {
+        for (uint8_t i = 0; i < timeSyncPeerCount; i++)
+        {
+            if (memcmp(timeSyncPeers[i].mac, mac, 6) == 0)
+            {
+                return &timeSyncPeers[i];
+            }
+        }
+        if (timeSyncPeerCount == TIMESYNC_MAX_PEERS)
+        {
+            return NULL;
+        }
+        timesync_peer_t *peer = &timeSyncPeers[timeSyncPeerCount++];
+        memset(peer, 0, sizeof(*peer));
+        memcpy(peer->mac, mac, 6);
+        return peer;
+    }
+
+    // PACKET_TIME_REPLY payload received at t4 (WiFi task context)
+    void handleReply(const uint8_t *mac, const uint8_t *payload, size_t length, uint32_t t4)
+    {
+        if (length < canEspNowWire::TIME_REPLY_LEN)
+        {
+            timeSyncRepliesIgnored++;
+            return;
+        }
+        canEspNowWire::TimeReply reply;
+        canEspNowWire::decodeTimeReply(payload, reply);
+        timesync_peer_t *peer = findPeer(mac);
+        if (peer == NULL)
+        {
+            timeSyncRepliesIgnored++;
+            return;
+        }
+
+        int32_t roundTrip = (int32_t)(t4 - reply.t1) - (int32_t)(reply.t3 - reply.t2);
+        if (roundTrip < 0)
+        {
+            timeSyncRepliesIgnored++;
+            return;
+        }
+        int32_t offset = ((int32_t)(reply.t2 - reply.t1) + (int32_t)(reply.t3 - t4)) / 2;
+        uint32_t oneWay = (uint32_t)roundTrip / 2;
+
+        if (peer->samples > 0)
+        {
+            uint32_t change = (uint32_t)abs(offset - peer->offsetUs);
+            peer->offsetErrorUs = peer->samples == 1 ? change : peer->offsetErrorUs - peer->offsetErrorUs / 8 + change / 8;
+            peer->oneWayAvgUs = peer->oneWayAvgUs - peer->oneWayAvgUs / 8 + oneWay / 8;
+        }
+        else
+        {
+            peer->oneWayAvgUs = oneWay;
+        }
+        peer->offsetUs = offset;
+        peer->oneWayUs = oneWay;
+        if (oneWay > peer->oneWayMaxUs)
+        {
+            peer->oneWayMaxUs = oneWay;
+        }
+        peer->samples++;
+    }
+
+    void printStatus()
+    {
+        for (uint8_t i = 0; i < timeSyncPeerCount; i++)
+        {
+            const timesync_peer_t &peer = timeSyncPeers[i];
+            debugf("[TIME] %02X:%02X:%02X:%02X:%02X:%02X samples=%lu offset=%ld us (error ~%lu us) one-way=%lu us avg=%lu max=%lu\n",
+                   peer.mac[0], peer.mac[1], peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5],
+                   (unsigned long)peer.samples, (long)peer.offsetUs, (unsigned long)peer.offsetErrorUs,
+                   (unsigned long)peer.oneWayUs, (unsigned long)peer.oneWayAvgUs, (unsigned long)peer.oneWayMaxUs);
+        }
+        if (timeSyncRepliesIgnored > 0)
+        {
+            debugf("[TIME] Replies ignored: %lu\n", (unsigned long)timeSyncRepliesIgnored);
+        }
+    }
+}
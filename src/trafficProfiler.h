@@ -0,0 +1,353 @@
+#pragma once
+#include "globals.h"
+#include "radioLink.h"
+
+// Bus traffic profile kept by the CAN receive task: per-ID count, period
+// (mean, min, max) and period jitter, last DLC, and the bus load estimated
+// from the length of every received frame. Dumped over ESP-NOW on
+// PACKET_PROFILE_REQUEST or the CONFIG_PROFILE CAN request, and to the
+// serial log with the periodic reports.
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+// Open the hardware acceptance filter so the profile and load cover the whole bus, not only forwarded IDs
+#ifndef PROFILER_ACCEPT_ALL
+#define PROFILER_ACCEPT_ALL 0
+#endif
+// Table slots (power of two); at most 3/4 are used
+#ifndef PROFILER_CAPACITY
+#define PROFILER_CAPACITY 256
+#endif
+// Probes per lookup; IDs that do not fit are counted as untracked, keeping the update O(1)
+#ifndef PROFILER_MAX_PROBES
+#define PROFILER_MAX_PROBES 8
+#endif
+#ifndef PROFILER_BITRATE
+#define PROFILER_BITRATE 500000
+#endif
+#ifndef PROFILER_LOAD_WINDOW_MS
+#define PROFILER_LOAD_WINDOW_MS 1000
+#endif
+// Profile dump pacing, one packet per interval in the gaps of live traffic
+#ifndef PROFILER_PACKET_INTERVAL_MS
+#define PROFILER_PACKET_INTERVAL_MS 5
+#endif
+// Requests waiting behind the dump being sent (power of two)
+#ifndef PROFILER_QUEUE_DEPTH
+#define PROFILER_QUEUE_DEPTH 4
+#endif
+
+static_assert((PROFILER_CAPACITY & (PROFILER_CAPACITY - 1)) == 0, "PROFILER_CAPACITY must be a power of two");
+
+#define PROFILER_EMPTY_KEY 0xFFFFFFFF
+// EWMA weight 1/2^PROFILER_EWMA_SHIFT
+#define PROFILER_EWMA_SHIFT 3
+
+typedef struct
+{
+    uint32_t key;  /**< CAN ID, bit 31 set for extended IDs; PROFILER_EMPTY_KEY if unused */
+    uint32_t count;
+    uint32_t lastUs;
+    uint64_t periodTotalUs;
+    uint32_t minPeriodUs;
+    uint32_t maxPeriodUs;
+    uint32_t ewmaPeriodUs;
+    uint32_t ewmaJitterUs;
+    uint8_t lastDlc;
+} profile_entry_t;
+
+typedef struct
+{
+    uint8_t mac[6];
+} profile_request_t;
+
+// Written by the CAN receive task; the ESP-NOW transmit task reads it for dumps and tolerates torn entries
+static profile_entry_t profileTable[PROFILER_CAPACITY];
+static uint16_t profileUsed = 0;
+static uint32_t profileUntracked = 0;
+
+// Bus load over the current and last window; CAN receive task
+static uint32_t profileWindowStartMs = 0;
+static uint64_t profileWindowBits = 0;
+static uint32_t profileLoadPermille = 0;
+static uint32_t profileLoadPeakPermille = 0;
+
+// Cost of the per-frame update
+static uint32_t profileUpdates = 0;
+static uint64_t profileUpdateTotalUs = 0;
+static uint32_t profileUpdateMaxUs = 0;
+
+// Dump requests: ESP-NOW receive task -> transmit task; CAN requests are broadcast
+FrameRing<profile_request_t, PROFILER_QUEUE_DEPTH> profileRequests;
+static std::atomic<bool> profileBroadcastRequested{false};
+
+// Dump in progress; transmit task only
+static bool profileDumping = false;
+static const uint8_t *profileDestination = NULL;
+static uint8_t profileDestinationMac[6];
+static uint16_t profileCursor = 0;
+static unsigned long profileLastPacketMs = 0;
+static uint32_t profileDumps = 0;
+
+namespace trafficProfiler
+{
+    void initialize()
+    {
+        for (uint16_t i = 0; i < PROFILER_CAPACITY; i++)
+        {
+            profileTable[i].key = PROFILER_EMPTY_KEY;
+        }
+        profileUsed = 0;
+        profileWindowStartMs = millis();
+    }
+
+    // Bits on the wire, without stuff bits: SOF..EOF plus the 3-bit intermission
+    static inline uint32_t frameBits(const twai_message_t &message)
+    {
+        uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+        return (message.extd ? 67 : 47) + (message.rtr ? 0 : 8 * dlc);
+    }
+
+    // Close the load window once it has run its length; also called while the bus is idle
+    void service(uint32_t nowMs)
+    {
+        uint32_t elapsed = nowMs - profileWindowStartMs;
+        if (elapsed < PROFILER_LOAD_WINDOW_MS)
+        {
+            return;
+        }
+        profileLoadPermille = (uint32_t)(profileWindowBits * 1000000ULL / ((uint64_t)PROFILER_BITRATE * elapsed));
+        if (profileLoadPermille > profileLoadPeakPermille)
+        {
+            profileLoadPeakPermille = profileLoadPermille;
+        }
+        profileWindowBits = 0;
+        profileWindowStartMs = nowMs;
+    }
+
+    static profile_entry_t *findOrInsert(uint32_t key)
+    {
+        uint32_t index = (key * 2654435761u) & (PROFILER_CAPACITY - 1);
+        for (uint8_t probe = 0; probe < PROFILER_MAX_PROBES; probe++)
+        {
+            profile_entry_t &entry = profileTable[index];
+            if (entry.key == key)
+            {
+                return &entry;
+            }
+            if (entry.key == PROFILER_EMPTY_KEY)
+            {
+                if (profileUsed >= (PROFILER_CAPACITY * 3) / 4)
+                {
+                    return NULL;
+                }
+                memset(&entry, 0, sizeof(entry));
+                entry.key = key;
+                profileUsed++;
+                return &entry;
+            }
+            index = (index + 1) & (PROFILER_CAPACITY - 1);
+        }
+        return NULL;
+    }
+
+    // CAN receive task: account one received frame; constant time
+    void record(const twai_message_t &message, uint32_t rxMicros)
+    {
+        if (!PROFILER_ENABLED)
+        {
+            return;
+        }
+        uint32_t started = micros();
+        profileWindowBits += frameBits(message);
+
+        profile_entry_t *entry = findOrInsert(message.identifier | (message.extd ? 0x80000000 : 0));
+        if (entry == NULL)
+        {
+            profileUntracked++;
+        }
+        else
+        {
+            if (entry->count > 0)
+            {
+                uint32_t period = rxMicros - entry->lastUs;
+                entry->periodTotalUs += period;
+                if (entry->count == 1)
+                {
+                    entry->minPeriodUs = period;
+                    entry->maxPeriodUs = period;
+                    entry->ewmaPeriodUs = period;
+                }
+                else
+                {
+                    if (period < entry->minPeriodUs) entry->minPeriodUs = period;
+                    if (period > entry->maxPeriodUs) entry->maxPeriodUs = period;
+                    int32_t deviation = (int32_t)(period - entry->ewmaPeriodUs);
+                    entry->ewmaPeriodUs += deviation >> PROFILER_EWMA_SHIFT;
+                    uint32_t absolute = deviation < 0 ? (uint32_t)-deviation : (uint32_t)deviation;
+                    entry->ewmaJitterUs += ((int32_t)(absolute - entry->ewmaJitterUs)) >> PROFILER_EWMA_SHIFT;
+                }
+            }
+            entry->count++;
+            entry->lastUs = rxMicros;
+            entry->lastDlc = message.data_length_code;
+        }
+
+        uint32_t elapsed = micros() - started;
+        profileUpdateTotalUs += elapsed;
+        profileUpdates++;
+        if (elapsed > profileUpdateMaxUs)
+        {
+            profileUpdateMaxUs = elapsed;
+        }
+    }
+
+    static void toRecord(const profile_entry_t &entry, canEspNowWire::ProfileRecord &record)
+    {
+        record.key = entry.key;
+        record.count = entry.count;
+        record.meanPeriodUs = entry.count > 1 ? (uint32_t)(entry.periodTotalUs / (entry.count - 1)) : 0;
+        record.minPeriodUs = entry.minPeriodUs;
+        record.maxPeriodUs = entry.maxPeriodUs;
+        record.jitterUs = entry.ewmaJitterUs;
+        record.lastDlc = entry.lastDlc;
+    }
+
+    // ESP-NOW receive task: queue a dump for the requesting receiver
+    bool queueRequest(const uint8_t *mac)
+    {
+        profile_request_t request;
+        memcpy(request.mac, mac, 6);
+        if (!profileRequests.push(request))
+        {
+            return false;
+        }
+        if (espNowTxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowTxTaskHandle);
+        }
+        return true;
+    }
+
+    // Config task (CONFIG_PROFILE): broadcast a dump
+    void requestBroadcast()
+    {
+        profileBroadcastRequested = true;
+        if (espNowTxTaskHandle != NULL)
+        {
+            xTaskNotifyGive(espNowTxTaskHandle);
+        }
+    }
+
+    bool pending()
+    {
+        return profileDumping || profileBroadcastRequested.load() || !profileRequests.empty();
+    }
+
+    bool due()
+    {
+        return pending() && millis() - profileLastPacketMs >= PROFILER_PACKET_INTERVAL_MS;
+    }
+
+    // True while a dump to mac is still being sent
+    bool replyingTo(const uint8_t *mac)
+    {
+        return profileDumping && memcmp(profileDestination, mac, 6) == 0;
+    }
+
+    static bool start()
+    {
+        profile_request_t request;
+        if (profileBroadcastRequested.exchange(false))
+        {
+            profileDestination = broadcastAddress;
+        }
+        else if (profileRequests.pop(request))
+        {
+            // Reply by unicast (MAC-layer retries); broadcast if the peer table is full
+            memcpy(profileDestinationMac, request.mac, 6);
+            esp_err_t result = radioLink->addPeer(profileDestinationMac);
+            profileDestination = (result == ESP_OK || result == ESP_ERR_ESPNOW_EXIST) ? profileDestinationMac : broadcastAddress;
+        }
+        else
+        {
+            return false;
+        }
+        profileCursor = 0;
+        profileDumping = true;
+        return true;
+    }
+
+    // Transmit task: fill the next PACKET_PROFILE packet; 0 when nothing is pending
+    size_t buildPacket(uint8_t *buffer, size_t capacity, const uint8_t *&destination)
+    {
+        if (!profileDumping && !start())
+        {
+            return 0;
+        }
+        size_t length = canEspNowWire::HEADER_LEN;
+        uint8_t count = 0;
+        canEspNowWire::ProfileRecord record;
+        while (profileCursor < PROFILER_CAPACITY && length + canEspNowWire::PROFILE_RECORD_LEN <= capacity)
+        {
+            const profile_entry_t &entry = profileTable[profileCursor];
+            if (entry.key != PROFILER_EMPTY_KEY)
+            {
+                toRecord(entry, record);
+                canEspNowWire::encodeProfile(record, buffer + length);
+                length += canEspNowWire::PROFILE_RECORD_LEN;
+                count++;
+            }
+            profileCursor++;
+        }
+        uint8_t flags = 0;
+        if (profileCursor == PROFILER_CAPACITY)
+        {
+            flags = canEspNowWire::FLAG_FINAL;
+            profileDumping = false;
+            profileDumps++;
+        }
+        canEspNowWire::writeHeader(buffer, canEspNowWire::PACKET_PROFILE, flags, count);
+        destination = profileDestination;
+        profileLastPacketMs = millis();
+        return length;
+    }
+
+    void printStatus()
+    {
+        if (!PROFILER_ENABLED)
+        {
+            return;
+        }
+        debugf("[PROFILE] Bus load %lu.%lu%% (peak %lu.%lu%%), %u IDs, %lu untracked frames, update avg=%lu us max=%lu us, dumps=%lu\n",
+               (unsigned long)(profileLoadPermille / 10), (unsigned long)(profileLoadPermille % 10),
+               (unsigned long)(profileLoadPeakPermille / 10), (unsigned long)(profileLoadPeakPermille % 10),
+               profileUsed, (unsigned long)profileUntracked,
+               (unsigned long)(profileUpdates ? profileUpdateTotalUs / profileUpdates : 0),
+               (unsigned long)profileUpdateMaxUs, (unsigned long)profileDumps);
+    }
+
+    void printReport()
+    {
+        if (!PROFILER_ENABLED)
+        {
+            return;
+        }
+        printStatus();
+        canEspNowWire::ProfileRecord record;
+        for (uint16_t i = 0; i < PROFILER_CAPACITY; i++)
+        {
+            const profile_entry_t &entry = profileTable[i];
+            if (entry.key == PROFILER_EMPTY_KEY)
+            {
+                continue;
+            }
+            toRecord(entry, record);
+            debugf("[PROFILE]   ID=0x%03lX%s count=%lu period avg=%lu min=%lu max=%lu jitter=%lu us dlc=%u\n",
+                   (unsigned long)(record.key & 0x1FFFFFFF), (record.key & 0x80000000) ? "x" : "",
+                   (unsigned long)record.count, (unsigned long)record.meanPeriodUs,
+                   (unsigned long)record.minPeriodUs, (unsigned long)record.maxPeriodUs,
+                   (unsigned long)record.jitterUs, record.lastDlc);
+        }
+    }
+}
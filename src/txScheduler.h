@@ -0,0 +1,137 @@
+#pragma once
+#include "globals.h"
+#include "gatewayConfig.h"
+#include "metrics.h"
+
+// Frames waiting for the radio, per priority class
+#ifndef SCHED_QUEUE_DEPTH
+#define SCHED_QUEUE_DEPTH 64
+#endif
+
+#define RATE_LIMIT_COUNT (sizeof(rateLimits) / sizeof(rateLimits[0]))
+
+typedef struct
+{
+    uint32_t milliTokens;
+    uint32_t lastRefillMs;
+} token_bucket_t;
+
+// Only the ESP-NOW transmit task touches the scheduler; FrameRing is used as a plain FIFO
+static FrameRing<gateway_frame_t, SCHED_QUEUE_DEPTH> schedQueues[PRIORITY_CLASSES];
+static token_bucket_t tokenBuckets[RATE_LIMIT_COUNT];
+static uint32_t schedEnqueued[PRIORITY_CLASSES];
+static uint32_t schedRateLimited[PRIORITY_CLASSES];
+
+namespace txScheduler
+{
+    void initialize()
+    {
+        uint32_t now = millis();
+        for (size_t i = 0; i < RATE_LIMIT_COUNT; i++)
+        {
+            tokenBuckets[i].milliTokens = rateLimits[i].burst * 1000u;
+            tokenBuckets[i].lastRefillMs = now;
+        }
+    }
+
+    uint8_t classify(const twai_message_t &message)
+    {
+        if (message.extd)
+        {
+            return PRIORITY_LOW;
+        }
+        for (size_t i = 0; i < sizeof(priorityRanges) / sizeof(priorityRanges[0]); i++)
+        {
+            if (message.identifier >= priorityRanges[i].firstId && message.identifier <= priorityRanges[i].lastId)
+            {
+                return priorityRanges[i].priority;
+            }
+        }
+        return PRIORITY_LOW;
+    }
+
+    // Take a token for the frame's ID; false if its bucket is empty
+    static bool takeToken(const twai_message_t &message, uint32_t nowMs)
+    {
+        for (size_t i = 0; i < RATE_LIMIT_COUNT; i++)
+        {
+            const id_rate_limit_t &limit = rateLimits[i];
+            if (limit.framesPerSecond == 0 || limit.id != message.identifier)
+            {
+                continue;
+            }
+            token_bucket_t &bucket = tokenBuckets[i];
+            uint32_t capacity = limit.burst * 1000u;
+            uint32_t elapsed = nowMs - bucket.lastRefillMs;
+            if (elapsed > 60000)
+            {
+                elapsed = 60000;  // Bucket is full long before this; avoids overflow
+            }
+            uint32_t refill = elapsed * limit.framesPerSecond;
+            bucket.lastRefillMs = nowMs;
+            bucket.milliTokens = (capacity - bucket.milliTokens < refill) ? capacity : bucket.milliTokens + refill;
+            if (bucket.milliTokens < 1000)
+            {
+                return false;
+            }
+            bucket.milliTokens -= 1000;
+            return true;
+        }
+        return true;
+    }
+
+    // Queue a frame in its priority class; false if rate limited or the class queue is full
+    bool enqueue(const gateway_frame_t &frame, uint32_t nowMs)
+    {
+        uint8_t priority = classify(frame.message);
+        if (!takeToken(frame.message, nowMs))
+        {
+            schedRateLimited[priority]++;
+            metricFramesDropped++;
+            return false;
+        }
+        if (!schedQueues[priority].push(frame))
+        {
+            metricFramesDropped++;
+            return false;
+        }
+        schedEnqueued[priority]++;
+        return true;
+    }
+
+    // Pop the oldest frame from the highest-priority non-empty class
+    bool dequeue(gateway_frame_t &frame, uint8_t &priority)
+    {
+        for (priority = 0; priority < PRIORITY_CLASSES; priority++)
+        {
+            if (schedQueues[priority].pop(frame))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool empty()
+    {
+        for (uint8_t priority = 0; priority < PRIORITY_CLASSES; priority++)
+        {
+            if (!schedQueues[priority].empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void printStatus()
+    {
+        for (uint8_t priority = 0; priority < PRIORITY_CLASSES; priority++)
+        {
+            debugf("[SCHED] Class %u: queued=%lu waiting=%lu high water=%lu dropped=%lu rate limited=%lu\n",
+                   priority, (unsigned long)schedEnqueued[priority], (unsigned long)schedQueues[priority].size(),
+                   (unsigned long)schedQueues[priority].highWater(), (unsigned long)schedQueues[priority].dropped(),
+                   (unsigned long)schedRateLimited[priority]);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+/**
+ * Host (env:native) stand-ins for the Arduino-ESP32 and ESP-IDF APIs the
+ * gateway uses, so src/ and the tests in test/ build with a desktop compiler.
+ * Only what the firmware calls is provided. Time is simulated: millis() and
+ * micros() advance through hostClock, delay() and vTaskDelay(), never by
+ * themselves, so tests are deterministic.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+typedef uint8_t byte;
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_ESPNOW_BASE 0x3066
+#define ESP_ERR_ESPNOW_FULL (ESP_ERR_ESPNOW_BASE + 4)
+#define ESP_ERR_ESPNOW_NOT_FOUND (ESP_ERR_ESPNOW_BASE + 5)
+#define ESP_ERR_ESPNOW_EXIST (ESP_ERR_ESPNOW_BASE + 7)
+
+#define IRAM_ATTR
+
+// Simulated clock shared by millis(), micros(), esp_timer_get_time() and the FreeRTOS tick
+namespace hostClock
+{
+    inline uint64_t nowUs = 0;
+
+    inline void advanceMicros(uint64_t us) { nowUs += us; }
+    inline void advanceMillis(uint64_t ms) { nowUs += ms * 1000; }
+}
+
+inline unsigned long millis() { return (unsigned long)(hostClock::nowUs / 1000); }
+inline unsigned long micros() { return (unsigned long)hostClock::nowUs; }
+inline void delay(unsigned long ms) { hostClock::advanceMillis(ms); }
+
+// Deterministic xorshift; seed with hostRandomSeed for a different sequence
+inline uint32_t hostRandomSeed = 0x2545F491;
+inline uint32_t esp_random()
+{
+    hostRandomSeed ^= hostRandomSeed << 13;
+    hostRandomSeed ^= hostRandomSeed >> 17;
+    hostRandomSeed ^= hostRandomSeed << 5;
+    return hostRandomSeed;
+}
+
+class String
+{
+public:
+    String(const char *text = "") : text_(text ? text : "") {}
+    const char *c_str() const { return text_.c_str(); }
+    size_t length() const { return text_.size(); }
+    bool equals(const char *other) const { return text_ == other; }
+    bool operator==(const String &other) const { return text_ == other.text_; }
+    bool operator!=(const String &other) const { return text_ != other.text_; }
+
+private:
+    std::string text_;
+};
+
+// Serial output goes to stdout (muted with HostSerial::quiet) and optionally into output; input is queued with feed()
+class HostSerial
+{
+public:
+    void begin(unsigned long) {}
+    void print(const char *text) { write("%s", text); }
+    void print(const String &text) { write("%s", text.c_str()); }
+    void print(char c) { write("%c", c); }
+    void print(long value) { write("%ld", value); }
+    void print(int value) { write("%d", value); }
+    void print(unsigned long value) { write("%lu", value); }
+    void print(unsigned int value) { write("%u", value); }
+    void print(double value) { write("%.2f", value); }
+    template <typename T>
+    void println(const T &value)
+    {
+        print(value);
+        println();
+    }
+    void println() { write("\n"); }
+
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        int length = vwrite(format, args);
+        va_end(args);
+        return length;
+    }
+
+    int available() { return (int)(input_.size() - inputPos_); }
+    int read() { return inputPos_ < input_.size() ? (uint8_t)input_[inputPos_++] : -1; }
+
+    // Queue text for available()/read(), as if typed on the serial monitor
+    void feed(const char *text) { input_ += text; }
+
+    bool quiet = false;
+    bool capture = false;  // Append everything printed to output, quiet or not
+    std::string output;
+
+private:
+    void write(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        vwrite(format, args);
+        va_end(args);
+    }
+
+    int vwrite(const char *format, va_list args)
+    {
+        char text[512];
+        int length = vsnprintf(text, sizeof(text), format, args);
+        if (capture)
+        {
+            output += text;
+        }
+        if (!quiet)
+        {
+            fputs(text, stdout);
+        }
+        return length;
+    }
+
+    std::string input_;
+    size_t inputPos_ = 0;
+};
+inline HostSerial Serial;
+
+// Heap figures of a stock ESP32 module; the host has no meaningful equivalent
+class EspClass
+{
+public:
+    uint32_t getHeapSize() { return 327680; }
+    uint32_t getFreeHeap() { return 262144; }
+    uint32_t getMinFreeHeap() { return 262144; }
+    uint32_t getCpuFreqMHz() { return 240; }
+    void restart() { restarts++; }
+
+    uint32_t restarts = 0;
+};
+inline EspClass ESP;
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
@@ -0,0 +1,11 @@
+#pragma once
+#include <Arduino.h>
+
+// Updates are never attempted on the host
+class OtaUpdate
+{
+public:
+    OtaUpdate(int, const char *, const char *) {}
+    String getHostName() { return String("esp32-484F53"); }
+    void waitForOta() {}
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+// NVS kept in memory for the life of the process, shared by every Preferences object
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false)
+    {
+        namespace_ = name;
+        readOnly_ = readOnly;
+        return true;
+    }
+    void end() {}
+
+    size_t putBytes(const char *key, const void *value, size_t length)
+    {
+        if (readOnly_)
+        {
+            return 0;
+        }
+        const uint8_t *bytes = (const uint8_t *)value;
+        store()[namespace_ + "/" + key].assign(bytes, bytes + length);
+        return length;
+    }
+    size_t getBytesLength(const char *key)
+    {
+        const std::vector<uint8_t> *value = find(key);
+        return value ? value->size() : 0;
+    }
+    size_t getBytes(const char *key, void *buffer, size_t capacity)
+    {
+        const std::vector<uint8_t> *value = find(key);
+        if (value == nullptr || value->size() > capacity)
+        {
+            return 0;
+        }
+        memcpy(buffer, value->data(), value->size());
+        return value->size();
+    }
+
+    size_t putString(const char *key, const char *value) { return putBytes(key, value, strlen(value) + 1); }
+    size_t putString(const char *key, const String &value) { return putString(key, value.c_str()); }
+    String getString(const char *key, const char *fallback = "")
+    {
+        const std::vector<uint8_t> *value = find(key);
+        return value ? String((const char *)value->data()) : String(fallback);
+    }
+
+    size_t putUShort(const char *key, uint16_t value) { return putBytes(key, &value, sizeof(value)); }
+    uint16_t getUShort(const char *key, uint16_t fallback = 0) { return get(key, fallback); }
+    size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    uint32_t getUInt(const char *key, uint32_t fallback = 0) { return get(key, fallback); }
+
+    bool remove(const char *key) { return !readOnly_ && store().erase(namespace_ + "/" + key) > 0; }
+    bool clear()
+    {
+        std::map<std::string, std::vector<uint8_t>> &all = store();
+        for (auto it = all.begin(); it != all.end();)
+        {
+            it = it->first.compare(0, namespace_.size() + 1, namespace_ + "/") == 0 ? all.erase(it) : std::next(it);
+        }
+        return true;
+    }
+
+private:
+    static std::map<std::string, std::vector<uint8_t>> &store()
+    {
+        static std::map<std::string, std::vector<uint8_t>> values;
+        return values;
+    }
+
+    const std::vector<uint8_t> *find(const char *key)
+    {
+        auto it = store().find(namespace_ + "/" + key);
+        return it == store().end() ? nullptr : &it->second;
+    }
+
+    template <typename T>
+    T get(const char *key, T fallback)
+    {
+        T value;
+        return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : fallback;
+    }
+
+    std::string namespace_;
+    bool readOnly_ = false;
+};
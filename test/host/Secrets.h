@@ -0,0 +1,3 @@
+#pragma once
+// Host builds only; on target this comes from src/Secrets.h (see src/secrets.h.example)
+uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
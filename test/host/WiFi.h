@@ -0,0 +1,20 @@
+#pragma once
+#include <Arduino.h>
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+
+struct IPAddress
+{
+    String toString() const { return String("0.0.0.0"); }
+};
+
+// Never connected on the host
+class HostWiFi
+{
+public:
+    void mode(int) {}
+    bool isConnected() { return false; }
+    IPAddress localIP() { return IPAddress(); }
+};
+inline HostWiFi WiFi;
@@ -0,0 +1,27 @@
+#pragma once
+#include <Arduino.h>
+#include "esp_wifi.h"
+
+// Types only: the radio is DryRunRadioLink (src/radioLink.h) on the host
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+
+typedef enum
+{
+    ESP_NOW_SEND_SUCCESS = 0,
+    ESP_NOW_SEND_FAIL
+} esp_now_send_status_t;
+
+typedef struct
+{
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t lmk[16];
+    uint8_t channel;
+    wifi_interface_t ifidx;
+    bool encrypt;
+    void *priv;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_recv_cb_t)(const uint8_t *mac, const uint8_t *data, int length);
+typedef void (*esp_now_send_cb_t)(const uint8_t *mac, esp_now_send_status_t status);
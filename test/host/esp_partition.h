@@ -0,0 +1,85 @@
+#pragma once
+#include <Arduino.h>
+#include <string.h>
+#include <vector>
+
+// No flash on the host: lookups fail, as on a unit with the legacy partition table,
+// unless a test provides one partition with hostFlash::provide()
+typedef enum
+{
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+#define ESP_PARTITION_SUBTYPE_DATA_SPIFFS ((esp_partition_subtype_t)0x82)
+
+typedef struct
+{
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+// RAM-backed NOR flash: writes only clear bits, erases set whole sectors back to 0xFF
+namespace hostFlash
+{
+    inline esp_partition_t partition = {};
+    inline std::vector<uint8_t> bytes;
+    inline uint32_t erases = 0;
+    inline uint32_t writes = 0;
+
+    inline void provide(const char *label, uint32_t size, bool blank)
+    {
+        partition.type = ESP_PARTITION_TYPE_DATA;
+        partition.size = size;
+        strncpy(partition.label, label, sizeof(partition.label) - 1);
+        bytes.assign(size, blank ? 0xFF : 0x00);
+    }
+
+    inline bool inRange(const esp_partition_t *p, size_t offset, size_t length)
+    {
+        return p == &partition && offset + length <= bytes.size();
+    }
+}
+
+inline const esp_partition_t *esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char *label)
+{
+    return (label != nullptr && strcmp(label, hostFlash::partition.label) == 0 && !hostFlash::bytes.empty())
+               ? &hostFlash::partition
+               : nullptr;
+}
+inline esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *out, size_t length)
+{
+    if (!hostFlash::inRange(p, offset, length))
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memcpy(out, hostFlash::bytes.data() + offset, length);
+    return ESP_OK;
+}
+inline esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *data, size_t length)
+{
+    if (!hostFlash::inRange(p, offset, length))
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        hostFlash::bytes[offset + i] &= ((const uint8_t *)data)[i];
+    }
+    hostFlash::writes++;
+    return ESP_OK;
+}
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t length)
+{
+    if (!hostFlash::inRange(p, offset, length) || offset % 4096 != 0 || length % 4096 != 0)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memset(hostFlash::bytes.data() + offset, 0xFF, length);
+    hostFlash::erases++;
+    return ESP_OK;
+}
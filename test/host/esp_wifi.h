@@ -0,0 +1,18 @@
+#pragma once
+#include <Arduino.h>
+
+typedef enum
+{
+    WIFI_IF_STA,
+    WIFI_IF_AP
+} wifi_interface_t;
+
+// Fixed locally administered station MAC
+inline esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t *mac)
+{
+    static const uint8_t host[6] = {0x02, 0x48, 0x4F, 0x53, 0x54, 0x01};
+    memcpy(mac, host, sizeof(host));
+    return ESP_OK;
+}
+inline esp_err_t esp_wifi_start() { return ESP_OK; }
+inline esp_err_t esp_wifi_stop() { return ESP_OK; }
@@ -0,0 +1,43 @@
+#pragma once
+#include "FreeRTOS.h"
+#include <string.h>
+#include <deque>
+#include <vector>
+
+// Copying FIFO with the FreeRTOS queue semantics the gateway relies on; never blocks
+struct HostQueue
+{
+    size_t itemSize;
+    size_t capacity;
+    std::deque<std::vector<uint8_t>> items;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return new HostQueue{itemSize, length, {}};
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t)
+{
+    if (queue->items.size() >= queue->capacity)
+    {
+        return pdFALSE;
+    }
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t)
+{
+    if (queue->items.empty())
+    {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return (UBaseType_t)queue->items.size(); }
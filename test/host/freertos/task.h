@@ -0,0 +1,33 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// Tasks are registered but never run: host tests call the work a task loop does
+// (e.g. canHelper::checkCanBusForMessages(), espNowHelper::service()) directly.
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+namespace hostTasks
+{
+    inline unsigned created = 0;
+    inline uint32_t notifications = 0;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t,
+                                          TaskHandle_t *handle, BaseType_t)
+{
+    hostTasks::created++;
+    if (handle != nullptr)
+    {
+        *handle = (TaskHandle_t)(uintptr_t)hostTasks::created;
+    }
+    return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { hostClock::advanceMillis(ticks); }
+inline void vTaskDelete(TaskHandle_t) {}
+inline TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+inline void xTaskNotifyGive(TaskHandle_t) { hostTasks::notifications++; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+inline BaseType_t xPortGetCoreID() { return 0; }
+#define tskNO_AFFINITY 0x7FFFFFFF
@@ -0,0 +1,159 @@
+// Synthetic saturation benchmark on the host: SyntheticCanBus drives the
+// receive and transmit task passes on the simulated clock and the [BENCH]
+// report is checked. Host throughput is measured on the wall clock; it says
+// nothing about the ESP32, whose figures come from tools/can_benchmark.py.
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <string>
+
+#define CAN_REPLAY 1
+#define CAN_BENCH 1
+
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+static const uint32_t STEP_US = 250;
+
+typedef std::map<std::string, unsigned long> bench_report_t;
+
+struct BenchRun
+{
+    bench_report_t report;
+    double wallSeconds;
+};
+
+// Fields of the first [BENCH] line printed since the last call
+static bench_report_t takeReport()
+{
+    bench_report_t report;
+    size_t start = Serial.output.find("[BENCH]");
+    if (start != std::string::npos)
+    {
+        std::string line = Serial.output.substr(start, Serial.output.find('\n', start) - start);
+        char key[32];
+        unsigned long value;
+        for (size_t pos = line.find(' '); pos != std::string::npos; pos = line.find(' ', pos + 1))
+        {
+            if (sscanf(line.c_str() + pos + 1, "%31[a-z0-9_]=%lu", key, &value) == 2)
+            {
+                report[key] = value;
+            }
+        }
+    }
+    Serial.output.clear();
+    return report;
+}
+
+/**
+ * Run one BENCH command to its report, as the two tasks would. The transmit
+ * pass is skipped from stallMs before the end of the run until stallMs after
+ * it, like a radio that stops taking packets.
+ */
+static BenchRun runBench(const char *command, uint32_t stallMs = 0)
+{
+    Serial.output.clear();
+    Serial.feed(command);
+    Serial.feed("\n");
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    uint64_t limitUs = hostClock::nowUs + 60000000;
+    while (hostClock::nowUs < limitUs && Serial.output.find("[BENCH]") == std::string::npos)
+    {
+        canHelper::checkCanBusForMessages();  // Parses the command on the first pass
+        canHelper::serviceBenchmark();
+        uint64_t endUs = (uint64_t)syntheticCanBus.startedUs() + (uint64_t)syntheticCanBus.seconds * 1000000;
+        if (hostClock::nowUs + (uint64_t)stallMs * 1000 < endUs || hostClock::nowUs >= endUs + (uint64_t)stallMs * 1000)
+        {
+            espNowHelper::service();
+        }
+        hostClock::advanceMicros(STEP_US);
+    }
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+    return BenchRun{takeReport(), wall.count()};
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_periodic_run_forwards_every_frame()
+{
+    BenchRun run = runBench("BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=0 seconds=2");
+    bench_report_t &report = run.report;
+    TEST_ASSERT_EQUAL(8000, report["generated"]);
+    TEST_ASSERT_EQUAL(8000, report["handled"]);
+    TEST_ASSERT_EQUAL(0, report["overruns"]);
+    TEST_ASSERT_EQUAL(0, report["dropped"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(2000, report["drain_ms"]);
+    TEST_ASSERT_LESS_OR_EQUAL(2005, report["drain_ms"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(3990, report["fps"]);
+    TEST_ASSERT_LESS_OR_EQUAL(4000, report["fps"]);
+    TEST_ASSERT_EQUAL(1, report.count("heap_peak_used_boot"));
+}
+
+void test_stalled_radio_lowers_throughput()
+{
+    // The last 25 ms of frames (100) fit in the ring, so nothing is dropped, but they leave it 25 ms late
+    BenchRun run = runBench("BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=0 seconds=1", 25);
+    bench_report_t &report = run.report;
+    TEST_ASSERT_EQUAL(4000, report["handled"]);
+    TEST_ASSERT_EQUAL(0, report["dropped"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(1025, report["drain_ms"]);
+    TEST_ASSERT_LESS_OR_EQUAL(4000 * 1000 / 1025, report["fps"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(25000, report["max_us"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(100, report["ring_high_water"]);
+}
+
+void test_max_and_high_water_cover_one_run()
+{
+    // Follows the stalled run: its 25 ms latency and full ring must not carry over
+    BenchRun run = runBench("BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=0 seconds=1");
+    bench_report_t &report = run.report;
+    TEST_ASSERT_EQUAL(4000, report["handled"]);
+    TEST_ASSERT_LESS_THAN(25000, report["max_us"]);
+    TEST_ASSERT_LESS_THAN(100, report["ring_high_water"]);
+}
+
+// The profiles of tools/benchmark_baseline.json, shortened, timed on the host
+void test_host_throughput()
+{
+    static const char *const profiles[][2] = {
+        {"periodic_4k", "BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=0 seconds=5"},
+        {"bursty_4k", "BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=32 control=0 seconds=5"},
+        {"control_mix_4k", "BENCH rate=4000 ids=64 ext=10 dlc8=70 burst=1 control=20 seconds=5"},
+    };
+    for (const auto &profile : profiles)
+    {
+        BenchRun run = runBench(profile[1]);
+        bench_report_t &report = run.report;
+        TEST_ASSERT_EQUAL(20000, report["generated"]);
+        TEST_ASSERT_EQUAL(0, report["overruns"]);
+        TEST_ASSERT_EQUAL(0, report["dropped"]);
+
+        char message[200];
+        snprintf(message, sizeof(message),
+                 "%s: %.0f frames/s host wall clock (%.2f us/frame), p50=%lu us p99=%lu us p99.9=%lu us simulated",
+                 profile[0], report["handled"] / run.wallSeconds, run.wallSeconds * 1e6 / report["handled"],
+                 report["p50_us"], report["p99_us"], report["p999_us"]);
+        TEST_MESSAGE(message);
+    }
+}
+
+int main()
+{
+    Serial.quiet = true;
+    Serial.capture = true;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_periodic_run_forwards_every_frame);
+    RUN_TEST(test_stalled_radio_lowers_throughput);
+    RUN_TEST(test_max_and_high_water_cover_one_run);
+    RUN_TEST(test_host_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,178 @@
+// canFilter::compute(): the derived code/mask must pass every wanted ID
+// through the TWAI acceptance filter and admit as few others as it reports.
+#include <unity.h>
+#include "canFilter.h"
+
+using namespace canFilter;
+
+// TWAI acceptance check for a standard data frame (mask bit 1 = don't care)
+static bool hardwareAccepts(const AcceptanceFilter &filter, uint32_t id)
+{
+    if (filter.single)
+    {
+        return (((id << 21) ^ filter.code) & ~filter.mask & 0xFFE00000) == 0;
+    }
+    uint32_t code1 = filter.code >> 21, mask1 = filter.mask >> 21;
+    uint32_t code2 = (filter.code >> 5) & 0x7FF, mask2 = (filter.mask >> 5) & 0x7FF;
+    return ((id ^ code1) & ~mask1 & 0x7FF) == 0 || ((id ^ code2) & ~mask2 & 0x7FF) == 0;
+}
+
+static uint16_t countAccepted(const AcceptanceFilter &filter)
+{
+    uint16_t accepted = 0;
+    for (uint32_t id = 0; id < STD_ID_COUNT; id++)
+    {
+        accepted += hardwareAccepts(filter, id);
+    }
+    return accepted;
+}
+
+// No wanted ID rejected, and acceptedIds is exact (single) or an upper bound (dual)
+static AcceptanceFilter checkFilter(const IdSet &ids)
+{
+    AcceptanceFilter filter = compute(ids);
+    for (uint32_t id = 0; id < STD_ID_COUNT; id++)
+    {
+        if (ids.contains(id))
+        {
+            TEST_ASSERT_TRUE_MESSAGE(hardwareAccepts(filter, id), "wanted ID rejected by the hardware filter");
+        }
+    }
+    uint16_t accepted = countAccepted(filter);
+    TEST_ASSERT_GREATER_OR_EQUAL(ids.count(), accepted);
+    if (filter.single)
+    {
+        TEST_ASSERT_EQUAL(accepted, filter.acceptedIds);
+    }
+    else
+    {
+        TEST_ASSERT_GREATER_OR_EQUAL(accepted, filter.acceptedIds);
+    }
+    return filter;
+}
+
+static uint32_t randomState = 2024;
+static uint32_t nextRandom()
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return randomState >> 8;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_id_set_membership()
+{
+    IdSet ids;
+    ids.clear();
+    ids.add(0x000);
+    ids.addRange(0x7FE, 0x900);  // Clipped at 0x7FF
+    ids.add(0x800);              // Not a standard ID
+    TEST_ASSERT_TRUE(ids.contains(0x000));
+    TEST_ASSERT_TRUE(ids.contains(0x7FF));
+    TEST_ASSERT_FALSE(ids.contains(0x001));
+    TEST_ASSERT_FALSE(ids.contains(0x800));
+    TEST_ASSERT_EQUAL(3, ids.count());
+}
+
+void test_empty_and_full_sets_accept_all()
+{
+    IdSet ids;
+    ids.clear();
+    AcceptanceFilter filter = compute(ids);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, filter.mask);
+    TEST_ASSERT_EQUAL(STD_ID_COUNT, filter.acceptedIds);
+    ids.addRange(0x000, 0x7FF);
+    filter = compute(ids);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, filter.mask);
+    TEST_ASSERT_EQUAL(STD_ID_COUNT, filter.acceptedIds);
+}
+
+void test_single_id_is_exact()
+{
+    IdSet ids;
+    ids.clear();
+    ids.add(0x321);
+    AcceptanceFilter filter = checkFilter(ids);
+    TEST_ASSERT_TRUE(filter.single);
+    TEST_ASSERT_EQUAL_HEX32(0x321u << 21, filter.code);
+    TEST_ASSERT_EQUAL_HEX32(0x001FFFFF, filter.mask);
+    TEST_ASSERT_EQUAL(1, filter.acceptedIds);
+}
+
+void test_aligned_range_is_one_mask()
+{
+    IdSet ids;
+    ids.clear();
+    ids.addRange(0x200, 0x20F);
+    AcceptanceFilter filter = checkFilter(ids);
+    TEST_ASSERT_EQUAL(16, filter.acceptedIds);
+    TEST_ASSERT_EQUAL(16, countAccepted(filter));
+}
+
+void test_two_clusters_use_both_filters()
+{
+    // One mask over both clusters would admit most of the ID space
+    IdSet ids;
+    ids.clear();
+    ids.addRange(0x100, 0x107);
+    ids.addRange(0x700, 0x703);
+    AcceptanceFilter filter = checkFilter(ids);
+    TEST_ASSERT_FALSE(filter.single);
+    TEST_ASSERT_EQUAL(12, filter.acceptedIds);
+    TEST_ASSERT_EQUAL(12, countAccepted(filter));
+}
+
+void test_control_ids_with_a_range()
+{
+    // Typical gateway set: forwarded range plus the OTA trigger and config request IDs
+    IdSet ids;
+    ids.clear();
+    ids.addRange(0x400, 0x47F);
+    ids.add(0x000);
+    ids.add(0x001);
+    AcceptanceFilter filter = checkFilter(ids);
+    TEST_ASSERT_EQUAL(130, countAccepted(filter));
+}
+
+void test_random_sets_never_reject_wanted_ids()
+{
+    for (uint32_t round = 0; round < 200; round++)
+    {
+        IdSet ids;
+        ids.clear();
+        uint32_t shape = round % 4;
+        uint32_t count = 1 + nextRandom() % 24;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t id = nextRandom() % STD_ID_COUNT;
+            if (shape == 0)
+            {
+                ids.add(id);  // Scattered
+            }
+            else if (shape == 1)
+            {
+                ids.addRange(id, id + nextRandom() % 32);  // Ranges
+            }
+            else
+            {
+                // Clusters around one or two bases
+                ids.add(((shape == 2 || i % 2) ? 0x120 : 0x6A0) + nextRandom() % 16);
+            }
+        }
+        checkFilter(ids);
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_id_set_membership);
+    RUN_TEST(test_empty_and_full_sets_accept_all);
+    RUN_TEST(test_single_id_is_exact);
+    RUN_TEST(test_aligned_range_is_one_mask);
+    RUN_TEST(test_two_clusters_use_both_filters);
+    RUN_TEST(test_control_ids_with_a_range);
+    RUN_TEST(test_random_sets_never_reject_wanted_ids);
+    return UNITY_END();
+}
@@ -0,0 +1,163 @@
+// CAN -> ESP-NOW forwarding path on the host: frames injected into HostCanBus
+// go through the CAN receive handler, the ring, the last-value cache, the
+// scheduler and the batcher to the radio, as the two tasks would move them.
+#include <unity.h>
+#include <vector>
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+// Dry-run radio keeping a copy of every packet handed to it
+class CaptureRadioLink : public DryRunRadioLink
+{
+public:
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        sent.emplace_back(data, data + length);
+        return DryRunRadioLink::send(mac, data, length);
+    }
+
+    std::vector<std::vector<uint8_t>> sent;
+};
+
+static CaptureRadioLink captureRadioLink;
+
+static twai_message_t standardFrame(uint32_t identifier, uint8_t fill)
+{
+    twai_message_t message = {};
+    message.identifier = identifier;
+    message.data_length_code = 8;
+    memset(message.data, fill, sizeof(message.data));
+    return message;
+}
+
+// Run the receive and transmit task passes until every batch has gone out
+static void pump()
+{
+    canHelper::checkCanBusForMessages();
+    espNowHelper::service();
+    hostClock::advanceMillis(BATCH_FLUSH_DEADLINE_MS);
+    espNowHelper::service();
+}
+
+// Frames of every captured PACKET_FRAMES packet, in send order
+static std::vector<canEspNowWire::Frame> forwardedFrames()
+{
+    std::vector<canEspNowWire::Frame> frames;
+    for (const std::vector<uint8_t> &packet : captureRadioLink.sent)
+    {
+        canEspNowWire::PacketReader reader;
+        canEspNowWire::Frame frame;
+        if (!reader.begin(packet.data(), packet.size()) || reader.type() != canEspNowWire::PACKET_FRAMES)
+        {
+            continue;
+        }
+        while (reader.next(frame))
+        {
+            frames.push_back(frame);
+        }
+    }
+    return frames;
+}
+
+void setUp()
+{
+    captureRadioLink.sent.clear();
+}
+
+void tearDown() {}
+
+void test_frame_is_forwarded_with_its_payload()
+{
+    twai_message_t message = standardFrame(0x321, 0xA5);
+    message.data[0] = 0x01;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    pump();
+
+    std::vector<canEspNowWire::Frame> frames = forwardedFrames();
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL_HEX32(0x321, frames[0].identifier);
+    TEST_ASSERT_FALSE(frames[0].extended);
+    TEST_ASSERT_EQUAL(8, frames[0].dlc);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(message.data, frames[0].data, 8);
+}
+
+void test_frames_share_a_packet()
+{
+    for (uint32_t id = 0x400; id < 0x410; id++)
+    {
+        TEST_ASSERT_TRUE(hostCanBus.inject(standardFrame(id, (uint8_t)id)));
+    }
+    pump();
+
+    std::vector<canEspNowWire::Frame> frames = forwardedFrames();
+    TEST_ASSERT_EQUAL(16, frames.size());
+    TEST_ASSERT_LESS_THAN(16, captureRadioLink.sent.size());
+    for (uint32_t i = 0; i < frames.size(); i++)
+    {
+        TEST_ASSERT_EQUAL_HEX32(0x400 + i, frames[i].identifier);
+    }
+}
+
+void test_extended_frame_is_forwarded()
+{
+    twai_message_t message = standardFrame(0x18FEF100, 0x11);
+    message.extd = 1;
+    message.data_length_code = 2;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    pump();
+
+    std::vector<canEspNowWire::Frame> frames = forwardedFrames();
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_TRUE(frames[0].extended);
+    TEST_ASSERT_EQUAL_HEX32(0x18FEF100, frames[0].identifier);
+    TEST_ASSERT_EQUAL(2, frames[0].dlc);
+}
+
+void test_unchanged_frame_waits_for_heartbeat()
+{
+    twai_message_t message = standardFrame(0x500, 0x42);
+    hostCanBus.inject(message);
+    pump();
+    hostCanBus.inject(message);
+    pump();
+    TEST_ASSERT_EQUAL(1, forwardedFrames().size());
+
+    hostClock::advanceMillis(LVC_HEARTBEAT_MS);
+    hostCanBus.inject(message);
+    pump();
+    TEST_ASSERT_EQUAL(2, forwardedFrames().size());
+}
+
+void test_control_frames_are_not_forwarded()
+{
+    // OTA trigger for another unit and a configuration frame are consumed by the gateway
+    twai_message_t ota = standardFrame(0x000, 0x00);
+    ota.data_length_code = 3;
+    twai_message_t config = standardFrame(configCanIds[0], 0x00);
+    hostCanBus.inject(ota);
+    hostCanBus.inject(config);
+    pump();
+
+    TEST_ASSERT_EQUAL(0, forwardedFrames().size());
+}
+
+int main()
+{
+    Serial.quiet = true;
+    radioLink = &captureRadioLink;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    configHelper::startTask();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_is_forwarded_with_its_payload);
+    RUN_TEST(test_frames_share_a_packet);
+    RUN_TEST(test_extended_frame_is_forwarded);
+    RUN_TEST(test_unchanged_frame_waits_for_heartbeat);
+    RUN_TEST(test_control_frames_are_not_forwarded);
+    return UNITY_END();
+}
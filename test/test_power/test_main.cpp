@@ -0,0 +1,148 @@
+// Power saving on the host: which traffic postpones sleep, and the gateway's
+// own periodic broadcasts pausing while the bus is idle.
+#include <unity.h>
+#include <vector>
+
+#define WRITABLE_RANGE_TABLE {0x300, 0x30F}
+
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+// Dry-run radio keeping the type of every packet handed to it
+class CaptureRadioLink : public DryRunRadioLink
+{
+public:
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        types.push_back(data[0] & 0x0F);  // Low nibble of the header's first byte
+        return DryRunRadioLink::send(mac, data, length);
+    }
+
+    size_t count(canEspNowWire::PacketType type) const
+    {
+        size_t n = 0;
+        for (uint8_t sent : types)
+        {
+            n += sent == type;
+        }
+        return n;
+    }
+
+    std::vector<uint8_t> types;
+};
+
+static CaptureRadioLink captureRadioLink;
+static const uint8_t senderMac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0D};
+
+// A packet from senderMac through the gateway's receive path
+static void receive(const uint8_t *data, size_t length)
+{
+    espNowHelper::OnDataRecv(senderMac, data, (int)length);
+    espnow_packet_t packet;
+    while (espNowRxRing.pop(packet))
+    {
+        espNowHelper::handlePacket(packet);
+    }
+}
+
+// PACKET_FRAMES carrying one frame, relayed with the given sequence number
+static size_t framesPacket(uint8_t *buffer, uint32_t identifier, uint16_t seq)
+{
+    canEspNowWire::PacketWriter writer;
+    writer.begin(buffer, ESP_NOW_MAX_DATA_LEN, canEspNowWire::PACKET_FRAMES, true, canEspNowWire::FLAG_RELAY);
+    canEspNowWire::Frame frame = {};
+    frame.identifier = identifier;
+    frame.dlc = 1;
+    writer.append(frame);
+    size_t length = writer.finish();
+    canEspNowWire::RelayInfo info = {0x12345678, seq, 0};
+    canEspNowWire::writeRelay(buffer, info);
+    return length;
+}
+
+// Run the transmit task and the stats loop for ms milliseconds of quiet bus
+static void runQuiet(uint32_t ms)
+{
+    for (uint32_t i = 0; i < ms; i += 100)
+    {
+        espNowHelper::service();
+        if (i % STATS_PUBLISH_INTERVAL_MS == 0)
+        {
+            canHelper::publishStats();
+        }
+        hostClock::advanceMillis(100);
+    }
+}
+
+void setUp()
+{
+    captureRadioLink.types.clear();
+}
+
+void tearDown() {}
+
+void test_only_bus_bound_packets_postpone_sleep()
+{
+    uint8_t packet[ESP_NOW_MAX_DATA_LEN];
+    hostClock::advanceMillis(1000);
+    uint32_t quietSince = powerLastActivityMs;
+
+    uint8_t reply[canEspNowWire::HEADER_LEN];
+    canEspNowWire::writeHeader(reply, canEspNowWire::PACKET_TIME_REPLY, 0, 0);
+    receive(reply, sizeof(reply));
+    receive(packet, framesPacket(packet, 0x123, 1));  // Not writable: never reaches the bus
+    TEST_ASSERT_EQUAL(quietSince, powerLastActivityMs);
+
+    receive(packet, framesPacket(packet, 0x301, 2));
+    uint32_t written = powerLastActivityMs;
+    TEST_ASSERT_EQUAL(millis(), written);
+
+    // The same packet relayed back by another gateway is a duplicate
+    hostClock::advanceMillis(RELAY_SEEN_TTL_MS / 2);
+    receive(packet, framesPacket(packet, 0x301, 2));
+    TEST_ASSERT_EQUAL(written, powerLastActivityMs);
+}
+
+void test_broadcasts_pause_while_the_bus_is_idle()
+{
+    twai_message_t message = {};
+    message.identifier = 0x123;
+    message.data_length_code = 1;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    canHelper::checkCanBusForMessages();
+    runQuiet(POWER_BROADCAST_IDLE_MS);
+    TEST_ASSERT_GREATER_THAN(0, captureRadioLink.count(canEspNowWire::PACKET_TIME));
+    TEST_ASSERT_GREATER_THAN(0, captureRadioLink.count(canEspNowWire::PACKET_STATS));
+
+    captureRadioLink.types.clear();
+    runQuiet(3 * STATS_PUBLISH_INTERVAL_MS);
+    TEST_ASSERT_EQUAL(0, captureRadioLink.count(canEspNowWire::PACKET_TIME));
+    TEST_ASSERT_EQUAL(0, captureRadioLink.count(canEspNowWire::PACKET_STATS));
+    // Sending nothing did not count as traffic either
+    TEST_ASSERT_TRUE(powerManager::busIdle());
+
+    // The next frame on the bus brings them back
+    message.data[0] = 1;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    canHelper::checkCanBusForMessages();
+    runQuiet(TIMESYNC_INTERVAL_MS + 100);
+    TEST_ASSERT_GREATER_THAN(0, captureRadioLink.count(canEspNowWire::PACKET_TIME));
+}
+
+int main()
+{
+    Serial.quiet = true;
+    radioLink = &captureRadioLink;
+    canHelper::initialize();
+    canHelper::startTxTask();
+    espNowHelper::initialize();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_only_bus_bound_packets_postpone_sleep);
+    RUN_TEST(test_broadcasts_pause_while_the_bus_is_idle);
+    return UNITY_END();
+}
@@ -0,0 +1,234 @@
+// canEspNowReceiver::Receiver decoding every gateway packet type into its
+// stores, plus a decode-throughput benchmark.
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <CanEspNowReceiver.h>
+
+using namespace canEspNowWire;
+using canEspNowReceiver::FrameValue;
+using canEspNowReceiver::SignalValue;
+
+typedef canEspNowReceiver::Receiver<256, 64> TestReceiver;
+
+static Frame frameFor(uint32_t identifier, uint8_t fill, uint8_t dlc = 8)
+{
+    Frame frame = {};
+    frame.identifier = identifier;
+    frame.dlc = dlc;
+    memset(frame.data, fill, dlc);
+    return frame;
+}
+
+// One packet of frames; ages are in ms for PACKET_STORED, offsets in us otherwise
+static size_t buildFrames(uint8_t *buffer, PacketType type, uint8_t flags, uint32_t base,
+                          const Frame *frames, size_t count)
+{
+    PacketWriter writer;
+    writer.begin(buffer, MAX_PACKET_LEN, type, true, flags);
+    writer.setBase(base);
+    for (size_t i = 0; i < count; i++)
+    {
+        writer.append(frames[i]);
+    }
+    return writer.finish();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_frames_are_stored_per_id()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    Frame frames[] = {frameFor(0x100, 0x11), frameFor(0x101, 0x22, 2), frameFor(0x18FEF100, 0x33)};
+    frames[2].extended = true;
+    size_t length = buildFrames(packet, PACKET_FRAMES, 0, 0, frames, 3);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, length, 5000));
+
+    FrameValue value;
+    TEST_ASSERT_TRUE(receiver.frames.read(0x101, false, value));
+    TEST_ASSERT_EQUAL(2, value.dlc);
+    TEST_ASSERT_EQUAL_HEX8(0x22, value.data[1]);
+    TEST_ASSERT_EQUAL_UINT32(5000, value.capturedUs);
+    TEST_ASSERT_TRUE(receiver.frames.read(0x18FEF100, true, value));
+    TEST_ASSERT_FALSE(receiver.frames.read(0x18FEF100, false, value));
+    TEST_ASSERT_EQUAL(3, receiver.frames.size());
+    TEST_ASSERT_EQUAL(3, receiver.framesDecoded());
+}
+
+void test_timestamps_map_to_the_receiver_clock()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    // PACKET_TIME: gateway clock 1,000,000 arrives at local 250,000
+    writeHeader(packet, PACKET_TIME, 0, 1);
+    packet[HEADER_LEN] = 7;
+    putU32(packet + HEADER_LEN + 1, 1000000);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, HEADER_LEN + TIME_SYNC_LEN, 250000));
+
+    Frame frame = frameFor(0x200, 0x44);
+    frame.offset = -300;
+    size_t length = buildFrames(packet, PACKET_FRAMES, FLAG_TIMESTAMPS, 1010000, &frame, 1);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, length, 262000));
+    FrameValue value;
+    TEST_ASSERT_TRUE(receiver.frames.read(0x200, false, value));
+    TEST_ASSERT_EQUAL_UINT32(259700, value.capturedUs);
+
+    // The reply echoes the request once
+    uint8_t reply[HEADER_LEN + TIME_REPLY_LEN];
+    TEST_ASSERT_EQUAL(sizeof(reply), receiver.buildTimeReply(reply, sizeof(reply), 251000));
+    TimeReply decoded;
+    decodeTimeReply(reply + HEADER_LEN, decoded);
+    TEST_ASSERT_EQUAL(7, decoded.seq);
+    TEST_ASSERT_EQUAL_UINT32(1000000, decoded.t1);
+    TEST_ASSERT_EQUAL_UINT32(250000, decoded.t2);
+    TEST_ASSERT_EQUAL_UINT32(251000, decoded.t3);
+    TEST_ASSERT_EQUAL(0, receiver.buildTimeReply(reply, sizeof(reply), 252000));
+}
+
+void test_stored_frames_do_not_overwrite_newer_values()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    Frame live = frameFor(0x300, 0xAA);
+    size_t length = buildFrames(packet, PACKET_FRAMES, 0, 0, &live, 1);
+    receiver.onPacket(packet, length, 10000000);
+
+    // Buffered during an outage: captured 2 s before arrival
+    Frame stored = frameFor(0x300, 0x55);
+    length = buildFrames(packet, PACKET_STORED, 0, 2000, &stored, 1);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, length, 10100000));
+    FrameValue value;
+    TEST_ASSERT_TRUE(receiver.frames.read(0x300, false, value));
+    TEST_ASSERT_EQUAL_HEX8(0xAA, value.data[0]);
+    TEST_ASSERT_EQUAL(1, receiver.frames.stale());
+}
+
+void test_signals_and_stats()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    PacketWriter writer;
+    writer.begin(packet, sizeof(packet), PACKET_SIGNALS);
+    SignalUpdate update = {3, 0xF83, 0};
+    writer.append(update);
+    update = {200, 1, 0};  // Beyond SIGNAL_CAPACITY: ignored
+    writer.append(update);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, writer.finish(), 1000));
+    SignalValue signal;
+    TEST_ASSERT_TRUE(receiver.readSignal(3, signal));
+    TEST_ASSERT_EQUAL_HEX32(0xF83, (uint32_t)signal.raw);
+    TEST_ASSERT_FALSE(receiver.readSignal(4, signal));
+    TEST_ASSERT_EQUAL(2, receiver.signalsDecoded());
+
+    GatewayStats stats = {};
+    stats.uptimeMs = 123456;
+    stats.framesIn = 42;
+    writeHeader(packet, PACKET_STATS, 0, 1);
+    encodeStats(stats, packet + HEADER_LEN);
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, HEADER_LEN + STATS_LEN, 2000));
+    GatewayStats decoded;
+    TEST_ASSERT_TRUE(receiver.readStats(decoded));
+    TEST_ASSERT_EQUAL_UINT32(123456, decoded.uptimeMs);
+    TEST_ASSERT_EQUAL_UINT32(42, decoded.framesIn);
+}
+
+void test_reliable_duplicate_re_sends_the_ack()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    uint8_t ack[HEADER_LEN + ACK_LEN];
+    Frame frame = frameFor(0x010, 0x01);
+    size_t length = buildFrames(packet, PACKET_RELIABLE, FLAG_TIMESTAMPS, 0, &frame, 1);
+    writeSequence(packet, 5);
+
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, length, 1000));
+    TEST_ASSERT_EQUAL(sizeof(ack), receiver.buildAck(ack, sizeof(ack)));
+    TEST_ASSERT_EQUAL(0, receiver.buildAck(ack, sizeof(ack)));
+
+    // The gateway did not get that ACK and retransmits
+    TEST_ASSERT_TRUE(receiver.onPacket(packet, length, 2000));
+    TEST_ASSERT_EQUAL(1, receiver.retransmitted());
+    TEST_ASSERT_EQUAL(1, receiver.framesDecoded());
+    TEST_ASSERT_EQUAL(sizeof(ack), receiver.buildAck(ack, sizeof(ack)));
+    AckInfo info;
+    decodeAck(ack + HEADER_LEN, info);
+    TEST_ASSERT_EQUAL(5, info.cumulative);
+}
+
+void test_malformed_packets_are_counted()
+{
+    TestReceiver receiver;
+    uint8_t packet[MAX_PACKET_LEN];
+    Frame frames[] = {frameFor(0x100, 0x11), frameFor(0x200, 0x22)};
+    size_t length = buildFrames(packet, PACKET_FRAMES, 0, 0, frames, 2);
+
+    // Second record cut short: the first one is kept
+    TEST_ASSERT_FALSE(receiver.onPacket(packet, length - 3, 1000));
+    FrameValue value;
+    TEST_ASSERT_TRUE(receiver.frames.read(0x100, false, value));
+    TEST_ASSERT_FALSE(receiver.frames.read(0x200, false, value));
+    TEST_ASSERT_FALSE(receiver.onPacket(packet, 2, 1000));
+    TEST_ASSERT_EQUAL(2, receiver.malformed());
+}
+
+// Full timestamped packets of a 64-ID mix, decoded back to back
+void test_decode_throughput_benchmark()
+{
+    static TestReceiver receiver;
+    const size_t PACKETS = 64;
+    static uint8_t packets[PACKETS][MAX_PACKET_LEN];
+    size_t lengths[PACKETS];
+    uint32_t framesPerRound = 0;
+    for (size_t p = 0; p < PACKETS; p++)
+    {
+        PacketWriter writer;
+        writer.begin(packets[p], MAX_PACKET_LEN, PACKET_FRAMES, true, FLAG_TIMESTAMPS);
+        for (uint32_t i = 0;; i++)
+        {
+            Frame frame = frameFor(0x100 + ((p * 7 + i) % 64) * 3, (uint8_t)i, i % 4 ? 8 : 4);
+            frame.offset = (int32_t)(i * 250);
+            if (!writer.append(frame))
+            {
+                break;
+            }
+        }
+        framesPerRound += writer.count();
+        lengths[p] = writer.finish();
+    }
+
+    const uint32_t ROUNDS = 2000;
+    uint32_t nowUs = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < ROUNDS; round++)
+    {
+        for (size_t p = 0; p < PACKETS; p++)
+        {
+            nowUs += 5000;
+            receiver.onPacket(packets[p], lengths[p], nowUs);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    uint64_t frames = (uint64_t)framesPerRound * ROUNDS;
+
+    char report[128];
+    snprintf(report, sizeof(report), "receiver decode: %.2f Mframes/s, %.0f ns/frame (host)",
+             frames / seconds / 1e6, seconds * 1e9 / frames);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)frames, receiver.framesDecoded());
+    TEST_ASSERT_EQUAL(0, receiver.malformed());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_are_stored_per_id);
+    RUN_TEST(test_timestamps_map_to_the_receiver_clock);
+    RUN_TEST(test_stored_frames_do_not_overwrite_newer_values);
+    RUN_TEST(test_signals_and_stats);
+    RUN_TEST(test_reliable_duplicate_re_sends_the_ack);
+    RUN_TEST(test_malformed_packets_are_counted);
+    RUN_TEST(test_decode_throughput_benchmark);
+    return UNITY_END();
+}
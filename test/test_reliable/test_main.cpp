@@ -0,0 +1,299 @@
+// Reliable class over a lossy link: AckTracker bookkeeping, then the gateway's
+// window and retransmissions against a CanEspNowReceiver that acknowledges
+// what it hears, with packets and ACKs dropped at random.
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+
+#define RELIABLE_RANGE_TABLE {0x080, 0x08F}
+
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+#include <CanEspNowReceiver.h>
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+using canEspNowWire::AckTracker;
+
+// Steps between injected frames: a lost packet keeps its slot for up to
+// RELIABLE_MAX_RETRIES RTOs, so the window must not wrap in that time
+static const uint32_t FRAME_INTERVAL_MS = 20;
+
+static canEspNowReceiver::Receiver<64, 8> receiver;
+
+// Radio between the gateway and one receiver, dropping reliable broadcasts and
+// ACKs with independent probabilities
+class LossyRadioLink : public DryRunRadioLink
+{
+public:
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        onSent_ = onSent;
+        return DryRunRadioLink::begin(onReceive, NULL);
+    }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        onSent_(mac, ESP_NOW_SEND_SUCCESS);
+        canEspNowWire::PacketReader reader;
+        if (!reader.begin(data, length) || reader.type() != canEspNowWire::PACKET_RELIABLE)
+        {
+            return ESP_OK;
+        }
+        reliableSentMs.push_back(millis());
+        if (!lose(dataLossPercent))
+        {
+            receiver.onPacket(data, length, micros());
+        }
+        return ESP_OK;
+    }
+
+    // The receiver's ACK for this step, through the gateway's receive path
+    void returnAck()
+    {
+        static const uint8_t receiverMac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+        uint8_t ack[canEspNowWire::MAX_PACKET_LEN];
+        size_t length = receiver.buildAck(ack, sizeof(ack));
+        if (length == 0 || lose(ackLossPercent))
+        {
+            return;
+        }
+        espNowHelper::OnDataRecv(receiverMac, ack, (int)length);
+        espnow_packet_t packet;
+        while (espNowRxRing.pop(packet))
+        {
+            espNowHelper::handlePacket(packet);
+        }
+    }
+
+    uint8_t dataLossPercent = 0;
+    uint8_t ackLossPercent = 0;
+    std::vector<uint32_t> reliableSentMs;
+
+private:
+    static bool lose(uint8_t percent)
+    {
+        return percent > 0 && esp_random() % 100 < percent;
+    }
+
+    esp_now_send_cb_t onSent_ = NULL;
+};
+
+static LossyRadioLink lossyRadioLink;
+static uint32_t framesInjected = 0;
+
+static void injectReliableFrame()
+{
+    twai_message_t message = {};
+    message.identifier = 0x080 + (framesInjected & 0x0F);
+    message.data_length_code = 8;
+    // Changing payload so the last-value cache forwards every frame
+    memcpy(message.data, &framesInjected, sizeof(framesInjected));
+    framesInjected++;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+}
+
+// One millisecond of both gateway tasks and the receiver
+static void step()
+{
+    canHelper::checkCanBusForMessages();
+    espNowHelper::service();
+    lossyRadioLink.returnAck();
+    hostClock::advanceMillis(1);
+}
+
+static void sendFrames(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        injectReliableFrame();
+        for (uint32_t ms = 0; ms < FRAME_INTERVAL_MS; ms++)
+        {
+            step();
+        }
+    }
+}
+
+// Run until every packet in the window is settled
+static void settle()
+{
+    for (uint32_t ms = 0; ms < 10000 && reliableDelivery::pending(); ms++)
+    {
+        step();
+    }
+    TEST_ASSERT_FALSE(reliableDelivery::pending());
+}
+
+void setUp()
+{
+    lossyRadioLink.dataLossPercent = 0;
+    lossyRadioLink.ackLossPercent = 0;
+    lossyRadioLink.reliableSentMs.clear();
+}
+
+void tearDown() {}
+
+void test_tracker_acknowledges_in_order_packets()
+{
+    AckTracker tracker;
+    TEST_ASSERT_TRUE(tracker.receive(65534));
+    TEST_ASSERT_TRUE(tracker.receive(65535));
+    TEST_ASSERT_TRUE(tracker.receive(0));
+    TEST_ASSERT_EQUAL_UINT16(0, tracker.ack().cumulative);
+    TEST_ASSERT_EQUAL_HEX32(0, tracker.ack().bitmap);
+    TEST_ASSERT_TRUE(canEspNowWire::acknowledges(tracker.ack(), 65534));
+    TEST_ASSERT_FALSE(canEspNowWire::acknowledges(tracker.ack(), 1));
+}
+
+void test_tracker_reports_gaps_in_the_bitmap()
+{
+    AckTracker tracker;
+    tracker.receive(10);
+    TEST_ASSERT_TRUE(tracker.receive(12));
+    TEST_ASSERT_TRUE(tracker.receive(14));
+    TEST_ASSERT_EQUAL_UINT16(10, tracker.ack().cumulative);
+    TEST_ASSERT_EQUAL_HEX32(0x5, tracker.ack().bitmap);
+    TEST_ASSERT_FALSE(canEspNowWire::acknowledges(tracker.ack(), 11));
+    TEST_ASSERT_TRUE(canEspNowWire::acknowledges(tracker.ack(), 12));
+    TEST_ASSERT_FALSE(canEspNowWire::acknowledges(tracker.ack(), 13));
+
+    // The retransmission of 11 closes the gap and advances over 12
+    TEST_ASSERT_TRUE(tracker.receive(11));
+    TEST_ASSERT_EQUAL_UINT16(12, tracker.ack().cumulative);
+    TEST_ASSERT_EQUAL_HEX32(0x1, tracker.ack().bitmap);
+}
+
+void test_tracker_flags_duplicates()
+{
+    AckTracker tracker;
+    tracker.receive(100);
+    tracker.receive(102);
+    TEST_ASSERT_FALSE(tracker.receive(100));
+    TEST_ASSERT_FALSE(tracker.receive(99));
+    TEST_ASSERT_FALSE(tracker.receive(102));
+    TEST_ASSERT_TRUE(tracker.receive(101));
+    TEST_ASSERT_FALSE(tracker.receive(101));
+}
+
+void test_tracker_abandons_a_gap_beyond_the_bitmap()
+{
+    AckTracker tracker;
+    tracker.receive(0);
+    tracker.receive(33);
+    TEST_ASSERT_EQUAL_UINT16(0, tracker.ack().cumulative);
+    TEST_ASSERT_TRUE(tracker.receive(34));
+    TEST_ASSERT_EQUAL_UINT16(34, tracker.ack().cumulative);
+    TEST_ASSERT_EQUAL_HEX32(0, tracker.ack().bitmap);
+}
+
+void test_without_receivers_packets_are_not_retransmitted()
+{
+    // Runs first: no ACK has been heard yet, so nobody is waited for
+    lossyRadioLink.ackLossPercent = 100;
+    uint32_t packets = reliablePackets;
+    uint32_t unconfirmed = reliableUnconfirmed;
+    uint32_t retransmits = reliableRetransmits;
+    sendFrames(10);
+    settle();
+
+    TEST_ASSERT_GREATER_THAN(0, reliablePackets - packets);
+    TEST_ASSERT_EQUAL(reliablePackets - packets, reliableUnconfirmed - unconfirmed);
+    TEST_ASSERT_EQUAL(retransmits, reliableRetransmits);
+}
+
+void test_lossless_link_delivers_without_retransmissions()
+{
+    uint32_t packets = reliablePackets;
+    uint32_t delivered = reliableDelivered;
+    uint32_t retransmits = reliableRetransmits;
+    uint32_t decoded = receiver.framesDecoded();
+    sendFrames(100);
+    settle();
+
+    TEST_ASSERT_EQUAL(reliablePackets - packets, reliableDelivered - delivered);
+    TEST_ASSERT_EQUAL(retransmits, reliableRetransmits);
+    TEST_ASSERT_EQUAL(100, receiver.framesDecoded() - decoded);
+}
+
+void test_lossy_link_recovers_every_packet()
+{
+    lossyRadioLink.dataLossPercent = 20;
+    lossyRadioLink.ackLossPercent = 20;
+    uint32_t packets = reliablePackets;
+    uint32_t delivered = reliableDelivered;
+    uint32_t recovered = reliableRecovered;
+    uint64_t recoveryMs = reliableRecoveryTotalMs;
+    uint32_t retransmits = reliableRetransmits;
+    uint32_t lost = reliableLost + reliableAbandoned;
+    uint32_t duplicates = receiver.retransmitted();
+    uint32_t decoded = receiver.framesDecoded();
+    sendFrames(500);
+    settle();
+
+    uint32_t sent = reliablePackets - packets;
+    TEST_ASSERT_EQUAL(lost, reliableLost + reliableAbandoned);
+    TEST_ASSERT_EQUAL(sent, reliableDelivered - delivered);
+    // Every frame reached the application exactly once
+    TEST_ASSERT_EQUAL(500, receiver.framesDecoded() - decoded);
+    TEST_ASSERT_GREATER_THAN(0, receiver.retransmitted() - duplicates);
+
+    // About one in three exchanges fails; cumulative ACKs cover some lost ACKs
+    uint32_t extra = reliableRetransmits - retransmits;
+    TEST_ASSERT_GREATER_OR_EQUAL(sent / 10, extra);
+    TEST_ASSERT_LESS_OR_EQUAL(sent, extra);
+
+    // Nothing is resent before the RTO
+    uint32_t count = reliableRecovered - recovered;
+    TEST_ASSERT_GREATER_THAN(0, count);
+    uint32_t averageMs = (uint32_t)((reliableRecoveryTotalMs - recoveryMs) / count);
+    TEST_ASSERT_GREATER_OR_EQUAL(RELIABLE_RTO_MS, averageMs);
+
+    char report[128];
+    snprintf(report, sizeof(report), "20%% loss: %lu packets, %lu retransmits, %lu recovered in %lu ms avg %lu ms max",
+             (unsigned long)sent, (unsigned long)extra, (unsigned long)count, (unsigned long)averageMs,
+             (unsigned long)reliableRecoveryMaxMs);
+    TEST_MESSAGE(report);
+}
+
+void test_packet_is_given_up_after_max_retries()
+{
+    // The receiver stays active but none of its ACKs get through
+    lossyRadioLink.ackLossPercent = 100;
+    uint32_t lost = reliableLost;
+    uint32_t retransmits = reliableRetransmits;
+    uint32_t duplicates = receiver.retransmitted();
+    sendFrames(1);
+    settle();
+
+    TEST_ASSERT_EQUAL(lost + 1, reliableLost);
+    TEST_ASSERT_EQUAL(retransmits + RELIABLE_MAX_RETRIES, reliableRetransmits);
+    TEST_ASSERT_EQUAL(duplicates + RELIABLE_MAX_RETRIES, receiver.retransmitted());
+    TEST_ASSERT_EQUAL(RELIABLE_MAX_RETRIES + 1, lossyRadioLink.reliableSentMs.size());
+    for (size_t i = 1; i < lossyRadioLink.reliableSentMs.size(); i++)
+    {
+        uint32_t gap = lossyRadioLink.reliableSentMs[i] - lossyRadioLink.reliableSentMs[i - 1];
+        TEST_ASSERT_GREATER_OR_EQUAL(RELIABLE_RTO_MS, gap);
+        TEST_ASSERT_LESS_OR_EQUAL(RELIABLE_RTO_MS + 1, gap);
+    }
+}
+
+int main()
+{
+    Serial.quiet = true;
+    radioLink = &lossyRadioLink;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_tracker_acknowledges_in_order_packets);
+    RUN_TEST(test_tracker_reports_gaps_in_the_bitmap);
+    RUN_TEST(test_tracker_flags_duplicates);
+    RUN_TEST(test_tracker_abandons_a_gap_beyond_the_bitmap);
+    RUN_TEST(test_without_receivers_packets_are_not_retransmitted);
+    RUN_TEST(test_lossless_link_delivers_without_retransmissions);
+    RUN_TEST(test_lossy_link_recovers_every_packet);
+    RUN_TEST(test_packet_is_given_up_after_max_retries);
+    return UNITY_END();
+}
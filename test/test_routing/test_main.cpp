@@ -0,0 +1,281 @@
+// Unicast routing on the host: routing table updates against the ESP-NOW peer
+// table, frames waiting in a batch while the table changes, the peers a
+// snapshot reply adds for its requester, and an outage of one routed peer.
+#include <unity.h>
+#include <vector>
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+// Dry-run radio keeping the destination and contents of every packet handed to it;
+// unicasts to the unreachable MAC are reported as not delivered
+class CaptureRadioLink : public DryRunRadioLink
+{
+public:
+    struct Sent
+    {
+        uint8_t mac[6];
+        std::vector<uint8_t> data;
+    };
+
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        onSent_ = onSent;
+        return DryRunRadioLink::begin(onReceive, onSent);
+    }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        Sent packet;
+        memcpy(packet.mac, mac, 6);
+        packet.data.assign(data, data + length);
+        sent.push_back(packet);
+        if (unreachable != NULL && memcmp(mac, unreachable, 6) == 0)
+        {
+            onSent_(mac, ESP_NOW_SEND_FAIL);
+            return ESP_OK;
+        }
+        return DryRunRadioLink::send(mac, data, length);
+    }
+
+    std::vector<Sent> sent;
+    const uint8_t *unreachable = NULL;
+
+private:
+    esp_now_send_cb_t onSent_ = NULL;
+};
+
+static CaptureRadioLink captureRadioLink;
+
+static const uint8_t macA[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0A};
+static const uint8_t macB[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0B};
+static const uint8_t macC[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0C};
+
+// Serialized table: the given peers, and one range 0x200-0x2FF routed to peerMask
+static std::vector<uint8_t> tableBlob(std::vector<const uint8_t *> peers, uint8_t peerMask)
+{
+    std::vector<uint8_t> blob;
+    blob.push_back((uint8_t)peers.size());
+    for (const uint8_t *mac : peers)
+    {
+        blob.insert(blob.end(), mac, mac + 6);
+    }
+    blob.push_back(1);
+    uint8_t range[9];
+    canEspNowWire::putU32(range, 0x200);
+    canEspNowWire::putU32(range + 4, 0x2FF);
+    range[8] = peerMask;
+    blob.insert(blob.end(), range, range + sizeof(range));
+    return blob;
+}
+
+static uint8_t payload = 0;
+
+// One new frame through both task passes until its batch has gone out
+static void forwardFrame(uint32_t identifier)
+{
+    twai_message_t message = {};
+    message.identifier = identifier;
+    message.data_length_code = 8;
+    message.data[0] = ++payload;  // Changing payload so the last-value cache forwards every frame
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    canHelper::checkCanBusForMessages();
+    espNowHelper::service();
+    hostClock::advanceMillis(BATCH_FLUSH_DEADLINE_MS);
+    espNowHelper::service();
+}
+
+static bool applyTable(const std::vector<uint8_t> &blob)
+{
+    return routingTable::update(blob.data(), blob.size());
+}
+
+// Ask for a snapshot from mac and run the transmit task until the reply is complete
+static void requestSnapshot(const uint8_t *mac)
+{
+    uint8_t request[canEspNowWire::HEADER_LEN];
+    canEspNowWire::writeHeader(request, canEspNowWire::PACKET_SNAPSHOT_REQUEST, 0, 0);
+    espNowHelper::OnDataRecv(mac, request, sizeof(request));
+    espnow_packet_t packet;
+    while (espNowRxRing.pop(packet))
+    {
+        espNowHelper::handlePacket(packet);
+    }
+    for (uint32_t i = 0; i < 100 && snapshot::pending(); i++)
+    {
+        hostClock::advanceMillis(SNAPSHOT_PACKET_INTERVAL_MS);
+        espNowHelper::service();
+    }
+    TEST_ASSERT_FALSE(snapshot::pending());
+}
+
+// Destinations of the captured packets of one type that carry frames
+static std::vector<const uint8_t *> destinations(canEspNowWire::PacketType type)
+{
+    std::vector<const uint8_t *> macs;
+    for (const CaptureRadioLink::Sent &packet : captureRadioLink.sent)
+    {
+        canEspNowWire::PacketReader reader;
+        if (reader.begin(packet.data.data(), packet.data.size()) && reader.type() == type && reader.count() > 0)
+        {
+            macs.push_back(packet.mac);
+        }
+    }
+    return macs;
+}
+
+// Frames carried by the captured packets of one type sent to mac
+static size_t framesTo(canEspNowWire::PacketType type, const uint8_t *mac)
+{
+    size_t frames = 0;
+    for (const CaptureRadioLink::Sent &packet : captureRadioLink.sent)
+    {
+        canEspNowWire::PacketReader reader;
+        if (memcmp(packet.mac, mac, 6) == 0 && reader.begin(packet.data.data(), packet.data.size()) &&
+            reader.type() == type)
+        {
+            frames += reader.count();
+        }
+    }
+    return frames;
+}
+
+void setUp()
+{
+    captureRadioLink.sent.clear();
+    captureRadioLink.unreachable = NULL;
+}
+
+void tearDown()
+{
+    TEST_ASSERT_TRUE(applyTable(std::vector<uint8_t>{0, 0}));
+}
+
+void test_update_removes_peers_the_table_dropped()
+{
+    uint8_t baseline = captureRadioLink.peerCount();
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macA, macB}, 0x3)));
+    TEST_ASSERT_TRUE(captureRadioLink.hasPeer(macA));
+    TEST_ASSERT_TRUE(captureRadioLink.hasPeer(macB));
+
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macB, macC}, 0x3)));
+    TEST_ASSERT_FALSE(captureRadioLink.hasPeer(macA));
+    TEST_ASSERT_TRUE(captureRadioLink.hasPeer(macB));
+    TEST_ASSERT_TRUE(captureRadioLink.hasPeer(macC));
+    TEST_ASSERT_EQUAL(baseline + 2, captureRadioLink.peerCount());
+}
+
+void test_repeated_updates_do_not_fill_the_peer_table()
+{
+    uint8_t baseline = captureRadioLink.peerCount();
+    for (uint8_t i = 0; i < 2 * ESP_NOW_MAX_TOTAL_PEER_NUM; i++)
+    {
+        uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x01, i};
+        TEST_ASSERT_TRUE(applyTable(tableBlob({mac}, 0x1)));
+        TEST_ASSERT_TRUE(captureRadioLink.hasPeer(mac));
+    }
+    TEST_ASSERT_EQUAL(baseline + 1, captureRadioLink.peerCount());
+}
+
+void test_waiting_frames_follow_the_new_table()
+{
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macA, macB}, 0x1)));
+    twai_message_t message = {};
+    message.identifier = 0x210;
+    message.data_length_code = 8;
+    TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    canHelper::checkCanBusForMessages();
+    espNowHelper::service();
+    TEST_ASSERT_EQUAL(0, destinations(canEspNowWire::PACKET_FRAMES).size());
+
+    // Same ID now routed to A again, but A moved to bit 1; bit 0 names B
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macB, macA}, 0x2)));
+    hostClock::advanceMillis(BATCH_FLUSH_DEADLINE_MS);
+    espNowHelper::service();
+
+    std::vector<const uint8_t *> macs = destinations(canEspNowWire::PACKET_FRAMES);
+    TEST_ASSERT_EQUAL(1, macs.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(macA, macs[0], 6);
+}
+
+void test_snapshot_peer_is_removed_after_the_reply()
+{
+    uint8_t baseline = captureRadioLink.peerCount();
+    // More requesters than ESP-NOW has peer slots: each is still answered by unicast
+    for (uint8_t i = 0; i < 2 * ESP_NOW_MAX_TOTAL_PEER_NUM; i++)
+    {
+        uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x02, i};
+        captureRadioLink.sent.clear();
+        requestSnapshot(mac);
+        TEST_ASSERT_FALSE(captureRadioLink.sent.empty());
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(mac, captureRadioLink.sent.back().mac, 6);
+        TEST_ASSERT_FALSE(captureRadioLink.hasPeer(mac));
+    }
+    TEST_ASSERT_EQUAL(baseline, captureRadioLink.peerCount());
+}
+
+void test_snapshot_keeps_a_routed_peer()
+{
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macA}, 0x1)));
+    requestSnapshot(macA);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(macA, captureRadioLink.sent.back().mac, 6);
+    TEST_ASSERT_TRUE(captureRadioLink.hasPeer(macA));
+}
+
+void test_outage_of_one_peer_stores_only_its_frames()
+{
+    TEST_ASSERT_TRUE(applyTable(tableBlob({macA, macB}, 0x3)));
+    captureRadioLink.unreachable = macB;
+    for (uint8_t i = 0; i < SF_OUTAGE_FAILURES; i++)
+    {
+        forwardFrame(0x220);
+    }
+    TEST_ASSERT_EQUAL_HEX8(0x2, storeForward::downPeers());
+
+    captureRadioLink.sent.clear();
+    uint32_t stored = sfStored;
+    for (uint8_t i = 0; i < 10; i++)
+    {
+        forwardFrame(0x220);
+        forwardFrame(0x520);  // No route: broadcast, never stored
+    }
+    // A and the broadcast receivers stay live; B's frames wait in the store
+    TEST_ASSERT_EQUAL(10, framesTo(canEspNowWire::PACKET_FRAMES, macA));
+    TEST_ASSERT_EQUAL(10, framesTo(canEspNowWire::PACKET_FRAMES, broadcastAddress));
+    TEST_ASSERT_EQUAL(0, framesTo(canEspNowWire::PACKET_FRAMES, macB));
+    TEST_ASSERT_EQUAL(10, sfStored - stored);
+    TEST_ASSERT_EQUAL(0, framesTo(canEspNowWire::PACKET_STORED, macB));
+
+    // B answers a probe, then gets what it missed and nobody else does
+    captureRadioLink.unreachable = NULL;
+    for (uint32_t ms = 0; ms < 1000 && (storeForward::downPeers() != 0 || storeForward::pending()); ms += SF_REPLAY_INTERVAL_MS)
+    {
+        hostClock::advanceMillis(SF_REPLAY_INTERVAL_MS);
+        espNowHelper::service();
+    }
+    TEST_ASSERT_EQUAL_HEX8(0, storeForward::downPeers());
+    TEST_ASSERT_FALSE(storeForward::pending());
+    TEST_ASSERT_EQUAL(10, framesTo(canEspNowWire::PACKET_STORED, macB));
+    TEST_ASSERT_EQUAL(0, framesTo(canEspNowWire::PACKET_STORED, macA));
+    TEST_ASSERT_EQUAL(0, framesTo(canEspNowWire::PACKET_STORED, broadcastAddress));
+}
+
+int main()
+{
+    Serial.quiet = true;
+    radioLink = &captureRadioLink;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_update_removes_peers_the_table_dropped);
+    RUN_TEST(test_repeated_updates_do_not_fill_the_peer_table);
+    RUN_TEST(test_waiting_frames_follow_the_new_table);
+    RUN_TEST(test_snapshot_peer_is_removed_after_the_reply);
+    RUN_TEST(test_snapshot_keeps_a_routed_peer);
+    RUN_TEST(test_outage_of_one_peer_stores_only_its_frames);
+    return UNITY_END();
+}
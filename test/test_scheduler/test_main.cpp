@@ -0,0 +1,233 @@
+// Transmit scheduler: PRIORITY_HIGH frames overtake any backlog and reach the
+// radio without waiting for the batch deadline, while token buckets cap the
+// flooding IDs.
+#include <unity.h>
+#include <vector>
+
+// 0x600 floods the low class; 0x050 is a rate-limited high-priority ID
+#define RATE_LIMIT_TABLE {0x600, 100, 10}, {0x050, 50, 5}
+
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+// Each packet holds the radio this long in the end-to-end test: two in flight
+// per 10 ms is about 4000 frames/s of full batches, below the offered load
+static const uint32_t AIRTIME_US = 10000;
+static const uint32_t STEP_US = 250;
+
+// Dry-run radio whose send callbacks only arrive when complete() is called,
+// so packets stay in flight like on a busy channel
+class SlowRadioLink : public DryRunRadioLink
+{
+public:
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        onSent_ = onSent;
+        return DryRunRadioLink::begin(onReceive, NULL);
+    }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        sent.emplace_back(data, data + length);
+        sentAtUs.push_back(micros());
+        inFlight++;
+        return DryRunRadioLink::send(mac, data, length);
+    }
+
+    void complete()
+    {
+        for (; inFlight > 0; inFlight--)
+        {
+            onSent_(broadcastAddress, ESP_NOW_SEND_SUCCESS);
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> sent;
+    std::vector<uint32_t> sentAtUs;
+    uint32_t inFlight = 0;
+
+private:
+    esp_now_send_cb_t onSent_ = NULL;
+};
+
+static SlowRadioLink slowRadioLink;
+
+static gateway_frame_t frameFor(uint32_t identifier)
+{
+    gateway_frame_t frame = {};
+    frame.message.identifier = identifier;
+    frame.message.data_length_code = 8;
+    frame.rxMicros = micros();
+    // Changing payload so the last-value cache forwards every frame
+    uint32_t now = frame.rxMicros;
+    memcpy(frame.message.data, &now, sizeof(now));
+    return frame;
+}
+
+static void drainScheduler()
+{
+    gateway_frame_t frame;
+    uint8_t priority;
+    while (txScheduler::dequeue(frame, priority))
+    {
+    }
+}
+
+// Index of the first captured packet carrying an ID, or -1
+static int packetWith(uint32_t identifier)
+{
+    for (size_t i = 0; i < slowRadioLink.sent.size(); i++)
+    {
+        canEspNowWire::PacketReader reader;
+        canEspNowWire::Frame frame;
+        const std::vector<uint8_t> &packet = slowRadioLink.sent[i];
+        if (!reader.begin(packet.data(), packet.size()))
+        {
+            continue;
+        }
+        while (reader.next(frame))
+        {
+            if (frame.identifier == identifier)
+            {
+                return (int)i;
+            }
+        }
+    }
+    return -1;
+}
+
+void setUp()
+{
+    hostClock::advanceMillis(1000);  // Refill every bucket
+    drainScheduler();
+}
+
+void tearDown() {}
+
+void test_classes_follow_the_priority_ranges()
+{
+    TEST_ASSERT_EQUAL(PRIORITY_HIGH, txScheduler::classify(frameFor(0x050).message));
+    TEST_ASSERT_EQUAL(PRIORITY_NORMAL, txScheduler::classify(frameFor(0x200).message));
+    TEST_ASSERT_EQUAL(PRIORITY_LOW, txScheduler::classify(frameFor(0x600).message));
+    gateway_frame_t extended = frameFor(0x050);
+    extended.message.extd = 1;
+    TEST_ASSERT_EQUAL(PRIORITY_LOW, txScheduler::classify(extended.message));
+}
+
+void test_high_priority_overtakes_a_full_backlog()
+{
+    uint32_t now = millis();
+    for (uint32_t i = 0; i < SCHED_QUEUE_DEPTH; i++)
+    {
+        txScheduler::enqueue(frameFor(0x400 + i), now);
+        txScheduler::enqueue(frameFor(0x200 + i), now);
+    }
+    TEST_ASSERT_TRUE(txScheduler::enqueue(frameFor(0x010), now));
+
+    gateway_frame_t frame;
+    uint8_t priority;
+    TEST_ASSERT_TRUE(txScheduler::dequeue(frame, priority));
+    TEST_ASSERT_EQUAL(PRIORITY_HIGH, priority);
+    TEST_ASSERT_EQUAL_HEX32(0x010, frame.message.identifier);
+    TEST_ASSERT_TRUE(txScheduler::dequeue(frame, priority));
+    TEST_ASSERT_EQUAL(PRIORITY_NORMAL, priority);
+}
+
+void test_token_bucket_caps_burst_and_rate()
+{
+    uint32_t now = millis();
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        accepted += txScheduler::enqueue(frameFor(0x600), now);
+    }
+    TEST_ASSERT_EQUAL(10, accepted);  // Burst
+
+    // 100 frames/s: one token every 10 ms
+    accepted = 0;
+    for (uint32_t ms = 1; ms <= 100; ms++)
+    {
+        accepted += txScheduler::enqueue(frameFor(0x600), now + ms);
+    }
+    TEST_ASSERT_EQUAL(10, accepted);
+}
+
+void test_limited_high_priority_id_keeps_its_burst()
+{
+    uint32_t now = millis();
+    // The low-class flood is limited on its own bucket and does not take 0x050's tokens
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        txScheduler::enqueue(frameFor(0x600), now);
+    }
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        accepted += txScheduler::enqueue(frameFor(0x050), now);
+    }
+    TEST_ASSERT_EQUAL(5, accepted);
+    TEST_ASSERT_TRUE(txScheduler::enqueue(frameFor(0x051), now));  // Unlimited high-priority ID
+}
+
+// Low-priority traffic saturating the radio; a high-priority frame arriving in
+// the middle must go out in the first packet sent after it arrives, i.e. once
+// a send slot frees up, within one packet airtime.
+void test_high_priority_latency_bound_under_load()
+{
+    slowRadioLink.sent.clear();
+    slowRadioLink.sentAtUs.clear();
+    uint32_t droppedBefore = metricFramesDropped;
+    uint32_t highRxUs = 0;
+    size_t sentBeforeHigh = 0;
+    for (uint32_t step = 0; step < 4000; step++)
+    {
+        // 4000 frames/s from 32 low-priority IDs plus the rate-limited 0x600
+        hostCanBus.inject(frameFor(0x680 + step % 32).message);
+        hostCanBus.inject(frameFor(0x600).message);
+        if (step == 2017)
+        {
+            highRxUs = micros();
+            sentBeforeHigh = slowRadioLink.sent.size();
+            hostCanBus.inject(frameFor(0x020).message);
+        }
+        canHelper::checkCanBusForMessages();
+        espNowHelper::service();
+        hostClock::advanceMicros(STEP_US);
+        if ((step + 1) % (AIRTIME_US / STEP_US) == 0)
+        {
+            slowRadioLink.complete();
+        }
+    }
+    // The radio was the bottleneck: frames were limited and dropped
+    TEST_ASSERT_TRUE(schedRateLimited[PRIORITY_LOW] > 0);
+    TEST_ASSERT_TRUE(metricFramesDropped - droppedBefore > 0);
+
+    int index = packetWith(0x020);
+    TEST_ASSERT_EQUAL((int)sentBeforeHigh, index);
+    uint32_t latencyUs = slowRadioLink.sentAtUs[index] - highRxUs;
+    char report[96];
+    snprintf(report, sizeof(report), "PRIORITY_HIGH latency under load: %lu us (bound %lu us)",
+             (unsigned long)latencyUs, (unsigned long)AIRTIME_US);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_LESS_OR_EQUAL(AIRTIME_US, latencyUs);
+}
+
+int main()
+{
+    Serial.quiet = true;
+    radioLink = &slowRadioLink;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_classes_follow_the_priority_ranges);
+    RUN_TEST(test_high_priority_overtakes_a_full_backlog);
+    RUN_TEST(test_token_bucket_caps_burst_and_rate);
+    RUN_TEST(test_limited_high_priority_id_keeps_its_burst);
+    RUN_TEST(test_high_priority_latency_bound_under_load);
+    return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// canSignals::extractRaw()/physical() against hand-encoded frames of
+// dbc/trailer.dbc. The descriptors are tools/dbc_codegen.py output for every
+// message of that file (trailerSignals.h, see subscribed.txt).
+#include <unity.h>
+#include <string.h>
+#include "trailerSignals.h"
+
+using namespace canSignals;
+
+static const Signal &signalNamed(const char *name)
+{
+    for (const Signal &signal : signalTable)
+    {
+        if (strcmp(signal.name, name) == 0)
+        {
+            return signal;
+        }
+    }
+    TEST_FAIL_MESSAGE(name);
+    return signalTable[0];
+}
+
+static void assertSignal(const char *name, const uint8_t *data, uint64_t raw, float value)
+{
+    const Signal &signal = signalNamed(name);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)raw, (uint32_t)extractRaw(signal, data));
+    TEST_ASSERT_FLOAT_WITHIN(signal.scale / 2, value, physical(signal, extractRaw(signal, data)));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_generated_table_matches_dbc()
+{
+    TEST_ASSERT_EQUAL(11, SIGNAL_COUNT);
+    TEST_ASSERT_EQUAL(3, SIGNAL_MESSAGE_COUNT);
+    TEST_ASSERT_EQUAL_HEX32(0x100, signalMessages[0].identifier);
+    TEST_ASSERT_EQUAL_HEX32(0x200, signalMessages[1].identifier);
+    TEST_ASSERT_EQUAL_HEX32(0x210, signalMessages[2].identifier);
+
+    const Signal &cabin = signalNamed("Climate_Status.CabinTemp");
+    TEST_ASSERT_TRUE(cabin.bigEndian);
+    TEST_ASSERT_TRUE(cabin.isSigned);
+    TEST_ASSERT_EQUAL(12, cabin.length);
+    TEST_ASSERT_EQUAL(2, cabin.minDlc);
+    TEST_ASSERT_EQUAL(3, signalNamed("Climate_Status.OutsideTemp").minDlc);
+    TEST_ASSERT_EQUAL(5, signalNamed("Climate_Status.Humidity").minDlc);
+}
+
+// BMS_Status (0x100): Intel byte order
+void test_intel_signals()
+{
+    // 13.25 V, -45.6 A, 87.5 %, 23 degC
+    const uint8_t data[8] = {0x2D, 0x05, 0x38, 0xFE, 0xAF, 0x3F, 0x00, 0x00};
+    assertSignal("BMS_Status.PackVoltage", data, 1325, 13.25f);
+    assertSignal("BMS_Status.PackCurrent", data, 0xFE38, -45.6f);
+    assertSignal("BMS_Status.StateOfCharge", data, 175, 87.5f);
+    assertSignal("BMS_Status.CellTempMax", data, 63, 23.0f);
+}
+
+void test_intel_signed_limits()
+{
+    const uint8_t data[8] = {0xFF, 0xFF, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00};
+    assertSignal("BMS_Status.PackVoltage", data, 0xFFFF, 655.35f);
+    assertSignal("BMS_Status.PackCurrent", data, 0x8000, -3276.8f);
+    const uint8_t positive[8] = {0x00, 0x00, 0xFF, 0x7F, 0x00, 0x00, 0x00, 0x00};
+    assertSignal("BMS_Status.PackCurrent", positive, 0x7FFF, 3276.7f);
+}
+
+// Tank_Levels (0x200): one byte per signal
+void test_byte_aligned_signals()
+{
+    const uint8_t data[8] = {80, 10, 0, 100, 0xEE, 0xEE, 0xEE, 0xEE};
+    assertSignal("Tank_Levels.FreshWater", data, 80, 80.0f);
+    assertSignal("Tank_Levels.GreyWater", data, 10, 10.0f);
+    assertSignal("Tank_Levels.BlackWater", data, 0, 0.0f);
+    assertSignal("Tank_Levels.Propane", data, 100, 100.0f);
+}
+
+// Climate_Status (0x210): Motorola signed 12-bit fields sharing byte 1
+//   CabinTemp   7|12@0-  byte 0, byte 1 bits 7..4
+//   OutsideTemp 11|12@0- byte 1 bits 3..0, byte 2
+void test_motorola_signed_12_bit()
+{
+    // -12.5 degC = -125 = 0xF83; 25.3 degC = 253 = 0x0FD; 45 % = 90
+    const uint8_t data[8] = {0xF8, 0x30, 0xFD, 0x00, 0x5A, 0x00, 0x00, 0x00};
+    assertSignal("Climate_Status.CabinTemp", data, 0xF83, -12.5f);
+    assertSignal("Climate_Status.OutsideTemp", data, 0x0FD, 25.3f);
+    assertSignal("Climate_Status.Humidity", data, 90, 45.0f);
+}
+
+void test_motorola_signed_limits()
+{
+    // CabinTemp -204.8 (0x800), OutsideTemp -0.1 (0xFFF)
+    const uint8_t negative[8] = {0x80, 0x0F, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00};
+    assertSignal("Climate_Status.CabinTemp", negative, 0x800, -204.8f);
+    assertSignal("Climate_Status.OutsideTemp", negative, 0xFFF, -0.1f);
+    // CabinTemp 204.7 (0x7FF), OutsideTemp 204.7 (0x7FF)
+    const uint8_t positive[8] = {0x7F, 0xF7, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00};
+    assertSignal("Climate_Status.CabinTemp", positive, 0x7FF, 204.7f);
+    assertSignal("Climate_Status.OutsideTemp", positive, 0x7FF, 204.7f);
+}
+
+void test_neighbouring_bits_do_not_leak()
+{
+    // Every bit outside the signal set, the signal itself zero
+    const uint8_t data[8] = {0x00, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    assertSignal("Climate_Status.CabinTemp", data, 0, 0.0f);
+    const uint8_t intel[8] = {0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF};
+    assertSignal("BMS_Status.PackCurrent", intel, 0, 0.0f);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_generated_table_matches_dbc);
+    RUN_TEST(test_intel_signals);
+    RUN_TEST(test_intel_signed_limits);
+    RUN_TEST(test_byte_aligned_signals);
+    RUN_TEST(test_motorola_signed_12_bit);
+    RUN_TEST(test_motorola_signed_limits);
+    RUN_TEST(test_neighbouring_bits_do_not_leak);
+    return UNITY_END();
+}
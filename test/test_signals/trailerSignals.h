@@ -0,0 +1,30 @@
+// Generated by tools/dbc_codegen.py from dbc/trailer.dbc; do not edit.
+// Signal indexes are part of the PACKET_SIGNALS wire format: receivers must use the same table.
+#pragma once
+#include <CanSignals.h>
+
+#define SIGNAL_COUNT 11
+#define SIGNAL_MESSAGE_COUNT 3
+
+// Index on the wire = position in this table
+static constexpr canSignals::Signal signalTable[] = {
+    // name, start bit, length, big endian, signed, min DLC, scale, offset
+    {"BMS_Status.PackVoltage", 0, 16, false, false, 2, 0.01f, 0.0f},
+    {"BMS_Status.PackCurrent", 16, 16, false, true, 4, 0.1f, 0.0f},
+    {"BMS_Status.StateOfCharge", 32, 8, false, false, 5, 0.5f, 0.0f},
+    {"BMS_Status.CellTempMax", 40, 8, false, false, 6, 1.0f, -40.0f},
+    {"Tank_Levels.FreshWater", 0, 8, false, false, 1, 1.0f, 0.0f},
+    {"Tank_Levels.GreyWater", 8, 8, false, false, 2, 1.0f, 0.0f},
+    {"Tank_Levels.BlackWater", 16, 8, false, false, 3, 1.0f, 0.0f},
+    {"Tank_Levels.Propane", 24, 8, false, false, 4, 1.0f, 0.0f},
+    {"Climate_Status.CabinTemp", 7, 12, true, true, 2, 0.1f, 0.0f},
+    {"Climate_Status.OutsideTemp", 11, 12, true, true, 3, 0.1f, 0.0f},
+    {"Climate_Status.Humidity", 39, 8, true, false, 5, 0.5f, 0.0f},
+};
+
+// Sorted by identifier (extended IDs after standard IDs)
+static constexpr canSignals::Message signalMessages[] = {
+    {0x100, false, 0, 4},  // BMS_Status
+    {0x200, false, 4, 4},  // Tank_Levels
+    {0x210, false, 8, 3},  // Climate_Status
+};
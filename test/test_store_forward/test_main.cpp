@@ -0,0 +1,137 @@
+// Store-and-forward flash on the host: a RAM-backed "storefwd" partition that
+// starts out written, so every sector has to be erased before the log can use
+// it. Erases must wait for a quiet bus and the hourly budget, and spills during
+// an outage may only write into sectors erased beforehand.
+#include <unity.h>
+#include "globals.h"
+#include "canHelper.h"
+#include "espNowHelper.h"
+
+OtaUpdate otaUpdate(OTA_TIMEOUT_MS, "", "");
+
+static const uint16_t SECTORS = 32;
+static const uint8_t receiverMac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0A};
+
+// Dry-run radio on which unicasts to the receiver fail while it is unreachable
+class OutageRadioLink : public DryRunRadioLink
+{
+public:
+    esp_err_t begin(esp_now_recv_cb_t onReceive, esp_now_send_cb_t onSent) override
+    {
+        onSent_ = onSent;
+        return DryRunRadioLink::begin(onReceive, onSent);
+    }
+
+    esp_err_t send(const uint8_t *mac, const uint8_t *data, size_t length) override
+    {
+        if (unreachable && memcmp(mac, receiverMac, 6) == 0)
+        {
+            onSent_(mac, ESP_NOW_SEND_FAIL);
+            return ESP_OK;
+        }
+        return DryRunRadioLink::send(mac, data, length);
+    }
+
+    bool unreachable = false;
+
+private:
+    esp_now_send_cb_t onSent_ = NULL;
+};
+
+static OutageRadioLink outageRadioLink;
+static uint32_t payload = 0;
+
+// One millisecond of both tasks, with a new frame for the receiver if busy
+static void step(bool busy)
+{
+    if (busy)
+    {
+        twai_message_t message = {};
+        message.identifier = 0x200 + (payload & 0x3F);
+        message.data_length_code = 8;
+        // Changing payload so the last-value cache forwards every frame
+        memcpy(message.data, &payload, sizeof(payload));
+        payload++;
+        TEST_ASSERT_TRUE(hostCanBus.inject(message));
+    }
+    canHelper::checkCanBusForMessages();
+    espNowHelper::service();
+    hostClock::advanceMillis(1);
+}
+
+static void run(uint32_t ms, bool busy)
+{
+    for (uint32_t i = 0; i < ms; i++)
+    {
+        step(busy);
+    }
+}
+
+void setUp()
+{
+    outageRadioLink.unreachable = false;
+}
+
+void tearDown() {}
+
+void test_erases_wait_for_a_quiet_bus_and_the_budget()
+{
+    // Runs first: the whole partition still needs erasing
+    run(5000, true);
+    TEST_ASSERT_EQUAL(0, hostFlash::erases);
+
+    run(SF_ERASE_IDLE_MS + 1000, false);
+    TEST_ASSERT_EQUAL(SF_ERASE_BURST, hostFlash::erases);
+
+    // Then one erase per budget interval
+    run(3600000UL / SF_ERASES_PER_HOUR, false);
+    TEST_ASSERT_EQUAL(SF_ERASE_BURST + 1, hostFlash::erases);
+}
+
+void test_outage_spills_only_into_erased_sectors()
+{
+    uint32_t erases = hostFlash::erases;
+    uint32_t erased = sfErasedSectors;
+    TEST_ASSERT_GREATER_THAN(0, erased);
+    uint32_t stored = sfStored;
+    uint32_t evicted = sfEvicted;
+
+    outageRadioLink.unreachable = true;
+    run(100, true);
+    TEST_ASSERT_NOT_EQUAL(0, storeForward::downPeers());
+    // More frames than RAM and the erased sectors hold, without a quiet moment
+    uint32_t frames = SF_RAM_RECORDS + (erased + 2) * SF_RECORDS_PER_SECTOR;
+    run(frames, true);
+
+    TEST_ASSERT_EQUAL(erases, hostFlash::erases);
+    TEST_ASSERT_EQUAL(erased, sfFlashWrites);
+    TEST_ASSERT_EQUAL(0, sfErasedSectors);
+    TEST_ASSERT_GREATER_OR_EQUAL(frames, sfStored - stored);
+    TEST_ASSERT_GREATER_THAN(0, sfEvicted - evicted);
+
+    // The receiver returns and the log replays; replayed sectors are erased again as the budget refills
+    outageRadioLink.unreachable = false;
+    run(30000, false);
+    TEST_ASSERT_FALSE(storeForward::pending());
+    TEST_ASSERT_EQUAL(0, storeForward::downPeers());
+    run(3600000UL / SF_ERASES_PER_HOUR, false);
+    TEST_ASSERT_GREATER_THAN(erases, hostFlash::erases);
+    TEST_ASSERT_EQUAL(hostFlash::erases - erases, sfErasedSectors);
+}
+
+int main()
+{
+    Serial.quiet = true;
+    hostFlash::provide(SF_PARTITION_LABEL, SECTORS * SF_SECTOR_SIZE, false);
+    radioLink = &outageRadioLink;
+    canHelper::initialize();
+    espNowHelper::initialize();
+    uint8_t table[] = {1, 0x02, 0x00, 0x00, 0x00, 0x00, 0x0A, 1, 0x00, 0x02, 0x00, 0x00, 0xFF, 0x02, 0x00, 0x00, 0x01};
+    routingTable::update(table, sizeof(table));
+    espNowHelper::startTxTask();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_erases_wait_for_a_quiet_bus_and_the_budget);
+    RUN_TEST(test_outage_spills_only_into_erased_sectors);
+    return UNITY_END();
+}
@@ -0,0 +1,228 @@
+// PacketWriter/PacketReader round trips and the bytes-per-frame cost of the
+// wire format (lib/CanEspNowWire) against the old padded 16-byte message.
+#include <unity.h>
+#include <stdio.h>
+#include <CanEspNowWire.h>
+
+using namespace canEspNowWire;
+
+// Size of the esp_now_message_t the wire format replaced
+static const size_t LEGACY_MESSAGE_LEN = 16;
+
+static uint32_t randomState = 12345;
+static uint32_t nextRandom()
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return randomState >> 8;
+}
+
+// Frame from a trailer-like mix: 64 IDs, 10% extended, 70% DLC 8, a few remote frames
+static Frame randomFrame()
+{
+    Frame frame = {};
+    uint32_t slot = nextRandom() % 64;
+    frame.extended = slot < 6;
+    frame.identifier = frame.extended ? 0x18FEF000 + slot * 0x100 : 0x100 + slot * 0x10;
+    frame.rtr = nextRandom() % 50 == 0;
+    frame.dlc = nextRandom() % 100 < 70 ? 8 : nextRandom() % 8;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        frame.data[i] = i < frame.dlc && !frame.rtr ? (uint8_t)nextRandom() : 0;
+    }
+    return frame;
+}
+
+static void assertSameFrame(const Frame &expected, const Frame &actual)
+{
+    TEST_ASSERT_EQUAL_HEX32(expected.identifier, actual.identifier);
+    TEST_ASSERT_EQUAL(expected.extended, actual.extended);
+    TEST_ASSERT_EQUAL(expected.rtr, actual.rtr);
+    TEST_ASSERT_EQUAL(expected.dlc, actual.dlc);
+    if (!expected.rtr)
+    {
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.data, actual.data, expected.dlc);
+    }
+}
+
+// Fill one packet, decode it and compare every frame
+static void roundTrip(PacketType type, bool deltaIds, uint8_t flags)
+{
+    uint8_t buffer[MAX_PACKET_LEN];
+    Frame written[MAX_PACKET_LEN];
+    PacketWriter writer;
+    writer.begin(buffer, sizeof(buffer), type, deltaIds, flags);
+    writer.setBase(0x12345678);
+    size_t count = 0;
+    for (;;)
+    {
+        Frame frame = randomFrame();
+        frame.offset = flags & FLAG_TIMESTAMPS ? (int32_t)(nextRandom() % 65536) - 32768 : 0;
+        if (!writer.append(frame))
+        {
+            break;
+        }
+        written[count++] = frame;
+    }
+    size_t length = writer.finish();
+    TEST_ASSERT_GREATER_THAN(0, count);
+    TEST_ASSERT_LESS_OR_EQUAL(MAX_PACKET_LEN, length);
+
+    PacketReader reader;
+    TEST_ASSERT_TRUE(reader.begin(buffer, length));
+    TEST_ASSERT_EQUAL(type, reader.type());
+    TEST_ASSERT_EQUAL(count, reader.count());
+    if (isTimed(type, flags))
+    {
+        TEST_ASSERT_EQUAL_HEX32(0x12345678, reader.base());
+    }
+    Frame frame;
+    for (size_t i = 0; i < count; i++)
+    {
+        TEST_ASSERT_TRUE(reader.next(frame));
+        assertSameFrame(written[i], frame);
+        if (flags & FLAG_TIMESTAMPS)
+        {
+            TEST_ASSERT_EQUAL_INT32(written[i].offset, frame.offset);
+        }
+    }
+    TEST_ASSERT_FALSE(reader.next(frame));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_round_trip_plain_ids()
+{
+    roundTrip(PACKET_FRAMES, false, 0);
+}
+
+void test_round_trip_delta_ids()
+{
+    roundTrip(PACKET_FRAMES, true, 0);
+}
+
+void test_round_trip_timestamped()
+{
+    roundTrip(PACKET_FRAMES, true, FLAG_TIMESTAMPS);
+}
+
+void test_round_trip_reliable_relayed()
+{
+    roundTrip(PACKET_RELIABLE, true, FLAG_TIMESTAMPS | FLAG_RELAY);
+}
+
+void test_round_trip_stored()
+{
+    roundTrip(PACKET_STORED, true, 0);
+}
+
+void test_record_sizes()
+{
+    uint8_t buffer[MAX_PACKET_LEN];
+    PacketWriter writer;
+    writer.begin(buffer, sizeof(buffer), PACKET_FRAMES);
+    Frame frame = {};
+    frame.identifier = 0x123;
+    frame.dlc = 8;
+    TEST_ASSERT_EQUAL(11, writer.frameSize(frame));
+    TEST_ASSERT_TRUE(writer.append(frame));
+    frame.identifier = 0x124;
+    TEST_ASSERT_EQUAL(10, writer.frameSize(frame));
+    frame.identifier = 0x123 + 200;  // Delta out of int8 range
+    TEST_ASSERT_EQUAL(11, writer.frameSize(frame));
+    frame.extended = true;
+    frame.identifier = 0x18FEF100;
+    TEST_ASSERT_EQUAL(13, writer.frameSize(frame));
+    frame.extended = false;
+    frame.identifier = 0x125;
+    frame.dlc = 2;
+    TEST_ASSERT_EQUAL(4, writer.frameSize(frame));
+}
+
+void test_full_packet_is_left_unchanged()
+{
+    uint8_t buffer[32];
+    PacketWriter writer;
+    writer.begin(buffer, sizeof(buffer), PACKET_FRAMES, false);
+    Frame frame = {};
+    frame.dlc = 8;
+    frame.identifier = 0x100;
+    TEST_ASSERT_TRUE(writer.append(frame));
+    frame.identifier = 0x200;
+    TEST_ASSERT_TRUE(writer.append(frame));
+    size_t length = writer.length();
+    frame.identifier = 0x300;
+    TEST_ASSERT_FALSE(writer.append(frame));
+    TEST_ASSERT_EQUAL(length, writer.length());
+    TEST_ASSERT_EQUAL(2, writer.count());
+}
+
+void test_reader_rejects_malformed_packets()
+{
+    uint8_t buffer[MAX_PACKET_LEN];
+    PacketWriter writer;
+    writer.begin(buffer, sizeof(buffer), PACKET_FRAMES);
+    Frame frame = {};
+    frame.identifier = 0x321;
+    frame.dlc = 8;
+    writer.append(frame);
+    size_t length = writer.finish();
+
+    PacketReader reader;
+    Frame decoded;
+    // Truncated record
+    TEST_ASSERT_TRUE(reader.begin(buffer, length - 1));
+    TEST_ASSERT_FALSE(reader.next(decoded));
+    // Header only
+    TEST_ASSERT_FALSE(reader.begin(buffer, HEADER_LEN - 1));
+    // Unknown version
+    buffer[0] = (uint8_t)((VERSION + 1) << 4) | PACKET_FRAMES;
+    TEST_ASSERT_FALSE(reader.begin(buffer, length));
+}
+
+// Average on-air bytes per frame (headers included) for the trailer-like mix
+void test_bytes_per_frame_benchmark()
+{
+    const uint32_t FRAMES = 100000;
+    uint8_t buffer[MAX_PACKET_LEN];
+    PacketWriter writer;
+    uint64_t bytes = 0;
+    uint32_t packets = 0;
+    writer.begin(buffer, sizeof(buffer), PACKET_FRAMES, true, FLAG_TIMESTAMPS);
+    for (uint32_t i = 0; i < FRAMES; i++)
+    {
+        Frame frame = randomFrame();
+        if (!writer.append(frame))
+        {
+            bytes += writer.finish();
+            packets++;
+            writer.begin(buffer, sizeof(buffer), PACKET_FRAMES, true, FLAG_TIMESTAMPS);
+            writer.append(frame);
+        }
+    }
+    bytes += writer.finish();
+    packets++;
+
+    double perFrame = (double)bytes / FRAMES;
+    char report[128];
+    snprintf(report, sizeof(report), "wire: %.2f bytes/frame, %.1f frames/packet (legacy %u bytes/frame, 15 frames/packet)",
+             perFrame, (double)FRAMES / packets, (unsigned)LEGACY_MESSAGE_LEN);
+    TEST_MESSAGE(report);
+    // Timestamps included, the mix still fits in less than the padded legacy record
+    TEST_ASSERT_TRUE(perFrame < LEGACY_MESSAGE_LEN);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_plain_ids);
+    RUN_TEST(test_round_trip_delta_ids);
+    RUN_TEST(test_round_trip_timestamped);
+    RUN_TEST(test_round_trip_reliable_relayed);
+    RUN_TEST(test_round_trip_stored);
+    RUN_TEST(test_record_sizes);
+    RUN_TEST(test_full_packet_is_left_unchanged);
+    RUN_TEST(test_reader_rejects_malformed_packets);
+    RUN_TEST(test_bytes_per_frame_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Decode a dump of the gateway's blackbox partition into candump -L format.
+
+    esptool.py read_flash 0x390000 0x49000 blackbox.bin
+    tools/blackbox_decode.py blackbox.bin > trailer.log
+
+Pages are checked against their CRC and ordered by sequence number; torn or
+stale pages are skipped. Timestamps are seconds since the gateway booted;
+each boot starts a new section (reported on stderr). See src/blackBox.h for
+the page and record layout.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+PAGE_SIZE = 256
+HEADER_LEN = 20
+MAGIC = 0x4B42
+VERSION = 1
+
+FRAME_EXT = 0x80
+FRAME_RTR = 0x40
+FRAME_DELTA_ID = 0x20
+FRAME_REPEAT = 0x10
+FRAME_DLC_MASK = 0x0F
+
+
+def read_pages(data):
+    pages = []
+    for offset in range(0, len(data) - PAGE_SIZE + 1, PAGE_SIZE):
+        page = data[offset:offset + PAGE_SIZE]
+        magic, version, count, sequence, boot, length, base_us, crc = struct.unpack_from("<HBBIHHII", page)
+        if magic != MAGIC or version != VERSION or length > PAGE_SIZE - HEADER_LEN:
+            continue
+        payload = page[HEADER_LEN:HEADER_LEN + length]
+        if zlib.crc32(payload, zlib.crc32(page[:16])) != crc:
+            continue
+        pages.append((sequence, boot, base_us, count, payload))
+    # Sequence numbers only grow; order relative to the newest page to survive 32-bit wrap
+    if pages:
+        newest = max(pages, key=lambda p: p[0])[0]
+        pages.sort(key=lambda p: (p[0] - newest - 1) & 0xFFFFFFFF)
+    return pages
+
+
+def read_varint(payload, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = payload[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, offset
+        shift += 7
+
+
+def decode_page(base_us, count, payload):
+    """Yield (time_us, identifier, extended, rtr, data) for each record."""
+    offset = 0
+    time_us = base_us
+    last_id = 0
+    last_data = {}
+    for _ in range(count):
+        delta_us, offset = read_varint(payload, offset)
+        time_us += delta_us
+        head = payload[offset]
+        offset += 1
+        extended = bool(head & FRAME_EXT)
+        rtr = bool(head & FRAME_RTR)
+        dlc = head & FRAME_DLC_MASK
+        if head & FRAME_DELTA_ID:
+            identifier = last_id + struct.unpack_from("<b", payload, offset)[0]
+            offset += 1
+        elif extended:
+            identifier = struct.unpack_from("<I", payload, offset)[0]
+            offset += 4
+        else:
+            identifier = struct.unpack_from("<H", payload, offset)[0]
+            offset += 2
+        key = (identifier, extended)
+        if rtr:
+            data = None
+        elif head & FRAME_REPEAT:
+            data = last_data[key]
+        else:
+            data = payload[offset:offset + dlc]
+            offset += dlc
+            last_data[key] = data
+        last_id = identifier
+        yield time_us, identifier, extended, rtr, dlc, data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="raw blackbox partition image")
+    parser.add_argument("--interface", default="can0", help="interface name written to each line")
+    parser.add_argument("--boot", type=int, help="only decode this boot ID")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        pages = read_pages(f.read())
+    if not pages:
+        sys.exit("no valid black-box pages in %s" % args.dump)
+
+    current_boot = None
+    wrap_us = 0
+    last_base = 0
+    frames = 0
+    for sequence, boot, base_us, count, payload in pages:
+        if args.boot is not None and boot != args.boot:
+            continue
+        if boot != current_boot:
+            print("boot %u starts at page sequence %u" % (boot, sequence), file=sys.stderr)
+            current_boot = boot
+            wrap_us = 0
+            last_base = base_us
+        elif base_us < last_base:
+            wrap_us += 1 << 32  # micros() wrapped (every ~71.6 minutes)
+        last_base = base_us
+        try:
+            for time_us, identifier, extended, rtr, dlc, data in decode_page(base_us + wrap_us, count, payload):
+                can_id = ("%08X" if extended else "%03X") % identifier
+                body = ("R%d" % dlc if dlc else "R") if rtr else data.hex().upper()
+                print("(%d.%06d) %s %s#%s" % (time_us // 1000000, time_us % 1000000, args.interface, can_id, body))
+                frames += 1
+        except (IndexError, KeyError, struct.error):
+            print("page %u: malformed record, rest of page skipped" % sequence, file=sys.stderr)
+    print("%d frames from %d pages" % (frames, len(pages)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
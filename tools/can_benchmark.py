@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Run synthetic saturation benchmarks on a gateway built with the esp32dev_bench
+environment and compare the results against stored regression thresholds.
+
+    pio run -e esp32dev_bench -t upload
+    tools/can_benchmark.py /dev/ttyUSB0                      # every profile in the baseline
+    tools/can_benchmark.py /dev/ttyUSB0 --profile bursty_4k
+    tools/can_benchmark.py /dev/ttyUSB0 --traffic "rate=8000 burst=16"   # ad hoc, no thresholds
+    tools/can_benchmark.py /dev/ttyUSB0 --update             # record thresholds from this run
+
+Each profile's traffic is sent as a BENCH command (see SyntheticCanBus in
+src/canBus.h); the gateway answers with one [BENCH] key=value line. Thresholds
+are "min_<key>" or "max_<key>" on those keys. Exits with status 1 when any
+threshold is violated, or when a profile has none yet: thresholds only come
+from --update on the reference board, never from host runs or estimates.
+
+Requires pyserial (pip install pyserial).
+"""
+import argparse
+import json
+import os
+import sys
+import time
+
+import serial
+
+DEFAULT_BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "benchmark_baseline.json")
+TRAFFIC_KEYS = ("rate", "ids", "ext", "dlc8", "burst", "control", "seconds")
+
+# Margins applied by --update so run-to-run noise does not fail the next run.
+# Latencies are histogram bucket upper bounds (powers of two): 1.5x still fails
+# a move to the next bucket.
+UPDATE_MARGINS = {"fps": 0.98, "_us": 1.5, "heap_peak_used_boot": 1.1}
+
+# Recorded by --update for a profile that has no thresholds yet
+DEFAULT_THRESHOLDS = ("min_fps", "max_p50_us", "max_p99_us", "max_p999_us", "max_overruns", "max_dropped",
+                      "max_heap_peak_used_boot")
+
+
+def parse_report(line):
+    fields = {}
+    for token in line.split()[1:]:
+        key, _, value = token.partition("=")
+        if value.isdigit():
+            fields[key] = int(value)
+    return fields
+
+
+def run_profile(port, traffic, settle):
+    command = "BENCH " + " ".join("%s=%d" % (k, traffic[k]) for k in TRAFFIC_KEYS if k in traffic)
+    port.reset_input_buffer()
+    port.write((command + "\n").encode("ascii"))
+    deadline = time.monotonic() + traffic.get("seconds", 10) + settle
+    while time.monotonic() < deadline:
+        line = port.readline().decode("utf-8", errors="replace").strip()
+        if line.startswith("[BENCH]"):
+            return parse_report(line)
+    return None
+
+
+def check(report, thresholds):
+    failures = []
+    for name, limit in sorted(thresholds.items()):
+        bound, _, key = name.partition("_")
+        if key not in report:
+            failures.append("%s: not reported" % key)
+        elif bound == "min" and report[key] < limit:
+            failures.append("%s=%d below %d" % (key, report[key], limit))
+        elif bound == "max" and report[key] > limit:
+            failures.append("%s=%d above %d" % (key, report[key], limit))
+    return failures
+
+
+def updated_thresholds(report, thresholds):
+    result = {}
+    for name in thresholds or DEFAULT_THRESHOLDS:
+        bound, _, key = name.partition("_")
+        if key not in report:
+            continue
+        value = report[key]
+        margin = next((m for suffix, m in UPDATE_MARGINS.items() if key.endswith(suffix)), 1.0)
+        result[name] = int(value * margin) if bound == "min" else int(value * margin + 0.5)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the gateway")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="profiles and thresholds (JSON)")
+    parser.add_argument("--profile", action="append", help="run only this profile (repeatable)")
+    parser.add_argument("--traffic", help="run one ad hoc profile, e.g. \"rate=6000 burst=8\"")
+    parser.add_argument("--update", action="store_true", help="store this run's results as the new thresholds")
+    parser.add_argument("--settle", type=float, default=10.0, help="seconds to wait for a report after a run")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    profiles = baseline["profiles"]
+    if args.traffic:
+        traffic = dict(token.split("=", 1) for token in args.traffic.split())
+        profiles = {"adhoc": {"traffic": {k: int(v) for k, v in traffic.items()}, "thresholds": {}}}
+    elif args.profile:
+        unknown = [name for name in args.profile if name not in profiles]
+        if unknown:
+            sys.exit("unknown profile(s): %s" % ", ".join(unknown))
+        profiles = {name: profiles[name] for name in args.profile}
+
+    port = serial.Serial(args.port, args.baud, timeout=1)
+    time.sleep(2)  # opening the port resets most boards
+    failed = False
+    try:
+        for name, profile in profiles.items():
+            report = run_profile(port, profile["traffic"], args.settle)
+            if report is None:
+                print("%-16s no [BENCH] report" % name)
+                failed = True
+                continue
+            print("%-16s fps=%d drain=%d ms p50=%d us p99=%d us p99.9=%d us max=%d us overruns=%d dropped=%d "
+                  "heap_peak_used_boot=%d" % (
+                      name, report.get("fps", 0), report.get("drain_ms", 0), report.get("p50_us", 0),
+                      report.get("p99_us", 0), report.get("p999_us", 0), report.get("max_us", 0),
+                      report.get("overruns", 0), report.get("dropped", 0), report.get("heap_peak_used_boot", 0)))
+            if args.update and name in baseline["profiles"]:
+                baseline["profiles"][name]["thresholds"] = updated_thresholds(report, profile["thresholds"])
+                continue
+            if not profile["thresholds"] and not args.traffic:
+                print("  NO THRESHOLDS: record them with --update on the reference board")
+                failed = True
+                continue
+            failures = check(report, profile["thresholds"])
+            for failure in failures:
+                print("  REGRESSION %s" % failure)
+            failed = failed or bool(failures)
+    finally:
+        port.close()
+
+    if args.update and not args.traffic:
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2)
+            f.write("\n")
+        print("thresholds written to %s" % args.baseline)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
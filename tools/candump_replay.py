@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Stream a candump -L log to a gateway built with the esp32dev_replay
+environment and print the [REPLAY] reports it sends back.
+
+    pio run -e esp32dev_replay -t upload
+    tools/candump_replay.py /dev/ttyUSB0 trailer.log --loops 10
+
+Requires pyserial (pip install pyserial).
+"""
+import argparse
+import sys
+import threading
+import time
+
+import serial
+
+
+def read_reports(port, stop):
+    while not stop.is_set():
+        line = port.readline().decode("utf-8", errors="replace").strip()
+        if line.startswith("[REPLAY]"):
+            print(line, flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the gateway")
+    parser.add_argument("log", help="candump -L log file")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--loops", type=int, default=1, help="times to replay the log (0 = forever)")
+    parser.add_argument("--realtime", action="store_true", help="pace frames by their log timestamps")
+    args = parser.parse_args()
+
+    with open(args.log) as f:
+        frames = []
+        for line in f:
+            parts = line.split()
+            if len(parts) >= 3 and parts[0].startswith("("):
+                frames.append((float(parts[0].strip("()")), "%s %s %s\n" % tuple(parts[:3])))
+    if not frames:
+        sys.exit("no candump -L frames in %s" % args.log)
+
+    port = serial.Serial(args.port, args.baud, timeout=1)
+    stop = threading.Event()
+    reader = threading.Thread(target=read_reports, args=(port, stop), daemon=True)
+    reader.start()
+
+    loop = 0
+    sent = 0
+    started = time.monotonic()
+    try:
+        while args.loops == 0 or loop < args.loops:
+            loop_start = time.monotonic()
+            first_ts = frames[0][0]
+            for ts, line in frames:
+                if args.realtime:
+                    delay = (ts - first_ts) - (time.monotonic() - loop_start)
+                    if delay > 0:
+                        time.sleep(delay)
+                port.write(line.encode("ascii"))
+                sent += 1
+            loop += 1
+        port.flush()
+        time.sleep(6)  # let the next status report arrive
+    except KeyboardInterrupt:
+        pass
+    finally:
+        stop.set()
+        elapsed = time.monotonic() - started
+        print("sent %d frames in %.1f s (%.0f frames/s)" % (sent, elapsed, sent / elapsed if elapsed else 0))
+        port.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Generate the gateway's signal table header from a DBC file.
+
+    tools/dbc_codegen.py dbc/trailer.dbc dbc/subscribed.txt src/signalTable.h
+
+Only signals listed in the subscription file (Message.Signal, or Message for
+all of its signals) are emitted, grouped by CAN ID and sorted for binary
+search. The output is rewritten only when it changes.
+
+Also runs as a PlatformIO pre-build script (extra_scripts in platformio.ini),
+regenerating src/signalTable.h from dbc/trailer.dbc and dbc/subscribed.txt
+before every build. See lib/CanEspNowWire/src/CanSignals.h for the layout.
+"""
+import argparse
+import os
+import re
+import sys
+
+MAX_SIGNALS = 255  # Signal index is one byte on the wire
+
+MESSAGE_RE = re.compile(r"^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)")
+SIGNAL_RE = re.compile(
+    r"^\s+SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*"
+    r"\(\s*([^,\s]+)\s*,\s*([^)\s]+)\s*\)")
+
+
+class DbcError(Exception):
+    pass
+
+
+def parse_dbc(path):
+    """Return {message name: (identifier, extended, [signal dicts])}."""
+    messages = {}
+    current = None
+    with open(path, encoding="latin-1") as f:
+        for number, line in enumerate(f, 1):
+            match = MESSAGE_RE.match(line)
+            if match:
+                raw_id = int(match.group(1))
+                current = match.group(2)
+                messages[current] = (raw_id & 0x1FFFFFFF, bool(raw_id & 0x80000000), [])
+                continue
+            match = SIGNAL_RE.match(line)
+            if not match:
+                if line.strip() and not line.startswith(" "):
+                    current = None
+                continue
+            if current is None:
+                raise DbcError("%s:%d: signal outside a message" % (path, number))
+            name, mux, start, length, order, sign, scale, offset = match.groups()
+            messages[current][2].append({
+                "name": name,
+                "multiplexed": mux is not None,
+                "start": int(start),
+                "length": int(length),
+                "big_endian": order == "0",
+                "signed": sign == "-",
+                "scale": float(scale),
+                "offset": float(offset),
+            })
+    return messages
+
+
+def min_dlc(signal):
+    """Number of data bytes a frame needs to carry the whole signal."""
+    start, length = signal["start"], signal["length"]
+    if not 1 <= length <= 64:
+        raise DbcError("%s: length %d out of range" % (signal["name"], length))
+    if signal["big_endian"]:
+        lsb = (7 - start // 8) * 8 + start % 8 - (length - 1)
+        if lsb < 0:
+            raise DbcError("%s: Motorola signal runs past the end of the frame" % signal["name"])
+        return 8 - lsb // 8
+    if start + length > 64:
+        raise DbcError("%s: Intel signal runs past the end of the frame" % signal["name"])
+    return (start + length - 1) // 8 + 1
+
+
+def read_subscriptions(path):
+    entries = []
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if line:
+                entries.append(line)
+    return entries
+
+
+def select(messages, subscriptions):
+    """Return [(identifier, extended, message name, [signals])] sorted by key."""
+    chosen = {}
+    for entry in subscriptions:
+        message_name, _, signal_name = entry.partition(".")
+        if message_name not in messages:
+            raise DbcError("unknown message %s" % message_name)
+        identifier, extended, signals = messages[message_name]
+        if signal_name:
+            signals = [s for s in signals if s["name"] == signal_name]
+            if not signals:
+                raise DbcError("unknown signal %s" % entry)
+        selected = chosen.setdefault(message_name, [])
+        for signal in signals:
+            if signal["multiplexed"]:
+                # Multiplexed signals depend on the selector value; not supported
+                print("dbc_codegen: skipping multiplexed signal %s.%s" % (message_name, signal["name"]), file=sys.stderr)
+            elif signal not in selected:
+                selected.append(signal)
+    result = [(messages[name][0], messages[name][1], name, signals) for name, signals in chosen.items() if signals]
+    result.sort(key=lambda m: (m[0] | (0x80000000 if m[1] else 0)))
+    return result
+
+
+def render(source, selected):
+    count = sum(len(signals) for _, _, _, signals in selected)
+    if count > MAX_SIGNALS:
+        raise DbcError("%d signals subscribed, at most %d fit the wire format" % (count, MAX_SIGNALS))
+    lines = [
+        "// Generated by tools/dbc_codegen.py from %s; do not edit." % source,
+        "// Signal indexes are part of the PACKET_SIGNALS wire format: receivers must use the same table.",
+        "#pragma once",
+        "#include <CanSignals.h>",
+        "",
+        "#define SIGNAL_COUNT %d" % count,
+        "#define SIGNAL_MESSAGE_COUNT %d" % len(selected),
+        "",
+        "// Index on the wire = position in this table",
+        "static constexpr canSignals::Signal signalTable[] = {",
+        "    // name, start bit, length, big endian, signed, min DLC, scale, offset",
+    ]
+    messages = []
+    index = 0
+    for identifier, extended, message_name, signals in selected:
+        messages.append("    {0x%X, %s, %d, %d},  // %s" % (
+            identifier, "true" if extended else "false", index, len(signals), message_name))
+        for signal in signals:
+            lines.append('    {"%s.%s", %d, %d, %s, %s, %d, %rf, %rf},' % (
+                message_name, signal["name"], signal["start"], signal["length"],
+                "true" if signal["big_endian"] else "false", "true" if signal["signed"] else "false",
+                min_dlc(signal), signal["scale"], signal["offset"]))
+            index += 1
+    if not count:
+        lines.append('    {"", 0, 1, false, false, 0, 1.0f, 0.0f},  // Placeholder; no signals subscribed')
+        messages.append("    {0, false, 0, 0},  // Placeholder; no signals subscribed")
+    lines += [
+        "};",
+        "",
+        "// Sorted by identifier (extended IDs after standard IDs)",
+        "static constexpr canSignals::Message signalMessages[] = {",
+    ] + messages + ["};", ""]
+    return "\n".join(lines)
+
+
+def generate(dbc, subscriptions, output, source_name=None):
+    text = render(source_name or dbc, select(parse_dbc(dbc), read_subscriptions(subscriptions)))
+    if os.path.exists(output):
+        with open(output) as f:
+            if f.read() == text:
+                return False
+    with open(output, "w") as f:
+        f.write(text)
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dbc")
+    parser.add_argument("subscriptions")
+    parser.add_argument("output")
+    args = parser.parse_args()
+    try:
+        generate(args.dbc, args.subscriptions, args.output)
+    except (DbcError, OSError) as error:
+        sys.exit("dbc_codegen: %s" % error)
+
+
+try:
+    Import("env")  # noqa: F821 - defined when PlatformIO runs this as an extra script
+except NameError:
+    if __name__ == "__main__":
+        main()
+else:
+    project = env["PROJECT_DIR"]  # noqa: F821
+    try:
+        if generate(os.path.join(project, "dbc", "trailer.dbc"), os.path.join(project, "dbc", "subscribed.txt"),
+                    os.path.join(project, "src", "signalTable.h"), "dbc/trailer.dbc"):
+            print("dbc_codegen: regenerated src/signalTable.h")
+    except (DbcError, OSError) as error:
+        sys.exit("dbc_codegen: %s" % error)